@@ -81,6 +81,13 @@ KDMAPI_ONLYSTRUCTS = Used by MIDI apps who want to use the KDMAPI functions
 
 #define OM_UNLOCKCHANS				0x10033
 
+// Time formats for SendDirectDataScheduled
+#define OM_SCHED_SAMPLES			0x0
+#define OM_SCHED_QPC				0x1
+
+// Ports available to SendDirectDataPort, 16 channels each
+#define OM_MAXPORTS					16
+
 // The debug info struct, you can set the default values by assigning DEFAULT_DEBUG
 typedef struct
 {
@@ -104,6 +111,18 @@ typedef struct
 	DOUBLE AudioLatency = 0.0f;
 	DWORD AudioBufferSize = 0;
 
+	// Extended latency info for the latency breakdown widget
+	DOUBLE AsioInputLatency = 0.0f;			// ASIO input latency (for round-trip calculations)
+	DWORD ActualSampleRate = 48000;			// Actual sample rate being used by the device
+
+	// Port-aware addressing
+	DWORD ActivePorts = 1;					// Ports currently in use
+	DWORD ActivePortVoices[OM_MAXPORTS] = { 0 };	// Active voices, summed over the 16 channels of each port
+
+	// Voice budgets, summed over the ports
+	DWORD ActiveNotes[16] = { 0 };			// Notes held down or sustained on each channel
+	DWORD StolenNotes[16] = { 0 };			// Notes released early, or dropped, to keep each channel within its budget
+
 	// Add more down here
 	// ------------------
 } DebugInfo;
@@ -177,6 +196,38 @@ typedef struct
 } Settings;
 #endif
 
+// A short message with the time it should be played at, for SendDirectDataScheduledBatch
+typedef struct
+{
+	DWORD64 Timestamp;						// When the event should play, in the chosen time format
+	DWORD Event;							// The event itself (Running status is not allowed)
+	DWORD Reserved;							// Reserved, leave it to zero
+} ScheduledEvent;
+
+// A consistent copy of the driver's stats, for GetDriverStats
+typedef struct
+{
+	DWORD Size;								// Size of the struct, set it before calling GetDriverStats
+	DWORD Version;							// Increases every time the driver publishes new stats
+	DWORD64 Timestamp;						// QPC value at the time the stats got published
+	FLOAT RenderingTime;					// BASS rendering time
+	DWORD ActiveVoices[16];					// Active voices for each channel
+	DWORD TotalVoices;						// Active voices on every channel of every port
+	DWORD64 EventsBufferSize;				// Size of the events buffer
+	DWORD64 EventsBufferFill;				// Events waiting in the buffer
+	DWORD64 EventsDropped;					// Events lost because the buffer was full
+	DWORD64 ScheduledDropped;				// Events refused by SendDirectDataScheduled
+	DWORD64 RenderedBlocks;					// Audio blocks rendered so far
+	DWORD64 Underruns;						// Blocks that took longer to render than to play
+	DOUBLE AudioLatency;					// Output latency, in milliseconds
+	FLOAT BlockTimeP50;						// Block render time percentiles over the last second, in microseconds
+	FLOAT BlockTimeP95;
+	FLOAT BlockTimeP99;
+	FLOAT BlockTimeMax;
+	DWORD PublishCost;						// Time it took the driver to publish this snapshot, in nanoseconds
+	DWORD Reserved;
+} DriverStats;
+
 #ifndef KDMAPI_ONLYSTRUCTS
 // Return the KDMAPI version from OmniMIDI as the following output: Major.Minor.Build Rev. Revision (eg. 1.30.0 Rev. 51).
 BOOL KDMAPI(ReturnKDMAPIVer)(LPDWORD Major, LPDWORD Minor, LPDWORD Build, LPDWORD Revision);
@@ -202,6 +253,18 @@ VOID KDMAPI(SendDirectData)(DWORD dwMsg);
 // Send short messages through KDMAPI like SendDirectData, but bypasses the buffer. (Like midiOutShortMsg)
 VOID KDMAPI(SendDirectDataNoBuf)(DWORD dwMsg);
 
+// Send short messages through KDMAPI to one of the extra ports (0 to OM_MAXPORTS - 1). Port 0 is the same as SendDirectData.
+BOOL KDMAPI(SendDirectDataPort)(DWORD dwMsg, DWORD Port);
+
+// Schedule a short message to be played at a specific time, either on the render clock (OM_SCHED_SAMPLES) or in QPC ticks (OM_SCHED_QPC).
+BOOL KDMAPI(SendDirectDataScheduled)(DWORD dwMsg, DWORD64 Timestamp, DWORD TimeFormat);
+
+// Schedule multiple short messages at once. Returns how many events got queued.
+UINT KDMAPI(SendDirectDataScheduledBatch)(const ScheduledEvent* Events, UINT Count, DWORD TimeFormat);
+
+// Get the current position of the render clock, along with the QPC value it was sampled at.
+BOOL KDMAPI(GetRenderClock)(DWORD64* SamplePosition, DWORD64* QPCTime, LPDWORD SampleRate);
+
 // Send long messages through KDMAPI. (Like midiOutLongMsg)
 UINT KDMAPI(SendDirectLongData)(MIDIHDR* IIMidiHdr, UINT IIMidiHdrSize);
 
@@ -220,9 +283,51 @@ BOOL KDMAPI(DriverSettings)(DWORD Setting, DWORD Mode, LPVOID Value, UINT cbValu
 // Get a pointer to the debug info of the driver.
 DebugInfo* KDMAPI(GetDriverDebugInfo)();
 
+// Copy a consistent snapshot of the driver's stats to Stats. Set Stats->Size before calling it.
+BOOL KDMAPI(GetDriverStats)(DriverStats* Stats);
+
 // Load a custom sflist. (You can also load SF2 and SFZ files)
 VOID KDMAPI(LoadCustomSoundFontsList)(LPWSTR Directory);
 
+// Open a device-less instance, which renders as fast as the CPU allows. Pass NULL to SoundFontList to use the default list.
+HANDLE KDMAPI(InitializeOfflineRender)(DWORD SampleRate, LPCWSTR SoundFontList);
+
+// Send a short message to an offline instance, to be played SampleOffset frames after the current render position.
+BOOL KDMAPI(SendOfflineRenderData)(HANDLE Renderer, DWORD SampleOffset, DWORD dwMsg);
+
+// Send a long message to an offline instance, it will be applied at the current render position.
+BOOL KDMAPI(SendOfflineRenderLongData)(HANDLE Renderer, LPSTR MidiHdrData, DWORD MidiHdrDataLen);
+
+// Render the requested amount of frames (Interleaved stereo, 32-bit float) into Buffer. Returns how many frames got rendered.
+DWORD KDMAPI(RenderOfflineFrames)(HANDLE Renderer, FLOAT* Buffer, DWORD Frames);
+
+// Close an offline instance.
+BOOL KDMAPI(TerminateOfflineRender)(HANDLE Renderer);
+
+// Load a Standard MIDI File (Format 0, 1 or 2), to be played by the driver itself. Replaces the one that was loaded before.
+BOOL KDMAPI(LoadMIDIFile)(LPCWSTR Path);
+
+// Same as above, but from a buffer. The driver keeps its own copy of the parsed data.
+BOOL KDMAPI(LoadMIDIFileFromMemory)(const BYTE* Data, DWORD Length);
+
+// Unload the MIDI file, stopping it if it's playing.
+VOID KDMAPI(UnloadMIDIFile)();
+
+// Start playing the MIDI file from the current position, or from the start if it already ended.
+BOOL KDMAPI(PlayMIDIFile)();
+
+// Pause the MIDI file, and silence the notes it was playing.
+BOOL KDMAPI(StopMIDIFile)();
+
+// Move to the specified position (in microseconds). Controllers and programs before it get restored.
+BOOL KDMAPI(SeekMIDIFile)(DWORD64 Microseconds);
+
+// Change the playback speed of the MIDI file (From 0.01 to 100.0, 1.0 is the normal speed).
+BOOL KDMAPI(SetMIDIFileSpeed)(FLOAT Speed);
+
+// Get the current position and the length of the MIDI file (in microseconds). Pass NULL to skip either one.
+BOOL KDMAPI(GetMIDIFilePosition)(DWORD64* Position, DWORD64* Length);
+
 // timeGetTime, but 64-bit
 DWORD64 KDMAPI(timeGetTime64)();
 
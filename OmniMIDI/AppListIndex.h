@@ -0,0 +1,176 @@
+/*
+OmniMIDI app list index
+Maps app names and paths to the SoundFont list (A-G) their applist assigns them to, through a single hash table.
+The table is stored next to the applists with the write time and size of every source,
+so that it only has to be rebuilt when one of them changes.
+Doesn't depend on Win32, the driver takes care of reading and writing the files.
+*/
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#define APPIDX_MAGIC	0x494C414F	// "OALI"
+#define APPIDX_VERSION	1
+#define APPIDX_SOURCES	7			// One per list, A to G
+
+class AppListIndex {
+public:
+	typedef struct Stamp {
+		uint64_t Time;
+		uint64_t Size;
+	} Stamp;
+
+private:
+	typedef struct Entry {
+		uint64_t Hash;		// 0 = empty
+		uint32_t List;
+		uint32_t Reserved;
+	} Entry;
+
+	typedef struct Header {
+		uint32_t Magic;
+		uint32_t Version;
+		Stamp Sources[APPIDX_SOURCES];
+		uint32_t Capacity;
+		uint32_t Count;
+	} Header;
+
+	Stamp Sources[APPIDX_SOURCES];
+	std::vector<Entry> Table;
+	uint32_t Count = 0;
+
+	uint32_t Slot(uint64_t Hash) const {
+		return (uint32_t)(Hash ^ (Hash >> 32)) & (uint32_t)(Table.size() - 1);
+	}
+
+	void Grow() {
+		std::vector<Entry> Old;
+		Old.swap(Table);
+		Table.assign(Old.empty() ? 64 : Old.size() * 2, Entry());
+		Count = 0;
+
+		for (size_t i = 0; i < Old.size(); i++) {
+			if (Old[i].Hash)
+				Insert(Old[i].Hash, Old[i].List);
+		}
+	}
+
+	bool Insert(uint64_t Hash, uint32_t List) {
+		if ((Count + 1) * 2 > Table.size())
+			Grow();
+
+		for (uint32_t i = Slot(Hash);; i = (i + 1) & (uint32_t)(Table.size() - 1)) {
+			if (Table[i].Hash == Hash)
+				return false;	// Already assigned to an earlier list, that one wins
+
+			if (!Table[i].Hash) {
+				Table[i].Hash = Hash;
+				Table[i].List = List;
+				Count++;
+				return true;
+			}
+		}
+	}
+
+public:
+	AppListIndex() { Reset(nullptr); }
+
+	// FNV-1a, case folded like _wcsicmp, with both kinds of separator treated as the same
+	static uint64_t Hash(const wchar_t* String) {
+		uint64_t H = 14695981039346656037ULL;
+
+		for (; *String && *String != L'\r'; String++) {
+			uint32_t C = (uint32_t)*String;
+			if (C >= L'A' && C <= L'Z') C += L'a' - L'A';
+			else if (C == L'/') C = L'\\';
+
+			H = (H ^ C) * 1099511628211ULL;
+		}
+
+		return H ? H : 1;
+	}
+
+	void Reset(const Stamp* NewSources) {
+		if (NewSources) memcpy(Sources, NewSources, sizeof(Sources));
+		else memset(Sources, 0, sizeof(Sources));
+
+		Table.clear();
+		Count = 0;
+		Grow();
+	}
+
+	// Lists have to be added in order, the first list that names the app is the one it gets
+	bool Add(const wchar_t* App, uint32_t List) {
+		if (!*App || *App == L'\r')
+			return false;
+
+		return Insert(Hash(App), List);
+	}
+
+	// Returns the list assigned to the app, or -1 if it doesn't have one
+	int Find(const wchar_t* App) const {
+		uint64_t H = Hash(App);
+
+		for (uint32_t i = Slot(H); Table[i].Hash; i = (i + 1) & (uint32_t)(Table.size() - 1)) {
+			if (Table[i].Hash == H)
+				return (int)Table[i].List;
+		}
+
+		return -1;
+	}
+
+	bool IsCurrent(const Stamp* CurrentSources) const {
+		return !memcmp(Sources, CurrentSources, sizeof(Sources));
+	}
+
+	uint32_t Size() const { return Count; }
+
+	void Serialize(std::vector<uint8_t>& Out) const {
+		Header H;
+
+		memset(&H, 0, sizeof(H));
+		H.Magic = APPIDX_MAGIC;
+		H.Version = APPIDX_VERSION;
+		memcpy(H.Sources, Sources, sizeof(Sources));
+		H.Capacity = (uint32_t)Table.size();
+		H.Count = Count;
+
+		Out.resize(sizeof(H) + Table.size() * sizeof(Entry));
+		memcpy(&Out[0], &H, sizeof(H));
+		memcpy(&Out[sizeof(H)], &Table[0], Table.size() * sizeof(Entry));
+	}
+
+	// Fails if the data is damaged, or if it has been built from different sources
+	bool Deserialize(const uint8_t* Data, size_t Length, const Stamp* CurrentSources) {
+		Header H;
+
+		if (Length < sizeof(H))
+			return false;
+
+		memcpy(&H, Data, sizeof(H));
+		if (H.Magic != APPIDX_MAGIC || H.Version != APPIDX_VERSION ||
+			H.Capacity < 64 || (H.Capacity & (H.Capacity - 1)) || H.Count * 2 > H.Capacity ||
+			Length != sizeof(H) + (size_t)H.Capacity * sizeof(Entry) ||
+			memcmp(H.Sources, CurrentSources, sizeof(H.Sources)))
+			return false;
+
+		std::vector<Entry> Loaded(H.Capacity);
+		uint32_t Used = 0;
+
+		memcpy(&Loaded[0], Data + sizeof(H), H.Capacity * sizeof(Entry));
+		for (size_t i = 0; i < Loaded.size(); i++)
+			Used += Loaded[i].Hash != 0;
+
+		// Find() needs free slots to stop probing
+		if (Used != H.Count)
+			return false;
+
+		memcpy(Sources, H.Sources, sizeof(Sources));
+		Table.swap(Loaded);
+		Count = H.Count;
+
+		return true;
+	}
+};
@@ -22,14 +22,117 @@ BOOL BannedProcesses() {
 	return FALSE;
 }
 
+// Compiled blacklist index
+// The lists are parsed once, and stored as sorted case-folded hashes next to the user blacklist,
+// so that other processes can load them instead of parsing the lists again.
+// The index is rebuilt whenever the write time or the size of one of the lists changes.
+// Hashing and stamps are shared with the applist index (AppListIndex::Hash, GetAppListStamp).
+#define BLIDX_MAGIC		0x4C42494F	// "OIBL"
+#define BLIDX_VERSION	2
+#define BLIDX_RECHECK	1000		// ms, how often the lists get checked for changes in the same process
+
+typedef struct BlacklistIndexHeader {
+	DWORD Magic;
+	DWORD Version;
+	AppListIndex::Stamp Default;
+	AppListIndex::Stamp User;
+	DWORD DefaultCount;
+	DWORD UserCount;
+} BlacklistIndexHeader;
+
+// BLMutex guards everything below, the hashes are built into locals and only the result gets published
+static std::mutex BLMutex;
+static AppListIndex::Stamp BLDefaultSrc = { 0 }, BLUserSrc = { 0 };
+static DWORD BLVerdict = DEVICE_UNAVAILABLE;
+static ULONGLONG BLCheckedAt = 0;
+static BOOL BLIndexReady = FALSE;
+
+static BOOL BlacklistContains(const std::vector<ULONGLONG>& Hashes, LPCWSTR String) {
+	return std::binary_search(Hashes.begin(), Hashes.end(), (ULONGLONG)AppListIndex::Hash(String));
+}
+
+static BOOL ParseBlacklist(LPCWSTR Path, std::vector<ULONGLONG>* Hashes) {
+	wchar_t TempString[NTFS_MAX_PATH] = { 0 };
+	std::wifstream file(Path);
+
+	Hashes->clear();
+	if (!file)
+		return FALSE;
+
+	file.imbue(UTF8Support);
+	while (file.getline(TempString, sizeof(TempString) / sizeof(*TempString)))
+		Hashes->push_back(AppListIndex::Hash(TempString));
+
+	std::sort(Hashes->begin(), Hashes->end());
+	return TRUE;
+}
+
+static BOOL LoadBlacklistIndex(LPCWSTR Path, const AppListIndex::Stamp* DefaultSrc, const AppListIndex::Stamp* UserSrc,
+	std::vector<ULONGLONG>* DefaultHashes, std::vector<ULONGLONG>* UserHashes) {
+	BlacklistIndexHeader Header;
+	DWORD Read;
+	BOOL Valid = FALSE;
+
+	HANDLE File = CreateFileW(Path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (File == INVALID_HANDLE_VALUE)
+		return FALSE;
+
+	if (ReadFile(File, &Header, sizeof(Header), &Read, NULL) && Read == sizeof(Header) &&
+		Header.Magic == BLIDX_MAGIC && Header.Version == BLIDX_VERSION &&
+		!memcmp(&Header.Default, DefaultSrc, sizeof(AppListIndex::Stamp)) &&
+		!memcmp(&Header.User, UserSrc, sizeof(AppListIndex::Stamp)) &&
+		Header.DefaultCount < 0x100000 && Header.UserCount < 0x100000) {
+		DefaultHashes->resize(Header.DefaultCount);
+		UserHashes->resize(Header.UserCount);
+
+		Valid = (!Header.DefaultCount || (ReadFile(File, &(*DefaultHashes)[0], Header.DefaultCount * sizeof(ULONGLONG), &Read, NULL) && Read == Header.DefaultCount * sizeof(ULONGLONG))) &&
+				(!Header.UserCount || (ReadFile(File, &(*UserHashes)[0], Header.UserCount * sizeof(ULONGLONG), &Read, NULL) && Read == Header.UserCount * sizeof(ULONGLONG)));
+	}
+
+	CloseHandle(File);
+	return Valid;
+}
+
+static void SaveBlacklistIndex(LPCWSTR Path, const AppListIndex::Stamp* DefaultSrc, const AppListIndex::Stamp* UserSrc,
+	const std::vector<ULONGLONG>& DefaultHashes, const std::vector<ULONGLONG>& UserHashes) {
+	BlacklistIndexHeader Header = { BLIDX_MAGIC, BLIDX_VERSION, *DefaultSrc, *UserSrc, (DWORD)DefaultHashes.size(), (DWORD)UserHashes.size() };
+	DWORD Written;
+
+	// Not being able to write it is fine, the next process will just parse the lists again
+	HANDLE File = CreateFileW(Path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (File == INVALID_HANDLE_VALUE)
+		return;
+
+	WriteFile(File, &Header, sizeof(Header), &Written, NULL);
+	if (Header.DefaultCount) WriteFile(File, &DefaultHashes[0], Header.DefaultCount * sizeof(ULONGLONG), &Written, NULL);
+	if (Header.UserCount) WriteFile(File, &UserHashes[0], Header.UserCount * sizeof(ULONGLONG), &Written, NULL);
+
+	CloseHandle(File);
+}
+
+static void InvalidateBlacklistIndex() {
+	std::lock_guard<std::mutex> Lock(BLMutex);
+	BLIndexReady = FALSE;
+}
+
 DWORD BlackListSystem(){
 	// Blacklist system init
 	std::wstring DBLDir;
 	std::wstring UBLDir;
+	std::wstring IdxDir;
+	AppListIndex::Stamp DefaultSrc, UserSrc;
+	std::vector<ULONGLONG> DefaultHashes, UserHashes;
+	DWORD Verdict;
 
 	wchar_t SysDir32[MAX_PATH] = { 0 };
 	wchar_t UserProfile[MAX_PATH] = { 0 };
-	wchar_t TempString[NTFS_MAX_PATH] = { 0 };
+
+	// The app doesn't change, so the verdict only has to be checked again if the lists did
+	{
+		std::lock_guard<std::mutex> Lock(BLMutex);
+		if (BLIndexReady && GetTickCount64() - BLCheckedAt < BLIDX_RECHECK)
+			return BLVerdict;
+	}
 
 	// Start the system
 	if (!GetFolderPath(FOLDERID_SystemX86, CSIDL_SYSTEMX86, SysDir32, sizeof(SysDir32)))
@@ -42,45 +145,55 @@ DWORD BlackListSystem(){
 	DBLDir.append(_T("\\OmniMIDI\\OmniMIDI.dbl\0"));
 	UBLDir.append(UserProfile);
 	UBLDir.append(_T("\\OmniMIDI\\blacklist\\OmniMIDI.blacklist\0"));
+	IdxDir.append(UserProfile);
+	IdxDir.append(_T("\\OmniMIDI\\blacklist\\OmniMIDI.blidx\0"));
 
 	try {
-		if (PathFileExistsW(DBLDir.c_str())) {
-			std::wifstream file(DBLDir.c_str());
+		if (!PathFileExistsW(DBLDir.c_str())) {
+			InvalidateBlacklistIndex();
+			MessageBoxW(NULL, L"The default blacklist is missing, or the driver is not installed properly!\nThe driver will refuse to run.\n\nPlease reinstall OmniMIDI to restore it.\nPress OK to continue.", L"OmniMIDI - ERROR", MB_OK | MB_ICONEXCLAMATION | MB_SYSTEMMODAL);
+			return DEVICE_UNAVAILABLE;
+		}
 
-			if (file) {
-				file.imbue(UTF8Support);
+		GetAppListStamp(DBLDir.c_str(), &DefaultSrc);
+		GetAppListStamp(UBLDir.c_str(), &UserSrc);
 
-				// The default blacklist exists, continue
-				while (file.getline(TempString, sizeof(TempString) / sizeof(*TempString)))
-				{
-					if (_wcsicmp(AppNameW, TempString) == 0) return DEVICE_UNAVAILABLE;
-				}
-			}
-			else {
+		// Nothing changed since the last check
+		{
+			std::lock_guard<std::mutex> Lock(BLMutex);
+			BLCheckedAt = GetTickCount64();
+
+			if (BLIndexReady &&
+				!memcmp(&DefaultSrc, &BLDefaultSrc, sizeof(AppListIndex::Stamp)) &&
+				!memcmp(&UserSrc, &BLUserSrc, sizeof(AppListIndex::Stamp)))
+				return BLVerdict;
+		}
+
+		// Try the index left by another process first, parse the lists otherwise
+		if (!LoadBlacklistIndex(IdxDir.c_str(), &DefaultSrc, &UserSrc, &DefaultHashes, &UserHashes)) {
+			if (!ParseBlacklist(DBLDir.c_str(), &DefaultHashes)) {
+				InvalidateBlacklistIndex();
 				MessageBoxW(NULL, L"Failed to parse the default blacklist!\nThe driver will refuse to run.\n\nPlease reinstall OmniMIDI to restore it.\nPress OK to continue.", L"OmniMIDI - ERROR", MB_OK | MB_ICONEXCLAMATION | MB_SYSTEMMODAL);
 				return DEVICE_UNAVAILABLE;
 			}
+
+			ParseBlacklist(UBLDir.c_str(), &UserHashes);
+			SaveBlacklistIndex(IdxDir.c_str(), &DefaultSrc, &UserSrc, DefaultHashes, UserHashes);
+			PrintMessageToDebugLog("BlackListSystem", "Blacklist index rebuilt from the lists.");
 		}
-		else {
-			MessageBoxW(NULL, L"The default blacklist is missing, or the driver is not installed properly!\nThe driver will refuse to run.\n\nPlease reinstall OmniMIDI to restore it.\nPress OK to continue.", L"OmniMIDI - ERROR", MB_OK | MB_ICONEXCLAMATION | MB_SYSTEMMODAL);
-			return DEVICE_UNAVAILABLE;
-		}
+		else PrintMessageToDebugLog("BlackListSystem", "Blacklist index loaded from disk.");
 
-		if (PathFileExistsW(UBLDir.c_str())) {
-			std::wifstream file(UBLDir.c_str());
+		Verdict = (BlacklistContains(DefaultHashes, AppNameW) ||
+				   BlacklistContains(UserHashes, AppNameW) ||
+				   BlacklistContains(UserHashes, AppPathW)) ? DEVICE_UNAVAILABLE : DEVICE_AVAILABLE;
 
-			if (file) {
-				file.imbue(UTF8Support);
-				while (file.getline(TempString, sizeof(TempString) / sizeof(*TempString)))
-				{
-					if (_wcsicmp(AppNameW, TempString) == 0 ||
-						_wcsicmp(AppPathW, TempString) == 0)
-						return DEVICE_UNAVAILABLE;
-				}
-			}
-		}
+		std::lock_guard<std::mutex> Lock(BLMutex);
+		BLDefaultSrc = DefaultSrc;
+		BLUserSrc = UserSrc;
+		BLVerdict = Verdict;
+		BLIndexReady = TRUE;
 
-		return DEVICE_AVAILABLE;
+		return Verdict;
 	}
 	catch (...) {
 		_THROWCRASH;
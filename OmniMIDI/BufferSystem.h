@@ -5,6 +5,15 @@ Some code has been optimized by Sono (SonoSooS), the old one has been commented
 #pragma once
 #define SMALLBUFFER 2
 
+// EventScheduler.h
+BOOL QueueNoteOff(DWORD dwParam1, DWORD Bytes);
+void CancelNoteTimer(DWORD dwParam1);
+void CancelNoteTimers(DWORD Chan);
+void ResetNoteTimers();
+
+// PlayerCache.h
+void PlayerCacheInput();
+
 int __inline BufferCheck(void) {
 	return (EVBuffer.ReadHead != EVBuffer.WriteHead);
 }
@@ -39,7 +48,8 @@ void __inline CaptureDebugMidiEvent(BYTE cmd, BYTE channel, BYTE data1, BYTE dat
 	DebugMidiEventWriteHead++;
 }
 
-BOOL __inline CheckIfEventIsToIgnore(DWORD dwParam1)
+// The offline renderer passes its own copy of the settings
+BOOL __inline CheckIfEventIsToIgnore(DWORD dwParam1, const Settings &Config = ManagedSettings)
 {
 	/*
 	if (ignorenotes1) {
@@ -73,14 +83,14 @@ BOOL __inline CheckIfEventIsToIgnore(DWORD dwParam1)
 	Understandable version of what the following function does
 	*/
 
-	if (ManagedSettings.IgnoreNotesBetweenVel && !((dwParam1 - 0x80) & 0xE0)
-		&& ((HIWORD(dwParam1) & 0xFF) >= ManagedSettings.MinVelIgnore && (HIWORD(dwParam1) & 0xFF) <= ManagedSettings.MaxVelIgnore))
+	if (Config.IgnoreNotesBetweenVel && !((dwParam1 - 0x80) & 0xE0)
+		&& ((HIWORD(dwParam1) & 0xFF) >= Config.MinVelIgnore && (HIWORD(dwParam1) & 0xFF) <= Config.MaxVelIgnore))
 	{
 		PrintMessageToDebugLog("CheckIfEventIsToIgnoreFunc", "Ignored NoteON/NoteOFF MIDI event.");
 		return TRUE;
 	}
 
-	if (ManagedSettings.LimitTo88Keys && (!((dwParam1 - 0x80) & 0xE0) && dwParam1 != 0x89))
+	if (Config.LimitTo88Keys && (!((dwParam1 - 0x80) & 0xE0) && dwParam1 != 0x89))
 	{
 		if (!(((dwParam1 >> 8) & 0xFF) >= 21 && ((dwParam1 >> 8) & 0xFF) <= 108))
 		{
@@ -92,7 +102,7 @@ BOOL __inline CheckIfEventIsToIgnore(DWORD dwParam1)
 	return FALSE;
 }
 
-DWORD __inline ReturnEditedEvent(DWORD dwParam1) {
+DWORD __inline ReturnEditedEvent(DWORD dwParam1, const Settings &Config = ManagedSettings) {
 	// SETSTATUS(dwParam1, status);
 
 	/*
@@ -112,20 +122,20 @@ DWORD __inline ReturnEditedEvent(DWORD dwParam1) {
 	Understandable version of what the following function does
 	*/
 
-	if (ManagedSettings.TransposeValue != 0x7F)
+	if (Config.TransposeValue != 0x7F)
 	{
 		if (!((dwParam1 - 0x80) & 0xE0))
 		{
 			if (pitchshiftchan[dwParam1 & 0xF])
 			{
-				int newnote = (((dwParam1 >> 8) & 0xFF) - 0x7F) + ManagedSettings.TransposeValue;
+				int newnote = (((dwParam1 >> 8) & 0xFF) - 0x7F) + Config.TransposeValue;
 				if (newnote > 0x7F) { newnote = 0x7F; }
 				else if (newnote < 0) { newnote = 0; }
 				SETNOTE(dwParam1, newnote);
 			}
 		}
 	}
-	if (ManagedSettings.FullVelocityMode && (((dwParam1 & 0xFF) & 0xF0) == 0x90 && ((dwParam1 >> 16) & 0xFF)))
+	if (Config.FullVelocityMode && (((dwParam1 & 0xFF) & 0xF0) == 0x90 && ((dwParam1 >> 16) & 0xFF)))
 		SETVELOCITY(dwParam1, 0x7F);
 
 	return dwParam1;
@@ -187,18 +197,23 @@ bool __inline SendToBASSMIDI(unsigned int sev) {
 	INFO: ev will be recasted as char in some parts of the code, since those parts
 	do not require the high-word part of the unsigned int.
 
+	Since the high-order byte is ignored by Windows, OmniMIDI uses it to carry the port
+	of events coming from SendDirectDataPort. Port N drives the BASSMIDI channels
+	from N * 16 to N * 16 + 15, and has its own running status.
+
 	*/
 
-	unsigned int tev = sev;
+	unsigned char port = GETPORT(sev);
+	unsigned int tev = STRIPPORT(sev);
 
-	if (CHKLRS(GETSTATUS(tev)) != 0) LastRunningStatus = GETSTATUS(tev);
-	else tev = tev << 8 | LastRunningStatus;
+	if (CHKLRS(GETSTATUS(tev)) != 0) LastRunningStatus[port] = GETSTATUS(tev);
+	else tev = tev << 8 | LastRunningStatus[port];
 
 	unsigned int evt = MIDI_SYSTEM_DEFAULT;
 	unsigned int ev = 0;
 	unsigned char status = GETSTATUS(tev);
 	unsigned char cmd = GETCMD(tev);
-	unsigned char ch = GETCHANNEL(tev);
+	unsigned char ch = (port << 4) | GETCHANNEL(tev);
 	unsigned char param1 = GETFP(tev);
 	unsigned char param2 = GETSP(tev);
 
@@ -207,6 +222,16 @@ bool __inline SendToBASSMIDI(unsigned int sev) {
 
 	unsigned int len = 3;
 
+	MirrorSynthEvent(ch, cmd, param1, param2);
+	PlayerCacheInput();
+
+	if (DecimationOn)
+		DecimationSent(ch, cmd, param1, param2);
+
+	// Keep track of the notes playing on each channel, and make room if one goes over its budget
+	if (VoiceBudgetOn)
+		VoiceBudgetEvent(ch, cmd, param1, param2);
+
 	switch (cmd) {
 	case MIDI_NOTEON:
 		// param1 is the key, param2 is the velocity
@@ -238,6 +263,10 @@ bool __inline SendToBASSMIDI(unsigned int sev) {
 		switch (status) {
 		case 0xFF:
 			// This is 0xFF, which is a system reset.
+			ResetVoiceBudgets();
+			ResetNoteTimers();
+			ResetSynthState();
+			if (DecimationOn) InvalidateDecimation(-1);
 			_BMSE(OMStream, 0, MIDI_EVENT_SYSTEMEX, MIDI_SYSTEM_DEFAULT);
 			return true;
 
@@ -246,7 +275,7 @@ bool __inline SendToBASSMIDI(unsigned int sev) {
 			// to be directly fed to the library by using the BASS_MIDI_EVENTS_RAW flag.
 			if (!(tev - 0x80 & 0xC0))
 			{
-				_BMSEs(OMStream, BASS_MIDI_EVENTS_RAW, &tev, 3);
+				_BMSEs(OMStream, RAWCHANNEL(ch), &tev, 3);
 				return true;
 			}
 
@@ -269,6 +298,7 @@ bool __inline SendToBASSMIDI(unsigned int sev) {
 				}
 			}
 
+			// System messages, they don't belong to any port
 			_BMSEs(OMStream, BASS_MIDI_EVENTS_RAW, &tev, len);
 			return true;
 		}
@@ -287,11 +317,19 @@ void __inline PrepareForBASSMIDI(DWORD dwParam1) {
 
 	if (ManagedSettings.OverrideNoteLength || ManagedSettings.DelayNoteOff) {
 		if (((dwParam1 & 0xF0) == MIDI_NOTEON && ((dwParam1 >> 16) & 0xFF))) {
+			// Like BASS_MIDI_EVENTS_CANCEL did, a note-off still pending for the key can't cut the new note
+			CancelNoteTimer(dwParam1);
+
+			// The note-off goes to the timer wheel, since BMSEsFlags cancels whatever BASSMIDI still had queued
+			if (!ManagedSettings.OverrideNoteLength || QueueNoteOff(dwParam1, FNoteLengthValue)) {
+				SendToBASSMIDI(dwParam1);
+				return;
+			}
 
-			Evs[0] = { MIDI_EVENT_NOTE, dwParam1 >> 8, dwParam1 & 0xF, 0, 0 };
+			Evs[0] = { MIDI_EVENT_NOTE, (dwParam1 >> 8) & 0xFFFF, GETPORTCHANNEL(dwParam1), 0, 0 };
 
 			if (ManagedSettings.OverrideNoteLength)
-				Evs[1] = { MIDI_EVENT_NOTE, (BYTE)(dwParam1 >> 8), dwParam1 & 0xF, FNoteLengthValue, 0 };
+				Evs[1] = { MIDI_EVENT_NOTE, (BYTE)(dwParam1 >> 8), GETPORTCHANNEL(dwParam1), FNoteLengthValue, 0 };
 
 			_BMSEs(OMStream, BMSEsFlags, &Evs, ManagedSettings.OverrideNoteLength ? 2 : 1);
 
@@ -299,13 +337,18 @@ void __inline PrepareForBASSMIDI(DWORD dwParam1) {
 		}
 		else if ((dwParam1 & 0xF0) == MIDI_NOTEOFF) {
 			if (!ManagedSettings.OverrideNoteLength && ManagedSettings.DelayNoteOff) {
-				Evs[0] = { MIDI_EVENT_NOTE, (BYTE)(dwParam1 >> 8), dwParam1 & 0xF, FDelayNoteOff, 0 };
+				if (QueueNoteOff(dwParam1, FDelayNoteOff))
+					return;
+
+				Evs[0] = { MIDI_EVENT_NOTE, (BYTE)(dwParam1 >> 8), GETPORTCHANNEL(dwParam1), FDelayNoteOff, 0 };
 
 				_BMSEs(OMStream, BMSEsFlags, &Evs, 1);
 			}
 
 			return;
 		}
+		else if ((dwParam1 & 0xF0) == MIDI_CMC && (((dwParam1 >> 8) & 0xFF) == 120 || ((dwParam1 >> 8) & 0xFF) == 123))
+			CancelNoteTimers(GETPORTCHANNEL(dwParam1));
 	}
 
 	SendToBASSMIDI(dwParam1);
@@ -321,6 +364,12 @@ void __inline SendLongToBASSMIDI(LPMIDIHDR IIMidiHdr) {
 	// and thanks to Windows Media Player for doing this...
 	DWORD FLen = IIMidiHdr->dwBytesRecorded < 1 ? IIMidiHdr->dwBufferLength : IIMidiHdr->dwBytesRecorded;
 
+	// A SysEx could reset any controller, the values the decimation stage knows about are stale now
+	if (DecimationOn)
+		InvalidateDecimation(-1);
+
+	MirrorSynthSysEx((const BYTE*)IIMidiHdr->lpData, FLen);
+	PlayerCacheInput();
 	_BMSEs(OMStream, BASS_MIDI_EVENTS_RAW, IIMidiHdr->lpData, FLen);
 	PrintLongMessageToDebugLog(IIMidiHdr);
 }
@@ -333,7 +382,8 @@ void __inline PBufData(void) {
 
 	if (++EVBuffer.ReadHead >= EVBuffer.BufSize) EVBuffer.ReadHead = 0;
 
-	_PforBASSMIDI(dwParam1);
+	if (DecimationOn) DecimateEvent(dwParam1);
+	else _PforBASSMIDI(dwParam1);
 }
 
 void __inline PSmallBufData(void)
@@ -353,8 +403,9 @@ void __inline PSmallBufData(void)
 
 		EVBuffer.ReadHead = HeadPos;
 
-		if (~dwParam1) _PforBASSMIDI(dwParam1);
-		else return;
+		if (!~dwParam1) return;
+		else if (DecimationOn) DecimateEvent(dwParam1);
+		else _PforBASSMIDI(dwParam1);
 
 		if (HeadPos == HeadStart) return;
 
@@ -377,6 +428,9 @@ void __inline PlayBufferedData(void) {
 		while (BufferCheck());
 	}
 	else PSmallBufData();
+
+	if (DecimationOn)
+		FlushDecimation();
 }
 
 void __inline PlayBufferedDataHyper(void) {
@@ -387,6 +441,9 @@ void __inline PlayBufferedDataHyper(void) {
 
 	do PBufData();
 	while (EVBuffer.ReadHead != EVBuffer.WriteHead);
+
+	if (DecimationOn)
+		FlushDecimation();
 }
 
 void __inline PlayBufferedDataChunk(void) {
@@ -399,6 +456,9 @@ void __inline PlayBufferedDataChunk(void) {
 		while (EVBuffer.ReadHead != whe);
 	}
 	else PSmallBufData();
+
+	if (DecimationOn)
+		FlushDecimation();
 }
 
 void __inline PlayBufferedDataChunkHyper(void) {
@@ -407,6 +467,9 @@ void __inline PlayBufferedDataChunkHyper(void) {
 	ULONGLONG whe = EVBuffer.WriteHead;
 	do PBufData();
 	while (EVBuffer.ReadHead != whe);
+
+	if (DecimationOn)
+		FlushDecimation();
 }
 
 void __inline ParseData(DWORD_PTR dwParam1) {
@@ -430,6 +493,7 @@ void __inline ParseData(DWORD_PTR dwParam1) {
 		EVBuffer.Buffer[EVBuffer.WriteHead].Event = dwParam1;
 		//do NOT advance the WriteHead for a more sensical note skipping
 		//EVBuffer.WriteHead = NextWriteHead;
+		EvBufferDropped++;
 	}
 	else
 	{
@@ -459,6 +523,52 @@ void __inline ParseDataHyper(DWORD_PTR dwParam1)
 
 	if (NextWriteHead != EVBuffer.ReadHead)
 		EVBuffer.WriteHead = NextWriteHead; //skip notes properly
+	else
+		EvBufferDropped++;
 
 	// UnlockForWriting(&EPThreadsL);
-}
\ No newline at end of file
+}
+
+// How many BASSMIDI channels the stream needs, based on the ports in use
+FLOAT __inline RequiredMIDIChannels(void) {
+	DWORD Chans = ActivePorts * 16;
+
+	if (UnlimitedChannels && Chans < 128)
+		Chans = 128;
+
+	return (FLOAT)Chans;
+}
+
+BOOL EnableMIDIPort(DWORD Port) {
+	DWORD Current;
+
+	if (Port >= OM_MAXPORTS)
+		return FALSE;
+
+	// Fast path, the port is already available
+	if (Port < ActivePorts)
+		return TRUE;
+
+	do Current = ActivePorts;
+	while (Port >= Current && InterlockedCompareExchange((volatile LONG*)&ActivePorts, Port + 1, Current) != Current);
+
+	// Someone else got there first
+	if (Port < Current)
+		return TRUE;
+
+	if (OMStream) {
+		BASS_ChannelSetAttribute(OMStream, BASS_ATTRIB_MIDI_CHANS, RequiredMIDIChannels());
+
+		// Every port gets its own drum channel, just like port 0
+		for (DWORD NewPort = Current; NewPort <= Port; NewPort++)
+			_BMSE(OMStream, (NewPort << 4) | 9, MIDI_EVENT_DRUMS, 1);
+	}
+
+	PrintMessageToDebugLog("EnableMIDIPort", "Raised the channel count to fit a new port.");
+	return TRUE;
+}
+
+void ResetMIDIPorts(void) {
+	ActivePorts = 1;
+	memset(LastRunningStatus, 0, sizeof(LastRunningStatus));
+}
@@ -0,0 +1,254 @@
+/*
+OmniMIDI controller decimation
+Automation-heavy MIDI can send controllers, pitch bends and channel pressure at kilohertz rates,
+while only the last value of each one matters by the time the next block gets rendered.
+While enabled, the drain loop holds them back, keeps the latest value per channel and controller,
+and sends what's left at the end of the pass, skipping the values the synth already has.
+Anything else flushes the held values of its channel first, so the order the synth sees stays intact.
+*/
+#pragma once
+
+#define DEC_CONTROLS		130		// 128 controllers, plus channel pressure and pitch bend
+#define DEC_CHANPRES		128
+#define DEC_PITCH			129
+
+static BOOL DecimationOn = FALSE;
+
+// Latest value held back for each controller, 0 = nothing held
+static DWORD DecHeld[VB_CHANNELS][DEC_CONTROLS];
+static BYTE DecHeldList[VB_CHANNELS][DEC_CONTROLS];		// Controllers held on each channel, in arrival order
+static BYTE DecHeldCount[VB_CHANNELS];
+static BYTE DecDirtyList[VB_CHANNELS];					// Channels with something held, in arrival order
+static BOOL DecDirty[VB_CHANNELS];
+static DWORD DecDirtyCount = 0;
+
+// Last value that reached the synth, 0xFFFF if it might have been reset since then
+static WORD DecSent[VB_CHANNELS][DEC_CONTROLS];
+
+static BYTE DecRunningStatus[OM_MAXPORTS] = { 0 };
+
+static volatile LONG DecResetPending = FALSE;
+
+// Stats, printed to the debug pipe
+static volatile QWORD DecCollapsed = 0;		// Messages that never had to be sent
+static volatile QWORD DecDispatched = 0;	// Held messages that got sent anyway
+static volatile FLOAT DecDispatchNs = 0.0f;	// Average cost of sending one of them
+static volatile FLOAT DecSavedMs = 0.0f;	// Dispatch time saved so far, based on that average
+static LARGE_INTEGER DecQPCFreq = { 0 };
+
+void InvalidateDecimation(int Chan)
+{
+	if (Chan < 0) memset(DecSent, 0xFF, sizeof(DecSent));
+	else memset(DecSent[Chan], 0xFF, sizeof(DecSent[Chan]));
+}
+
+// Can be called from any thread, the held values belong to the drain loop and get dropped before its next event
+void ResetDecimation()
+{
+	InterlockedExchange(&DecResetPending, TRUE);
+	InvalidateDecimation(-1);
+}
+
+static void __inline ApplyDecimationReset()
+{
+	if (DecResetPending && InterlockedExchange(&DecResetPending, FALSE))
+	{
+		memset(DecHeld, 0, sizeof(DecHeld));
+		memset(DecHeldCount, 0, sizeof(DecHeldCount));
+		memset(DecDirty, 0, sizeof(DecDirty));
+		memset(DecRunningStatus, 0, sizeof(DecRunningStatus));
+		DecDirtyCount = 0;
+	}
+}
+
+void LoadDecimation()
+{
+	BOOL On = FALSE;
+	HKEY hKey;
+
+	if (RegOpenKeyExW(HKEY_CURRENT_USER, L"Software\\OmniMIDI\\Configuration", 0, KEY_READ, &hKey) == ERROR_SUCCESS)
+	{
+		DWORD dwType = REG_DWORD, dwSize = sizeof(DWORD);
+		RegQueryValueExW(hKey, L"DecimateControllers", NULL, &dwType, (LPBYTE)&On, &dwSize);
+		RegCloseKey(hKey);
+	}
+
+	if (!DecQPCFreq.QuadPart)
+		QueryPerformanceFrequency(&DecQPCFreq);
+
+	if (On && !DecimationOn)
+	{
+		ResetDecimation();
+		DecCollapsed = DecDispatched = 0;
+		DecDispatchNs = DecSavedMs = 0.0f;
+	}
+
+	DecimationOn = On;
+}
+
+// Called by SendToBASSMIDI, keeps track of what the synth has been told through any path
+void __inline DecimationSent(BYTE Chan, BYTE Cmd, BYTE Param1, BYTE Param2)
+{
+	switch (Cmd)
+	{
+	case MIDI_CMC:
+		// Reset all controllers changes more than just itself
+		if (Param1 == 121) InvalidateDecimation(Chan);
+		else DecSent[Chan][Param1] = Param2;
+		break;
+	case MIDI_CHANAFTER:
+		DecSent[Chan][DEC_CHANPRES] = Param1;
+		break;
+	case MIDI_PITCHWHEEL:
+		DecSent[Chan][DEC_PITCH] = (Param2 << 7) | Param1;
+		break;
+	}
+}
+
+// Returns the slot the message can be held in, or -1 if it has to keep its place in the stream
+static int __inline DecimationSlot(DWORD Msg)
+{
+	switch (GETCMD(Msg))
+	{
+	case MIDI_CMC:
+		switch (GETFP(Msg))
+		{
+		case 0: case 32:					// Bank select
+		case 6: case 38:					// Data entry
+		case 96: case 97:					// Data increment/decrement
+		case 98: case 99: case 100: case 101:	// NRPN/RPN
+			return -1;
+		default:
+			// Pedals and channel mode messages
+			if ((GETFP(Msg) >= 64 && GETFP(Msg) <= 69) || GETFP(Msg) >= 120)
+				return -1;
+
+			return GETFP(Msg) & 0x7F;
+		}
+	case MIDI_CHANAFTER:
+		return DEC_CHANPRES;
+	case MIDI_PITCHWHEEL:
+		return DEC_PITCH;
+	default:
+		return -1;
+	}
+}
+
+static WORD __inline DecimationValue(DWORD Msg, int Slot)
+{
+	switch (Slot)
+	{
+	case DEC_CHANPRES:
+		return GETFP(Msg);
+	case DEC_PITCH:
+		return (GETSP(Msg) << 7) | GETFP(Msg);
+	default:
+		return GETSP(Msg);
+	}
+}
+
+static void FlushDecimatedChannel(BYTE Chan)
+{
+	for (BYTE i = 0; i < DecHeldCount[Chan]; i++)
+	{
+		BYTE Slot = DecHeldList[Chan][i];
+		DWORD Msg = DecHeld[Chan][Slot];
+
+		DecHeld[Chan][Slot] = 0;
+
+		// The synth is already there
+		if (DecSent[Chan][Slot] == DecimationValue(Msg, Slot))
+		{
+			DecCollapsed++;
+			continue;
+		}
+
+		_PforBASSMIDI(Msg);
+		DecDispatched++;
+	}
+
+	DecHeldCount[Chan] = 0;
+}
+
+// Called at the end of every drain pass, and before anything that isn't tied to a single channel
+void FlushDecimation()
+{
+	LARGE_INTEGER Start, End;
+	QWORD Before = DecDispatched;
+
+	ApplyDecimationReset();
+
+	if (!DecDirtyCount)
+		return;
+
+	QueryPerformanceCounter(&Start);
+
+	for (DWORD i = 0; i < DecDirtyCount; i++)
+	{
+		FlushDecimatedChannel(DecDirtyList[i]);
+		DecDirty[DecDirtyList[i]] = FALSE;
+	}
+
+	DecDirtyCount = 0;
+
+	QueryPerformanceCounter(&End);
+
+	if (DecDispatched > Before && DecQPCFreq.QuadPart)
+	{
+		FLOAT Ns = (FLOAT)((DOUBLE)(End.QuadPart - Start.QuadPart) * 1000000000.0 / DecQPCFreq.QuadPart / (DecDispatched - Before));
+
+		DecDispatchNs = DecDispatchNs ? (DecDispatchNs * 0.99f + Ns * 0.01f) : Ns;
+	}
+
+	DecSavedMs = (FLOAT)((DOUBLE)DecCollapsed * DecDispatchNs / 1000000.0);
+}
+
+// Takes the place of _PforBASSMIDI in the drain loop while decimation is enabled
+void __inline DecimateEvent(DWORD dwParam1)
+{
+	DWORD Port = GETPORT(dwParam1);
+	DWORD Msg = STRIPPORT(dwParam1);
+
+	ApplyDecimationReset();
+
+	// Resolve the running status here, held messages won't be right before the data that relies on them anymore
+	if (CHKLRS(GETSTATUS(Msg))) DecRunningStatus[Port] = GETSTATUS(Msg);
+	else if (DecRunningStatus[Port]) Msg = Msg << 8 | DecRunningStatus[Port];
+
+	// System messages, flush everything before letting them through
+	if (!CHKLRS(GETSTATUS(Msg)) || GETCMD(Msg) == 0xF0)
+	{
+		FlushDecimation();
+		_PforBASSMIDI(dwParam1);
+		return;
+	}
+
+	BYTE Chan = (BYTE)((Port << 4) | GETCHANNEL(Msg));
+	int Slot = DecimationSlot(Msg);
+
+	Msg = SETPORT(Msg, Port);
+
+	if (Slot == -1)
+	{
+		if (DecHeldCount[Chan])
+			FlushDecimatedChannel(Chan);
+
+		_PforBASSMIDI(Msg);
+		return;
+	}
+
+	if (DecHeld[Chan][Slot])
+		DecCollapsed++;
+	else
+	{
+		if (!DecDirty[Chan])
+		{
+			DecDirty[Chan] = TRUE;
+			DecDirtyList[DecDirtyCount++] = Chan;
+		}
+
+		DecHeldList[Chan][DecHeldCount[Chan]++] = (BYTE)Slot;
+	}
+
+	DecHeld[Chan][Slot] = Msg;
+}
@@ -0,0 +1,167 @@
+/*
+OmniMIDI device resolution cache
+Remembers which ID the configured device had the last time it got resolved, so that
+(re)initializing only needs one info query to confirm it, instead of walking every device.
+Entries are persisted to HKCU\Software\OmniMIDI\DeviceCache, and dropped whenever WASAPI
+reports a device being added, removed or switched.
+*/
+#pragma once
+
+#define DEVCACHE_BASS	0
+#define DEVCACHE_WASAPI	1
+#define DEVCACHE_ASIO	2
+#define DEVCACHE_TYPES	3
+
+typedef struct DeviceCacheEntry
+{
+	char Name[MAX_PATH];	// Device name (or endpoint ID) as stored in the configuration
+	LONG ID;				// Index it had when it got resolved
+	LONG Generation;		// DeviceCacheGeneration at the time, the entry is stale if it doesn't match anymore
+};
+
+static DeviceCacheEntry DeviceCache[DEVCACHE_TYPES] = { 0 };
+static const char *DeviceCacheTypes[DEVCACHE_TYPES] = { "BASS", "WASAPI", "ASIO" };
+static volatile LONG DeviceCacheGeneration = 0;
+static BOOL DeviceCacheLoaded = FALSE;
+static LARGE_INTEGER DeviceCacheStart = { 0 };
+static LARGE_INTEGER DeviceCacheQPCFreq = { 0 };
+
+// Called by BASSWASAPI from its own thread
+void CALLBACK DeviceCacheNotifyProc(DWORD notify, DWORD device, void *user)
+{
+	InterlockedIncrement(&DeviceCacheGeneration);
+}
+
+static void DeviceCacheLoad()
+{
+	HKEY Key;
+	char ValueName[32];
+	DWORD Type, Size;
+
+	DeviceCacheLoaded = TRUE;
+	QueryPerformanceFrequency(&DeviceCacheQPCFreq);
+
+	for (DWORD i = 0; i < DEVCACHE_TYPES; i++)
+		DeviceCache[i].ID = -1;
+
+	// Get notified when the device list changes, BASS and WASAPI share the same endpoints
+	if (BASS_WASAPI_SetNotify)
+		BASS_WASAPI_SetNotify(DeviceCacheNotifyProc, NULL);
+
+	if (RegOpenKeyExW(HKEY_CURRENT_USER, L"Software\\OmniMIDI\\DeviceCache", 0, KEY_READ, &Key) != ERROR_SUCCESS)
+		return;
+
+	for (DWORD i = 0; i < DEVCACHE_TYPES; i++)
+	{
+		DeviceCacheEntry *Entry = &DeviceCache[i];
+
+		sprintf_s(ValueName, "%sName", DeviceCacheTypes[i]);
+		Size = sizeof(Entry->Name) - 1;
+		if (RegQueryValueExA(Key, ValueName, NULL, &Type, (LPBYTE)Entry->Name, &Size) != ERROR_SUCCESS || Type != REG_SZ)
+			continue;
+
+		sprintf_s(ValueName, "%sID", DeviceCacheTypes[i]);
+		Size = sizeof(DWORD);
+		if (RegQueryValueExA(Key, ValueName, NULL, &Type, (LPBYTE)&Entry->ID, &Size) != ERROR_SUCCESS || Type != REG_DWORD)
+			Entry->ID = -1;
+
+		Entry->Generation = DeviceCacheGeneration;
+	}
+
+	RegCloseKey(Key);
+}
+
+// Stops the notifications before BASSWASAPI gets unloaded, they get registered again on the next lookup
+void DeviceCacheRelease()
+{
+	if (DeviceCacheLoaded && BASS_WASAPI_SetNotify)
+		BASS_WASAPI_SetNotify(NULL, NULL);
+
+	DeviceCacheLoaded = FALSE;
+}
+
+// One targeted query, to make sure the cached ID still points to the same device
+static BOOL DeviceCacheValidate(DWORD Type, LPCSTR Name, LONG ID)
+{
+	switch (Type)
+	{
+	case DEVCACHE_BASS:
+	{
+		BASS_DEVICEINFO info;
+		return BASS_GetDeviceInfo(ID, &info) && info.driver && !strcmp(Name, info.driver);
+	}
+
+	case DEVCACHE_WASAPI:
+	{
+		BASS_WASAPI_DEVICEINFO info;
+		return BASS_WASAPI_GetDeviceInfo(ID, &info) && !strcmp(Name, info.id) &&
+			   !(info.flags & (BASS_DEVICE_LOOPBACK | BASS_DEVICE_INPUT | BASS_DEVICE_UNPLUGGED | BASS_DEVICE_DISABLED));
+	}
+
+	case DEVCACHE_ASIO:
+	{
+		BASS_ASIO_DEVICEINFO info;
+		return BASS_ASIO_GetDeviceInfo(ID, &info) && !strcmp(Name, info.name);
+	}
+
+	default:
+		return FALSE;
+	}
+}
+
+static FLOAT DeviceCacheElapsed()
+{
+	LARGE_INTEGER Now;
+	QueryPerformanceCounter(&Now);
+	return (FLOAT)((DOUBLE)(Now.QuadPart - DeviceCacheStart.QuadPart) * 1000000.0 / DeviceCacheQPCFreq.QuadPart);
+}
+
+// Returns the cached ID if it's still good, -1 if the caller has to enumerate the devices
+LONG DeviceCacheLookup(DWORD Type, LPCSTR Name)
+{
+	if (!DeviceCacheLoaded)
+		DeviceCacheLoad();
+
+	QueryPerformanceCounter(&DeviceCacheStart);
+
+	DeviceCacheEntry *Entry = &DeviceCache[Type];
+	if (Entry->ID == -1 || Entry->Generation != DeviceCacheGeneration || strcmp(Entry->Name, Name))
+		return -1;
+
+	if (!DeviceCacheValidate(Type, Name, Entry->ID))
+	{
+		PrintMessageToDebugLog("DeviceCacheLookup", "The cached device ID is stale, enumerating the devices...");
+		Entry->ID = -1;
+		return -1;
+	}
+
+	FLOAT Elapsed = DeviceCacheElapsed();
+	PrintVarToDebugLog(DeviceCacheTypes[Type], "Device resolved from cache in (us)", &Elapsed, PRINT_FLOAT);
+	return Entry->ID;
+}
+
+// Stores what the enumeration found, both in memory and in the registry
+void DeviceCacheStore(DWORD Type, LPCSTR Name, LONG ID)
+{
+	HKEY Key;
+	char ValueName[32];
+
+	FLOAT Elapsed = DeviceCacheElapsed();
+	PrintVarToDebugLog(DeviceCacheTypes[Type], "Device resolved by enumeration in (us)", &Elapsed, PRINT_FLOAT);
+
+	DeviceCacheEntry *Entry = &DeviceCache[Type];
+	strcpy_s(Entry->Name, Name);
+	Entry->ID = ID;
+	Entry->Generation = DeviceCacheGeneration;
+
+	if (RegCreateKeyExW(HKEY_CURRENT_USER, L"Software\\OmniMIDI\\DeviceCache", 0, NULL, 0, KEY_WRITE, NULL, &Key, NULL) != ERROR_SUCCESS)
+		return;
+
+	sprintf_s(ValueName, "%sName", DeviceCacheTypes[Type]);
+	RegSetValueExA(Key, ValueName, 0, REG_SZ, (LPBYTE)Name, (DWORD)strlen(Name) + 1);
+
+	sprintf_s(ValueName, "%sID", DeviceCacheTypes[Type]);
+	RegSetValueExA(Key, ValueName, 0, REG_DWORD, (LPBYTE)&ID, sizeof(DWORD));
+
+	RegCloseKey(Key);
+}
@@ -379,6 +379,7 @@ void AudioEngine(LPVOID lpParam)
 {
 	DWORD DataLength = 0;
 	QWORD QDataLength = 0;
+	LARGE_INTEGER BlockStart;
 
 	PrintMessageToDebugLog("AudioEngine", "Initializing audio rendering thread...");
 	// Skip if ASIO isn't using the direct feed mode
@@ -397,9 +398,14 @@ void AudioEngine(LPVOID lpParam)
 				case XAUDIO_ENGINE:
 				{
 					_PlayBufDataChk();
+					ReleaseScheduledEvents(SchedulerFrameBytes ? (SamplesPerFrame * sizeof(float)) / SchedulerFrameBytes : 0);
 
+					QueryPerformanceCounter(&BlockStart);
 					if ((DataLength = BASS_ChannelGetData(OMStream, FSndBuf, BASS_DATA_FLOAT + SamplesPerFrame * sizeof(float))) != -1)
+					{
+						RecordRenderBlock(BlockStart.QuadPart, SchedulerFrameBytes ? DataLength / SchedulerFrameBytes : 0);
 						SndDrv->WriteFrame(FSndBuf, DataLength / sizeof(float));
+					}
 
 					_FWAIT;
 					continue;
@@ -408,7 +414,11 @@ void AudioEngine(LPVOID lpParam)
 					//				case DXAUDIO_ENGINE:
 					{
 						_PlayBufDataChk();
+						ReleaseScheduledEvents(SchedulerLookaheadFrames());
+
+						QueryPerformanceCounter(&BlockStart);
 						BASS_ChannelUpdate(OMStream, /*(ManagedSettings.CurrentEngine != DXAUDIO_ENGINE) ?*/ ManagedSettings.ChannelUpdateLength /*: 0*/);
+						RecordRenderBlock(BlockStart.QuadPart, (SchedulerFreq * ManagedSettings.ChannelUpdateLength) / 1000);
 
 						_FWAIT;
 						continue;
@@ -417,6 +427,9 @@ void AudioEngine(LPVOID lpParam)
 				{
 					_PlayBufData();
 
+					// The stream feeds ASIO directly, nothing else releases the scheduled events on this path
+					ReleaseScheduledEvents(SchedulerLookaheadFrames());
+
 					_FWAIT;
 					continue;
 				}
@@ -426,6 +439,7 @@ void AudioEngine(LPVOID lpParam)
 					_PlayBufDataChk();
 
 					QDataLength = BASS_ChannelSeconds2Bytes(OMStream, 0.016);
+					ReleaseScheduledEvents(SchedulerFrameBytes ? (DWORD)(QDataLength / SchedulerFrameBytes) : 0);
 					BASS_ChannelGetData(OMStream, FSndBuf, AudioRenderingType(FALSE, ManagedSettings.AudioBitDepth) | QDataLength);
 					BASS_Encode_Write(OMStream, FSndBuf, QDataLength);
 
@@ -455,11 +469,19 @@ DWORD CALLBACK ProcData(void *buffer, DWORD length, void *user)
 	// Handle state transitions at frame boundary
 	AudioBus_ProcessFrameBoundary();
 
+	// Release the scheduled events that fall inside this block
+	ReleaseScheduledEvents(SchedulerFrameBytes ? length / SchedulerFrameBytes : 0);
+
 	// Get audio from BASSMIDI
+	LARGE_INTEGER BlockStart;
+	QueryPerformanceCounter(&BlockStart);
+
 	DWORD data = BASS_ChannelGetData(OMStream, buffer, length);
 	if (data == -1)
 		return 0;
 
+	RecordRenderBlock(BlockStart.QuadPart, SchedulerFrameBytes ? length / SchedulerFrameBytes : 0);
+
 	AudioBus_RecordSynthComplete();
 
 	// Permafrost takeover?
@@ -623,16 +645,35 @@ void InitializeBASSVST()
 		}
 		// Initialize BASS_VST
 		LoadFuncM(BASS_VST, BASS_VST_ChannelSetDSP);
+		LoadFuncM(BASS_VST, BASS_VST_ChannelRemoveDSP);
 		LoadFuncM(BASS_VST, BASS_VST_ChannelFree);
 		LoadFuncM(BASS_VST, BASS_VST_ChannelCreate);
 		LoadFuncM(BASS_VST, BASS_VST_ProcessEvent);
 		LoadFuncM(BASS_VST, BASS_VST_ProcessEventRaw);
 
-		BASS_VST_ChannelSetDSP(OMStream, LoudMax, BASS_UNICODE, 1);
+		LimiterVST = BASS_VST_ChannelSetDSP(OMStream, LoudMax, BASS_UNICODE, 1);
 	}
 #endif
 }
 
+void InitializeLimiter()
+{
+	ReleaseLimiter();
+	LoadLimiterSettings();
+
+	switch (LimiterMode)
+	{
+	case LIMITER_BUILTIN:
+		InitializeBuiltInLimiter();
+		break;
+	case LIMITER_LOUDMAX:
+		InitializeBASSVST();
+		break;
+	default:
+		break;
+	}
+}
+
 BOOL InitializeStream(INT32 mixfreq)
 {
 	PrintMessageToDebugLog("InitializeStreamFunc", "Creating stream...");
@@ -674,6 +715,9 @@ BOOL InitializeStream(INT32 mixfreq)
 	BMSEsFlags = (ManagedSettings.BASSDSMode ? BASS_MIDI_EVENTS_ASYNC : 0) | BASS_MIDI_EVENTS_STRUCT | BASS_MIDI_EVENTS_TIME | BASS_MIDI_EVENTS_CANCEL;
 	BMSEsRAWFlags = (ManagedSettings.BASSDSMode ? BASS_MIDI_EVENTS_ASYNC : 0) | BASS_MIDI_EVENTS_RAW;
 
+	// The render clock starts from zero with the new stream
+	ResetEventScheduler();
+
 	PrintMessageToDebugLog("InitializeStreamFunc", "Stream is now active!");
 	return TRUE;
 }
@@ -721,6 +765,8 @@ void FreeUpBASS()
 	// Deinitialize the BASS stream, then the output and free the library, since we need to restart it
 	BASS_StreamFree(OMStream);
 	PrintMessageToDebugLog("FreeUpBASSFunc", "BASS stream freed.");
+	ReleaseLimiter();
+	ReleaseNativeEffects();
 
 	// BASS_PluginFree(0);
 	// PrintMessageToDebugLog("FreeUpBASSFunc", "Plug-ins freed.");
@@ -787,9 +833,15 @@ void SetUpStream()
 {
 	// Initialize the MIDI channels
 	PrintMessageToDebugLog("SetUpStreamFunc", "Preparing MIDI channels...");
-	BASS_ChannelSetAttribute(OMStream, BASS_ATTRIB_MIDI_CHANS, 16);
+	BASS_ChannelSetAttribute(OMStream, BASS_ATTRIB_MIDI_CHANS, RequiredMIDIChannels());
 	_BMSE(OMStream, 0, MIDI_EVENT_SYSTEM, MIDI_SYSTEM_DEFAULT);
-	_BMSE(OMStream, 9, MIDI_EVENT_DRUMS, 1);
+	for (DWORD Port = 0; Port < ActivePorts; Port++)
+		_BMSE(OMStream, (Port << 4) | 9, MIDI_EVENT_DRUMS, 1);
+	LoadVoiceBudgets();
+	ResetVoiceBudgets();
+	LoadDecimation();
+	ResetDecimation();
+	ResetSynthState();
 	PrintMessageToDebugLog("SetUpStreamFunc", "MIDI channels are now ready to receive events.");
 }
 
@@ -906,12 +958,18 @@ LONG BASSDetectID()
 		}
 		else
 		{
+			// Check if it's still where it was last time
+			LONG CachedID = DeviceCacheLookup(DEVCACHE_BASS, OutputName);
+			if (CachedID != -1)
+				return CachedID;
+
 			for (int CurrentDevice = 1; BASS_GetDeviceInfo(CurrentDevice, &info); CurrentDevice++)
 			{
 				// Return the correct ID when found
 				if (strcmp(OutputName, info.driver) == 0)
 				{
 					PrintMessageToDebugLog("BASSDetectIDFunc", "It's a match! Initializing matched BASS device...");
+					DeviceCacheStore(DEVCACHE_BASS, OutputName, CurrentDevice);
 					return CurrentDevice;
 				}
 			}
@@ -944,6 +1002,11 @@ LONG WASAPIDetectID()
 		OpenRegistryKey(Configuration, L"Software\\OmniMIDI\\Configuration", TRUE);
 		RegQueryValueExA(Configuration.Address, "WASAPIOutput", NULL, &WSType, (LPBYTE)&OutputName, &WSSize);
 
+		// Check if it's still where it was last time
+		LONG CachedID = DeviceCacheLookup(DEVCACHE_WASAPI, OutputName);
+		if (CachedID != -1)
+			return CachedID;
+
 		// Loop through the available devices
 		for (DWORD CurrentDevice = 0; BASS_WASAPI_GetDeviceInfo(CurrentDevice, &info); CurrentDevice++)
 		{
@@ -956,6 +1019,7 @@ LONG WASAPIDetectID()
 			{
 				// It is POG, return the device
 				PrintMessageToDebugLog("WASAPIDetectIDFunc", "Device found. Returning its ID...");
+				DeviceCacheStore(DEVCACHE_WASAPI, OutputName, CurrentDevice);
 				return CurrentDevice;
 			}
 		}
@@ -987,6 +1051,11 @@ LONG ASIODetectID()
 		OpenRegistryKey(Configuration, L"Software\\OmniMIDI\\Configuration", TRUE);
 		RegQueryValueExA(Configuration.Address, "ASIOOutput", NULL, &ASType, (LPBYTE)&OutputName, &ASSize);
 
+		// Check if it's still where it was last time
+		LONG CachedID = DeviceCacheLookup(DEVCACHE_ASIO, OutputName);
+		if (CachedID != -1)
+			return CachedID;
+
 		// Iterate through the available audio devices
 		for (DWORD CurrentDevice = 0; BASS_ASIO_GetDeviceInfo(CurrentDevice, &info); CurrentDevice++)
 		{
@@ -994,6 +1063,7 @@ LONG ASIODetectID()
 			if (strcmp(OutputName, info.name) == 0)
 			{
 				PrintMessageToDebugLog("ASIODetectIDFunc", "It's a match! Initializing matched ASIO device...");
+				DeviceCacheStore(DEVCACHE_ASIO, OutputName, CurrentDevice);
 				return CurrentDevice;
 			}
 		}
@@ -1111,6 +1181,169 @@ BOOL ApplyStreamSettings()
 	return TRUE;
 }
 
+// Sink helpers, shared by InitializeBASS and RestartOutput
+// Quiet skips the error dialogs, for when the watchdog is retrying on its own
+BOOL OpenWASAPIOutput(BOOL Quiet)
+{
+	BASS_WASAPI_INFO infoW;
+	LONG DeviceID = WASAPIDetectID();
+
+	// Initialize WASAPI
+	BOOL WInit = BASS_WASAPI_Init(DeviceID, ManagedSettings.AudioFrequency, (ManagedSettings.MonoRendering ? 1 : 2),
+								  (ManagedSettings.WASAPIExclusive) ? BASS_WASAPI_EXCLUSIVE : 0 | (ManagedSettings.WASAPIRAWMode ? BASS_WASAPI_RAW : 0) | (ManagedSettings.WASAPIDoubleBuf ? BASS_WASAPI_BUFFER : 0) | BASS_WASAPI_EVENT,
+								  (float)ManagedSettings.BufferLength / 1000.0f,
+								  0, WASAPIProc, NULL);
+
+	// Check if it's working
+	CheckUp(FALSE, ERRORCODE, "WASAPI initialization", !Quiet);
+	PrintMessageToDebugLog("InitializeWASAPIFunc", "WASAPI initialized.");
+
+	if (WInit)
+	{
+		// Start the device
+		BASS_WASAPI_Start();
+		CheckUp(FALSE, ERRORCODE, "WASAPI start-up", !Quiet);
+
+		if (BASS_WASAPI_GetInfo(&infoW))
+		{
+			// Store the latency for debug
+			ManagedDebugInfo.AudioBufferSize = infoW.buflen / 8;
+			ManagedDebugInfo.AudioLatency = ((DOUBLE)ManagedDebugInfo.AudioBufferSize * 1000.0f / (DOUBLE)infoW.freq);
+			ManagedDebugInfo.ActualSampleRate = infoW.freq;
+			ManagedDebugInfo.AsioInputLatency = 0.0f; // Not applicable for WASAPI
+			PrintMessageToDebugLog("InitializeWASAPIFunc", "Stored latency information.");
+		}
+	}
+
+	return WInit;
+}
+
+// Returns NULL on success, or XAudio2's error otherwise
+const char *OpenXAOutput()
+{
+	const char *XATmp = "XAudio2 is not available.";
+
+	PrintMessageToDebugLog("InitializeXAFunc", "Allocationg XAudio2 struct...");
+	SndDrv = CreateXAudio2Stream();
+
+	if (SndDrv->IsLoaded())
+	{
+		PrintMessageToDebugLog("InitializeXAFunc", "Opening XAudio2 device...");
+		XATmp =
+			SndDrv->OpenStream(
+				NULL,
+				ManagedSettings.AudioFrequency,
+				ManagedSettings.MonoRendering ? 1 : 2,
+				4,
+				SamplesPerFrame,
+				ManagedSettings.XASPFSweepRate);
+	}
+
+	if (XATmp != NULL)
+		return XATmp;
+
+	PrintMessageToDebugLog("InitializeXAFunc", "XAudio2 stream is up and running.");
+
+	// Store the latency for debug
+	ManagedDebugInfo.AudioBufferSize = SamplesPerFrame;
+	ManagedDebugInfo.AudioLatency = ((DOUBLE)SamplesPerFrame * 1000.0f / (DOUBLE)ManagedSettings.AudioFrequency) * ManagedSettings.XASPFSweepRate;
+	ManagedDebugInfo.ActualSampleRate = ManagedSettings.AudioFrequency;
+	ManagedDebugInfo.AsioInputLatency = 0.0f; // Not applicable for XAudio2
+	PrintMessageToDebugLog("InitializeXAFunc", "Stored latency information.");
+
+	return NULL;
+}
+
+#if !defined(_M_ARM64)
+BOOL OpenASIOOutput(LONG DeviceToUse, BOOL Quiet)
+{
+	PrintMessageToDebugLog("InitializeASIOFunc", "Initializing BASSASIO...");
+	if (BASS_ASIO_Init(DeviceToUse, BASS_ASIO_THREAD | BASS_ASIO_JOINORDER))
+	{
+		CheckUp(TRUE, ERRORCODE, "ASIO Initialized", !Quiet);
+
+		// Set the audio frequency
+		if (!ManagedSettings.LeaveASIODeviceFreq)
+		{
+			if (!BASS_ASIO_CheckRate(ManagedSettings.AudioFrequency) && !ManagedSettings.DisableASIOFreqWarn && !Quiet)
+			{
+				WCHAR Warn[255] = {0};
+
+				swprintf(Warn,
+						 L"The ASIO device reported %dHz as an unsupported frequency.\nYou might encounter audio glitches, crackling or other issues.\n\nPress OK to continue.",
+						 ManagedSettings.AudioFrequency);
+
+				MessageBox(NULL, Warn, L"OmniMIDI - WARNING", MB_OK | MB_ICONWARNING | MB_SYSTEMMODAL);
+			}
+
+			BASS_ASIO_SetRate(ManagedSettings.AudioFrequency);
+			CheckUp(TRUE, ERRORCODE, "ASIO Device Frequency Set", !ManagedSettings.DisableASIOFreqWarn && !Quiet);
+		}
+		else
+			BASS_ASIO_SetRate(0);
+
+		// Set the bit depth for the left channel (ASIO only supports 32-bit float, on Vista+)
+		BASS_ASIO_ChannelSetFormat(FALSE, 0, BASS_ASIO_FORMAT_FLOAT);
+		CheckUp(TRUE, ERRORCODE, "ASIO Device Format Set", !Quiet);
+
+		// If mono rendering is enabled, set the audio frequency of the channels to half the value of the frequency selected
+		if (ManagedSettings.MonoRendering == 1)
+			BASS_ASIO_ChannelSetRate(FALSE, 0, ManagedSettings.AudioFrequency / 2);
+		// Else, set it to the default frequency
+		else
+			BASS_ASIO_ChannelSetRate(FALSE, 0, ManagedSettings.AudioFrequency);
+		CheckUp(TRUE, ERRORCODE, "ASIO Channel Frequency Set", !Quiet);
+
+		// Enable the channels
+		if (ManagedSettings.ASIODirectFeed)
+		{
+			BASS_ASIO_ChannelEnableBASS(FALSE, 0, OMStream, TRUE);
+			CheckUp(TRUE, ERRORCODE, "ASIO DF Channel Enable", !Quiet);
+		}
+		else
+		{
+			BASS_ASIO_ChannelEnable(FALSE, 0, ASIOProc, NULL);
+			CheckUp(TRUE, ERRORCODE, "ASIO Channel Enable", !Quiet);
+
+			if (!ManagedSettings.MonoRendering)
+			{
+				BASS_ASIO_ChannelJoin(FALSE, 1, 0);
+				CheckUp(TRUE, ERRORCODE, "ASIO Channel Join", !Quiet);
+				// Set the bit depth for the right channel as well
+				BASS_ASIO_ChannelSetFormat(FALSE, 0, BASS_ASIO_FORMAT_FLOAT);
+				CheckUp(TRUE, ERRORCODE, "ASIO Channel Bit Depth Set", !Quiet);
+			}
+		}
+
+		// If mono rendering is enabled, mirror the left channel to the right one as well
+		if (ManagedSettings.MonoRendering)
+		{
+			BASS_ASIO_ChannelEnableMirror(1, FALSE, 0);
+			CheckUp(TRUE, ERRORCODE, "ASIO Device Mono Mode", !Quiet);
+		}
+
+		// And start the ASIO output
+		BASS_ASIO_Start(0, std::thread::hardware_concurrency());
+		CheckUp(TRUE, ERRORCODE, "ASIO Start Output", !Quiet);
+
+		// Store the latency for debug - both input and output
+		DOUBLE asioRate = BASS_ASIO_GetRate();
+		ManagedDebugInfo.AudioBufferSize = BASS_ASIO_GetLatency(FALSE);
+		ManagedDebugInfo.AudioLatency = ((DOUBLE)ManagedDebugInfo.AudioBufferSize * 1000.0f / asioRate);
+		ManagedDebugInfo.AsioInputLatency = ((DOUBLE)BASS_ASIO_GetLatency(TRUE) * 1000.0f / asioRate);
+		ManagedDebugInfo.ActualSampleRate = (DWORD)asioRate;
+		CheckUp(TRUE, ERRORCODE, "ASIO Get Frequency", FALSE);
+
+		PrintMessageToDebugLog("InitializeASIOFunc", "Done!");
+		return TRUE;
+	}
+
+	// Else, something is wrong
+	CheckUp(TRUE, ERRORCODE, "ASIO Initialization", !Quiet);
+	return FALSE;
+}
+#endif
+
 BOOL InitializeBASS(BOOL restart)
 {
 	BOOL InitializationCompleted = FALSE;
@@ -1305,36 +1538,8 @@ BEGSWITCH:
 				break;
 			}
 
-			BASS_WASAPI_INFO infoW;
-			LONG DeviceID = WASAPIDetectID();
-
 			// Initialize WASAPI
-			BOOL WInit = BASS_WASAPI_Init(DeviceID, ManagedSettings.AudioFrequency, (ManagedSettings.MonoRendering ? 1 : 2),
-										  (ManagedSettings.WASAPIExclusive) ? BASS_WASAPI_EXCLUSIVE : 0 | (ManagedSettings.WASAPIRAWMode ? BASS_WASAPI_RAW : 0) | (ManagedSettings.WASAPIDoubleBuf ? BASS_WASAPI_BUFFER : 0) | BASS_WASAPI_EVENT,
-										  (float)ManagedSettings.BufferLength / 1000.0f,
-										  0, WASAPIProc, NULL);
-
-			// Check if it's working
-			CheckUp(FALSE, ERRORCODE, "WASAPI initialization", TRUE);
-			PrintMessageToDebugLog("InitializeWASAPIFunc", "WASAPI initialized.");
-
-			if (WInit)
-			{
-				// Start the device
-				BASS_WASAPI_Start();
-				CheckUp(FALSE, ERRORCODE, "WASAPI start-up", TRUE);
-
-				if (BASS_WASAPI_GetInfo(&infoW))
-				{
-					// Store the latency for debug
-					ManagedDebugInfo.AudioBufferSize = infoW.buflen / 8;
-					ManagedDebugInfo.AudioLatency = ((DOUBLE)ManagedDebugInfo.AudioBufferSize * 1000.0f / (DOUBLE)infoW.freq);
-					ManagedDebugInfo.ActualSampleRate = infoW.freq;
-					ManagedDebugInfo.AsioInputLatency = 0.0f; // Not applicable for WASAPI
-					PrintMessageToDebugLog("InitializeWASAPIFunc", "Stored latency information.");
-				}
-			}
-			else
+			if (!OpenWASAPIOutput(FALSE))
 			{
 				// Return an error, and switch to BASS' own WASAPI implementation
 				ManagedSettings.CurrentEngine = BASS_OUTPUT;
@@ -1367,22 +1572,7 @@ BEGSWITCH:
 				break;
 			}
 
-			PrintMessageToDebugLog("InitializeXAFunc", "Allocationg XAudio2 struct...");
-			SndDrv = CreateXAudio2Stream();
-
-			if (SndDrv->IsLoaded())
-			{
-				PrintMessageToDebugLog("InitializeXAFunc", "Opening XAudio2 device...");
-				XATmp =
-					SndDrv->OpenStream(
-						NULL,
-						ManagedSettings.AudioFrequency,
-						ManagedSettings.MonoRendering ? 1 : 2,
-						4,
-						SamplesPerFrame,
-						ManagedSettings.XASPFSweepRate);
-			}
-
+			XATmp = OpenXAOutput();
 			if (XATmp != NULL)
 			{
 				ManagedSettings.CurrentEngine = WASAPI_ENGINE;
@@ -1393,15 +1583,6 @@ BEGSWITCH:
 				MessageBoxA(NULL, XAMsgStr, "OmniMIDI - XA ERROR", MB_ICONERROR | MB_OK | MB_SYSTEMMODAL);
 				goto BEGSWITCH;
 			}
-			else
-				PrintMessageToDebugLog("InitializeXAFunc", "XAudio2 stream is up and running.");
-
-			// Store the latency for debug
-			ManagedDebugInfo.AudioBufferSize = SamplesPerFrame;
-			ManagedDebugInfo.AudioLatency = ((DOUBLE)SamplesPerFrame * 1000.0f / (DOUBLE)ManagedSettings.AudioFrequency) * ManagedSettings.XASPFSweepRate;
-			ManagedDebugInfo.ActualSampleRate = ManagedSettings.AudioFrequency;
-			ManagedDebugInfo.AsioInputLatency = 0.0f; // Not applicable for XAudio2
-			PrintMessageToDebugLog("InitializeXAFunc", "Stored latency information.");
 
 			// Prepare audio buffer
 			FSndBuf = new float[SamplesPerFrame];
@@ -1459,88 +1640,7 @@ BEGSWITCH:
 			}
 
 			// If ASIO is successfully initialized, go on with the initialization process
-			PrintMessageToDebugLog("InitializeASIOFunc", "Initializing BASSASIO...");
-			if (BASS_ASIO_Init(DeviceToUse, BASS_ASIO_THREAD | BASS_ASIO_JOINORDER))
-			{
-				CheckUp(TRUE, ERRORCODE, "ASIO Initialized", TRUE);
-
-				// Set the audio frequency
-				if (!ManagedSettings.LeaveASIODeviceFreq)
-				{
-					if (!BASS_ASIO_CheckRate(ManagedSettings.AudioFrequency) && !ManagedSettings.DisableASIOFreqWarn)
-					{
-						WCHAR Warn[255] = {0};
-
-						swprintf(Warn,
-								 L"The ASIO device reported %dHz as an unsupported frequency.\nYou might encounter audio glitches, crackling or other issues.\n\nPress OK to continue.",
-								 ManagedSettings.AudioFrequency);
-
-						MessageBox(NULL, Warn, L"OmniMIDI - WARNING", MB_OK | MB_ICONWARNING | MB_SYSTEMMODAL);
-					}
-
-					BASS_ASIO_SetRate(ManagedSettings.AudioFrequency);
-					CheckUp(TRUE, ERRORCODE, "ASIO Device Frequency Set", !ManagedSettings.DisableASIOFreqWarn);
-				}
-				else
-					BASS_ASIO_SetRate(0);
-
-				// Set the bit depth for the left channel (ASIO only supports 32-bit float, on Vista+)
-				BASS_ASIO_ChannelSetFormat(FALSE, 0, BASS_ASIO_FORMAT_FLOAT);
-				CheckUp(TRUE, ERRORCODE, "ASIO Device Format Set", TRUE);
-
-				// If mono rendering is enabled, set the audio frequency of the channels to half the value of the frequency selected
-				if (ManagedSettings.MonoRendering == 1)
-					BASS_ASIO_ChannelSetRate(FALSE, 0, ManagedSettings.AudioFrequency / 2);
-				// Else, set it to the default frequency
-				else
-					BASS_ASIO_ChannelSetRate(FALSE, 0, ManagedSettings.AudioFrequency);
-				CheckUp(TRUE, ERRORCODE, "ASIO Channel Frequency Set", TRUE);
-
-				// Enable the channels
-				if (ManagedSettings.ASIODirectFeed)
-				{
-					BASS_ASIO_ChannelEnableBASS(FALSE, 0, OMStream, TRUE);
-					CheckUp(TRUE, ERRORCODE, "ASIO DF Channel Enable", TRUE);
-				}
-				else
-				{
-					BASS_ASIO_ChannelEnable(FALSE, 0, ASIOProc, NULL);
-					CheckUp(TRUE, ERRORCODE, "ASIO Channel Enable", TRUE);
-
-					if (!ManagedSettings.MonoRendering)
-					{
-						BASS_ASIO_ChannelJoin(FALSE, 1, 0);
-						CheckUp(TRUE, ERRORCODE, "ASIO Channel Join", TRUE);
-						// Set the bit depth for the right channel as well
-						BASS_ASIO_ChannelSetFormat(FALSE, 0, BASS_ASIO_FORMAT_FLOAT);
-						CheckUp(TRUE, ERRORCODE, "ASIO Channel Bit Depth Set", TRUE);
-					}
-				}
-
-				// If mono rendering is enabled, mirror the left channel to the right one as well
-				if (ManagedSettings.MonoRendering)
-				{
-					BASS_ASIO_ChannelEnableMirror(1, FALSE, 0);
-					CheckUp(TRUE, ERRORCODE, "ASIO Device Mono Mode", TRUE);
-				}
-
-				// And start the ASIO output
-				BASS_ASIO_Start(0, std::thread::hardware_concurrency());
-				CheckUp(TRUE, ERRORCODE, "ASIO Start Output", TRUE);
-
-				// Store the latency for debug - both input and output
-				DOUBLE asioRate = BASS_ASIO_GetRate();
-				ManagedDebugInfo.AudioBufferSize = BASS_ASIO_GetLatency(FALSE);
-				ManagedDebugInfo.AudioLatency = ((DOUBLE)ManagedDebugInfo.AudioBufferSize * 1000.0f / asioRate);
-				ManagedDebugInfo.AsioInputLatency = ((DOUBLE)BASS_ASIO_GetLatency(TRUE) * 1000.0f / asioRate);
-				ManagedDebugInfo.ActualSampleRate = (DWORD)asioRate;
-				CheckUp(TRUE, ERRORCODE, "ASIO Get Frequency", FALSE);
-
-				PrintMessageToDebugLog("InitializeASIOFunc", "Done!");
-			}
-			// Else, something is wrong
-			else
-				CheckUp(TRUE, ERRORCODE, "ASIO Initialization", TRUE);
+			OpenASIOOutput(DeviceToUse, FALSE);
 
 			InitializationCompleted = TRUE;
 		}
@@ -1570,10 +1670,16 @@ BEGSWITCH:
 	_PlayBufData = HyperMode ? PlayBufferedDataHyper : PlayBufferedData;
 	_PlayBufDataChk = ManagedSettings.NotesCatcherWithAudio ? (HyperMode ? PlayBufferedDataChunkHyper : PlayBufferedDataChunk) : DummyPlayBufData;
 
+	// Apply the limiter (built-in or LoudMax), if requested
+	InitializeLimiter();
+
+	// Prepare the built-in effects, InitializeOrUpdateEffects falls back to DX8 if they're not available
+	InitializeNativeEffects();
+
 #if !defined(_M_ARM64)
-	// Apply LoudMax, if requested
-	InitializeBASSVST();
 	InitializeOrUpdateEffects();
+#else
+	UpdateNativeEffects();
 #endif
 
 	// Fire up AudioBus for Permafrost (real-time levels + voice counts)
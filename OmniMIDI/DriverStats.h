@@ -0,0 +1,186 @@
+/*
+OmniMIDI stats snapshot
+Published by the health thread through a sequence lock, so that clients
+can copy a consistent set of stats without ever blocking the driver
+*/
+#pragma once
+
+#define STATS_HIST_BUCKETS 32		// Block render time histogram, bucket N holds 2^N to 2^(N+1) microseconds
+#define STATS_WINDOW_MS 1000		// How often the percentiles window gets restarted
+
+// The published snapshot, odd sequence = being written
+static DriverStats StatsSnapshot = { 0 };
+static volatile LONG StatsSeq = 0;
+
+// Written by the audio thread only
+static volatile ULONGLONG StatsHist[STATS_HIST_BUCKETS] = { 0 };
+static volatile ULONGLONG StatsBlocks = 0;
+static volatile ULONGLONG StatsUnderruns = 0;
+static volatile DWORD StatsBlockMaxUs = 0;
+
+// Owned by the health thread
+static ULONGLONG StatsWindowHist[STATS_HIST_BUCKETS] = { 0 };
+static ULONGLONG StatsWindowStart = 0;
+static LARGE_INTEGER StatsQPCFreq = { 0 };
+
+// Called by the audio thread, with the QPC value read before the block got rendered
+void __inline RecordRenderBlock(LONGLONG StartQPC, DWORD Frames) {
+	LARGE_INTEGER Now;
+	DWORD Bucket = 0;
+
+	if (!StatsQPCFreq.QuadPart || !SchedulerFreq)
+		return;
+
+	QueryPerformanceCounter(&Now);
+
+	DWORD ElapsedUs = (DWORD)((Now.QuadPart - StartQPC) * 1000000 / StatsQPCFreq.QuadPart);
+	DWORD BlockUs = (DWORD)(((ULONGLONG)Frames * 1000000) / SchedulerFreq);
+
+	while ((ElapsedUs >> (Bucket + 1)) && Bucket < STATS_HIST_BUCKETS - 1)
+		Bucket++;
+
+	StatsHist[Bucket]++;
+	StatsBlocks++;
+
+	// The block wasn't ready in time, the device had to play silence (or old data)
+	if (Frames && ElapsedUs > BlockUs)
+		StatsUnderruns++;
+
+	if (ElapsedUs > StatsBlockMaxUs)
+		StatsBlockMaxUs = ElapsedUs;
+}
+
+// Percentile from the histogram, interpolated inside the bucket
+static FLOAT StatsPercentile(const ULONGLONG *Hist, ULONGLONG Total, DOUBLE Percentile) {
+	ULONGLONG Target = (ULONGLONG)(Total * Percentile);
+	ULONGLONG Seen = 0;
+
+	if (!Total)
+		return 0.0f;
+
+	for (DWORD i = 0; i < STATS_HIST_BUCKETS; i++) {
+		if (Seen + Hist[i] > Target) {
+			DOUBLE Low = i ? (DOUBLE)(1ULL << i) : 0.0;
+			DOUBLE High = (DOUBLE)(1ULL << (i + 1));
+			return (FLOAT)(Low + (High - Low) * (DOUBLE)(Target - Seen) / (DOUBLE)Hist[i]);
+		}
+
+		Seen += Hist[i];
+	}
+
+	return (FLOAT)(1ULL << STATS_HIST_BUCKETS);
+}
+
+void PublishDriverStats() {
+	ULONGLONG Window[STATS_HIST_BUCKETS];
+	ULONGLONG WindowTotal = 0;
+	LARGE_INTEGER Start, End;
+	DWORD TotalVoices = 0;
+
+	if (!StatsQPCFreq.QuadPart)
+		QueryPerformanceFrequency(&StatsQPCFreq);
+
+	QueryPerformanceCounter(&Start);
+
+	// Gather everything before entering the write section, to keep it as short as possible
+	for (DWORD i = 0; i < STATS_HIST_BUCKETS; i++) {
+		Window[i] = StatsHist[i] - StatsWindowHist[i];
+		WindowTotal += Window[i];
+	}
+
+	DWORD ActiveVoices[16] = { 0 };
+	FLOAT RenderingTime = 0.0f;
+
+	if (BASSLoadedToMemory && bass_initialized && OMStream) {
+		BASS_ChannelGetAttribute(OMStream, BASS_ATTRIB_CPU, &RenderingTime);
+
+		for (DWORD ch = 0; ch < ActivePorts * 16; ch++) {
+			int Voices = BASS_MIDI_StreamGetEvent(OMStream, ch, MIDI_EVENT_VOICES);
+			if (Voices == -1)
+				continue;
+
+			if (ch < 16)
+				ActiveVoices[ch] = Voices;
+
+			TotalVoices += Voices;
+		}
+	}
+
+	ULONGLONG ReadHead = EVBuffer.ReadHead, WriteHead = EVBuffer.WriteHead;
+	ULONGLONG Fill = EVBuffer.BufSize ? ((WriteHead + EVBuffer.BufSize - ReadHead) % EVBuffer.BufSize) : 0;
+
+	// Write section
+	InterlockedIncrement(&StatsSeq);
+
+	StatsSnapshot.Size = sizeof(DriverStats);
+	StatsSnapshot.Version = (DWORD)(StatsSeq >> 1) + 1;
+	StatsSnapshot.Timestamp = Start.QuadPart;
+	StatsSnapshot.RenderingTime = RenderingTime;
+	memcpy(StatsSnapshot.ActiveVoices, ActiveVoices, sizeof(ActiveVoices));
+	StatsSnapshot.TotalVoices = TotalVoices;
+	StatsSnapshot.EventsBufferSize = EVBuffer.BufSize;
+	StatsSnapshot.EventsBufferFill = Fill;
+	StatsSnapshot.EventsDropped = EvBufferDropped;
+	StatsSnapshot.ScheduledDropped = SchedulerDropped;
+	StatsSnapshot.RenderedBlocks = StatsBlocks;
+	StatsSnapshot.Underruns = StatsUnderruns;
+	StatsSnapshot.AudioLatency = ManagedDebugInfo.AudioLatency;
+	StatsSnapshot.BlockTimeP50 = StatsPercentile(Window, WindowTotal, 0.50);
+	StatsSnapshot.BlockTimeP95 = StatsPercentile(Window, WindowTotal, 0.95);
+	StatsSnapshot.BlockTimeP99 = StatsPercentile(Window, WindowTotal, 0.99);
+	StatsSnapshot.BlockTimeMax = (FLOAT)StatsBlockMaxUs;
+
+	QueryPerformanceCounter(&End);
+	StatsSnapshot.PublishCost = (DWORD)((End.QuadPart - Start.QuadPart) * 1000000000 / StatsQPCFreq.QuadPart);
+
+	InterlockedIncrement(&StatsSeq);
+
+	// Restart the percentiles window
+	if (GetTickCount64() - StatsWindowStart >= STATS_WINDOW_MS) {
+		for (DWORD i = 0; i < STATS_HIST_BUCKETS; i++)
+			StatsWindowHist[i] += Window[i];
+
+		StatsBlockMaxUs = 0;
+		StatsWindowStart = GetTickCount64();
+	}
+}
+
+BOOL CopyDriverStats(DriverStats *Stats) {
+	DriverStats Copy;
+	LONG Seq;
+
+	DWORD Size = Stats->Size;
+	if (Size < offsetof(DriverStats, RenderingTime))
+		return FALSE;
+
+	if (Size > sizeof(DriverStats))
+		Size = sizeof(DriverStats);
+
+	// Nothing published yet
+	if (!StatsSeq)
+		return FALSE;
+
+	// Retry until we get a copy that wasn't touched by the health thread in the meantime
+	do {
+		while ((Seq = StatsSeq) & 1)
+			YieldProcessor();
+
+		MemoryBarrier();
+		memcpy(&Copy, &StatsSnapshot, sizeof(DriverStats));
+		MemoryBarrier();
+	} while (Seq != StatsSeq);
+
+	// Newer clients might have a bigger struct, older ones a smaller one
+	Copy.Size = Size;
+	memcpy(Stats, &Copy, Size);
+
+	return TRUE;
+}
+
+void ResetDriverStats() {
+	memset((void*)StatsHist, 0, sizeof(StatsHist));
+	memset(StatsWindowHist, 0, sizeof(StatsWindowHist));
+	StatsBlocks = StatsUnderruns = 0;
+	StatsBlockMaxUs = 0;
+	EvBufferDropped = 0;
+}
@@ -0,0 +1,309 @@
+/*
+OmniMIDI early queue
+Lets midiOutOpen/InitializeKDMAPIStream return right away, while the health thread is still
+initializing BASS and loading the SoundFonts.
+Everything the app sends in the meantime is queued in order, and played back once the stream is ready.
+When the queue fills up, note-ons get dropped, but the controller state and the note-offs are kept and replayed after the queue.
+*/
+#pragma once
+
+#define EARLY_QUEUE_EVENTS 16384
+#define EARLY_QUEUE_LONGDATA 262144		// Bytes of SysEx the queue can hold
+#define EARLY_STALE_MS 500				// Note-ons older than this don't get played back, by default
+
+typedef struct EarlyEvent
+{
+	DWORD Msg;			// Short message, with the running status resolved
+	DWORD Offset;		// Position of the long message in EarlyLongData
+	DWORD Length;		// Length of the long message, 0 for short messages
+	ULONGLONG Stamp;	// GetTickCount64 at the time it got queued
+} EarlyEvent;
+
+static volatile BOOL EarlyQueueActive = FALSE;
+static BOOL EarlyOpen = FALSE;					// The current client didn't wait for the driver to be ready
+static CRITICAL_SECTION EarlyLock;
+static BOOL EarlyLockReady = FALSE;
+
+static EarlyEvent* EarlyEvents = NULL;
+static BYTE* EarlyLongData = NULL;
+static DWORD EarlyCount = 0, EarlyLongUsed = 0;
+static BYTE EarlyLastStatus[OM_MAXPORTS] = { 0 };
+
+// Controller state that didn't fit in the queue, 0xFF/0xFFFF = untouched
+static BYTE EarlyCC[OM_MAXPORTS][16][128];
+static BYTE EarlyProgram[OM_MAXPORTS][16];
+static WORD EarlyPitch[OM_MAXPORTS][16];
+static DWORD EarlyNoteOff[OM_MAXPORTS][16][4];	// One bit per key, released after the queue so that no note hangs
+static BOOL EarlyStateDirty = FALSE;
+
+static BOOL EarlyDropStale = TRUE;
+static DWORD EarlyStaleMs = EARLY_STALE_MS;
+static LARGE_INTEGER EarlyOpenStart = { 0 };
+
+static FLOAT EarlyElapsedMs()
+{
+	LARGE_INTEGER Now, Freq;
+
+	QueryPerformanceCounter(&Now);
+	QueryPerformanceFrequency(&Freq);
+
+	return (FLOAT)((DOUBLE)(Now.QuadPart - EarlyOpenStart.QuadPart) * 1000.0 / Freq.QuadPart);
+}
+
+static void ClearEarlyEvents()
+{
+	EarlyCount = EarlyLongUsed = 0;
+	memset(EarlyLastStatus, 0, sizeof(EarlyLastStatus));
+	memset(EarlyCC, 0xFF, sizeof(EarlyCC));
+	memset(EarlyProgram, 0xFF, sizeof(EarlyProgram));
+	memset(EarlyPitch, 0xFF, sizeof(EarlyPitch));
+	memset(EarlyNoteOff, 0, sizeof(EarlyNoteOff));
+	EarlyStateDirty = FALSE;
+}
+
+// Called by DoStartClient, before the health thread gets started
+void StartEarlyQueue()
+{
+	if (!EarlyLockReady)
+	{
+		InitializeCriticalSection(&EarlyLock);
+		EarlyLockReady = TRUE;
+	}
+
+	if (!EarlyEvents)
+		EarlyEvents = (EarlyEvent*)malloc(EARLY_QUEUE_EVENTS * sizeof(EarlyEvent));
+
+	if (!EarlyLongData)
+		EarlyLongData = (BYTE*)malloc(EARLY_QUEUE_LONGDATA);
+
+	if (!EarlyEvents || !EarlyLongData)
+	{
+		PrintMessageToDebugLog("EarlyQueue", "Couldn't allocate the early queue, the app will have to wait for the driver.");
+		EarlyOpen = FALSE;
+		return;
+	}
+
+	EarlyDropStale = SynthHost_ReadSetting(L"DropStaleNoteOns", TRUE);
+	EarlyStaleMs = SynthHost_ReadSetting(L"StaleNoteOnMs", EARLY_STALE_MS);
+
+	ClearEarlyEvents();
+
+	EarlyQueued = EarlyDropped = EarlyStale = 0;
+	EarlyOpen = TRUE;
+	EarlyQueueActive = TRUE;
+}
+
+// The queue is full, only keep what the synth needs to sound right once it's ready
+static void KeepEarlyState(DWORD Msg)
+{
+	DWORD Port = GETPORT(Msg), Chan = Msg & 0xF, Key = (Msg >> 8) & 0x7F;
+
+	switch (Msg & 0xF0)
+	{
+	case MIDI_NOTEON:
+		// A note-on with no velocity is a note-off
+		if (Msg & 0x7F0000)
+		{
+			EarlyDropped++;
+			return;
+		}
+		// Fall through
+	case MIDI_NOTEOFF:
+		EarlyNoteOff[Port][Chan][Key >> 5] |= 1u << (Key & 31);
+		break;
+	case MIDI_CMC:
+		EarlyCC[Port][Chan][(Msg >> 8) & 0x7F] = (BYTE)((Msg >> 16) & 0x7F);
+		break;
+	case MIDI_PROGCHAN:
+		EarlyProgram[Port][Chan] = (BYTE)((Msg >> 8) & 0x7F);
+		break;
+	case MIDI_PITCHWHEEL:
+		EarlyPitch[Port][Chan] = (WORD)((Msg >> 8) & 0x7F7F);
+		break;
+	default:
+		EarlyDropped++;
+		return;
+	}
+
+	EarlyStateDirty = TRUE;
+}
+
+// Returns FALSE if the driver is ready, and the message has to go through the usual path
+BOOL QueueEarlyShort(DWORD Msg)
+{
+	DWORD Port = GETPORT(Msg);
+
+	EnterCriticalSection(&EarlyLock);
+
+	if (!EarlyQueueActive)
+	{
+		LeaveCriticalSection(&EarlyLock);
+		return FALSE;
+	}
+
+	// Resolve the running status now, so that dropping a note-on later doesn't break the messages after it
+	if (Msg & 0x80)
+	{
+		if ((Msg & 0xF0) != 0xF0)
+			EarlyLastStatus[Port] = (BYTE)Msg;
+	}
+	else if (EarlyLastStatus[Port])
+		Msg = (Msg & 0xFF000000) | ((Msg & 0xFFFF) << 8) | EarlyLastStatus[Port];
+	else
+	{
+		// Data without any status to go with it
+		LeaveCriticalSection(&EarlyLock);
+		return TRUE;
+	}
+
+	if (EarlyCount < EARLY_QUEUE_EVENTS)
+	{
+		EarlyEvents[EarlyCount].Msg = Msg;
+		EarlyEvents[EarlyCount].Length = 0;
+		EarlyEvents[EarlyCount].Stamp = GetTickCount64();
+		EarlyCount++;
+		EarlyQueued++;
+	}
+	else KeepEarlyState(Msg);
+
+	LeaveCriticalSection(&EarlyLock);
+	return TRUE;
+}
+
+BOOL QueueEarlyLong(LPMIDIHDR IIMidiHdr)
+{
+	DWORD FLen = IIMidiHdr->dwBytesRecorded < 1 ? IIMidiHdr->dwBufferLength : IIMidiHdr->dwBytesRecorded;
+
+	EnterCriticalSection(&EarlyLock);
+
+	if (!EarlyQueueActive)
+	{
+		LeaveCriticalSection(&EarlyLock);
+		return FALSE;
+	}
+
+	if (EarlyCount < EARLY_QUEUE_EVENTS && FLen <= EARLY_QUEUE_LONGDATA - EarlyLongUsed)
+	{
+		memcpy(EarlyLongData + EarlyLongUsed, IIMidiHdr->lpData, FLen);
+
+		EarlyEvents[EarlyCount].Msg = 0;
+		EarlyEvents[EarlyCount].Offset = EarlyLongUsed;
+		EarlyEvents[EarlyCount].Length = FLen;
+		EarlyEvents[EarlyCount].Stamp = GetTickCount64();
+		EarlyLongUsed += FLen;
+		EarlyCount++;
+		EarlyQueued++;
+	}
+	else EarlyDropped++;
+
+	LeaveCriticalSection(&EarlyLock);
+	return TRUE;
+}
+
+// The stream is there already, so the events skip the ring. Thousands of them in one go would only overflow it
+static void __inline PlayEarlyEvent(DWORD Msg)
+{
+	if (!CheckIfEventIsToIgnore(STRIPPORT(Msg)))
+		_PforBASSMIDI(Msg);
+}
+
+static void ReplayEarlyState()
+{
+	for (DWORD Port = 0; Port < OM_MAXPORTS; Port++)
+	{
+		for (DWORD Chan = 0; Chan < 16; Chan++)
+		{
+			// Bank selects come before the program change, since they're controllers too
+			for (DWORD CC = 0; CC < 128; CC++)
+			{
+				if (EarlyCC[Port][Chan][CC] != 0xFF)
+					PlayEarlyEvent(SETPORT(MIDI_CMC | Chan | (CC << 8) | (EarlyCC[Port][Chan][CC] << 16), Port));
+			}
+
+			if (EarlyProgram[Port][Chan] != 0xFF)
+				PlayEarlyEvent(SETPORT(MIDI_PROGCHAN | Chan | (EarlyProgram[Port][Chan] << 8), Port));
+
+			if (EarlyPitch[Port][Chan] != 0xFFFF)
+				PlayEarlyEvent(SETPORT(MIDI_PITCHWHEEL | Chan | (EarlyPitch[Port][Chan] << 8), Port));
+
+			for (DWORD Key = 0; Key < 128; Key++)
+			{
+				if (EarlyNoteOff[Port][Chan][Key >> 5] & (1u << (Key & 31)))
+					PlayEarlyEvent(SETPORT(MIDI_NOTEOFF | Chan | (Key << 8), Port));
+			}
+		}
+	}
+}
+
+// Reset during the early window, there's no stream to reset yet, so just forget what the app queued
+// Returns FALSE if the queue isn't active anymore, and the reset has to go to the synth
+BOOL ClearEarlyQueue()
+{
+	if (!EarlyQueueActive)
+		return FALSE;
+
+	EnterCriticalSection(&EarlyLock);
+
+	if (!EarlyQueueActive)
+	{
+		LeaveCriticalSection(&EarlyLock);
+		return FALSE;
+	}
+
+	ClearEarlyEvents();
+	PrintMessageToDebugLog("EarlyQueue", "The app sent a reset, the early queue has been cleared.");
+
+	LeaveCriticalSection(&EarlyLock);
+	return TRUE;
+}
+
+// Called by the health thread once the stream is ready, or with Discard set if it never will be
+void FlushEarlyQueue(BOOL Discard)
+{
+	if (!EarlyQueueActive)
+		return;
+
+	EnterCriticalSection(&EarlyLock);
+
+	if (!Discard)
+	{
+		ULONGLONG Now = GetTickCount64();
+
+		for (DWORD i = 0; i < EarlyCount; i++)
+		{
+			EarlyEvent* Ev = &EarlyEvents[i];
+
+			if (Ev->Length)
+			{
+				MIDIHDR Hdr = { 0 };
+				Hdr.lpData = (LPSTR)(EarlyLongData + Ev->Offset);
+				Hdr.dwBufferLength = Hdr.dwBytesRecorded = Ev->Length;
+				SendLongToBASSMIDI(&Hdr);
+				continue;
+			}
+
+			// The app already moved on from these, playing them now would only make a late burst of notes
+			if (EarlyDropStale && (Ev->Msg & 0xF0) == MIDI_NOTEON && (Ev->Msg & 0xFF0000) && Now - Ev->Stamp > EarlyStaleMs)
+			{
+				EarlyStale++;
+				continue;
+			}
+
+			PlayEarlyEvent(Ev->Msg);
+		}
+
+		if (EarlyStateDirty)
+			ReplayEarlyState();
+
+		FirstSoundMs = EarlyElapsedMs();
+		PrintVarToDebugLog("EarlyQueue", "Time to first sound (ms)", &FirstSoundMs, PRINT_FLOAT);
+		PrintVarToDebugLog("EarlyQueue", "Events played back", &EarlyQueued, PRINT_UINT32);
+		PrintVarToDebugLog("EarlyQueue", "Stale note-ons dropped", &EarlyStale, PRINT_UINT32);
+	}
+	else PrintMessageToDebugLog("EarlyQueue", "The driver didn't start, the early queue has been discarded.");
+
+	EarlyCount = EarlyLongUsed = 0;
+	EarlyQueueActive = FALSE;
+
+	LeaveCriticalSection(&EarlyLock);
+}
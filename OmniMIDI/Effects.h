@@ -0,0 +1,741 @@
+/*
+OmniMIDI built-in effects
+Reverb (FDN), chorus and stereo delay, used in place of the DX8 FX.
+Every effect is a self-contained instance working on interleaved stereo float blocks,
+so the same kernels can be attached to any stream, not just OMStream.
+*/
+#pragma once
+
+#if defined(_M_AMD64) || defined(_M_IX86)
+#include <emmintrin.h>
+#define FX_SSE
+#endif
+
+#define FX_CHUNK 256				// Frames processed per pass
+#define FX_SMOOTH_MS 30.0f			// Time constant of the parameters smoothing
+#define FX_REVERB_LINES 4			// One SSE lane per delay line
+#define FX_CHORUS_MAX_MS 40			// Delay (20ms max) plus the full modulation swing
+#define FX_ECHO_MAX_MS 2000
+
+// Lengths of the FDN delay lines (ms), mutually prime enough to avoid stacking resonances
+static const float FxReverbLineMs[FX_REVERB_LINES] = { 29.7f, 37.1f, 41.1f, 43.7f };
+
+// Use the built-in effects instead of the DX8 ones, see LoadNativeEffectsSettings
+static DWORD NativeEffects = 1;
+
+// Linearly ramped parameter, the target can be changed from any thread
+typedef struct FxRamp
+{
+	float Cur;
+	volatile float Tgt;
+};
+
+typedef struct FxReverb
+{
+	float *Lines[FX_REVERB_LINES];
+	DWORD Len[FX_REVERB_LINES];
+	DWORD Pos[FX_REVERB_LINES];
+	float State[FX_REVERB_LINES];	// Damping filters
+	float Gain[FX_REVERB_LINES];	// Loop gains, from the decay time
+	float Damp[FX_REVERB_LINES];	// Damping coefficients, from the HF ratio
+	FxRamp InGain, Mix, Time, HFRatio;
+};
+
+typedef struct FxChorus
+{
+	float *Line;					// Interleaved stereo
+	DWORD Len, Pos;
+	DOUBLE Phase;					// LFO phase, 0 to 1
+	volatile float Rate;			// Hz
+	volatile DWORD Waveform;		// 0 = triangle, 1 = sine
+	volatile float PhaseOffset;		// Right channel LFO offset, 0 to 1
+	FxRamp Mix, Feedback, Delay, Depth;
+};
+
+typedef struct FxEcho
+{
+	float *Line;					// Interleaved stereo
+	DWORD Len, Pos;
+	volatile BOOL PingPong;
+	FxRamp Mix, Feedback, DelayL, DelayR;
+};
+
+typedef struct FxChain
+{
+	DWORD Freq, Chans, SampleSize;
+	float *Work;					// FX_CHUNK stereo frames, used when the stream isn't stereo float
+	float *Wet;						// FX_CHUNK stereo frames
+	volatile BOOL ReverbOn, ChorusOn, EchoOn;
+	FxReverb Reverb;
+	FxChorus Chorus;
+	FxEcho Echo;
+};
+
+static FxChain *NativeFx = NULL;
+static HDSP NativeFxDSP = 0;
+
+// Stats, printed to the debug pipe (average processing time per block, in microseconds)
+static volatile FLOAT FxReverbUs = 0.0f;
+static volatile FLOAT FxChorusUs = 0.0f;
+static volatile FLOAT FxEchoUs = 0.0f;
+static LARGE_INTEGER FxQPCFreq = { 0 };
+
+static void LoadNativeEffectsSettings()
+{
+	HKEY hKey;
+
+	if (RegOpenKeyExW(HKEY_CURRENT_USER, L"Software\\OmniMIDI\\Configuration", 0, KEY_READ, &hKey) == ERROR_SUCCESS)
+	{
+		DWORD dwType = REG_DWORD;
+		DWORD dwSize = sizeof(DWORD);
+		RegQueryValueExW(hKey, L"NativeEffects", NULL, &dwType, (LPBYTE)&NativeEffects, &dwSize);
+		RegCloseKey(hKey);
+	}
+}
+
+// Returns where the ramp starts, and moves it towards its target for the next block
+float __inline FxRampStep(FxRamp *R, float Coef) {
+	float Start = R->Cur;
+	R->Cur += (R->Tgt - R->Cur) * Coef;
+	return Start;
+}
+
+void __inline FxRampSnap(FxRamp *R) {
+	R->Cur = R->Tgt;
+}
+
+float __inline FxDBToLinear(float dB) {
+	return (dB <= -96.0f) ? 0.0f : powf(10.0f, dB / 20.0f);
+}
+
+// Linear interpolated read from an interleaved stereo delay line, Delay in frames
+float __inline FxReadLine(const float *Line, DWORD Len, DWORD Pos, float Delay, DWORD Ch) {
+	float ReadPos = (float)Pos - Delay;
+	if (ReadPos < 0.0f)
+		ReadPos += (float)Len;
+
+	DWORD I0 = (DWORD)ReadPos;
+	DWORD I1 = (I0 + 1 == Len) ? 0 : I0 + 1;
+	float Frac = ReadPos - (float)I0;
+
+	return Line[(I0 * 2) + Ch] + (Line[(I1 * 2) + Ch] - Line[(I0 * 2) + Ch]) * Frac;
+}
+
+// Out = Out * Dry + Wet * WetGain, with both gains ramped linearly over the block
+static void FxMix(float *Out, const float *Wet, DWORD Frames, float Dry0, float Dry1, float Wet0, float Wet1)
+{
+	float DryStep = (Dry1 - Dry0) / Frames;
+	float WetStep = (Wet1 - Wet0) / Frames;
+	DWORD i = 0;
+
+#ifdef FX_SSE
+	__m128 D = _mm_setr_ps(Dry0, Dry0, Dry0 + DryStep, Dry0 + DryStep);
+	__m128 W = _mm_setr_ps(Wet0, Wet0, Wet0 + WetStep, Wet0 + WetStep);
+	const __m128 DInc = _mm_set1_ps(DryStep * 2.0f);
+	const __m128 WInc = _mm_set1_ps(WetStep * 2.0f);
+
+	for (; i + 2 <= Frames; i += 2)
+	{
+		__m128 O = _mm_loadu_ps(Out + (i * 2));
+		__m128 X = _mm_loadu_ps(Wet + (i * 2));
+		_mm_storeu_ps(Out + (i * 2), _mm_add_ps(_mm_mul_ps(O, D), _mm_mul_ps(X, W)));
+		D = _mm_add_ps(D, DInc);
+		W = _mm_add_ps(W, WInc);
+	}
+#endif
+
+	for (; i < Frames; i++)
+	{
+		float DG = Dry0 + DryStep * i;
+		float WG = Wet0 + WetStep * i;
+		Out[(i * 2)] = Out[(i * 2)] * DG + Wet[(i * 2)] * WG;
+		Out[(i * 2) + 1] = Out[(i * 2) + 1] * DG + Wet[(i * 2) + 1] * WG;
+	}
+}
+
+// ---- Reverb ----
+// Four delay lines, each with a damping filter in its loop, mixed back through a 4x4 Hadamard matrix.
+// Every line sits in its own SSE lane, so the filters, the loop gains and the matrix are done in one go.
+
+static BOOL FxReverbInit(FxReverb *R, DWORD Freq)
+{
+	for (DWORD l = 0; l < FX_REVERB_LINES; l++)
+	{
+		R->Len[l] = max((DWORD)((FxReverbLineMs[l] * Freq) / 1000.0f), 1);
+		R->Lines[l] = (float *)calloc(R->Len[l], sizeof(float));
+		if (!R->Lines[l])
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static void FxReverbFree(FxReverb *R)
+{
+	for (DWORD l = 0; l < FX_REVERB_LINES; l++)
+	{
+		free(R->Lines[l]);
+		R->Lines[l] = NULL;
+	}
+}
+
+// Clears the tails and jumps to the current parameters, the wet signal fades in from silence
+static void FxReverbReset(FxReverb *R)
+{
+	for (DWORD l = 0; l < FX_REVERB_LINES; l++)
+	{
+		if (R->Lines[l])
+			memset(R->Lines[l], 0, R->Len[l] * sizeof(float));
+		R->Pos[l] = 0;
+		R->State[l] = 0.0f;
+	}
+
+	FxRampSnap(&R->InGain);
+	FxRampSnap(&R->Time);
+	FxRampSnap(&R->HFRatio);
+	R->Mix.Cur = 0.0f;
+}
+
+// In gain and mix in dB, decay time in ms, HF ratio from 0.001 to 0.999 (same ranges as DX8)
+static void FxReverbSetParameters(FxReverb *R, float InGaindB, float MixdB, float TimeMs, float HFRatio)
+{
+	R->InGain.Tgt = FxDBToLinear(InGaindB);
+	R->Mix.Tgt = FxDBToLinear(MixdB) * 0.5f;
+	R->Time.Tgt = max(TimeMs, 1.0f);
+	R->HFRatio.Tgt = max(min(HFRatio, 0.999f), 0.001f);
+}
+
+static void FxReverbProcess(FxReverb *R, const float *In, float *Wet, DWORD Frames, DWORD Freq, float Coef)
+{
+	FxRampStep(&R->Time, Coef);
+	FxRampStep(&R->HFRatio, Coef);
+
+	// The loop gains follow the decay time, the damping makes the highs decay HFRatio times faster
+	for (DWORD l = 0; l < FX_REVERB_LINES; l++)
+	{
+		float G = powf(10.0f, (-3.0f * R->Len[l] * 1000.0f) / (R->Time.Cur * Freq));
+		float K = powf(G, (1.0f / R->HFRatio.Cur) - 1.0f);
+		R->Gain[l] = G;
+		R->Damp[l] = (1.0f - K) / (1.0f + K);
+	}
+
+	float In0 = FxRampStep(&R->InGain, Coef);
+	float InStep = (R->InGain.Cur - In0) / Frames;
+	float Rd[FX_REVERB_LINES], Y[FX_REVERB_LINES];
+
+#ifdef FX_SSE
+	const __m128 G = _mm_loadu_ps(R->Gain);
+	const __m128 A = _mm_loadu_ps(R->Damp);
+	const __m128 OneMinusA = _mm_sub_ps(_mm_set1_ps(1.0f), A);
+	const __m128 Half = _mm_set1_ps(0.5f);
+	__m128 S = _mm_loadu_ps(R->State);
+#endif
+
+	for (DWORD i = 0; i < Frames; i++)
+	{
+		// Tiny offset to keep the tails from decaying into denormals
+		float X = ((In[(i * 2)] + In[(i * 2) + 1]) * 0.5f * (In0 + InStep * i)) + 1e-18f;
+
+		for (DWORD l = 0; l < FX_REVERB_LINES; l++)
+			Rd[l] = R->Lines[l][R->Pos[l]];
+
+#ifdef FX_SSE
+		__m128 V = _mm_loadu_ps(Rd);
+		S = _mm_add_ps(_mm_mul_ps(V, OneMinusA), _mm_mul_ps(S, A));
+		V = _mm_mul_ps(S, G);
+
+		// Hadamard, two butterfly passes
+		for (int p = 0; p < 2; p++)
+		{
+			__m128 Sw = _mm_shuffle_ps(V, V, _MM_SHUFFLE(2, 3, 0, 1));
+			V = _mm_shuffle_ps(_mm_add_ps(V, Sw), _mm_sub_ps(V, Sw), _MM_SHUFFLE(2, 0, 2, 0));
+		}
+
+		_mm_storeu_ps(Y, _mm_mul_ps(V, Half));
+#else
+		float T[FX_REVERB_LINES];
+		for (DWORD l = 0; l < FX_REVERB_LINES; l++)
+		{
+			R->State[l] = Rd[l] * (1.0f - R->Damp[l]) + R->State[l] * R->Damp[l];
+			T[l] = R->State[l] * R->Gain[l];
+		}
+
+		Y[0] = (T[0] + T[1] + T[2] + T[3]) * 0.5f;
+		Y[1] = (T[0] - T[1] + T[2] - T[3]) * 0.5f;
+		Y[2] = (T[0] + T[1] - T[2] - T[3]) * 0.5f;
+		Y[3] = (T[0] - T[1] - T[2] + T[3]) * 0.5f;
+#endif
+
+		for (DWORD l = 0; l < FX_REVERB_LINES; l++)
+		{
+			R->Lines[l][R->Pos[l]] = Y[l] + X;
+			if (++R->Pos[l] == R->Len[l])
+				R->Pos[l] = 0;
+		}
+
+		Wet[(i * 2)] = Rd[0] + Rd[2];
+		Wet[(i * 2) + 1] = Rd[1] + Rd[3];
+	}
+
+#ifdef FX_SSE
+	_mm_storeu_ps(R->State, S);
+#endif
+}
+
+// ---- Chorus ----
+
+static BOOL FxChorusInit(FxChorus *C, DWORD Freq)
+{
+	C->Len = ((FX_CHORUS_MAX_MS * Freq) / 1000) + 4;
+	C->Line = (float *)calloc(C->Len * 2, sizeof(float));
+	return C->Line != NULL;
+}
+
+static void FxChorusFree(FxChorus *C)
+{
+	free(C->Line);
+	C->Line = NULL;
+}
+
+static void FxChorusReset(FxChorus *C)
+{
+	if (C->Line)
+		memset(C->Line, 0, C->Len * 2 * sizeof(float));
+	C->Pos = 0;
+	C->Phase = 0.0;
+
+	FxRampSnap(&C->Feedback);
+	FxRampSnap(&C->Delay);
+	FxRampSnap(&C->Depth);
+	C->Mix.Cur = 0.0f;
+}
+
+// Same ranges as DX8: mix, depth and feedback in %, rate in Hz, delay in ms, phase from 0 (-180°) to 4 (180°)
+static void FxChorusSetParameters(FxChorus *C, float Mix, float Depth, float Feedback, float Rate, DWORD Waveform, DWORD Phase, float DelayMs)
+{
+	C->Mix.Tgt = max(min(Mix, 100.0f), 0.0f) / 100.0f;
+	C->Depth.Tgt = max(min(Depth, 100.0f), 0.0f) / 100.0f;
+	C->Feedback.Tgt = max(min(Feedback, 99.0f), -99.0f) / 100.0f;
+	C->Delay.Tgt = max(min(DelayMs, 20.0f), 0.0f);
+	C->Rate = max(min(Rate, 10.0f), 0.0f);
+	C->Waveform = Waveform;
+	C->PhaseOffset = (float)(min(Phase, 4) * 90) / 360.0f - 0.5f;
+}
+
+// Triangle LFO from a phase that can be past 1, -1 to 1
+float __inline FxTriangle(float Phase) {
+	Phase -= (float)(int)Phase;
+	return 1.0f - 4.0f * fabsf(Phase - 0.5f);
+}
+
+// Fills Delays with the delay of every frame of the block, in frames, interleaved like the audio
+// The sine LFO is a rotating phasor, so sin() only runs when the block starts instead of on every sample
+static void FxChorusDelays(FxChorus *C, float *Delays, DWORD Frames, float Base0, float BaseStep, float Dp0, float DpStep, float PhaseStep)
+{
+	const float TwoPi = 6.283185307179586f;
+	float MaxDelay = (float)(C->Len - 2);
+	float P[2] = { (float)C->Phase, (float)(C->Phase + C->PhaseOffset + 1.0) };
+	BOOL Sine = C->Waveform;
+	DWORD i = 0;
+
+#ifdef FX_SSE
+	// Two frames per pass, lanes are L(i), R(i), L(i + 1), R(i + 1)
+	__m128 Pv = _mm_setr_ps(P[0], P[1], P[0] + PhaseStep, P[1] + PhaseStep);
+	__m128 Sv = _mm_setr_ps(sinf(P[0] * TwoPi), sinf(P[1] * TwoPi), sinf((P[0] + PhaseStep) * TwoPi), sinf((P[1] + PhaseStep) * TwoPi));
+	__m128 Cv = _mm_setr_ps(cosf(P[0] * TwoPi), cosf(P[1] * TwoPi), cosf((P[0] + PhaseStep) * TwoPi), cosf((P[1] + PhaseStep) * TwoPi));
+	__m128 B = _mm_setr_ps(Base0, Base0, Base0 + BaseStep, Base0 + BaseStep);
+	__m128 D = _mm_setr_ps(Dp0, Dp0, Dp0 + DpStep, Dp0 + DpStep);
+
+	const __m128 Rot2C = _mm_set1_ps(cosf(PhaseStep * 2.0f * TwoPi));
+	const __m128 Rot2S = _mm_set1_ps(sinf(PhaseStep * 2.0f * TwoPi));
+	const __m128 PInc = _mm_set1_ps(PhaseStep * 2.0f);
+	const __m128 BInc = _mm_set1_ps(BaseStep * 2.0f);
+	const __m128 DInc = _mm_set1_ps(DpStep * 2.0f);
+	const __m128 Half = _mm_set1_ps(0.5f);
+	const __m128 One = _mm_set1_ps(1.0f);
+	const __m128 Four = _mm_set1_ps(4.0f);
+	const __m128 AbsMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+	const __m128 Lo = _mm_set1_ps(1.0f);
+	const __m128 Hi = _mm_set1_ps(MaxDelay);
+
+	for (; i + 2 <= Frames; i += 2)
+	{
+		__m128 Mod;
+
+		if (Sine)
+		{
+			Mod = Sv;
+			__m128 NextS = _mm_add_ps(_mm_mul_ps(Sv, Rot2C), _mm_mul_ps(Cv, Rot2S));
+			Cv = _mm_sub_ps(_mm_mul_ps(Cv, Rot2C), _mm_mul_ps(Sv, Rot2S));
+			Sv = NextS;
+		}
+		else
+		{
+			// The phase is never negative, so truncating is the same as flooring
+			__m128 Frac = _mm_sub_ps(Pv, _mm_cvtepi32_ps(_mm_cvttps_epi32(Pv)));
+			Mod = _mm_sub_ps(One, _mm_mul_ps(Four, _mm_and_ps(_mm_sub_ps(Frac, Half), AbsMask)));
+		}
+
+		__m128 Dl = _mm_mul_ps(B, _mm_add_ps(One, _mm_mul_ps(D, Mod)));
+		_mm_storeu_ps(Delays + (i * 2), _mm_max_ps(_mm_min_ps(Dl, Hi), Lo));
+
+		Pv = _mm_add_ps(Pv, PInc);
+		B = _mm_add_ps(B, BInc);
+		D = _mm_add_ps(D, DInc);
+	}
+#endif
+
+	// Whatever is left (everything, without SSE), same phasor in scalar form
+	float S[2], Co[2];
+	float RotC = cosf(PhaseStep * TwoPi), RotS = sinf(PhaseStep * TwoPi);
+
+	for (DWORD ch = 0; ch < 2; ch++)
+	{
+		S[ch] = sinf((P[ch] + PhaseStep * i) * TwoPi);
+		Co[ch] = cosf((P[ch] + PhaseStep * i) * TwoPi);
+	}
+
+	for (; i < Frames; i++)
+	{
+		float Base = Base0 + BaseStep * i;
+		float Depth = Dp0 + DpStep * i;
+
+		for (DWORD ch = 0; ch < 2; ch++)
+		{
+			float Mod = Sine ? S[ch] : FxTriangle(P[ch] + PhaseStep * i);
+			Delays[(i * 2) + ch] = max(min(Base * (1.0f + Depth * Mod), MaxDelay), 1.0f);
+
+			float NextS = S[ch] * RotC + Co[ch] * RotS;
+			Co[ch] = Co[ch] * RotC - S[ch] * RotS;
+			S[ch] = NextS;
+		}
+	}
+}
+
+static void FxChorusProcess(FxChorus *C, const float *In, float *Wet, DWORD Frames, DWORD Freq, float Coef)
+{
+	float Delays[FX_CHUNK * 2];
+	float Fb0 = FxRampStep(&C->Feedback, Coef), FbStep = (C->Feedback.Cur - Fb0) / Frames;
+	float Dl0 = FxRampStep(&C->Delay, Coef), DlStep = (C->Delay.Cur - Dl0) / Frames;
+	float Dp0 = FxRampStep(&C->Depth, Coef), DpStep = (C->Depth.Cur - Dp0) / Frames;
+	DOUBLE PhaseStep = (DOUBLE)C->Rate / Freq;
+	float FramesPerMs = (float)Freq / 1000.0f;
+
+	FxChorusDelays(C, Delays, Frames, Dl0 * FramesPerMs, DlStep * FramesPerMs, Dp0, DpStep, (float)PhaseStep);
+
+	// The reads are interpolated at a different spot for every sample, and the feedback makes each frame depend on the previous ones
+	for (DWORD i = 0; i < Frames; i++)
+	{
+		float Fb = Fb0 + FbStep * i;
+
+		for (DWORD ch = 0; ch < 2; ch++)
+		{
+			float Rd = FxReadLine(C->Line, C->Len, C->Pos, Delays[(i * 2) + ch], ch);
+
+			C->Line[(C->Pos * 2) + ch] = In[(i * 2) + ch] + Rd * Fb;
+			Wet[(i * 2) + ch] = Rd;
+		}
+
+		if (++C->Pos == C->Len)
+			C->Pos = 0;
+	}
+
+	C->Phase += PhaseStep * Frames;
+	C->Phase -= floor(C->Phase);
+}
+
+// ---- Stereo delay ----
+
+static BOOL FxEchoInit(FxEcho *E, DWORD Freq)
+{
+	E->Len = ((FX_ECHO_MAX_MS * Freq) / 1000) + 4;
+	E->Line = (float *)calloc(E->Len * 2, sizeof(float));
+	return E->Line != NULL;
+}
+
+static void FxEchoFree(FxEcho *E)
+{
+	free(E->Line);
+	E->Line = NULL;
+}
+
+static void FxEchoReset(FxEcho *E)
+{
+	if (E->Line)
+		memset(E->Line, 0, E->Len * 2 * sizeof(float));
+	E->Pos = 0;
+
+	FxRampSnap(&E->Feedback);
+	FxRampSnap(&E->DelayL);
+	FxRampSnap(&E->DelayR);
+	E->Mix.Cur = 0.0f;
+}
+
+// Same ranges as DX8: mix and feedback in %, delays in ms, ping-pong swaps the feedback paths
+static void FxEchoSetParameters(FxEcho *E, float Mix, float Feedback, float LeftMs, float RightMs, BOOL PingPong)
+{
+	E->Mix.Tgt = max(min(Mix, 100.0f), 0.0f) / 100.0f;
+	E->Feedback.Tgt = max(min(Feedback, 100.0f), 0.0f) / 100.0f;
+	E->DelayL.Tgt = max(min(LeftMs, (float)FX_ECHO_MAX_MS), 1.0f);
+	E->DelayR.Tgt = max(min(RightMs, (float)FX_ECHO_MAX_MS), 1.0f);
+	E->PingPong = PingPong;
+}
+
+static void FxEchoProcess(FxEcho *E, const float *In, float *Wet, DWORD Frames, DWORD Freq, float Coef)
+{
+	float Fb0 = FxRampStep(&E->Feedback, Coef), FbStep = (E->Feedback.Cur - Fb0) / Frames;
+	float L0 = FxRampStep(&E->DelayL, Coef), LStep = (E->DelayL.Cur - L0) / Frames;
+	float R0 = FxRampStep(&E->DelayR, Coef), RStep = (E->DelayR.Cur - R0) / Frames;
+	float FramesPerMs = (float)Freq / 1000.0f;
+	float MaxDelay = (float)(E->Len - 2);
+	BOOL PingPong = E->PingPong;
+
+	for (DWORD i = 0; i < Frames; i++)
+	{
+		float Fb = Fb0 + FbStep * i;
+		float RdL = FxReadLine(E->Line, E->Len, E->Pos, min((L0 + LStep * i) * FramesPerMs, MaxDelay), 0);
+		float RdR = FxReadLine(E->Line, E->Len, E->Pos, min((R0 + RStep * i) * FramesPerMs, MaxDelay), 1);
+
+		E->Line[(E->Pos * 2)] = In[(i * 2)] + (PingPong ? RdR : RdL) * Fb;
+		E->Line[(E->Pos * 2) + 1] = In[(i * 2) + 1] + (PingPong ? RdL : RdR) * Fb;
+		Wet[(i * 2)] = RdL;
+		Wet[(i * 2) + 1] = RdR;
+
+		if (++E->Pos == E->Len)
+			E->Pos = 0;
+	}
+}
+
+// ---- Chain ----
+
+static void FreeFxChain(FxChain *Fx)
+{
+	if (!Fx)
+		return;
+
+	FxReverbFree(&Fx->Reverb);
+	FxChorusFree(&Fx->Chorus);
+	FxEchoFree(&Fx->Echo);
+	free(Fx->Work);
+	free(Fx->Wet);
+	free(Fx);
+}
+
+static FxChain *CreateFxChain(DWORD Freq, DWORD Chans, DWORD SampleSize)
+{
+	FxChain *Fx = (FxChain *)calloc(1, sizeof(FxChain));
+	if (!Fx)
+		return NULL;
+
+	Fx->Freq = Freq;
+	Fx->Chans = Chans;
+	Fx->SampleSize = SampleSize;
+	Fx->Work = (float *)calloc(FX_CHUNK * 2, sizeof(float));
+	Fx->Wet = (float *)calloc(FX_CHUNK * 2, sizeof(float));
+
+	if (!Fx->Work || !Fx->Wet ||
+		!FxReverbInit(&Fx->Reverb, Freq) ||
+		!FxChorusInit(&Fx->Chorus, Freq) ||
+		!FxEchoInit(&Fx->Echo, Freq))
+	{
+		FreeFxChain(Fx);
+		return NULL;
+	}
+
+	return Fx;
+}
+
+// Runs the enabled effects on a block of interleaved stereo float, in the same order the DX8 FX had
+static void ProcessFxChain(FxChain *Fx, float *Buffer, DWORD Frames)
+{
+	LARGE_INTEGER T0, T1;
+	float Coef = 1.0f - expf(-(float)Frames / ((FX_SMOOTH_MS / 1000.0f) * Fx->Freq));
+
+	if (Fx->EchoOn)
+	{
+		QueryPerformanceCounter(&T0);
+		float Mix0 = FxRampStep(&Fx->Echo.Mix, Coef);
+		FxEchoProcess(&Fx->Echo, Buffer, Fx->Wet, Frames, Fx->Freq, Coef);
+		FxMix(Buffer, Fx->Wet, Frames, 1.0f - Mix0, 1.0f - Fx->Echo.Mix.Cur, Mix0, Fx->Echo.Mix.Cur);
+		QueryPerformanceCounter(&T1);
+		FxEchoUs += ((FLOAT)((T1.QuadPart - T0.QuadPart) * 1000000 / FxQPCFreq.QuadPart) - FxEchoUs) * 0.05f;
+	}
+
+	if (Fx->ChorusOn)
+	{
+		QueryPerformanceCounter(&T0);
+		float Mix0 = FxRampStep(&Fx->Chorus.Mix, Coef);
+		FxChorusProcess(&Fx->Chorus, Buffer, Fx->Wet, Frames, Fx->Freq, Coef);
+		FxMix(Buffer, Fx->Wet, Frames, 1.0f - Mix0, 1.0f - Fx->Chorus.Mix.Cur, Mix0, Fx->Chorus.Mix.Cur);
+		QueryPerformanceCounter(&T1);
+		FxChorusUs += ((FLOAT)((T1.QuadPart - T0.QuadPart) * 1000000 / FxQPCFreq.QuadPart) - FxChorusUs) * 0.05f;
+	}
+
+	if (Fx->ReverbOn)
+	{
+		QueryPerformanceCounter(&T0);
+		float Mix0 = FxRampStep(&Fx->Reverb.Mix, Coef);
+		FxReverbProcess(&Fx->Reverb, Buffer, Fx->Wet, Frames, Fx->Freq, Coef);
+		FxMix(Buffer, Fx->Wet, Frames, 1.0f, 1.0f, Mix0, Fx->Reverb.Mix.Cur);
+		QueryPerformanceCounter(&T1);
+		FxReverbUs += ((FLOAT)((T1.QuadPart - T0.QuadPart) * 1000000 / FxQPCFreq.QuadPart) - FxReverbUs) * 0.05f;
+	}
+}
+
+void CALLBACK NativeFxDSPProc(HDSP handle, DWORD channel, void *buffer, DWORD length, void *user)
+{
+	FxChain *Fx = NativeFx;
+
+	if (!Fx)
+		return;
+
+	DWORD Frames = length / (Fx->Chans * Fx->SampleSize);
+
+	// Stereo float can be processed in place
+	if (Fx->Chans == 2 && Fx->SampleSize == sizeof(float))
+	{
+		for (DWORD Done = 0; Done < Frames; Done += FX_CHUNK)
+			ProcessFxChain(Fx, (float *)buffer + (Done * 2), min(Frames - Done, FX_CHUNK));
+
+		return;
+	}
+
+	// Everything else goes through the work buffer
+	for (DWORD Done = 0; Done < Frames; Done += FX_CHUNK)
+	{
+		DWORD Chunk = min(Frames - Done, FX_CHUNK);
+
+		for (DWORD i = 0; i < Chunk; i++)
+		{
+			for (DWORD ch = 0; ch < 2; ch++)
+			{
+				DWORD Src = ((Done + i) * Fx->Chans) + min(ch, Fx->Chans - 1);
+				Fx->Work[(i * 2) + ch] = (Fx->SampleSize == sizeof(float)) ? ((float *)buffer)[Src] : (float)((SHORT *)buffer)[Src] / 32768.0f;
+			}
+		}
+
+		ProcessFxChain(Fx, Fx->Work, Chunk);
+
+		for (DWORD i = 0; i < Chunk; i++)
+		{
+			for (DWORD ch = 0; ch < Fx->Chans; ch++)
+			{
+				DWORD Dst = ((Done + i) * Fx->Chans) + ch;
+				float S = (Fx->Chans == 1) ? (Fx->Work[(i * 2)] + Fx->Work[(i * 2) + 1]) * 0.5f : Fx->Work[(i * 2) + min(ch, 1)];
+
+				if (Fx->SampleSize == sizeof(float))
+					((float *)buffer)[Dst] = S;
+				else
+					((SHORT *)buffer)[Dst] = (SHORT)max(min(S * 32768.0f, 32767.0f), -32768.0f);
+			}
+		}
+	}
+}
+
+static void ReleaseNativeEffects()
+{
+	// The DSP goes away with the stream, only the chain needs to be freed
+	NativeFxDSP = 0;
+	FreeFxChain(NativeFx);
+	NativeFx = NULL;
+}
+
+// Takes the chain off a stream that's staying alive
+static void DetachNativeEffects()
+{
+	if (NativeFxDSP)
+		BASS_ChannelRemoveDSP(OMStream, NativeFxDSP);
+
+	ReleaseNativeEffects();
+}
+
+static BOOL InitializeNativeEffects()
+{
+	BASS_CHANNELINFO ci;
+
+	ReleaseNativeEffects();
+	LoadNativeEffectsSettings();
+
+	if (!NativeEffects || !OMStream || !BASS_ChannelGetInfo(OMStream, &ci))
+		return FALSE;
+
+	if (!(ci.flags & BASS_SAMPLE_FLOAT) && (ci.flags & BASS_SAMPLE_8BITS))
+	{
+		PrintMessageToDebugLog("InitializeNativeEffects", "The built-in effects don't support 8-bit streams, falling back to DX8.");
+		return FALSE;
+	}
+
+	if (!FxQPCFreq.QuadPart)
+		QueryPerformanceFrequency(&FxQPCFreq);
+
+	NativeFx = CreateFxChain(ci.freq, ci.chans, (ci.flags & BASS_SAMPLE_FLOAT) ? sizeof(float) : sizeof(SHORT));
+	if (!NativeFx)
+	{
+		PrintMessageToDebugLog("InitializeNativeEffects", "Unable to allocate the effects' buffers, falling back to DX8.");
+		return FALSE;
+	}
+
+	FxReverbUs = FxChorusUs = FxEchoUs = 0.0f;
+
+	PrintMessageToDebugLog("InitializeNativeEffects", "Built-in effects are ready.");
+	return TRUE;
+}
+
+void UpdateNativeEffects()
+{
+	if (!NativeFx)
+		return;
+
+	// Same conversions the DX8 structs get, the parameters just get smoothed on the audio thread
+	FxReverbSetParameters(&NativeFx->Reverb,
+		((float)ManagedSettings.ReverbInGain / 1000.0f) - 96.0f,
+		((float)ManagedSettings.ReverbMix / 1000.0f) - 96.0f,
+		(float)ManagedSettings.ReverbTime / 1000.0f,
+		(float)ManagedSettings.ReverbHighFreqRTRatio / 1000.0f);
+
+	FxChorusSetParameters(&NativeFx->Chorus,
+		(float)ManagedSettings.ChorusWetDryMix,
+		(float)ManagedSettings.ChorusDepth,
+		(float)ManagedSettings.ChorusFeedback - 100.0f,
+		(float)ManagedSettings.ChorusFrequency / 1000.0f,
+		ManagedSettings.ChorusSineMode,
+		ManagedSettings.ChorusPhase,
+		(float)ManagedSettings.ChorusDelay);
+
+	FxEchoSetParameters(&NativeFx->Echo,
+		(float)ManagedSettings.EchoWetDryMix,
+		(float)ManagedSettings.EchoFeedback,
+		(float)ManagedSettings.EchoLeftDelay,
+		(float)ManagedSettings.EchoRightDelay,
+		ManagedSettings.EchoPanDelay);
+
+	// Effects get reset while they're still off, so that the audio thread never sees stale audio
+	if (ManagedSettings.ReverbOverride && !NativeFx->ReverbOn)
+		FxReverbReset(&NativeFx->Reverb);
+	if (ManagedSettings.ChorusOverride && !NativeFx->ChorusOn)
+		FxChorusReset(&NativeFx->Chorus);
+	if (ManagedSettings.EchoOverride && !NativeFx->EchoOn)
+		FxEchoReset(&NativeFx->Echo);
+
+	MemoryBarrier();
+	NativeFx->ReverbOn = ManagedSettings.ReverbOverride;
+	NativeFx->ChorusOn = ManagedSettings.ChorusOverride;
+	NativeFx->EchoOn = ManagedSettings.EchoOverride;
+
+	BOOL AnyOn = NativeFx->ReverbOn || NativeFx->ChorusOn || NativeFx->EchoOn;
+
+	// Nothing enabled, get off the render path entirely
+	if (AnyOn && !NativeFxDSP)
+	{
+		NativeFxDSP = BASS_ChannelSetDSP(OMStream, NativeFxDSPProc, NULL, 2);
+		CheckUp(FALSE, ERRORCODE, "Native FX DSP Apply", FALSE);
+		PrintMessageToDebugLog("UpdateNativeEffects", "Applied built-in effects to OMStream.");
+	}
+	else if (!AnyOn && NativeFxDSP)
+	{
+		BASS_ChannelRemoveDSP(OMStream, NativeFxDSP);
+		CheckUp(FALSE, ERRORCODE, "Native FX DSP Remove", FALSE);
+		NativeFxDSP = 0;
+		PrintMessageToDebugLog("UpdateNativeEffects", "Removed built-in effects from OMStream.");
+	}
+}
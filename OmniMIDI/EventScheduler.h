@@ -0,0 +1,449 @@
+/*
+OmniMIDI event scheduler
+Lets KDMAPI clients submit events ahead of time, to be released sample-accurately into the render block.
+The note-offs generated by OverrideNoteLength and DelayNoteOff are held in a timer wheel, and released the same way.
+*/
+#pragma once
+
+#define SCHEDULER_MAX_EVENTS 65536	// Fixed capacity, no allocations on the audio thread
+#define SCHEDULER_DEFAULT_LOOKAHEAD 10	// Minimum lookahead (ms) for engines that don't expose their block size
+#define NOTETIMER_MIN_CAPACITY 4096	// Pending note-offs, allocated the first time one is needed (MaxVoices * 2 if bigger)
+#define NOTETIMER_CAPACITY (1 << 20)	// The wheel doubles when it's full, up to this
+#define SCHEDULER_BATCH 64				// Events handed to BASSMIDI with a single call
+
+typedef struct SchedEntry
+{
+	QWORD Frame;	// Render clock position, in sample frames
+	QWORD Seq;		// Submission order, keeps events with the same timestamp in FIFO order
+	DWORD Event;	// Short MIDI message
+};
+
+struct SchedEntryLater
+{
+	bool operator()(const SchedEntry& a, const SchedEntry& b) const
+	{
+		return (a.Frame != b.Frame) ? (a.Frame > b.Frame) : (a.Seq > b.Seq);
+	}
+};
+
+// The schedule is a min-heap ordered by render position
+static SchedEntry SchedulerHeap[SCHEDULER_MAX_EVENTS];
+static volatile DWORD SchedulerCount = 0;
+static QWORD SchedulerSeq = 0;
+static LockSystem SchedulerLock = { 0, 0 };
+
+// Format of the current stream, refreshed every time it gets recreated
+static DWORD SchedulerFrameBytes = 0;
+static DWORD SchedulerFreq = 0;
+
+// Render clock <-> QPC mapping, disciplined by the audio thread
+static LARGE_INTEGER SchedulerQPCFreq = { 0 };
+static volatile QWORD ClockAnchorFrame = 0;
+static volatile LONGLONG ClockAnchorQPC = 0;
+
+// Stats, printed to the debug pipe
+static volatile QWORD SchedulerReleased = 0;	// Events released into the stream
+static volatile QWORD SchedulerLate = 0;		// Events released after their timestamp had already passed
+static volatile QWORD SchedulerMaxLate = 0;		// Worst lateness, in sample frames
+static volatile QWORD SchedulerDropped = 0;		// Events refused because the schedule was full
+
+// Note-offs generated by the driver itself, one group per port/channel pair
+static TimerWheel NoteTimers;
+static LockSystem NoteTimersLock = { 0, 0 };
+static BOOL NoteTimersFailed = FALSE;
+static DWORD NoteTimerHandles[VB_CHANNELS][128];	// Last note-off queued for each key, TW_NIL if none
+
+// Stats, printed to the debug pipe
+static volatile QWORD NoteTimersReleased = 0;	// Note-offs released into the stream
+static volatile DWORD NoteTimersPeak = 0;		// Most note-offs pending at once
+static volatile QWORD NoteTimersOverflow = 0;	// Note-offs that didn't fit, and went through BASSMIDI's own queue
+
+QWORD __inline GetRenderPosition() {
+	if (!OMStream || !SchedulerFrameBytes)
+		return 0;
+
+	QWORD Bytes = BASS_ChannelGetPosition(OMStream, BASS_POS_BYTE | BASS_POS_DECODE);
+	if (Bytes == (QWORD)-1)
+		return 0;
+
+	return Bytes / SchedulerFrameBytes;
+}
+
+void ResetNoteTimers() {
+	LockForWriting(&NoteTimersLock);
+	if (NoteTimers.IsReady())
+		NoteTimers.Reset(GetRenderPosition());
+	memset(NoteTimerHandles, 0xFF, sizeof(NoteTimerHandles));
+	UnlockForWriting(&NoteTimersLock);
+}
+
+void FlushEventScheduler() {
+	LockForWriting(&SchedulerLock);
+	SchedulerCount = 0;
+	UnlockForWriting(&SchedulerLock);
+
+	ResetNoteTimers();
+}
+
+// Queues a note-off for the key of dwParam1, Bytes into the stream from now.
+// Returns FALSE if it can't be queued, and has to go through BMSEsFlags instead.
+BOOL QueueNoteOff(DWORD dwParam1, DWORD Bytes) {
+	if (!SchedulerFrameBytes || NoteTimersFailed)
+		return FALSE;
+
+	QWORD Frame = GetRenderPosition() + Bytes / SchedulerFrameBytes;
+	DWORD Chan = GETPORTCHANNEL(dwParam1);
+	BOOL Queued;
+
+	DWORD Key = (dwParam1 >> 8) & 0x7F;
+	DWORD Handle, Capacity = ManagedSettings.MaxVoices * 2;
+
+	if (Capacity < NOTETIMER_MIN_CAPACITY) Capacity = NOTETIMER_MIN_CAPACITY;
+	else if (Capacity > NOTETIMER_CAPACITY) Capacity = NOTETIMER_CAPACITY;
+
+	LockForWriting(&NoteTimersLock);
+
+	if (!NoteTimers.IsReady()) {
+		if (!NoteTimers.Init(Capacity, VB_CHANNELS)) {
+			NoteTimersFailed = TRUE;
+			UnlockForWriting(&NoteTimersLock);
+			PrintMessageToDebugLog("QueueNoteOff", "Couldn't allocate the note-off timers, BASSMIDI will queue them instead.");
+			return FALSE;
+		}
+
+		NoteTimers.Reset(GetRenderPosition());
+		memset(NoteTimerHandles, 0xFF, sizeof(NoteTimerHandles));
+	}
+
+	Handle = NoteTimers.Add(Frame, (Chan << 8) | Key, (WORD)Chan);
+
+	// Full, make it bigger instead of giving up on sample accuracy
+	if (Handle == TW_NIL && NoteTimers.Size() < NOTETIMER_CAPACITY && NoteTimers.Grow(min(NoteTimers.Size() * 2, (DWORD)NOTETIMER_CAPACITY)))
+		Handle = NoteTimers.Add(Frame, (Chan << 8) | Key, (WORD)Chan);
+
+	Queued = Handle != TW_NIL;
+	if (Queued)
+		NoteTimerHandles[Chan][Key] = Handle;
+
+	if (NoteTimers.Pending() > NoteTimersPeak)
+		NoteTimersPeak = NoteTimers.Pending();
+
+	UnlockForWriting(&NoteTimersLock);
+
+	if (!Queued)
+		NoteTimersOverflow++;
+
+	return Queued;
+}
+
+// The key is being played again, the note-off still pending for it would cut the new note short.
+// The old note gets released right away instead, before the new note-on goes out.
+void CancelNoteTimer(DWORD dwParam1) {
+	DWORD Chan = GETPORTCHANNEL(dwParam1), Key = (dwParam1 >> 8) & 0x7F;
+	BOOL Cancelled = FALSE;
+
+	if (!NoteTimers.IsReady())
+		return;
+
+	LockForWriting(&NoteTimersLock);
+	if (NoteTimerHandles[Chan][Key] != TW_NIL) {
+		Cancelled = NoteTimers.Cancel(NoteTimerHandles[Chan][Key], (Chan << 8) | Key);
+		NoteTimerHandles[Chan][Key] = TW_NIL;
+	}
+	UnlockForWriting(&NoteTimersLock);
+
+	if (Cancelled)
+		SendToBASSMIDI(SETPORT(MIDI_NOTEOFF | (Chan & 0xF) | (Key << 8), Chan >> 4));
+}
+
+// All notes/sound off, the pending note-offs of the channel would only cut the notes that come after it
+void CancelNoteTimers(DWORD Chan) {
+	if (!NoteTimers.IsReady())
+		return;
+
+	LockForWriting(&NoteTimersLock);
+	NoteTimers.CancelGroup((WORD)Chan);
+	memset(NoteTimerHandles[Chan], 0xFF, sizeof(NoteTimerHandles[Chan]));
+	UnlockForWriting(&NoteTimersLock);
+}
+
+// Called by the audio thread, same rules as the scheduled events
+void __inline ReleaseNoteTimers(QWORD Now, QWORD Horizon) {
+	BASS_MIDI_EVENT Evs[64];
+	DWORD EvsCount = 0;
+
+	if (!NoteTimers.IsReady())
+		return;
+
+	// Even when it's empty, so that the wheel's clock keeps up and the next note-off doesn't have to walk to it frame by frame
+	LockForWriting(&NoteTimersLock);
+
+	NoteTimers.Expire(Horizon, [&](QWORD Frame, DWORD Data) {
+		BYTE Chan = (BYTE)(Data >> 8), Key = (BYTE)Data;
+
+		NoteTimersReleased++;
+
+		if (Frame <= Now || (Frame * SchedulerFrameBytes) > MAXDWORD) {
+			if (EvsCount) {
+				_BMSEs(OMStream, BASS_MIDI_EVENTS_STRUCT | BASS_MIDI_EVENTS_ABSTIME, Evs, EvsCount);
+				EvsCount = 0;
+			}
+
+			SendToBASSMIDI(SETPORT(MIDI_NOTEOFF | (Chan & 0xF) | (Key << 8), Chan >> 4));
+			return;
+		}
+
+		if (VoiceBudgetOn)
+			VoiceBudgetNote(Chan, Key, 0);
+
+		Evs[EvsCount++] = { MIDI_EVENT_NOTE, Key, Chan, 0, (DWORD)(Frame * SchedulerFrameBytes) };
+
+		if (EvsCount == _countof(Evs)) {
+			_BMSEs(OMStream, BASS_MIDI_EVENTS_STRUCT | BASS_MIDI_EVENTS_ABSTIME, Evs, EvsCount);
+			EvsCount = 0;
+		}
+	});
+
+	UnlockForWriting(&NoteTimersLock);
+
+	if (EvsCount)
+		_BMSEs(OMStream, BASS_MIDI_EVENTS_STRUCT | BASS_MIDI_EVENTS_ABSTIME, Evs, EvsCount);
+}
+
+void ResetEventScheduler() {
+	BASS_CHANNELINFO ci;
+
+	// Timestamps from the old stream are meaningless now
+	FlushEventScheduler();
+
+	SchedulerFrameBytes = 0;
+	SchedulerFreq = 0;
+
+	if (!SchedulerQPCFreq.QuadPart)
+		QueryPerformanceFrequency(&SchedulerQPCFreq);
+
+	if (OMStream && BASS_ChannelGetInfo(OMStream, &ci)) {
+		DWORD SampleSize = (ci.flags & BASS_SAMPLE_FLOAT) ? sizeof(float) : ((ci.flags & BASS_SAMPLE_8BITS) ? sizeof(BYTE) : sizeof(SHORT));
+		SchedulerFrameBytes = SampleSize * ci.chans;
+		SchedulerFreq = ci.freq;
+	}
+
+	LARGE_INTEGER Now;
+	QueryPerformanceCounter(&Now);
+	ClockAnchorFrame = GetRenderPosition();
+	ClockAnchorQPC = Now.QuadPart;
+
+	// Restart the wheel from the position of the new stream
+	ResetNoteTimers();
+
+	SchedulerReleased = SchedulerLate = SchedulerMaxLate = SchedulerDropped = 0;
+	NoteTimersReleased = NoteTimersOverflow = NoteTimersPeak = 0;
+
+	PrintMessageToDebugLog("ResetEventScheduler", "Event scheduler is ready.");
+}
+
+// Keeps the QPC -> render clock mapping stable, since the render position advances in bursts
+void __inline DisciplineRenderClock(QWORD Frame) {
+	LARGE_INTEGER Now;
+
+	if (!SchedulerFreq || !SchedulerQPCFreq.QuadPart)
+		return;
+
+	QueryPerformanceCounter(&Now);
+
+	LONGLONG Elapsed = Now.QuadPart - ClockAnchorQPC;
+	LONGLONG Predicted = (LONGLONG)ClockAnchorFrame + (LONGLONG)((DOUBLE)Elapsed * SchedulerFreq / SchedulerQPCFreq.QuadPart);
+	LONGLONG Error = (LONGLONG)Frame - Predicted;
+
+	// Anything bigger than ~100ms is a discontinuity (stream restart, stall...), so just snap to it
+	if (Error > (LONGLONG)(SchedulerFreq / 10) || Error < -(LONGLONG)(SchedulerFreq / 10)) {
+		ClockAnchorFrame = Frame;
+		ClockAnchorQPC = Now.QuadPart;
+		return;
+	}
+
+	ClockAnchorFrame = Predicted + (Error / 16);
+	ClockAnchorQPC = Now.QuadPart;
+}
+
+QWORD __inline QPCToRenderFrame(LONGLONG QPCTime) {
+	if (!SchedulerFreq || !SchedulerQPCFreq.QuadPart)
+		return 0;
+
+	LONGLONG Frame = (LONGLONG)ClockAnchorFrame + (LONGLONG)((DOUBLE)(QPCTime - ClockAnchorQPC) * SchedulerFreq / SchedulerQPCFreq.QuadPart);
+	return (Frame < 0) ? 0 : (QWORD)Frame;
+}
+
+BOOL __inline ShortMsgToBASSEvent(DWORD dwParam1, BASS_MIDI_EVENT* Ev) {
+	BYTE param1 = GETFP(dwParam1);
+	BYTE param2 = GETSP(dwParam1);
+
+	Ev->chan = GETCHANNEL(dwParam1);
+	Ev->tick = 0;
+
+	switch (GETCMD(dwParam1)) {
+	case MIDI_NOTEOFF:
+		Ev->event = MIDI_EVENT_NOTE;
+		Ev->param = param1;
+		return TRUE;
+	case MIDI_NOTEON:
+		Ev->event = MIDI_EVENT_NOTE;
+		Ev->param = param2 << 8 | param1;
+		return TRUE;
+	case MIDI_POLYAFTER:
+		Ev->event = MIDI_EVENT_KEYPRES;
+		Ev->param = param2 << 8 | param1;
+		return TRUE;
+	case MIDI_CMC:
+		Ev->event = MIDI_EVENT_CONTROL;
+		Ev->param = param2 << 8 | param1;
+		return TRUE;
+	case MIDI_PROGCHAN:
+		Ev->event = MIDI_EVENT_PROGRAM;
+		Ev->param = param1;
+		return TRUE;
+	case MIDI_CHANAFTER:
+		Ev->event = MIDI_EVENT_CHANPRES;
+		Ev->param = param1;
+		return TRUE;
+	case MIDI_PITCHWHEEL:
+		Ev->event = MIDI_EVENT_PITCH;
+		Ev->param = param2 << 7 | param1;
+		return TRUE;
+	default:
+		// System messages have no struct counterpart, they get applied as soon as they're due
+		return FALSE;
+	}
+}
+
+BOOL ScheduleEvent(DWORD dwParam1, QWORD Frame) {
+	// No local stream to schedule against (e.g. the synth host is in use)
+	if (!SchedulerFrameBytes)
+		return FALSE;
+
+	// Scheduled events can't rely on running status, since they might be reordered
+	if (!CHKLRS(GETSTATUS(dwParam1)))
+		return FALSE;
+
+	// Filtered out by the user's settings, nothing to schedule
+	if (CheckIfEventIsToIgnore(dwParam1))
+		return TRUE;
+
+	if (ManagedSettings.FullVelocityMode || ManagedSettings.TransposeValue != 0x7F)
+		dwParam1 = ReturnEditedEvent(dwParam1);
+
+	// Scheduled events always go to port 0
+	dwParam1 = STRIPPORT(dwParam1);
+
+	LockForWriting(&SchedulerLock);
+
+	if (SchedulerCount >= SCHEDULER_MAX_EVENTS) {
+		UnlockForWriting(&SchedulerLock);
+		InterlockedIncrement64((volatile LONG64*)&SchedulerDropped);
+		return FALSE;
+	}
+
+	SchedulerHeap[SchedulerCount] = { Frame, SchedulerSeq++, dwParam1 };
+	SchedulerCount++;
+	std::push_heap(SchedulerHeap, SchedulerHeap + SchedulerCount, SchedEntryLater());
+
+	UnlockForWriting(&SchedulerLock);
+	return TRUE;
+}
+
+void __inline FlushBlockEvents(BASS_MIDI_EVENT* Evs, DWORD& EvsCount) {
+	if (EvsCount) {
+		_BMSEs(OMStream, BASS_MIDI_EVENTS_STRUCT | BASS_MIDI_EVENTS_ABSTIME, Evs, EvsCount);
+		EvsCount = 0;
+	}
+}
+
+// Hands an event to BASSMIDI with its absolute position, batching it in Evs (SCHEDULER_BATCH entries)
+void __inline PutBlockEvent(DWORD Event, QWORD Now, QWORD Frame, BASS_MIDI_EVENT* Evs, DWORD& EvsCount) {
+	// BASSMIDI takes 32-bit byte positions, past that point we can only be block-accurate
+	if (Frame <= Now || (Frame * SchedulerFrameBytes) > MAXDWORD || !ShortMsgToBASSEvent(Event, &Evs[EvsCount])) {
+		// Keep the order intact, flush what's pending before applying it
+		FlushBlockEvents(Evs, EvsCount);
+		SendToBASSMIDI(Event);
+		return;
+	}
+
+	MirrorSynthEvent(GETCHANNEL(Event), GETCMD(Event), GETFP(Event), GETSP(Event));
+
+	// Same bookkeeping as SendToBASSMIDI, or the note-offs placed here would never match their note-ons
+	if (VoiceBudgetOn)
+		VoiceBudgetEvent(GETCHANNEL(Event), GETCMD(Event), GETFP(Event), GETSP(Event));
+
+	Evs[EvsCount++].pos = (DWORD)(Frame * SchedulerFrameBytes);
+
+	if (EvsCount == SCHEDULER_BATCH)
+		FlushBlockEvents(Evs, EvsCount);
+}
+
+// MIDIPlayer.h
+void ReleasePlayerEvents(QWORD Now, QWORD Horizon);
+
+// Called by the audio thread right before a block gets rendered.
+// Every event due before the end of the block is handed to BASSMIDI with its absolute position,
+// so that it starts on the exact sample instead of at the beginning of the next block.
+void __inline ReleaseScheduledEvents(DWORD BlockFrames) {
+	BASS_MIDI_EVENT Evs[SCHEDULER_BATCH];
+	DWORD EvsCount = 0;
+
+	QWORD Now = GetRenderPosition();
+	QWORD Horizon = Now + BlockFrames;
+	DisciplineRenderClock(Now);
+
+	ReleaseNoteTimers(Now, Horizon);
+	ReleasePlayerEvents(Now, Horizon);
+
+	if (!SchedulerCount)
+		return;
+
+	// Anything the app scheduled would end up in a recording of the song
+	PlayerCacheInput();
+
+	SchedEntry Due[SCHEDULER_BATCH];
+	DWORD DueCount;
+
+	// The due entries are popped a batch at a time, so that the app never waits on BASSMIDI to schedule more
+	do {
+		DueCount = 0;
+
+		LockForWriting(&SchedulerLock);
+
+		while (DueCount < SCHEDULER_BATCH && SchedulerCount && SchedulerHeap[0].Frame < Horizon) {
+			Due[DueCount++] = SchedulerHeap[0];
+			std::pop_heap(SchedulerHeap, SchedulerHeap + SchedulerCount, SchedEntryLater());
+			SchedulerCount--;
+		}
+
+		UnlockForWriting(&SchedulerLock);
+
+		for (DWORD i = 0; i < DueCount; i++) {
+			_FeedbackShortMsg(Due[i].Event);
+			SchedulerReleased++;
+
+			if (Due[i].Frame < Now) {
+				QWORD Lateness = Now - Due[i].Frame;
+				SchedulerLate++;
+				if (Lateness > SchedulerMaxLate) SchedulerMaxLate = Lateness;
+			}
+
+			PutBlockEvent(Due[i].Event, Now, Due[i].Frame, Evs, EvsCount);
+		}
+	} while (DueCount == SCHEDULER_BATCH);
+
+	FlushBlockEvents(Evs, EvsCount);
+}
+
+// BASS_ChannelUpdate renders up to ChannelUpdateLength at once (up to the whole buffer if it's 0),
+// so the events have to be released at least that far ahead
+DWORD __inline SchedulerLookaheadFrames() {
+	DWORD Ms = ManagedSettings.ChannelUpdateLength ? ManagedSettings.ChannelUpdateLength : BASS_GetConfig(BASS_CONFIG_BUFFER);
+
+	if (Ms == (DWORD)-1 || Ms < SCHEDULER_DEFAULT_LOOKAHEAD)
+		Ms = SCHEDULER_DEFAULT_LOOKAHEAD;
+
+	return (SchedulerFreq * Ms) / 1000;
+}
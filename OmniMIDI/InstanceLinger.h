@@ -0,0 +1,134 @@
+/*
+OmniMIDI instance linger
+Apps that close and reopen the device on every scene change or song load would otherwise pay
+for a full BASS, stream and SoundFonts setup each time.
+After the last close, the engine is kept alive for a while, silent and with its threads parked.
+A reopen within that window only resets the synth, and everything is freed once it expires.
+Only WinMM clients get it: KDMAPI apps can unload the DLL right after TerminateKDMAPIStream,
+while WinMM always sends DRV_FREE first, which frees the parked engine.
+*/
+#pragma once
+
+#define LINGER_DEFAULT_MS 3000
+
+// LingerState values
+#define LINGER_NONE		0	// The driver is either open or completely closed
+#define LINGER_PARKED	1	// Closed by the app, waiting for a reopen
+#define LINGER_EXPIRING	2	// Too late, the health thread is freeing everything
+#define LINGER_PARKING	3	// Being parked, the health thread mustn't bring the threads or the output back
+
+static volatile LONG LingerState = LINGER_NONE;
+static ULONGLONG LingerDeadline = 0;
+
+static BOOL CanLinger()
+{
+	// Events would keep going to the synth host, there's nothing local to keep
+	if (SynthHostClient)
+		return FALSE;
+
+	// Nothing tells us before the app calls FreeLibrary, the health thread and BASS would outlive the DLL
+	if (AlreadyInitializedViaKDMAPI)
+		return FALSE;
+
+	switch (ManagedSettings.CurrentEngine)
+	{
+	// Exclusive devices would stay locked for the other apps, and the .WAV mode has to close its file
+	case AUDTOWAV:
+	case ASIO_ENGINE:
+		return FALSE;
+	case WASAPI_ENGINE:
+		return !ManagedSettings.WASAPIExclusive;
+	default:
+		return TRUE;
+	}
+}
+
+// Called by DoStopClient, returns FALSE if the driver has to be stopped for real
+BOOL StartLinger()
+{
+	DWORD LingerMs = SynthHost_ReadSetting(L"LingerMs", LINGER_DEFAULT_MS);
+
+	// Don't bother if the engine isn't even done initializing
+	if (!LingerMs || !CanLinger() || stop_svthread || EarlyQueueActive || !OMStream)
+		return FALSE;
+
+	// Published before anything gets torn down, so that the health thread leaves it alone
+	if (InterlockedCompareExchange(&LingerState, LINGER_PARKING, LINGER_NONE) != LINGER_NONE)
+		return FALSE;
+
+	PrintMessageToDebugLog("StopDriver", "Parking the engine, in case the app opens the driver again...");
+
+	// Silence everything, and stop the threads feeding the output
+	ResetSynth(FALSE, FALSE);
+	ResetSynth(TRUE, TRUE);
+	CloseThreads();
+
+	switch (ManagedSettings.CurrentEngine)
+	{
+	case BASS_OUTPUT:
+		BASS_ChannelPause(OMStream);
+		break;
+	case WASAPI_ENGINE:
+		BASS_WASAPI_Stop(FALSE);
+		break;
+	}
+
+	LingerDeadline = GetTickCount64() + LingerMs;
+	InterlockedExchange(&LingerState, LINGER_PARKED);
+
+	PrintVarToDebugLog("StopDriver", "Engine parked for (ms)", &LingerMs, PRINT_UINT32);
+	return TRUE;
+}
+
+// Called by DoStartClient, returns FALSE if there was nothing to reuse
+BOOL ResumeLinger()
+{
+	if (InterlockedCompareExchange(&LingerState, LINGER_NONE, LINGER_PARKED) != LINGER_PARKED)
+		return FALSE;
+
+	PrintMessageToDebugLog("StartDriver", "Reusing the parked engine...");
+
+	// Start from a clean state, as if the driver had been opened for the first time
+	ResetSynth(TRUE, TRUE);
+	CreateThreads();
+
+	switch (ManagedSettings.CurrentEngine)
+	{
+	case BASS_OUTPUT:
+		BASS_ChannelPlay(OMStream, FALSE);
+		break;
+	case WASAPI_ENGINE:
+		BASS_WASAPI_Start();
+		break;
+	}
+
+	WarmReopens++;
+	return TRUE;
+}
+
+// Called by the health thread, returns TRUE once the engine has to be freed
+BOOL LingerExpired()
+{
+	if (LingerState != LINGER_PARKED || GetTickCount64() < LingerDeadline)
+		return FALSE;
+
+	if (InterlockedCompareExchange(&LingerState, LINGER_EXPIRING, LINGER_PARKED) != LINGER_PARKED)
+		return FALSE;
+
+	PrintMessageToDebugLog("StreamWatchdog", "Nobody reopened the driver, freeing the parked engine...");
+	return TRUE;
+}
+
+// Called on DRV_FREE, WinMM is about to unload the driver, so the parked engine has to go right now
+void StopLinger()
+{
+	if (InterlockedCompareExchange(&LingerState, LINGER_EXPIRING, LINGER_PARKED) != LINGER_PARKED)
+		return;
+
+	PrintMessageToDebugLog("StopDriver", "The driver is being unloaded, freeing the parked engine...");
+
+	stop_svthread = TRUE;
+	if (OMReady && WaitForSingleObject(OMReady, INFINITE) == WAIT_OBJECT_0)
+		ResetEvent(OMReady);
+	stop_svthread = FALSE;
+}
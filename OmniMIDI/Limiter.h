@@ -0,0 +1,383 @@
+/*
+OmniMIDI built-in limiter
+Lookahead brickwall limiter, applied as a DSP on the main stream in place of the LoudMax VST
+*/
+#pragma once
+
+#if defined(_M_AMD64) || defined(_M_IX86)
+#include <emmintrin.h>
+#define LIMITER_SSE
+#endif
+
+#define LIMITER_OFF 0
+#define LIMITER_BUILTIN 1
+#define LIMITER_LOUDMAX 2
+
+#define LIMITER_CHUNK 256				// Frames processed per pass, the work buffers are sized around it
+#define LIMITER_MAX_LOOKAHEAD 20		// ms
+#define LIMITER_MAX_RELEASE 5000		// ms
+
+// Settings, see LoadLimiterSettings
+static DWORD LimiterMode = LIMITER_LOUDMAX;	// Keep the old behavior (LoudMax if present) until told otherwise
+static DWORD LimiterCeiling = 100;			// Hundredths of dB below full scale
+static DWORD LimiterRelease = 100;			// ms
+static DWORD LimiterLookahead = 5;			// ms
+
+typedef struct LimiterState
+{
+	DWORD Chans;
+	DWORD SampleSize;			// sizeof(float) or sizeof(SHORT), 8-bit streams are left alone
+	DWORD Look;					// Lookahead, in frames
+	DWORD Window;				// Look + 1, the gain has to cover every frame still sitting in the delay line
+	FLOAT Ceiling;				// Linear
+	FLOAT ReleaseCoef;
+
+	float *Work;				// [Look frames of history | LIMITER_CHUNK frames of new audio]
+	float *Scratch;				// Integer streams get converted here
+	float Peak[LIMITER_CHUNK];
+	float Gain[LIMITER_CHUNK];
+
+	// Sliding window minimum of the required gain (monotonic queue)
+	float *QVal;
+	QWORD *QIdx;
+	DWORD QHead, QCount;
+	QWORD Frame;
+
+	// Release envelope and moving average over the window
+	float Env;
+	float *Box;
+	DWORD BoxPos;
+	DOUBLE BoxSum;
+} LimiterState;
+
+static LimiterState *Limiter = NULL;
+static HDSP LimiterDSP = 0;
+static DWORD LimiterVST = 0;
+
+// Stats, printed to the debug pipe
+static volatile FLOAT LimiterReduction = 0.0f;		// Deepest gain reduction of the last block, in dB
+static volatile FLOAT LimiterBlockUs = 0.0f;		// Processing time per block, averaged
+static volatile DWORD LimiterBlockMaxUs = 0;
+static LARGE_INTEGER LimiterQPCFreq = { 0 };
+
+static void LoadLimiterSettings()
+{
+	HKEY hKey;
+
+	if (RegOpenKeyExW(HKEY_CURRENT_USER, L"Software\\OmniMIDI\\Configuration", 0, KEY_READ, &hKey) == ERROR_SUCCESS)
+	{
+		DWORD dwType = REG_DWORD;
+		DWORD dwSize = sizeof(DWORD);
+		RegQueryValueExW(hKey, L"LimiterMode", NULL, &dwType, (LPBYTE)&LimiterMode, &dwSize);
+		RegQueryValueExW(hKey, L"LimiterCeiling", NULL, &dwType, (LPBYTE)&LimiterCeiling, &dwSize);
+		RegQueryValueExW(hKey, L"LimiterRelease", NULL, &dwType, (LPBYTE)&LimiterRelease, &dwSize);
+		RegQueryValueExW(hKey, L"LimiterLookahead", NULL, &dwType, (LPBYTE)&LimiterLookahead, &dwSize);
+		RegCloseKey(hKey);
+	}
+
+	// Clamp to sane ranges
+	if (LimiterMode > LIMITER_LOUDMAX)
+		LimiterMode = LIMITER_BUILTIN;
+	if (LimiterCeiling > 2400)
+		LimiterCeiling = 2400;
+	if (LimiterRelease < 1)
+		LimiterRelease = 1;
+	if (LimiterRelease > LIMITER_MAX_RELEASE)
+		LimiterRelease = LIMITER_MAX_RELEASE;
+	if (LimiterLookahead < 1)
+		LimiterLookahead = 1;
+	if (LimiterLookahead > LIMITER_MAX_LOOKAHEAD)
+		LimiterLookahead = LIMITER_MAX_LOOKAHEAD;
+}
+
+static void FreeLimiter()
+{
+	if (!Limiter)
+		return;
+
+	free(Limiter->Work);
+	free(Limiter->Scratch);
+	free(Limiter->QVal);
+	free(Limiter->QIdx);
+	free(Limiter->Box);
+	free(Limiter);
+	Limiter = NULL;
+}
+
+static LimiterState *AllocateLimiter(DWORD Freq, DWORD Chans, DWORD SampleSize)
+{
+	LimiterState *L = (LimiterState *)calloc(1, sizeof(LimiterState));
+	if (!L)
+		return NULL;
+
+	L->Chans = Chans;
+	L->SampleSize = SampleSize;
+	L->Look = max((Freq * LimiterLookahead) / 1000, 1);
+	L->Window = L->Look + 1;
+	L->Ceiling = powf(10.0f, -((float)LimiterCeiling / 100.0f) / 20.0f);
+	L->ReleaseCoef = expf(-1000.0f / ((float)LimiterRelease * (float)Freq));
+	L->Env = 1.0f;
+
+	L->Work = (float *)calloc((L->Look + LIMITER_CHUNK) * Chans, sizeof(float));
+	L->Scratch = (float *)calloc(LIMITER_CHUNK * Chans, sizeof(float));
+	L->QVal = (float *)calloc(L->Window, sizeof(float));
+	L->QIdx = (QWORD *)calloc(L->Window, sizeof(QWORD));
+	L->Box = (float *)calloc(L->Window, sizeof(float));
+
+	if (!L->Work || !L->Scratch || !L->QVal || !L->QIdx || !L->Box)
+	{
+		free(L->Work);
+		free(L->Scratch);
+		free(L->QVal);
+		free(L->QIdx);
+		free(L->Box);
+		free(L);
+		return NULL;
+	}
+
+	// The average starts at unity gain
+	for (DWORD i = 0; i < L->Window; i++)
+		L->Box[i] = 1.0f;
+	L->BoxSum = (DOUBLE)L->Window;
+
+	return L;
+}
+
+// Absolute peak of every frame, linked across channels
+static void __inline LimiterPeaks(LimiterState *L, const float *In, DWORD Frames)
+{
+	DWORD i = 0;
+
+#ifdef LIMITER_SSE
+	if (L->Chans == 2)
+	{
+		const __m128 AbsMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+
+		for (; i + 4 <= Frames; i += 4)
+		{
+			__m128 A = _mm_and_ps(_mm_loadu_ps(In + (i * 2)), AbsMask);		// L0 R0 L1 R1
+			__m128 B = _mm_and_ps(_mm_loadu_ps(In + (i * 2) + 4), AbsMask);	// L2 R2 L3 R3
+			A = _mm_max_ps(A, _mm_shuffle_ps(A, A, _MM_SHUFFLE(2, 3, 0, 1)));
+			B = _mm_max_ps(B, _mm_shuffle_ps(B, B, _MM_SHUFFLE(2, 3, 0, 1)));
+			_mm_storeu_ps(L->Peak + i, _mm_shuffle_ps(A, B, _MM_SHUFFLE(2, 0, 2, 0)));
+		}
+	}
+#endif
+
+	for (; i < Frames; i++)
+	{
+		float Peak = 0.0f;
+		for (DWORD c = 0; c < L->Chans; c++)
+			Peak = max(Peak, fabsf(In[(i * L->Chans) + c]));
+		L->Peak[i] = Peak;
+	}
+}
+
+// Gain for every frame leaving the delay line.
+// The required gain goes through a minimum over the window, an instant attack/exponential release envelope,
+// then a moving average over the same window. Every stage can only lower the gain of the frames it covers,
+// so the average is never above what the frame leaving the delay line needs, hence no overshoot.
+static FLOAT __inline LimiterGains(LimiterState *L, DWORD Frames)
+{
+	FLOAT MinGain = 1.0f;
+
+	for (DWORD i = 0; i < Frames; i++)
+	{
+		float Required = (L->Peak[i] > L->Ceiling) ? (L->Ceiling / L->Peak[i]) : 1.0f;
+		QWORD Now = L->Frame++;
+
+		// Drop what fell out of the window, then what can't be the minimum anymore
+		if (L->QCount && L->QIdx[L->QHead] + L->Window <= Now)
+		{
+			L->QHead = (L->QHead + 1) % L->Window;
+			L->QCount--;
+		}
+
+		while (L->QCount && L->QVal[(L->QHead + L->QCount - 1) % L->Window] >= Required)
+			L->QCount--;
+
+		DWORD Tail = (L->QHead + L->QCount) % L->Window;
+		L->QVal[Tail] = Required;
+		L->QIdx[Tail] = Now;
+		L->QCount++;
+
+		float Hold = L->QVal[L->QHead];
+		L->Env = (Hold < L->Env) ? Hold : (Hold + (L->Env - Hold) * L->ReleaseCoef);
+
+		L->BoxSum += L->Env - L->Box[L->BoxPos];
+		L->Box[L->BoxPos] = L->Env;
+		L->BoxPos = (L->BoxPos + 1) % L->Window;
+
+		L->Gain[i] = (float)(L->BoxSum / L->Window);
+		if (L->Gain[i] < MinGain)
+			MinGain = L->Gain[i];
+	}
+
+	return MinGain;
+}
+
+// Applies the gains to the delayed audio, clamped to the ceiling to absorb rounding in the average
+static void __inline LimiterApply(LimiterState *L, float *Out, DWORD Frames)
+{
+	const float *Delayed = L->Work;
+	DWORD i = 0;
+
+#ifdef LIMITER_SSE
+	if (L->Chans == 2)
+	{
+		const __m128 Hi = _mm_set1_ps(L->Ceiling);
+		const __m128 Lo = _mm_set1_ps(-L->Ceiling);
+
+		for (; i + 4 <= Frames; i += 4)
+		{
+			__m128 G = _mm_loadu_ps(L->Gain + i);
+			__m128 A = _mm_mul_ps(_mm_loadu_ps(Delayed + (i * 2)), _mm_unpacklo_ps(G, G));
+			__m128 B = _mm_mul_ps(_mm_loadu_ps(Delayed + (i * 2) + 4), _mm_unpackhi_ps(G, G));
+			_mm_storeu_ps(Out + (i * 2), _mm_max_ps(_mm_min_ps(A, Hi), Lo));
+			_mm_storeu_ps(Out + (i * 2) + 4, _mm_max_ps(_mm_min_ps(B, Hi), Lo));
+		}
+	}
+#endif
+
+	for (; i < Frames; i++)
+	{
+		for (DWORD c = 0; c < L->Chans; c++)
+		{
+			float S = Delayed[(i * L->Chans) + c] * L->Gain[i];
+			Out[(i * L->Chans) + c] = max(min(S, L->Ceiling), -L->Ceiling);
+		}
+	}
+}
+
+static FLOAT LimiterProcessChunk(LimiterState *L, float *Buffer, DWORD Frames)
+{
+	DWORD LookSamples = L->Look * L->Chans;
+
+	// Append the new audio to the history, then the head of the work buffer is what comes out
+	memcpy(L->Work + LookSamples, Buffer, Frames * L->Chans * sizeof(float));
+
+	LimiterPeaks(L, Buffer, Frames);
+	FLOAT MinGain = LimiterGains(L, Frames);
+	LimiterApply(L, Buffer, Frames);
+
+	memmove(L->Work, L->Work + (Frames * L->Chans), LookSamples * sizeof(float));
+
+	return MinGain;
+}
+
+void CALLBACK LimiterDSPProc(HDSP handle, DWORD channel, void *buffer, DWORD length, void *user)
+{
+	LimiterState *L = Limiter;
+	LARGE_INTEGER Start, End;
+	FLOAT MinGain = 1.0f;
+
+	if (!L)
+		return;
+
+	QueryPerformanceCounter(&Start);
+
+	DWORD Frames = length / (L->Chans * L->SampleSize);
+
+	for (DWORD Done = 0; Done < Frames; )
+	{
+		DWORD Chunk = min(Frames - Done, LIMITER_CHUNK);
+		DWORD Samples = Chunk * L->Chans;
+		FLOAT ChunkGain;
+
+		if (L->SampleSize == sizeof(float))
+			ChunkGain = LimiterProcessChunk(L, (float *)buffer + (Done * L->Chans), Chunk);
+		else
+		{
+			SHORT *Data = (SHORT *)buffer + (Done * L->Chans);
+
+			for (DWORD i = 0; i < Samples; i++)
+				L->Scratch[i] = (float)Data[i] / 32768.0f;
+
+			ChunkGain = LimiterProcessChunk(L, L->Scratch, Chunk);
+
+			for (DWORD i = 0; i < Samples; i++)
+				Data[i] = (SHORT)max(min(L->Scratch[i] * 32768.0f, 32767.0f), -32768.0f);
+		}
+
+		if (ChunkGain < MinGain)
+			MinGain = ChunkGain;
+
+		Done += Chunk;
+	}
+
+	QueryPerformanceCounter(&End);
+
+	DWORD ElapsedUs = (DWORD)((End.QuadPart - Start.QuadPart) * 1000000 / LimiterQPCFreq.QuadPart);
+	LimiterBlockUs = (LimiterBlockUs * 0.95f) + ((FLOAT)ElapsedUs * 0.05f);
+	if (ElapsedUs > LimiterBlockMaxUs)
+		LimiterBlockMaxUs = ElapsedUs;
+
+	LimiterReduction = 20.0f * log10f(MinGain);
+}
+
+// Delay added by the lookahead, in ms
+FLOAT __inline GetLimiterLatency() {
+	return (LimiterDSP && LimiterLookahead) ? (FLOAT)LimiterLookahead : 0.0f;
+}
+
+static BOOL InitializeBuiltInLimiter()
+{
+	BASS_CHANNELINFO ci;
+
+	if (!OMStream || !BASS_ChannelGetInfo(OMStream, &ci))
+		return FALSE;
+
+	if (!(ci.flags & BASS_SAMPLE_FLOAT) && (ci.flags & BASS_SAMPLE_8BITS))
+	{
+		PrintMessageToDebugLog("InitializeLimiter", "The built-in limiter doesn't support 8-bit streams, skipping.");
+		return FALSE;
+	}
+
+	if (!LimiterQPCFreq.QuadPart)
+		QueryPerformanceFrequency(&LimiterQPCFreq);
+
+	Limiter = AllocateLimiter(ci.freq, ci.chans, (ci.flags & BASS_SAMPLE_FLOAT) ? sizeof(float) : sizeof(SHORT));
+	if (!Limiter)
+	{
+		PrintMessageToDebugLog("InitializeLimiter", "Unable to allocate the limiter's buffers.");
+		return FALSE;
+	}
+
+	// Lowest priority, so that it runs after every other effect on the stream
+	LimiterDSP = BASS_ChannelSetDSP(OMStream, LimiterDSPProc, NULL, -100);
+	if (!LimiterDSP)
+	{
+		CheckUp(FALSE, ERRORCODE, "Limiter DSP Apply", FALSE);
+		FreeLimiter();
+		return FALSE;
+	}
+
+	LimiterReduction = LimiterBlockUs = 0.0f;
+	LimiterBlockMaxUs = 0;
+
+	PrintMessageToDebugLog("InitializeLimiter", "Applied built-in limiter to OMStream.");
+	return TRUE;
+}
+
+static void ReleaseLimiter()
+{
+	// The DSPs go away with the stream, only the state needs to be freed
+	LimiterDSP = 0;
+	LimiterVST = 0;
+	FreeLimiter();
+}
+
+// Takes the limiter off a stream that's staying alive
+static void DetachLimiter()
+{
+	if (LimiterDSP)
+		BASS_ChannelRemoveDSP(OMStream, LimiterDSP);
+
+#ifndef _M_ARM64
+	if (LimiterVST)
+		BASS_VST_ChannelRemoveDSP(OMStream, LimiterVST);
+#endif
+
+	ReleaseLimiter();
+	PrintMessageToDebugLog("DetachLimiter", "Removed the limiter from OMStream.");
+}
@@ -0,0 +1,316 @@
+/*
+OmniMIDI live changes
+Figures out what a LiveChanges signal actually needs, and applies it at the smallest scope possible.
+Only engine-level changes go through the full restart in StreamHealthCheck,
+and so does any setting that isn't listed in LiveSettings, since nothing here knows how to apply it.
+*/
+#pragma once
+
+typedef struct LiveSetting
+{
+	LPCWSTR Name;
+	DWORD Scope;
+	DWORD Hash;		// Hash of the value that's currently applied
+};
+
+// Every setting with a known scope, the ones the real-time loop (LoadSettings(FALSE, TRUE)) doesn't pick up on its own
+// have something to do here
+static LiveSetting LiveSettings[] = {
+	// Output and stream format
+	{ L"CurrentEngine", LIVE_SCOPE_ENGINE },
+	{ L"AudioFrequency", LIVE_SCOPE_ENGINE },
+	{ L"AudioBitDepth", LIVE_SCOPE_ENGINE },
+	{ L"AudioOutput", LIVE_SCOPE_ENGINE },
+	{ L"WASAPIOutput", LIVE_SCOPE_ENGINE },
+	{ L"ASIOOutput", LIVE_SCOPE_ENGINE },
+	{ L"MonoRendering", LIVE_SCOPE_ENGINE },
+	{ L"WASAPIExclusive", LIVE_SCOPE_ENGINE },
+	{ L"WASAPIRAWMode", LIVE_SCOPE_ENGINE },
+	{ L"WASAPIDoubleBuf", LIVE_SCOPE_ENGINE },
+	{ L"ASIODirectFeed", LIVE_SCOPE_ENGINE },
+	{ L"LeaveASIODeviceFreq", LIVE_SCOPE_ENGINE },
+	{ L"XASamplesPerFrame", LIVE_SCOPE_ENGINE },
+	{ L"XASPFSweepRate", LIVE_SCOPE_ENGINE },
+	{ L"BASSDSMode", LIVE_SCOPE_ENGINE },
+	{ L"NotesCatcherWithAudio", LIVE_SCOPE_ENGINE },
+	{ L"FollowDefaultAudioDevice", LIVE_SCOPE_ENGINE },
+	{ L"BufferLength", LIVE_SCOPE_ENGINE },
+	{ L"DriverPriority", LIVE_SCOPE_ENGINE },
+	{ L"ReduceBootUpDelay", LIVE_SCOPE_ENGINE },
+
+	// Events buffer
+	{ L"EvBufferSize", LIVE_SCOPE_BUFFER },
+	{ L"EvBufferMultRatio", LIVE_SCOPE_BUFFER },
+	{ L"GetEvBuffSizeFromRAM", LIVE_SCOPE_BUFFER },
+
+	// SoundFont loading flags
+	{ L"LinAttMod", LIVE_SCOPE_FONTS },
+	{ L"LinDecVol", LIVE_SCOPE_FONTS },
+	{ L"NoSFGenLimits", LIVE_SCOPE_FONTS },
+	{ L"AudioRampIn", LIVE_SCOPE_FONTS },
+	{ L"PreloadSoundFonts", LIVE_SCOPE_FONTS },
+
+	// DSPs
+	{ L"LimiterMode", LIVE_SCOPE_EFFECT },
+	{ L"LimiterCeiling", LIVE_SCOPE_EFFECT },
+	{ L"LimiterRelease", LIVE_SCOPE_EFFECT },
+	{ L"LimiterLookahead", LIVE_SCOPE_EFFECT },
+	{ L"NativeEffects", LIVE_SCOPE_EFFECT },
+
+	// Plain values
+	{ L"LogarithmVol", LIVE_SCOPE_STREAM },
+	{ L"ChannelVoiceBudget", LIVE_SCOPE_STREAM },
+	{ L"ChannelVoiceBudgets", LIVE_SCOPE_STREAM },
+	{ L"VoiceStealMode", LIVE_SCOPE_STREAM },
+	{ L"DecimateControllers", LIVE_SCOPE_STREAM },
+
+	// Already applied by the real-time loop
+	{ L"WinMMSpeed", LIVE_SCOPE_NONE },
+	{ L"ChannelUpdateLength", LIVE_SCOPE_NONE },
+	{ L"DelayNoteOff", LIVE_SCOPE_NONE },
+	{ L"DelayNoteOffValue", LIVE_SCOPE_NONE },
+	{ L"DisableNotesFadeOut", LIVE_SCOPE_NONE },
+	{ L"DontMissNotes", LIVE_SCOPE_NONE },
+	{ L"EnableSFX", LIVE_SCOPE_NONE },
+	{ L"FastHotkeys", LIVE_SCOPE_NONE },
+	{ L"FullVelocityMode", LIVE_SCOPE_NONE },
+	{ L"HyperPlayback", LIVE_SCOPE_NONE },
+	{ L"IgnoreAllEvents", LIVE_SCOPE_NONE },
+	{ L"IgnoreNotesBetweenVel", LIVE_SCOPE_NONE },
+	{ L"IgnoreSysReset", LIVE_SCOPE_NONE },
+	{ L"LimitTo88Keys", LIVE_SCOPE_NONE },
+	{ L"MaxRenderingTime", LIVE_SCOPE_NONE },
+	{ L"MaxVelIgnore", LIVE_SCOPE_NONE },
+	{ L"MaxVoices", LIVE_SCOPE_NONE },
+	{ L"MinVelIgnore", LIVE_SCOPE_NONE },
+	{ L"NoteLengthValue", LIVE_SCOPE_NONE },
+	{ L"NoteOff1", LIVE_SCOPE_NONE },
+	{ L"OutputVolume", LIVE_SCOPE_NONE },
+	{ L"OverrideNoteLength", LIVE_SCOPE_NONE },
+	{ L"SincConv", LIVE_SCOPE_NONE },
+	{ L"SincInter", LIVE_SCOPE_NONE },
+	{ L"TransposeValue", LIVE_SCOPE_NONE },
+	{ L"CPitchValue", LIVE_SCOPE_NONE },
+	{ L"ReverbOverride", LIVE_SCOPE_NONE },
+	{ L"ReverbInGain", LIVE_SCOPE_NONE },
+	{ L"ReverbMix", LIVE_SCOPE_NONE },
+	{ L"ReverbTime", LIVE_SCOPE_NONE },
+	{ L"ReverbHighFreqRTRatio", LIVE_SCOPE_NONE },
+	{ L"ChorusOverride", LIVE_SCOPE_NONE },
+	{ L"ChorusWetDryMix", LIVE_SCOPE_NONE },
+	{ L"ChorusDepth", LIVE_SCOPE_NONE },
+	{ L"ChorusFeedback", LIVE_SCOPE_NONE },
+	{ L"ChorusFrequency", LIVE_SCOPE_NONE },
+	{ L"ChorusSineMode", LIVE_SCOPE_NONE },
+	{ L"ChorusDelay", LIVE_SCOPE_NONE },
+	{ L"ChorusPhase", LIVE_SCOPE_NONE },
+	{ L"EchoOverride", LIVE_SCOPE_NONE },
+	{ L"EchoWetDryMix", LIVE_SCOPE_NONE },
+	{ L"EchoFeedback", LIVE_SCOPE_NONE },
+	{ L"EchoLeftDelay", LIVE_SCOPE_NONE },
+	{ L"EchoRightDelay", LIVE_SCOPE_NONE },
+	{ L"EchoPanDelay", LIVE_SCOPE_NONE },
+};
+
+static const char *LiveScopeNames[LIVE_SCOPES] = { "Stream", "Effect", "Buffer", "Fonts", "Engine" };
+static BOOL LiveSnapshotTaken = FALSE;
+static DWORD LiveUnmappedHash = 0;		// Every value that isn't in LiveSettings, hashed together
+static LARGE_INTEGER LiveQPCFreq = { 0 };
+
+// FNV-1a over the type and the raw data, so that DWORDs, QWORDs and strings can all be compared the same way
+static DWORD HashLiveSetting(LPCWSTR Name)
+{
+	BYTE Data[1024];
+	DWORD Type = 0, Size = sizeof(Data);
+	DWORD Hash = 2166136261;
+
+	if (RegQueryValueExW(Configuration.Address, Name, NULL, &Type, Data, &Size) != ERROR_SUCCESS)
+		return 0;
+
+	Hash = (Hash ^ Type) * 16777619;
+	for (DWORD i = 0; i < Size; i++)
+		Hash = (Hash ^ Data[i]) * 16777619;
+
+	return Hash;
+}
+
+static BOOL IsLiveSettingMapped(LPCWSTR Name)
+{
+	for (DWORD i = 0; i < _countof(LiveSettings); i++)
+	{
+		if (!_wcsicmp(LiveSettings[i].Name, Name))
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+// Same hash, over the names and data of all the values nobody told us about
+static DWORD HashUnmappedSettings()
+{
+	wchar_t Name[256];
+	BYTE Data[1024];
+	DWORD Hash = 2166136261;
+
+	for (DWORD Index = 0;; Index++)
+	{
+		DWORD NameLen = _countof(Name), Type = 0, Size = sizeof(Data);
+		LONG Result = RegEnumValueW(Configuration.Address, Index, Name, &NameLen, NULL, &Type, Data, &Size);
+
+		if (Result == ERROR_NO_MORE_ITEMS)
+			break;
+
+		// Too big to compare, the size will have to do
+		if (Result == ERROR_MORE_DATA && NameLen < _countof(Name))
+			Size = 0;
+		else if (Result != ERROR_SUCCESS)
+			continue;
+
+		if (IsLiveSettingMapped(Name))
+			continue;
+
+		for (DWORD i = 0; i < NameLen; i++)
+			Hash = (Hash ^ Name[i]) * 16777619;
+
+		Hash = (Hash ^ Type) * 16777619;
+		for (DWORD i = 0; i < Size; i++)
+			Hash = (Hash ^ Data[i]) * 16777619;
+	}
+
+	return Hash;
+}
+
+// Stores what's currently applied, call it after every (re)initialization
+void TakeLiveSnapshot()
+{
+	OpenRegistryKey(Configuration, L"Software\\OmniMIDI\\Configuration", TRUE);
+
+	for (DWORD i = 0; i < _countof(LiveSettings); i++)
+		LiveSettings[i].Hash = HashLiveSetting(LiveSettings[i].Name);
+
+	LiveUnmappedHash = HashUnmappedSettings();
+	LiveSnapshotTaken = TRUE;
+}
+
+DWORD GetLiveChangesScope()
+{
+	DWORD Scope = 0;
+
+	// Nothing to compare against, assume the worst
+	if (!LiveSnapshotTaken)
+		return LIVE_SCOPE_ENGINE;
+
+	OpenRegistryKey(Configuration, L"Software\\OmniMIDI\\Configuration", TRUE);
+
+	for (DWORD i = 0; i < _countof(LiveSettings); i++)
+	{
+		if (HashLiveSetting(LiveSettings[i].Name) != LiveSettings[i].Hash)
+		{
+			PrintMessageWToDebugLog(L"GetLiveChangesScope", LiveSettings[i].Name);
+			Scope |= LiveSettings[i].Scope;
+		}
+	}
+
+	// No idea what it does, do what the driver always did and restart everything
+	if (HashUnmappedSettings() != LiveUnmappedHash)
+	{
+		PrintMessageToDebugLog("GetLiveChangesScope", "A setting without a live scope changed, the engine has to be restarted.");
+		Scope |= LIVE_SCOPE_ENGINE;
+	}
+
+	return Scope;
+}
+
+LONGLONG __inline LiveTimerStart() {
+	LARGE_INTEGER Now;
+
+	if (!LiveQPCFreq.QuadPart)
+		QueryPerformanceFrequency(&LiveQPCFreq);
+
+	QueryPerformanceCounter(&Now);
+	return Now.QuadPart;
+}
+
+void RecordLiveDropout(DWORD Scope, LONGLONG Start)
+{
+	LARGE_INTEGER Now;
+	DWORD Index = 0;
+
+	QueryPerformanceCounter(&Now);
+
+	while (!(Scope & (1 << Index)) && Index < LIVE_SCOPES - 1)
+		Index++;
+
+	FLOAT Elapsed = (FLOAT)((DOUBLE)(Now.QuadPart - Start) * 1000.0 / LiveQPCFreq.QuadPart);
+	LiveDropoutLast[Index] = Elapsed;
+	if (Elapsed > LiveDropoutMax[Index])
+		LiveDropoutMax[Index] = Elapsed;
+
+	PrintVarToDebugLog(LiveScopeNames[Index], "Live change applied in (ms)", &Elapsed, PRINT_FLOAT);
+}
+
+// Applies everything below the engine level to the running stream, without touching the output
+void ApplyLiveChanges(DWORD Scope)
+{
+	DWORD dwType = REG_DWORD, dwSize = sizeof(DWORD);
+	DWORD qwType = REG_QWORD, qwSize = sizeof(QWORD);
+	LONGLONG Start;
+
+	if (!Scope)
+		return;
+
+	OpenRegistryKey(Configuration, L"Software\\OmniMIDI\\Configuration", TRUE);
+
+	if (Scope & LIVE_SCOPE_STREAM)
+	{
+		Start = LiveTimerStart();
+		RegQueryValueEx(Configuration.Address, L"LogarithmVol", NULL, &dwType, (LPBYTE)&LogarithmVol, &dwSize);
+		LoadVoiceBudgets();
+		LoadDecimation();
+		RecordLiveDropout(LIVE_SCOPE_STREAM, Start);
+	}
+
+	if (Scope & LIVE_SCOPE_BUFFER)
+	{
+		Start = LiveTimerStart();
+		RegQueryValueEx(Configuration.Address, L"EvBufferSize", NULL, &qwType, (LPBYTE)&EvBufferSize, &qwSize);
+		RegQueryValueEx(Configuration.Address, L"EvBufferMultRatio", NULL, &dwType, (LPBYTE)&EvBufferMultRatio, &dwSize);
+		RegQueryValueEx(Configuration.Address, L"GetEvBuffSizeFromRAM", NULL, &dwType, (LPBYTE)&GetEvBuffSizeFromRAM, &dwSize);
+
+		// Only the threads reading from the buffer have to stop, the stream keeps going
+		CloseThreads();
+		AllocateMemory(TRUE);
+		CreateThreads();
+		RecordLiveDropout(LIVE_SCOPE_BUFFER, Start);
+	}
+
+	if (Scope & LIVE_SCOPE_FONTS)
+	{
+		Start = LiveTimerStart();
+		RegQueryValueEx(Configuration.Address, L"LinAttMod", NULL, &dwType, (LPBYTE)&ManagedSettings.LinAttMod, &dwSize);
+		RegQueryValueEx(Configuration.Address, L"LinDecVol", NULL, &dwType, (LPBYTE)&ManagedSettings.LinDecVol, &dwSize);
+		RegQueryValueEx(Configuration.Address, L"NoSFGenLimits", NULL, &dwType, (LPBYTE)&ManagedSettings.NoSFGenLimits, &dwSize);
+		RegQueryValueEx(Configuration.Address, L"AudioRampIn", NULL, &dwType, (LPBYTE)&ManagedSettings.AudioRampIn, &dwSize);
+		RegQueryValueEx(Configuration.Address, L"PreloadSoundFonts", NULL, &dwType, (LPBYTE)&ManagedSettings.PreloadSoundFonts, &dwSize);
+		LoadSoundFontsToStream();
+		RecordLiveDropout(LIVE_SCOPE_FONTS, Start);
+	}
+
+	if (Scope & LIVE_SCOPE_EFFECT)
+	{
+		Start = LiveTimerStart();
+		DetachLimiter();
+		DetachNativeEffects();
+
+		InitializeLimiter();
+		InitializeNativeEffects();
+#if !defined(_M_ARM64)
+		InitializeOrUpdateEffects();
+#else
+		UpdateNativeEffects();
+#endif
+		RecordLiveDropout(LIVE_SCOPE_EFFECT, Start);
+	}
+
+	TakeLiveSnapshot();
+}
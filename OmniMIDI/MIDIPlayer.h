@@ -0,0 +1,735 @@
+/*
+OmniMIDI MIDI file player
+Plays a Standard MIDI File inside the driver, so that KDMAPI players don't have to sequence it themselves.
+The audio thread releases the events into the render blocks with their exact sample position,
+a bit ahead of time so that a late block doesn't make them late too.
+Everything goes to port 0.
+*/
+#pragma once
+
+#define PLAYER_LOOKAHEAD_MS 20
+
+// PlayerSong gets decoded as it plays, so what it gets decoded from has to stay around for as long as it's loaded
+typedef struct PlayerSource
+{
+	LPVOID View;							// The mapped file
+	BYTE* Copy;								// Or a copy of the buffer the app gave us
+} PlayerSource;
+
+// PlayerControlMutex serializes the app's calls, PlayerSong only changes while it's held (and PlayerLock too).
+// PlayerLock is what the audio thread takes, nothing slower than a swap or a few events gets done under it.
+static SMFSequence PlayerSong;
+static SMFSequence::Cursor PlayerCursor;	// Next event to release
+static PlayerSource PlayerSongSource = { NULL, NULL };
+static std::mutex PlayerControlMutex;
+static LockSystem PlayerLock = { 0, 0 };
+static BOOL PlayerLoaded = FALSE;
+static volatile BOOL PlayerPlaying = FALSE;
+static BOOL PlayerCached = FALSE;			// Streamed from the rendered audio cache, no events get released
+static BOOL PlayerChasePending = FALSE;		// The synth took over from the cache, and waits for the health thread to chase the song
+static QWORD PlayerChaseTime = 0;
+
+// Song position <-> render clock mapping, moved every time the playback gets started, sought or sped up
+static QWORD PlayerOriginTime = 0;			// Song position (us) that plays at PlayerOriginFrame
+static QWORD PlayerOriginFrame = 0;
+static QWORD PlayerPosition = 0;			// Song position (us) as of the last block
+static QWORD PlayerQueuedFrame = 0;			// Everything before this frame has been handed to BASSMIDI already
+static DOUBLE PlayerSpeed = 1.0;
+static HSTREAM PlayerStream = 0;			// The stream the mapping belongs to
+
+// Stats, printed to the debug pipe
+static volatile QWORD PlayerReleased = 0;	// Events released into the stream
+static volatile QWORD PlayerLate = 0;		// Events released after their position had already passed
+static volatile QWORD PlayerMaxLate = 0;	// Worst lateness, in sample frames
+
+static QWORD __inline PlayerFrameAt(QWORD Time)
+{
+	return PlayerOriginFrame + (QWORD)((DOUBLE)(Time - PlayerOriginTime) * SchedulerFreq / (1000000.0 * PlayerSpeed));
+}
+
+static QWORD __inline PlayerTimeAt(QWORD Frame)
+{
+	if (Frame <= PlayerOriginFrame || !SchedulerFreq)
+		return PlayerOriginTime;
+
+	return PlayerOriginTime + (QWORD)((DOUBLE)(Frame - PlayerOriginFrame) * 1000000.0 * PlayerSpeed / SchedulerFreq);
+}
+
+// First song position whose events haven't been released before Frame
+static QWORD PlayerTimeFrom(QWORD Frame)
+{
+	QWORD Time = PlayerTimeAt(Frame);
+
+	// PlayerTimeAt rounds down, it's a step or two away at most
+	while (PlayerFrameAt(Time) < Frame)
+		Time++;
+
+	return Time;
+}
+
+// Where a stop, a seek or a speed change takes effect. The events the player released ahead of time can only
+// be cancelled along with everyone else's (KDMAPI's scheduled events, the note-off timers...), so they get to play,
+// and the change happens right after the last of them. Has to be called with PlayerLock held
+static QWORD PlayerSwitchFrame()
+{
+	QWORD Now = GetRenderPosition();
+
+	return (PlayerStream == OMStream && PlayerQueuedFrame > Now) ? PlayerQueuedFrame : Now;
+}
+
+// Silences whatever the player had started, at Frame (from PlayerSwitchFrame)
+static void StopPlayerNotes(QWORD Frame)
+{
+	BASS_MIDI_EVENT Evs[32];
+
+	if (!OMStream)
+		return;
+
+	if (Frame <= GetRenderPosition() || !SchedulerFrameBytes || (Frame * SchedulerFrameBytes) > MAXDWORD)
+	{
+		for (DWORD Chan = 0; Chan < 16; Chan++)
+		{
+			_BMSE(OMStream, Chan, MIDI_EVENT_NOTESOFF, 0);
+			_BMSE(OMStream, Chan, MIDI_EVENT_SUSTAIN, 0);
+		}
+
+		return;
+	}
+
+	for (DWORD Chan = 0; Chan < 16; Chan++)
+	{
+		Evs[Chan * 2] = { MIDI_EVENT_NOTESOFF, 0, Chan, 0, (DWORD)(Frame * SchedulerFrameBytes) };
+		Evs[Chan * 2 + 1] = { MIDI_EVENT_SUSTAIN, 0, Chan, 0, (DWORD)(Frame * SchedulerFrameBytes) };
+	}
+
+	_BMSEs(OMStream, BASS_MIDI_EVENTS_STRUCT | BASS_MIDI_EVENTS_ABSTIME, Evs, _countof(Evs));
+}
+
+// Moves the mapping so that Time plays at Frame. Has to be called with PlayerLock held
+static void AnchorPlayer(QWORD Time, QWORD Frame)
+{
+	PlayerOriginTime = PlayerPosition = Time;
+	PlayerOriginFrame = PlayerQueuedFrame = Frame;
+	PlayerStream = OMStream;
+	PlayerCursor.Seek(Time);
+}
+
+// Works out the last program, controllers and pitch bend of every channel before Time, so that a seek sounds right.
+// It walks the whole song, so it has to be called with PlayerControlMutex held, and never with PlayerLock
+static void BuildPlayerChase(QWORD Time, std::vector<DWORD>& Chase)
+{
+	std::vector<DWORD> Last(16 * 131, 0);	// 128 controllers, program, channel pressure and pitch bend for each channel
+	std::vector<QWORD> LastTime(16 * 131, 0);
+	DWORD RPN[16], BendRange[16] = { 0 }, Track = MAXDWORD;
+	QWORD BendTime[16] = { 0 }, ResetTime[16] = { 0 };
+	BOOL Reset[16] = { 0 };
+
+	// What a reset all controllers (CC121) puts back to its default, same as the synth state mirror
+	auto ResetBy121 = [](DWORD Slot) {
+		return Slot == 1 || Slot == 11 || (Slot >= 64 && Slot <= 69) || Slot == 129 || Slot == 130;
+	};
+
+	// The tracks are walked one by one, so a value only replaces another track's one if it doesn't come earlier
+	PlayerSong.ForEachBefore(Time, [&](uint16_t EvTrack, uint64_t EvTime, uint32_t Msg) {
+		DWORD Chan = Msg & 0xF, Slot;
+
+		if (EvTrack != Track)
+		{
+			Track = EvTrack;
+			for (DWORD i = 0; i < 16; i++) RPN[i] = 0x3FFF;
+		}
+
+		switch (Msg & 0xF0)
+		{
+		case MIDI_CMC:
+			switch ((Msg >> 8) & 0x7F)
+			{
+			case 6:		// Only the pitch bend range is worth chasing among the RPNs
+				if (!RPN[Chan] && EvTime >= BendTime[Chan])
+				{
+					BendRange[Chan] = (Msg >> 16) & 0x7F;
+					BendTime[Chan] = EvTime;
+				}
+				return;
+			case 98:
+			case 99:
+				RPN[Chan] = 0x3FFF;
+				return;
+			case 100:
+				RPN[Chan] = (RPN[Chan] & 0x3F80) | ((Msg >> 16) & 0x7F);
+				return;
+			case 101:
+				RPN[Chan] = (RPN[Chan] & 0x7F) | (((Msg >> 16) & 0x7F) << 7);
+				return;
+			case 121:
+				// Whatever it resets that came before it doesn't have to be chased anymore
+				if (!Reset[Chan] || EvTime > ResetTime[Chan])
+				{
+					for (DWORD i = 0; i < 131; i++)
+					{
+						if (ResetBy121(i) && LastTime[Chan * 131 + i] < EvTime)
+							Last[Chan * 131 + i] = 0;
+					}
+
+					Reset[Chan] = TRUE;
+					ResetTime[Chan] = EvTime;
+				}
+				return;
+			default:
+				// The other channel mode messages don't leave anything behind
+				if (((Msg >> 8) & 0x7F) >= 120)
+					return;
+
+				Slot = (Msg >> 8) & 0x7F;
+				break;
+			}
+			break;
+		case MIDI_PROGCHAN:
+			Slot = 128;
+			break;
+		case MIDI_CHANAFTER:
+			Slot = 129;
+			break;
+		case MIDI_PITCHWHEEL:
+			Slot = 130;
+			break;
+		default:
+			return;
+		}
+
+		// Reset later on, by another track
+		if (Reset[Chan] && EvTime < ResetTime[Chan] && ResetBy121(Slot))
+			return;
+
+		if (EvTime >= LastTime[Chan * 131 + Slot])
+		{
+			Last[Chan * 131 + Slot] = Msg;
+			LastTime[Chan * 131 + Slot] = EvTime;
+		}
+	});
+
+	Chase.clear();
+
+	for (DWORD Chan = 0; Chan < 16; Chan++)
+	{
+		// Bank selects first, then the program change, then the rest
+		if (Last[Chan * 131 + 0]) Chase.push_back(Last[Chan * 131 + 0]);
+		if (Last[Chan * 131 + 32]) Chase.push_back(Last[Chan * 131 + 32]);
+		if (Last[Chan * 131 + 128]) Chase.push_back(Last[Chan * 131 + 128]);
+
+		for (DWORD Slot = 1; Slot < 131; Slot++)
+		{
+			// No pedal held down on a note that isn't playing anymore, and no channel mode message
+			if (Slot == 32 || Slot == 64 || (Slot >= 120 && Slot <= 128) || !Last[Chan * 131 + Slot])
+				continue;
+
+			Chase.push_back(Last[Chan * 131 + Slot]);
+		}
+
+		if (BendRange[Chan])
+		{
+			Chase.push_back(MIDI_CMC | Chan | (101 << 8));
+			Chase.push_back(MIDI_CMC | Chan | (100 << 8));
+			Chase.push_back(MIDI_CMC | Chan | (6 << 8) | (BendRange[Chan] << 16));
+			Chase.push_back(MIDI_CMC | Chan | (101 << 8) | (127 << 16));
+			Chase.push_back(MIDI_CMC | Chan | (100 << 8) | (127 << 16));
+		}
+	}
+}
+
+// Sends what BuildPlayerChase worked out, at Frame. At most a couple thousand events, fine with PlayerLock held
+static void SendPlayerChase(const std::vector<DWORD>& Chase, QWORD Frame)
+{
+	BASS_MIDI_EVENT Evs[SCHEDULER_BATCH];
+	DWORD EvsCount = 0;
+	QWORD Now = GetRenderPosition();
+
+	for (size_t i = 0; i < Chase.size(); i++)
+		PutBlockEvent(Chase[i], Now, Frame, Evs, EvsCount);
+
+	FlushBlockEvents(Evs, EvsCount);
+}
+
+// The synth takes over from Time, but the audio thread can't walk the song. It holds the song back
+// until the health thread has sent the chase, in ProcessPlayerChase. Has to be called with PlayerLock held
+static void RequestPlayerChase(QWORD Time)
+{
+	PlayerChasePending = TRUE;
+	PlayerChaseTime = PlayerPosition = Time;
+}
+
+// Called by the audio thread before every block
+void ReleasePlayerEvents(QWORD Now, QWORD Horizon)
+{
+	BASS_MIDI_EVENT Evs[SCHEDULER_BATCH];
+	DWORD EvsCount = 0;
+
+	if (!PlayerPlaying || !SchedulerFreq)
+		return;
+
+	LockForWriting(&PlayerLock);
+
+	// The stream got recreated, pick the song up from where the old one was
+	if (PlayerStream != OMStream)
+	{
+		// The cache's DSP went away with the old stream, the synth has to take over
+		if (PlayerCached)
+		{
+			PlayerCached = FALSE;
+			PlayerCacheFallbacks++;
+			RequestPlayerChase(PlayerPosition);
+		}
+
+		ClosePlayerCache();
+		AnchorPlayer(PlayerPosition, GetRenderPosition());
+	}
+
+	// Nothing gets released until the synth has caught up
+	if (PlayerChasePending)
+	{
+		UnlockForWriting(&PlayerLock);
+		return;
+	}
+
+	// A recording or a streamed play starts with this block, line the song up with it
+	if (PlayerCacheBlock())
+		AnchorPlayer(PlayerOriginTime, GetRenderPosition());
+
+	QWORD Limit = Horizon + (SchedulerFreq * PLAYER_LOOKAHEAD_MS) / 1000;
+	PlayerPosition = PlayerTimeAt(Now);
+
+	if (PlayerCached)
+	{
+		if (!PlayerCacheLost)
+		{
+			// The DSP keeps going through the tail on its own
+			if (PlayerPosition >= PlayerSong.Length)
+			{
+				PlayerPlaying = PlayerCached = FALSE;
+				PlayerPosition = PlayerSong.Length;
+				PrintMessageToDebugLog("MIDIPlayer", "End of the song reached.");
+			}
+
+			UnlockForWriting(&PlayerLock);
+			return;
+		}
+
+		// The cached audio couldn't be read, the synth picks the song up from here
+		PrintMessageToDebugLog("MIDIPlayer", "The cached audio couldn't be read, the song will be rendered live.");
+		PlayerCached = FALSE;
+		PlayerCacheFallbacks++;
+		ClosePlayerCache();
+		RequestPlayerChase(PlayerPosition);
+
+		UnlockForWriting(&PlayerLock);
+		return;
+	}
+
+	// Whatever this thread sends from here on is the song, the cache doesn't have to drop its recording over it
+	PlayerCacheOwner = GetCurrentThreadId();
+
+	while (PlayerPlaying && !PlayerCursor.AtEnd())
+	{
+		QWORD Frame = PlayerFrameAt(PlayerCursor.PeekTime());
+
+		if (Frame >= Limit)
+			break;
+
+		SMFSequence::Event Ev = PlayerCursor.Next();
+		PlayerReleased++;
+
+		if (Frame < Now)
+		{
+			QWORD Lateness = Now - Frame;
+			PlayerLate++;
+			if (Lateness > PlayerMaxLate) PlayerMaxLate = Lateness;
+		}
+
+		if (Ev.Long)
+		{
+			MIDIHDR Hdr = { 0 };
+
+			// SysExes can't be scheduled, they're applied when they're reached
+			FlushBlockEvents(Evs, EvsCount);
+			Hdr.lpData = (LPSTR)Ev.Long;
+			Hdr.dwBufferLength = Hdr.dwBytesRecorded = Ev.LongLength;
+			SendLongToBASSMIDI(&Hdr);
+			continue;
+		}
+
+		DWORD Msg = Ev.Msg;
+
+		if (CheckIfEventIsToIgnore(Msg))
+			continue;
+
+		if (ManagedSettings.FullVelocityMode || ManagedSettings.TransposeValue != 0x7F)
+			Msg = ReturnEditedEvent(Msg);
+
+		_FeedbackShortMsg(Msg);
+		PutBlockEvent(Msg, Now, Frame, Evs, EvsCount);
+	}
+
+	PlayerCacheOwner = 0;
+	if (Limit > PlayerQueuedFrame) PlayerQueuedFrame = Limit;
+
+	if (PlayerCursor.AtEnd())
+	{
+		PlayerPlaying = FALSE;
+		PlayerPosition = PlayerSong.Length;
+		PrintMessageToDebugLog("MIDIPlayer", "End of the song reached.");
+	}
+
+	UnlockForWriting(&PlayerLock);
+
+	FlushBlockEvents(Evs, EvsCount);
+}
+
+// Called by the health thread, sends the chase the audio thread asked for and lets the song go on
+void ProcessPlayerChase()
+{
+	std::vector<DWORD> Chase;
+	QWORD Time, Frame;
+
+	if (!PlayerChasePending)
+		return;
+
+	std::lock_guard<std::mutex> Control(PlayerControlMutex);
+
+	LockForWriting(&PlayerLock);
+	Time = PlayerChaseTime;
+	UnlockForWriting(&PlayerLock);
+
+	BuildPlayerChase(Time, Chase);
+
+	LockForWriting(&PlayerLock);
+
+	// Checked again, a seek or a new song would have taken care of it already
+	if (PlayerChasePending && PlayerChaseTime == Time)
+	{
+		Frame = PlayerSwitchFrame();
+		SendPlayerChase(Chase, Frame);
+		PlayerChasePending = FALSE;
+
+		if (PlayerPlaying)
+			AnchorPlayer(Time, Frame);
+	}
+
+	UnlockForWriting(&PlayerLock);
+}
+
+static void FreePlayerSource(PlayerSource* Source)
+{
+	if (Source->View) UnmapViewOfFile(Source->View);
+	delete[] Source->Copy;
+
+	Source->View = NULL;
+	Source->Copy = NULL;
+}
+
+// How much memory the index of a song can take, "MIDIFileMemoryLimit" (MB) or half of the physical memory if it's not set
+static QWORD PlayerMemoryLimit()
+{
+	MEMORYSTATUSEX Mem;
+	QWORD Limit = (QWORD)SynthHost_ReadSetting(L"MIDIFileMemoryLimit", 0) << 20;
+
+	Mem.dwLength = sizeof(MEMORYSTATUSEX);
+	if (!Limit && GlobalMemoryStatusEx(&Mem))
+		Limit = Mem.ullTotalPhys / 2;
+
+#ifndef _WIN64
+	// A 32-bit process wouldn't be able to get much more than this anyway
+	if (!Limit || Limit > ((QWORD)1 << 30))
+		Limit = (QWORD)1 << 30;
+#endif
+
+	return Limit;
+}
+
+// Takes Source over, whether it succeeds or not
+static BOOL OpenPlayerSong(PlayerSource Source, const BYTE* Data, size_t Length)
+{
+	SMFSequence* Song = new SMFSequence;
+	LARGE_INTEGER Start, End, Freq;
+	QWORD Limit = PlayerMemoryLimit(), Events, CacheKey;
+	FLOAT LoadMs, EventsPerSec, MemoryMB;
+
+	QueryPerformanceCounter(&Start);
+
+	if (!Song->Load(Data, Length, Limit))
+	{
+		if (Limit && Song->MemoryUsed > Limit)
+			PrintMessageToDebugLog("MIDIPlayer", "The MIDI file would take more memory than it's allowed to, it won't be loaded.");
+		else
+			PrintMessageToDebugLog("MIDIPlayer", "The data isn't a valid MIDI file.");
+
+		delete Song;
+		FreePlayerSource(&Source);
+		return FALSE;
+	}
+
+	QueryPerformanceCounter(&End);
+	QueryPerformanceFrequency(&Freq);
+	CacheKey = HashPlayerCacheSong(Data, Length);
+	LoadMs = (FLOAT)((DOUBLE)(End.QuadPart - Start.QuadPart) * 1000.0 / Freq.QuadPart);
+	EventsPerSec = LoadMs ? (FLOAT)(Song->EventCount * 1000.0 / LoadMs) : 0.0f;
+	MemoryMB = (FLOAT)(Song->MemoryUsed / 1048576.0);
+	Events = Song->EventCount;
+
+	PlayerControlMutex.lock();
+	LockForWriting(&PlayerLock);
+
+	if (PlayerPlaying)
+	{
+		PlayerPlaying = FALSE;
+		StopPlayerNotes(PlayerSwitchFrame());
+	}
+
+	// Parsed outside of the lock, so swapping is all the audio thread could ever wait for
+	std::swap(PlayerSong, *Song);
+	std::swap(PlayerSongSource, Source);
+	PlayerCursor.Attach(PlayerSong);
+	PlayerLoaded = TRUE;
+	PlayerSpeed = 1.0;
+	PlayerOriginTime = PlayerPosition = 0;
+	PlayerCached = PlayerChasePending = FALSE;
+	PlayerCacheSongKey = CacheKey;
+
+	UnlockForWriting(&PlayerLock);
+
+	// The audio thread is done with it, the file can be let go of without holding it up
+	ClosePlayerCache();
+	PlayerControlMutex.unlock();
+
+	PrintVarToDebugLog("MIDIPlayer", "Song loaded, parse time (ms)", &LoadMs, PRINT_FLOAT);
+	PrintVarToDebugLog("MIDIPlayer", "Events", &Events, PRINT_UINT64);
+	PrintVarToDebugLog("MIDIPlayer", "Events per second", &EventsPerSec, PRINT_FLOAT);
+	PrintVarToDebugLog("MIDIPlayer", "Memory used (MB)", &MemoryMB, PRINT_FLOAT);
+
+	// The old song goes before what it was decoded from
+	delete Song;
+	FreePlayerSource(&Source);
+	return TRUE;
+}
+
+BOOL LoadPlayerSong(const BYTE* Data, size_t Length)
+{
+	// The app is free to let go of its buffer once we return
+	PlayerSource Source = { NULL, new (std::nothrow) BYTE[Length] };
+
+	if (!Source.Copy)
+	{
+		PrintMessageToDebugLog("MIDIPlayer", "Not enough memory to copy the MIDI file.");
+		return FALSE;
+	}
+
+	memcpy(Source.Copy, Data, Length);
+	return OpenPlayerSong(Source, Source.Copy, Length);
+}
+
+BOOL LoadPlayerFile(LPCWSTR Path)
+{
+	// Mapped rather than read, black MIDIs can be bigger than what we'd want to copy around
+	HANDLE File = CreateFileW(Path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	HANDLE Mapping = NULL;
+	LPVOID View = NULL;
+	LARGE_INTEGER Size;
+	BOOL Success = FALSE;
+
+	if (File == INVALID_HANDLE_VALUE)
+	{
+		PrintMessageToDebugLog("MIDIPlayer", "Couldn't open the MIDI file.");
+		return FALSE;
+	}
+
+	if (!GetFileSizeEx(File, &Size) || (ULONGLONG)Size.QuadPart > SIZE_MAX || !Size.QuadPart)
+	{
+		CloseHandle(File);
+		PrintMessageToDebugLog("MIDIPlayer", "The MIDI file is either empty or too big.");
+		return FALSE;
+	}
+
+	Mapping = CreateFileMappingW(File, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (Mapping) View = MapViewOfFile(Mapping, FILE_MAP_READ, 0, 0, 0);
+
+	// The view keeps the file open on its own, and stays mapped for as long as the song is loaded
+	if (Mapping) CloseHandle(Mapping);
+	CloseHandle(File);
+
+	if (View)
+	{
+		PlayerSource Source = { View, NULL };
+		Success = OpenPlayerSong(Source, (const BYTE*)View, (size_t)Size.QuadPart);
+	}
+	else PrintMessageToDebugLog("MIDIPlayer", "Couldn't map the MIDI file.");
+
+	return Success;
+}
+
+void UnloadPlayerSong()
+{
+	SMFSequence Empty;
+	PlayerSource Source = { NULL, NULL };
+
+	PlayerControlMutex.lock();
+	LockForWriting(&PlayerLock);
+
+	if (PlayerPlaying)
+	{
+		PlayerPlaying = FALSE;
+		StopPlayerNotes(PlayerSwitchFrame());
+	}
+
+	PlayerCursor.Detach();
+	std::swap(PlayerSong, Empty);
+	std::swap(PlayerSongSource, Source);
+	PlayerLoaded = FALSE;
+	PlayerOriginTime = PlayerPosition = 0;
+	PlayerCached = PlayerChasePending = FALSE;
+	PlayerCacheSongKey = 0;
+
+	UnlockForWriting(&PlayerLock);
+
+	ClosePlayerCache();
+	PlayerControlMutex.unlock();
+
+	FreePlayerSource(&Source);
+}
+
+BOOL StartPlayer()
+{
+	std::lock_guard<std::mutex> Control(PlayerControlMutex);
+
+	QWORD Start;
+	BOOL Cached;
+
+	if (!PlayerLoaded || !SchedulerFreq)
+		return FALSE;
+
+	// Only the app's calls start it, and they all go through PlayerControlMutex
+	if (PlayerPlaying)
+		return TRUE;
+
+	// Play it again from the start, if it's over
+	Start = PlayerPosition >= PlayerSong.Length ? 0 : PlayerPosition;
+
+	// Opening the cached audio or allocating the recording can take a while, the audio thread
+	// doesn't look at the cache before the player is playing, so it doesn't have to wait for it.
+	// A play the synth is still catching up with can't be streamed
+	Cached = PlayerSpeed == 1.0 && !PlayerChasePending && StartPlayerCache(Start, PlayerSong.Length);
+
+	LockForWriting(&PlayerLock);
+
+	AnchorPlayer(Start, PlayerSwitchFrame());
+	PlayerCached = Cached;
+	PlayerPlaying = TRUE;
+
+	UnlockForWriting(&PlayerLock);
+	return TRUE;
+}
+
+BOOL StopPlayer()
+{
+	std::lock_guard<std::mutex> Control(PlayerControlMutex);
+
+	if (!PlayerLoaded)
+		return FALSE;
+
+	LockForWriting(&PlayerLock);
+
+	if (PlayerPlaying)
+	{
+		// Whatever got released ahead of time still plays, it stops right after it
+		QWORD Frame = PlayerSwitchFrame();
+
+		PlayerPlaying = PlayerCached = FALSE;
+		PlayerPosition = PlayerChasePending ? PlayerChaseTime : PlayerTimeFrom(Frame);
+		StopPlayerCache();
+		StopPlayerNotes(Frame);
+	}
+
+	UnlockForWriting(&PlayerLock);
+	return TRUE;
+}
+
+BOOL SeekPlayer(QWORD Time)
+{
+	std::lock_guard<std::mutex> Control(PlayerControlMutex);
+	std::vector<DWORD> Chase;
+	QWORD Frame;
+
+	if (!PlayerLoaded)
+		return FALSE;
+
+	if (Time > PlayerSong.Length)
+		Time = PlayerSong.Length;
+
+	// Walks the whole song, the audio thread doesn't have to wait for it
+	BuildPlayerChase(Time, Chase);
+
+	LockForWriting(&PlayerLock);
+
+	Frame = PlayerSwitchFrame();
+	StopPlayerNotes(Frame);
+
+	// A streamed play only has to move through the cached audio, otherwise the synth has to catch up with the song
+	if (!PlayerCached || !SeekPlayerCache(Time))
+	{
+		PlayerCached = FALSE;
+		StopPlayerCache();
+		SendPlayerChase(Chase, Frame);
+	}
+
+	PlayerChasePending = FALSE;
+	AnchorPlayer(Time, Frame);
+
+	UnlockForWriting(&PlayerLock);
+	return TRUE;
+}
+
+BOOL SetPlayerSpeed(DOUBLE Speed)
+{
+	std::lock_guard<std::mutex> Control(PlayerControlMutex);
+
+	if (Speed < 0.01 || Speed > 100.0)
+		return FALSE;
+
+	LockForWriting(&PlayerLock);
+
+	if (PlayerPlaying)
+	{
+		// What got released ahead of time keeps the old speed, the new one starts right after it
+		QWORD Frame = PlayerSwitchFrame();
+		QWORD Position = PlayerChasePending ? PlayerChaseTime : PlayerTimeFrom(Frame);
+
+		// The cached audio, and the one being recorded, only work at the speed they got rendered at
+		if (Speed != PlayerSpeed)
+		{
+			if (PlayerCached)
+			{
+				PlayerCached = FALSE;
+				PlayerCacheFallbacks++;
+				RequestPlayerChase(Position);
+			}
+
+			StopPlayerCache();
+		}
+
+		PlayerSpeed = Speed;
+		AnchorPlayer(Position, Frame);
+	}
+	else PlayerSpeed = Speed;
+
+	UnlockForWriting(&PlayerLock);
+	return TRUE;
+}
+
+BOOL GetPlayerPosition(QWORD* Position, QWORD* Length)
+{
+	if (!PlayerLoaded)
+		return FALSE;
+
+	if (Position) *Position = PlayerPosition;
+	if (Length) *Length = PlayerSong.Length;
+
+	return TRUE;
+}
@@ -0,0 +1,275 @@
+/*
+OmniMIDI offline renderer
+Device-less BASSMIDI instances, rendered as fast as the CPU allows
+*/
+#pragma once
+
+// The SoundFonts of a list, shared by all the instances that use that list since they only read from them
+typedef struct OfflineFontSet
+{
+	std::wstring List;
+	std::vector<HSOUNDFONT> Fonts;			// Separate from the driver's, so it can reload its own freely
+	std::vector<BASS_MIDI_FONTEX> Presets;
+	LONG Users = 0;
+};
+
+typedef struct OfflineRenderer
+{
+	HSTREAM Stream = 0;
+	DWORD Frequency = 0;
+	QWORD Position = 0;						// Frames rendered so far
+	OfflineFontSet* FontSet = NULL;
+	Settings Config;						// Own copy, never written back to the driver's ManagedSettings
+};
+
+#define OFFLINE_CHANNELS 2					// Always interleaved stereo float, regardless of MonoRendering
+#define OFFLINE_FRAMEBYTES (OFFLINE_CHANNELS * sizeof(float))
+
+// Instances can be created and destroyed from several threads at once, by batch renderers
+// OfflineMutex guards everything below
+static std::mutex OfflineMutex;
+static LONG OfflineInstances = 0;
+static BOOL OfflineOwnsBASS = FALSE;
+static std::vector<OfflineFontSet*> OfflineFontSets;
+
+// Same values LoadSettings reads at boot, but only the ones that matter to a decoding stream
+// A driver running in the same process keeps its own ManagedSettings, including the ones set by its client
+static void LoadOfflineSettings(Settings *Config)
+{
+	if (bass_initialized)
+	{
+		*Config = ManagedSettings;
+		return;
+	}
+
+	*Config = Settings();
+	Config->AudioFrequency = SynthHost_ReadSetting(L"AudioFrequency", Config->AudioFrequency);
+	Config->AudioRampIn = SynthHost_ReadSetting(L"AudioRampIn", Config->AudioRampIn);
+	Config->DisableNotesFadeOut = SynthHost_ReadSetting(L"DisableNotesFadeOut", Config->DisableNotesFadeOut);
+	Config->EnableSFX = SynthHost_ReadSetting(L"EnableSFX", Config->EnableSFX);
+	Config->FullVelocityMode = SynthHost_ReadSetting(L"FullVelocityMode", Config->FullVelocityMode);
+	Config->IgnoreNotesBetweenVel = SynthHost_ReadSetting(L"IgnoreNotesBetweenVel", Config->IgnoreNotesBetweenVel);
+	Config->IgnoreSysReset = SynthHost_ReadSetting(L"IgnoreSysReset", Config->IgnoreSysReset);
+	Config->LimitTo88Keys = SynthHost_ReadSetting(L"LimitTo88Keys", Config->LimitTo88Keys);
+	Config->LinAttMod = SynthHost_ReadSetting(L"LinAttMod", Config->LinAttMod);
+	Config->LinDecVol = SynthHost_ReadSetting(L"LinDecVol", Config->LinDecVol);
+	Config->MaxVelIgnore = SynthHost_ReadSetting(L"MaxVelIgnore", Config->MaxVelIgnore);
+	Config->MaxVoices = SynthHost_ReadSetting(L"MaxVoices", Config->MaxVoices);
+	Config->MinVelIgnore = SynthHost_ReadSetting(L"MinVelIgnore", Config->MinVelIgnore);
+	Config->NoSFGenLimits = SynthHost_ReadSetting(L"NoSFGenLimits", Config->NoSFGenLimits);
+	Config->NoteOff1 = SynthHost_ReadSetting(L"NoteOff1", Config->NoteOff1);
+	Config->PreloadSoundFonts = SynthHost_ReadSetting(L"PreloadSoundFonts", Config->PreloadSoundFonts);
+	Config->SincConv = SynthHost_ReadSetting(L"SincConv", Config->SincConv);
+	Config->SincInter = SynthHost_ReadSetting(L"SincInter", Config->SincInter);
+	Config->TransposeValue = SynthHost_ReadSetting(L"TransposeValue", Config->TransposeValue);
+
+	if (!Between(Config->MinVelIgnore, 1, 127))
+		Config->MinVelIgnore = 1;
+	if (!Between(Config->MaxVelIgnore, 1, 127))
+		Config->MaxVelIgnore = 1;
+}
+
+// Has to be called with OfflineMutex held
+static void ReleaseOfflineFontSet(OfflineFontSet* Set)
+{
+	if (!Set || --Set->Users)
+		return;
+
+	for (auto it = Set->Fonts.begin(); it != Set->Fonts.end(); ++it)
+		BASS_MIDI_FontFree(*it);
+
+	OfflineFontSets.erase(std::find(OfflineFontSets.begin(), OfflineFontSets.end(), Set));
+	delete Set;
+}
+
+static BOOL LoadOfflineSoundFonts(OfflineRenderer *Renderer, LPCWSTR ListPath)
+{
+	wchar_t DefaultList[NTFS_MAX_PATH] = { 0 };
+	std::vector<SoundFontList> TempSoundFonts;
+
+	// No list specified, use the same default list the driver falls back to
+	if (!ListPath || !*ListPath)
+	{
+		if (!GetFolderPath(FOLDERID_RoamingAppData, CSIDL_APPDATA, DefaultList, sizeof(DefaultList)))
+			return FALSE;
+
+		swprintf_s(DefaultList + wcslen(DefaultList), NTFS_MAX_PATH - wcslen(DefaultList), CSFFileTemplate);
+		ListPath = DefaultList;
+	}
+
+	// Another instance already loaded the same list
+	for (auto it = OfflineFontSets.begin(); it != OfflineFontSets.end(); ++it)
+	{
+		if (!_wcsicmp((*it)->List.c_str(), ListPath))
+		{
+			Renderer->FontSet = *it;
+			Renderer->FontSet->Users++;
+			PrintMessageToDebugLog("OfflineRender", "Sharing the SoundFonts of another offline renderer.");
+
+			return BASS_MIDI_StreamSetFonts(Renderer->Stream, &Renderer->FontSet->Presets[0], (DWORD)Renderer->FontSet->Presets.size() | BASS_MIDI_FONT_EX);
+		}
+	}
+
+	LPCWSTR Extension = PathFindExtensionW(ListPath);
+	if (!_wcsicmp(Extension, L".omlist") || !_wcsicmp(Extension, L".csflist"))
+	{
+		if (!ParseSoundFontListFile(ListPath, &TempSoundFonts))
+			return FALSE;
+	}
+	else
+	{
+		// A single SoundFont, use all of its presets
+		SoundFontList SingleSF = { TRUE, FALSE, { 0 }, -1, -1, -1, 0, 0, FALSE };
+		wcsncpy(SingleSF.Path, ListPath, NTFS_MAX_PATH - 1);
+		TempSoundFonts.push_back(SingleSF);
+	}
+
+	OfflineFontSet* Set = new OfflineFontSet;
+	Set->List = ListPath;
+	Set->Users = 1;
+	InitSoundFontsFromVector(&TempSoundFonts, &Set->Fonts, &Set->Presets, Renderer->Config, TRUE);
+	OfflineFontSets.push_back(Set);
+	Renderer->FontSet = Set;
+
+	if (!Set->Presets.size())
+		return FALSE;
+
+	return BASS_MIDI_StreamSetFonts(Renderer->Stream, &Set->Presets[0], (DWORD)Set->Presets.size() | BASS_MIDI_FONT_EX);
+}
+
+// Has to be called with OfflineMutex held
+static void FreeOfflineRenderer(OfflineRenderer *Renderer)
+{
+	if (!Renderer)
+		return;
+
+	if (Renderer->Stream)
+		BASS_StreamFree(Renderer->Stream);
+
+	ReleaseOfflineFontSet(Renderer->FontSet);
+	delete Renderer;
+
+	// Last instance gone, give BASS back if we were the ones who initialized it
+	if (!--OfflineInstances && OfflineOwnsBASS && !bass_initialized)
+	{
+		// BASS_Free works on the thread's current device, which isn't necessarily the one we initialized
+		BASS_SetDevice(0);
+		BASS_Free();
+		OfflineOwnsBASS = FALSE;
+		PrintMessageToDebugLog("OfflineRender", "Freed BASS.");
+	}
+}
+
+static void DestroyOfflineRenderer(OfflineRenderer *Renderer)
+{
+	std::lock_guard<std::mutex> Lock(OfflineMutex);
+	FreeOfflineRenderer(Renderer);
+}
+
+static OfflineRenderer *CreateOfflineRenderer(DWORD Frequency, LPCWSTR ListPath)
+{
+	std::lock_guard<std::mutex> Lock(OfflineMutex);
+
+	PrintMessageToDebugLog("OfflineRender", "Creating offline renderer...");
+
+	// The driver might not be running at all, in which case we have to take care of BASS ourselves
+	if (!LoadBASSFunctions())
+	{
+		PrintMessageToDebugLog("OfflineRender", "Unable to load BASS.");
+		return NULL;
+	}
+
+	OfflineRenderer *Renderer = new OfflineRenderer;
+	LoadOfflineSettings(&Renderer->Config);
+
+	if (!Frequency)
+		Frequency = Renderer->Config.AudioFrequency;
+
+	// Device 0 is the "no sound" device, decoding channels don't need anything else
+	if (BASS_Init(0, Frequency, 0, 0, NULL))
+		OfflineOwnsBASS = TRUE;
+	else if (BASS_ErrorGetCode() != BASS_ERROR_ALREADY)
+	{
+		CheckUp(FALSE, ERRORCODE, "Offline BASS Initialization", FALSE);
+		delete Renderer;
+		return NULL;
+	}
+
+	Renderer->Frequency = Frequency;
+	OfflineInstances++;
+
+	// No async processing and no CPU limit, so that the same input always gives the same output
+	Renderer->Stream = BASS_MIDI_StreamCreate(16,
+		BASS_STREAM_DECODE | BASS_SAMPLE_FLOAT |
+		(Renderer->Config.IgnoreSysReset ? BASS_MIDI_NOSYSRESET : 0) |
+		(Renderer->Config.NoteOff1 ? BASS_MIDI_NOTEOFF1 : 0) |
+		(Renderer->Config.EnableSFX ? 0 : BASS_MIDI_NOFX) |
+		(Renderer->Config.SincInter ? BASS_MIDI_SINCINTER : 0),
+		Frequency);
+
+	if (!Renderer->Stream)
+	{
+		CheckUp(FALSE, ERRORCODE, "Offline Stream Initialization", FALSE);
+		FreeOfflineRenderer(Renderer);
+		return NULL;
+	}
+
+	BASS_ChannelSetAttribute(Renderer->Stream, BASS_ATTRIB_SRC, Renderer->Config.SincConv);
+	BASS_ChannelSetAttribute(Renderer->Stream, BASS_ATTRIB_MIDI_VOICES, Renderer->Config.MaxVoices);
+	BASS_ChannelSetAttribute(Renderer->Stream, BASS_ATTRIB_MIDI_CPU, 0);
+	BASS_ChannelSetAttribute(Renderer->Stream, BASS_ATTRIB_MIDI_KILL, Renderer->Config.DisableNotesFadeOut);
+
+	if (!LoadOfflineSoundFonts(Renderer, ListPath))
+	{
+		PrintMessageToDebugLog("OfflineRender", "No SoundFonts could be loaded for the offline renderer.");
+		FreeOfflineRenderer(Renderer);
+		return NULL;
+	}
+
+	PrintMessageToDebugLog("OfflineRender", "Offline renderer is ready.");
+	return Renderer;
+}
+
+static BOOL OfflineRendererEvent(OfflineRenderer *Renderer, DWORD SampleOffset, DWORD dwParam1)
+{
+	BASS_MIDI_EVENT Ev;
+
+	// Same rules as the scheduler, every event needs its own status byte
+	if (!CHKLRS(GETSTATUS(dwParam1)))
+		return FALSE;
+
+	if (CheckIfEventIsToIgnore(dwParam1, Renderer->Config))
+		return TRUE;
+
+	if (Renderer->Config.FullVelocityMode || Renderer->Config.TransposeValue != 0x7F)
+		dwParam1 = ReturnEditedEvent(dwParam1, Renderer->Config);
+
+	QWORD Pos = (Renderer->Position + SampleOffset) * OFFLINE_FRAMEBYTES;
+
+	if (!ShortMsgToBASSEvent(dwParam1, &Ev))
+	{
+		// Only the system reset matters here, the other system messages are meant for real-time devices
+		if (GETSTATUS(dwParam1) == 0xFF)
+			return BASS_MIDI_StreamEvent(Renderer->Stream, 0, MIDI_EVENT_SYSTEMEX, MIDI_SYSTEM_DEFAULT);
+
+		return TRUE;
+	}
+
+	// Too far for a 32-bit position, apply it right away
+	if (Pos > MAXDWORD)
+		return BASS_MIDI_StreamEvent(Renderer->Stream, Ev.chan, Ev.event, Ev.param);
+
+	Ev.pos = (DWORD)Pos;
+	return BASS_MIDI_StreamEvents(Renderer->Stream, BASS_MIDI_EVENTS_STRUCT | BASS_MIDI_EVENTS_ABSTIME, &Ev, 1) > 0;
+}
+
+static DWORD OfflineRendererRender(OfflineRenderer *Renderer, float *Buffer, DWORD Frames)
+{
+	DWORD Bytes = BASS_ChannelGetData(Renderer->Stream, Buffer, (Frames * OFFLINE_FRAMEBYTES) | BASS_DATA_FLOAT);
+
+	if (Bytes == (DWORD)-1)
+		return 0;
+
+	Renderer->Position += Bytes / OFFLINE_FRAMEBYTES;
+	return Bytes / OFFLINE_FRAMEBYTES;
+}
@@ -46,9 +46,11 @@ typedef long NTSTATUS;
 #include <sstream>
 #include <stdio.h>
 #include <vector>
+#include <algorithm>
 #include <Dbghelp.h>
 #include <assert.h>
 #include <strsafe.h>
+#include <sddl.h>
 #include <VersionHelpers.h>
 #include "NTDLLDummy.h"
 #include "Resource.h"
@@ -79,11 +81,31 @@ typedef long NTSTATUS;
 
 // OmniMIDI vital parts
 #include "SoundFontLoader.h"
+#include "AppListIndex.h"
+#include "PatchCache.h"
 #include "PermafrostIPC.h"
+#include "VoiceBudget.h"
+#include "ControllerDecimation.h"
+#include "SynthState.h"
 #include "BufferSystem.h"
+#include "TimerWheel.h"
+#include "EventScheduler.h"
+#include "SMFSequence.h"
+#include "PlayerCache.h"
+#include "MIDIPlayer.h"
+#include "SynthHost.h"
+#include "EarlyQueue.h"
+#include "DriverStats.h"
+#include "Limiter.h"
+#include "Effects.h"
+#include "DeviceCache.h"
 #include "Settings.h"
 #include "BlacklistSystem.h"
 #include "DriverInit.h"
+#include "LiveConfig.h"
+#include "OutputRecovery.h"
+#include "InstanceLinger.h"
+#include "OfflineRender.h"
 #include "KDMAPI.h"
 
 BOOL APIENTRY DllMain(HMODULE hModule, DWORD CallReason, LPVOID lpReserved)
@@ -132,7 +154,11 @@ LONG WINAPI DriverProc(DWORD dwDriverIdentifier, HANDLE hdrvr, UINT uMsg, LONG l
 	switch (uMsg)
 	{
 	case DRV_LOAD:
+		return DRVCNF_OK;
+
 	case DRV_FREE:
+		// Don't leave a parked engine running in a DLL that's about to go away
+		StopLinger();
 		return DRVCNF_OK;
 
 	case DRV_OPEN:
@@ -363,8 +389,12 @@ extern "C" MMRESULT WINAPI modMessage(UINT uDeviceID, UINT uMsg, DWORD_PTR dwUse
 	switch (uMsg)
 	{
 	case MODM_DATA:
+		// Still initializing, queue it until the stream is ready
+		if (EarlyQueueActive && QueueEarlyShort(STRIPPORT(dwParam1)))
+			return MMSYSERR_NOERROR;
+
 		// Parse the data lol
-		_PrsData(dwParam1);
+		_PrsData(STRIPPORT(dwParam1));
 		return MMSYSERR_NOERROR;
 	case MODM_LONGDATA:
 		// Safety check: dwParam1 must be a valid MIDIHDR pointer
@@ -593,8 +623,9 @@ extern "C" MMRESULT WINAPI modMessage(UINT uDeviceID, UINT uMsg, DWORD_PTR dwUse
 		return RetVal;
 	}
 	case MODM_RESET:
-		// Stop all the current active voices
-		ResetSynth(FALSE, OMCookedMode ? TRUE : FALSE);
+		// Stop all the current active voices, or forget what got queued if the stream isn't ready yet
+		if (!ClearEarlyQueue())
+			ResetSynth(FALSE, OMCookedMode ? TRUE : FALSE);
 
 		PrintMessageToDebugLog("MODM_RESET", (OMCookedPlayer != nullptr ? "The app requested OmniMIDI to reset CookedPlayer." : "The app sent a reset command."));
 		return (OMCookedMode ? DequeueMIDIHDRs() : MMSYSERR_NOERROR);
@@ -666,7 +697,7 @@ extern "C" MMRESULT WINAPI modMessage(UINT uDeviceID, UINT uMsg, DWORD_PTR dwUse
 			return AlreadyInitializedViaKDMAPI ? MMSYSERR_ALLOCATED : MMSYSERR_INVALPARAM;
 		}
 
-		if (!AlreadyInitializedViaKDMAPI && !bass_initialized)
+		if (!AlreadyInitializedViaKDMAPI && !bass_initialized && !EarlyQueueActive)
 		{
 			// Prevent the app from calling MODM_OPEN again...
 			PreventInit = TRUE;
@@ -724,13 +755,14 @@ extern "C" MMRESULT WINAPI modMessage(UINT uDeviceID, UINT uMsg, DWORD_PTR dwUse
 			// Prevent the app from calling MODM_CLOSE again...
 			PreventInit = TRUE;
 
-			if (DriverInitStatus)
+			if (DriverInitStatus || EarlyQueueActive)
 			{
 				// Prevent BASS from reinitializing itself
 				block_bassinit = TRUE;
 
 				PrintMessageToDebugLog("MODM_CLOSE", "The app requested the driver to terminate its audio stream.");
-				ResetSynth(TRUE, TRUE);
+				if (!ClearEarlyQueue())
+					ResetSynth(TRUE, TRUE);
 
 				PrintMessageToDebugLog("MODM_CLOSE", "Terminating driver...");
 				KillOldCookedPlayer();
@@ -753,6 +785,10 @@ extern "C" MMRESULT WINAPI modMessage(UINT uDeviceID, UINT uMsg, DWORD_PTR dwUse
 	}
 	case MODM_CACHEPATCHES:
 	case MODM_CACHEDRUMPATCHES:
+		// Safety check: dwParam1 must be a valid PATCHARRAY/KEYARRAY pointer
+		if (dwParam1 < 0x100000)
+			return MMSYSERR_INVALPARAM;
+		return CachePatches(uMsg == MODM_CACHEDRUMPATCHES, (WORD *)dwParam1, (DWORD)dwParam2);
 	case DRV_QUERYDEVICEINTERFACESIZE:
 	case DRV_QUERYDEVICEINTERFACE:
 		return MMSYSERR_NOERROR;
@@ -0,0 +1,163 @@
+/*
+OmniMIDI output recovery
+When the device goes away (unplugged, default device switch, driver reset), only the sink gets reopened.
+OMStream, the SoundFonts loaded into it, the channels' state and the DSPs are left alone.
+*/
+#pragma once
+
+#define OUTPUT_RECOVERY_FULL_AFTER 40	// Failed attempts (one per watchdog pass) before falling back to a full restart
+
+// CheckOutput results
+#define OUTPUT_OK	0	// Alive, or reopened
+#define OUTPUT_DOWN	1	// Still down, try again on the next pass
+#define OUTPUT_LOST	2	// Reopening the output alone isn't enough, do a full restart
+
+static DWORD OutputRecoveryFails = 0;
+
+// The stream handle is still valid, everything in it can be kept
+BOOL IsStreamAlive()
+{
+	BASS_CHANNELINFO Info;
+	return OMStream && BASS_ChannelGetInfo(OMStream, &Info);
+}
+
+// Is something still pulling audio out of OMStream?
+BOOL IsOutputAlive()
+{
+	switch (ManagedSettings.CurrentEngine)
+	{
+	case BASS_OUTPUT:
+	{
+		// Another app owns the device, nothing we can do about it
+		if (HostSessionMode)
+			return TRUE;
+
+		DWORD State = BASS_ChannelIsActive(OMStream);
+		return (State != BASS_ACTIVE_STOPPED && State != BASS_ACTIVE_PAUSED_DEVICE);
+	}
+
+	case WASAPI_ENGINE:
+		return BASS_WASAPI_IsStarted();
+
+#if !defined(_M_ARM64)
+	case ASIO_ENGINE:
+		return BASS_ASIO_IsStarted();
+#endif
+
+	// XAudio2 reopens itself from WriteFrame, and the .WAV mode has no device
+	default:
+		return TRUE;
+	}
+}
+
+// Reopens the sink around the existing OMStream
+BOOL RestartOutput()
+{
+	BOOL Reopened = FALSE;
+	LONGLONG Start = LiveTimerStart();
+
+	switch (ManagedSettings.CurrentEngine)
+	{
+	case BASS_OUTPUT:
+	{
+		DWORD Flags = (ManagedSettings.ReduceBootUpDelay ? 0 : BASS_DEVICE_LATENCY) | BASS_DEVICE_STEREO;
+
+		// Reinitialize the device in place, the channels playing on it are kept
+		Reopened = BASS_Init(BASS_GetDevice(), ManagedSettings.AudioFrequency, Flags | BASS_DEVICE_REINIT, 0, NULL);
+
+		// The device is gone for good, move the stream to the one the user wants now
+		if (!Reopened)
+		{
+			LONG Device = BASSDetectID();
+
+			// Already initialized (the user picked a device BASS still has open) is fine, it only has to become the current one
+			if (BASS_Init(Device, ManagedSettings.AudioFrequency, Flags, 0, NULL) || (BASS_ErrorGetCode() == BASS_ERROR_ALREADY && BASS_SetDevice(Device)))
+				Reopened = BASS_ChannelSetDevice(OMStream, BASS_GetDevice());
+			else
+				CheckUp(FALSE, ERRORCODE, "Output Recovery BASS Initialization", FALSE);
+		}
+
+		if (Reopened)
+			Reopened = BASS_ChannelPlay(OMStream, FALSE);
+
+		break;
+	}
+
+	case WASAPI_ENGINE:
+	{
+		// FreeUpBASSWASAPI skips devices that aren't started anymore, which is the case here
+		BASS_WASAPI_Stop(TRUE);
+		BASS_WASAPI_Free();
+
+		Reopened = OpenWASAPIOutput(TRUE) && BASS_WASAPI_IsStarted();
+		if (!Reopened)
+			BASS_WASAPI_Free();
+
+		break;
+	}
+
+#if !defined(_M_ARM64)
+	case ASIO_ENGINE:
+	{
+		BASS_ASIO_Stop();
+		BASS_ASIO_Free();
+
+		LONG DeviceToUse = ASIODetectID();
+		if (DeviceToUse == -1)
+			break;
+
+		Reopened = OpenASIOOutput(DeviceToUse, TRUE) && BASS_ASIO_IsStarted();
+		if (!Reopened)
+			BASS_ASIO_Free();
+
+		break;
+	}
+#endif
+
+	default:
+		return TRUE;
+	}
+
+	if (!Reopened)
+		return FALSE;
+
+	LARGE_INTEGER Now;
+	QueryPerformanceCounter(&Now);
+
+	OutputRecoveryLast = (FLOAT)((DOUBLE)(Now.QuadPart - Start) * 1000.0 / LiveQPCFreq.QuadPart);
+	if (OutputRecoveryLast > OutputRecoveryMax)
+		OutputRecoveryMax = OutputRecoveryLast;
+	OutputRecoveries++;
+
+	PrintVarToDebugLog("RestartOutput", "Output reopened in (ms)", &OutputRecoveryLast, PRINT_FLOAT);
+	return TRUE;
+}
+
+// Called by the watchdog before it checks the stream itself
+DWORD CheckOutput()
+{
+	if (IsOutputAlive())
+	{
+		OutputRecoveryFails = 0;
+		return OUTPUT_OK;
+	}
+
+	if (IsStreamAlive() && OutputRecoveryFails < OUTPUT_RECOVERY_FULL_AFTER)
+	{
+		if (!OutputRecoveryFails)
+			PrintMessageToDebugLog("StreamWatchdog", "The output is down! Reopening it...");
+
+		if (RestartOutput())
+		{
+			OutputRecoveryFails = 0;
+			return OUTPUT_OK;
+		}
+
+		OutputRecoveryFails++;
+		return OUTPUT_DOWN;
+	}
+
+	PrintMessageToDebugLog("StreamWatchdog", "Couldn't reopen the output alone, falling back to a full restart.");
+	OutputRecoveryFails = 0;
+	return OUTPUT_LOST;
+}
@@ -0,0 +1,137 @@
+/*
+OmniMIDI patch caching
+Apps using MODM_CACHEPATCHES/MODM_CACHEDRUMPATCHES tell us which programs they're going to use.
+The requests are queued in a bitmap, and the health thread loads the matching presets
+from the active SoundFonts a few at a time, so that the first notes don't stall on sample loading.
+*/
+#pragma once
+
+#define PATCH_BANKS 129			// 0-127 for melodic banks, 128 for drum kits (like BASSMIDI)
+#define PATCH_DRUMBANK 128
+#define PATCH_BUDGET_MS 20		// How long the health thread can spend loading presets on each pass
+
+// Bit N of PatchPending[Bank][N / 32] is set when preset N of Bank has to be loaded
+static volatile LONG PatchPending[PATCH_BANKS][128 / 32] = { 0 };
+static volatile LONG PatchRequested = 0;
+static volatile LONG PatchLoaded = 0;
+static volatile LONG PatchDropped = 0;
+
+static BOOL IsPatchPending(DWORD Bank, DWORD Preset)
+{
+	return (PatchPending[Bank][Preset >> 5] & (LONG)(1u << (Preset & 31))) != 0;
+}
+
+static void SetPatchPending(DWORD Bank, DWORD Preset, BOOL Pending)
+{
+	LONG Bit = (LONG)(1u << (Preset & 31));
+
+	if (Pending)
+	{
+		if (!(InterlockedOr(&PatchPending[Bank][Preset >> 5], Bit) & Bit))
+			InterlockedIncrement(&PatchRequested);
+	}
+	else if (InterlockedAnd(&PatchPending[Bank][Preset >> 5], ~Bit) & Bit)
+		InterlockedIncrement(&PatchDropped);
+}
+
+// MODM_CACHEPATCHES: Patches[N] has a bit set for every channel that uses program N of Bank
+// MODM_CACHEDRUMPATCHES: Patches[N] has a bit set for every channel that uses key N of drum kit Preset
+// BASSMIDI can only load whole presets, so a drum kit gets loaded as soon as any of its keys is requested
+MMRESULT CachePatches(BOOL Drums, WORD *Patches, DWORD Param)
+{
+	DWORD Bank = Drums ? PATCH_DRUMBANK : (HIWORD(Param) & 0x7F);
+	DWORD Flags = LOWORD(Param);
+
+	if (!Patches)
+		return MMSYSERR_INVALPARAM;
+
+	// Report what's still being loaded as not cached
+	// Only the app's array gets written, the queue is left alone
+	if (Flags == MIDI_CACHE_QUERY)
+	{
+		for (DWORD i = 0; i < 128; i++)
+		{
+			if (IsPatchPending(Bank, Drums ? (HIWORD(Param) & 0x7F) : i))
+				Patches[i] = 0;
+		}
+
+		return MMSYSERR_NOERROR;
+	}
+
+	for (DWORD i = 0; i < 128; i++)
+	{
+		DWORD Preset = Drums ? (HIWORD(Param) & 0x7F) : i;
+
+		switch (Flags)
+		{
+		case MIDI_CACHE_ALL:
+		case MIDI_CACHE_BESTFIT:
+			if (Patches[i])
+				SetPatchPending(Bank, Preset, TRUE);
+			break;
+
+		// Nothing gets unloaded, but drop what hasn't been loaded yet
+		case MIDI_UNCACHE:
+			if (Patches[i])
+				SetPatchPending(Bank, Preset, FALSE);
+			break;
+
+		default:
+			return MMSYSERR_INVALFLAG;
+		}
+	}
+
+	return MMSYSERR_NOERROR;
+}
+
+// Loads the preset from every SoundFont that would end up playing it
+static void LoadCachedPatch(int Bank, int Preset)
+{
+	for (auto FEX = SoundFontPresets.begin(); FEX != SoundFontPresets.end(); ++FEX)
+	{
+		// Skip the fonts mapped to something else
+		if ((FEX->dpreset != -1 && FEX->dpreset != Preset) || (FEX->dbank != -1 && FEX->dbank != Bank))
+			continue;
+
+		// The font might be missing the preset, that's fine
+		BASS_MIDI_FontLoad(FEX->font, (FEX->spreset != -1) ? FEX->spreset : Preset, (FEX->sbank != -1) ? FEX->sbank : Bank);
+	}
+}
+
+// Called by the health thread
+void ProcessPatchCache()
+{
+	ULONGLONG Start = GetTickCount64();
+	BOOL Loaded = FALSE;
+
+	if (!OMStream)
+		return;
+
+	for (DWORD Bank = 0; Bank < PATCH_BANKS; Bank++)
+	{
+		for (DWORD Word = 0; Word < 128 / 32; Word++)
+		{
+			while (PatchPending[Bank][Word])
+			{
+				DWORD Bit;
+				_BitScanForward(&Bit, PatchPending[Bank][Word]);
+
+				// Clear it before loading, so that a request coming in while we're at it doesn't get lost
+				LONG Mask = (LONG)(1u << Bit);
+				if (!(InterlockedAnd(&PatchPending[Bank][Word], ~Mask) & Mask))
+					continue;
+
+				LoadCachedPatch(Bank, (Word << 5) | Bit);
+				InterlockedIncrement(&PatchLoaded);
+				Loaded = TRUE;
+
+				// Leave the rest for the next pass
+				if (GetTickCount64() - Start >= PATCH_BUDGET_MS)
+					return;
+			}
+		}
+	}
+
+	if (Loaded)
+		PrintMessageToDebugLog("ProcessPatchCache", "All the requested patches have been loaded.");
+}
@@ -0,0 +1,742 @@
+/*
+OmniMIDI rendered audio cache
+Games and kiosks loop the same song over and over, and the synth renders the exact same audio every time.
+While enabled ("PlayerAudioCache"), the first play of a MIDI file from its start gets recorded to disk,
+and the next plays of the same song, with the same settings, soundfonts and output format,
+stream that audio back instead of having BASSMIDI render it all over again.
+The audio is taken right after the synth, before the effects, the limiter and the volume are applied.
+Anything that would make it sound different (events from the app, seeks, speed changes, a new stream...)
+drops the recording, or hands the playback back to the synth from where it was.
+*/
+#pragma once
+
+#define PCACHE_MAGIC		0x43524D4F	// "OMRC"
+#define PCACHE_VERSION		1
+#define PCACHE_TAIL_MS		2000		// Recorded past the end of the song, for the releases and the reverb
+#define PCACHE_PRIORITY		10			// Right after the synth, before the effects (2) and the limiter (-100)
+
+#define PCACHE_IDLE			0
+#define PCACHE_ARMED		1			// Starts recording with the next block
+#define PCACHE_RECORDING	2
+#define PCACHE_DONE			3			// Waiting for the health thread to write it down
+#define PCACHE_QUEUED		4			// Starts streaming with the next block
+#define PCACHE_STREAMING	5
+
+typedef struct PlayerCacheHeader
+{
+	DWORD Magic;
+	DWORD Version;
+	QWORD Key;					// Fingerprint of the song, settings, soundfonts and synth state
+	QWORD SongLength;			// us
+	QWORD Frames;
+	DWORD Freq;
+	DWORD Chans;
+	DWORD SampleSize;			// sizeof(float) or sizeof(SHORT), 8-bit streams don't get cached
+	FLOAT LiveUs;				// Time it took to render a second of it live, measured while recording
+} PlayerCacheHeader;
+
+static LockSystem PlayerCacheLock = { 0, 0 };
+static volatile DWORD PlayerCacheMode = PCACHE_IDLE;
+static volatile BOOL PlayerCacheTainted = FALSE;	// Something else reached the synth during the recording
+static volatile BOOL PlayerCacheLost = FALSE;		// The cached audio couldn't be read anymore
+static volatile DWORD PlayerCacheOwner = 0;			// Thread releasing the player's events, those are part of the recording
+static QWORD PlayerCacheSongKey = 0;				// Hash of the loaded song, 0 if the cache was off when it got loaded
+
+// The stream the DSP sits on, and its format
+static HSTREAM PlayerCacheStream = 0;
+static DWORD PlayerCacheFreq = 0;
+static DWORD PlayerCacheChans = 0;
+static DWORD PlayerCacheSampleSize = 0;
+
+// Recording, kept in memory until the health thread writes it down
+static PlayerCacheHeader PlayerCacheRecEntry;
+static wchar_t PlayerCacheRecPath[MAX_PATH] = { 0 };
+static BYTE* PlayerCacheRec = NULL;
+static QWORD PlayerCacheRecSize = 0;			// Song plus tail, in bytes
+static QWORD PlayerCacheRecBytes = 0;
+static QWORD PlayerCacheRecMin = 0;				// The song alone, a recording cut short after it is still worth keeping
+static DOUBLE PlayerCacheRecUs = 0.0;
+static QWORD PlayerCacheRecTimed = 0;			// Frames covered by PlayerCacheRecUs
+
+// Streaming, off a mapped file
+static PlayerCacheHeader PlayerCacheEntry;
+static HANDLE PlayerCacheFile = INVALID_HANDLE_VALUE;
+static HANDLE PlayerCacheMapping = NULL;
+static const BYTE* PlayerCacheView = NULL;
+static QWORD PlayerCacheRead = 0;				// Byte offsets into the audio data
+static QWORD PlayerCacheTail = 0;				// The previous play's tail, still ringing when the song got restarted
+static QWORD PlayerCacheTailEnd = 0;
+static DOUBLE PlayerCacheHitTotalUs = 0.0;
+static QWORD PlayerCacheHitTimed = 0;
+
+static LARGE_INTEGER PlayerCacheBlockStart = { 0 };
+static LARGE_INTEGER PlayerCacheQPCFreq = { 0 };
+
+// Stats, printed to the debug pipe
+static volatile QWORD PlayerCacheHits = 0;			// Plays streamed from the cache
+static volatile QWORD PlayerCacheMisses = 0;		// Plays that had to be rendered live
+static volatile QWORD PlayerCacheFallbacks = 0;		// Streamed plays the synth had to take over
+static volatile QWORD PlayerCacheWritten = 0;		// Recordings written to the store
+static volatile FLOAT PlayerCacheLiveUs = 0.0f;		// Render time per second of audio, live
+static volatile FLOAT PlayerCacheHitUs = 0.0f;		// Same, while streaming from the cache
+static volatile FLOAT PlayerCacheSavedMs = 0.0f;	// Render time saved so far, based on the two
+
+#define PCACHE_FNV_BASIS	0xCBF29CE484222325ULL
+#define PCACHE_FNV_PRIME	0x100000001B3ULL
+
+// FNV-1a, a word at a time since a song can take hundreds of MBs
+static QWORD PlayerCacheHash(QWORD Hash, const void* Data, size_t Length)
+{
+	const BYTE* Bytes = (const BYTE*)Data;
+	QWORD Word;
+
+	for (; Length >= sizeof(QWORD); Bytes += sizeof(QWORD), Length -= sizeof(QWORD))
+	{
+		memcpy(&Word, Bytes, sizeof(QWORD));
+		Hash = (Hash ^ Word) * PCACHE_FNV_PRIME;
+		Hash ^= Hash >> 32;
+	}
+
+	for (; Length; Length--)
+		Hash = (Hash ^ *Bytes++) * PCACHE_FNV_PRIME;
+
+	return Hash;
+}
+
+static BOOL PlayerCacheOn()
+{
+	return SynthHost_ReadSetting(L"PlayerAudioCache", 0) != 0;
+}
+
+// Size of the store, "PlayerAudioCacheSize" (MB)
+static QWORD PlayerCacheLimit()
+{
+	return (QWORD)SynthHost_ReadSetting(L"PlayerAudioCacheSize", 1024) << 20;
+}
+
+static BOOL PlayerCacheDir(wchar_t* Dir, size_t Size)
+{
+	if (!GetFolderPath(FOLDERID_LocalAppData, CSIDL_LOCAL_APPDATA, Dir, Size))
+		return FALSE;
+
+	StringCchCatW(Dir, Size, L"\\OmniMIDI");
+	CreateDirectoryW(Dir, NULL);
+	StringCchCatW(Dir, Size, L"\\AudioCache");
+	CreateDirectoryW(Dir, NULL);
+
+	return TRUE;
+}
+
+// Called by LoadPlayerSong, outside of the player lock. Returns 0 if the cache is off
+QWORD HashPlayerCacheSong(const BYTE* Data, size_t Length)
+{
+	if (!PlayerCacheOn())
+		return 0;
+
+	return PlayerCacheHash(PCACHE_FNV_BASIS, Data, Length) | 1;
+}
+
+// Everything that has a say in what comes out of the synth, other than the song's own events
+static QWORD PlayerCacheKey(QWORD SongLength)
+{
+	BASS_MIDI_FONTINFO Info;
+	QWORD Key = PlayerCacheHash(PCACHE_FNV_BASIS, &PlayerCacheSongKey, sizeof(QWORD));
+	DWORD Format[] = { PCACHE_VERSION, PlayerCacheFreq, PlayerCacheChans, PlayerCacheSampleSize };
+	DWORD Render[] = {
+		ManagedSettings.MaxVoices, ManagedSettings.MaxRenderingTime,
+		ManagedSettings.SincInter, ManagedSettings.SincConv,
+		ManagedSettings.NoteOff1, ManagedSettings.EnableSFX,
+		ManagedSettings.IgnoreSysReset, ManagedSettings.DisableNotesFadeOut,
+		ManagedSettings.FullVelocityMode, ManagedSettings.TransposeValue,
+		ManagedSettings.IgnoreAllEvents, ManagedSettings.IgnoreNotesBetweenVel,
+		ManagedSettings.MinVelIgnore, ManagedSettings.MaxVelIgnore,
+		ManagedSettings.LimitTo88Keys, ManagedSettings.AudioRampIn,
+		ManagedSettings.LinAttMod, ManagedSettings.LinDecVol,
+		ManagedSettings.NoSFGenLimits, ManagedSettings.OverrideInstruments,
+		ManagedSettings.ConcertPitch, (DWORD)VoiceBudgetOn
+	};
+
+	Key = PlayerCacheHash(Key, &SongLength, sizeof(QWORD));
+	Key = PlayerCacheHash(Key, Format, sizeof(Format));
+	Key = PlayerCacheHash(Key, Render, sizeof(Render));
+	Key = PlayerCacheHash(Key, cbank, sizeof(cbank));
+	Key = PlayerCacheHash(Key, cpreset, sizeof(cpreset));
+	Key = PlayerCacheHash(Key, pitchshiftchan, sizeof(pitchshiftchan));
+
+	// The soundfonts, in the order the synth looks them up
+	for (auto FEX = SoundFontPresets.begin(); FEX != SoundFontPresets.end(); ++FEX)
+	{
+		int Map[] = { FEX->spreset, FEX->sbank, FEX->dpreset, FEX->dbank, FEX->dbanklsb };
+		Key = PlayerCacheHash(Key, Map, sizeof(Map));
+
+		if (BASS_MIDI_FontGetInfo(FEX->font, &Info))
+		{
+			DWORD Id[] = { Info.presets, Info.samsize, Info.samtype };
+			Key = PlayerCacheHash(Key, Id, sizeof(Id));
+			if (Info.name) Key = PlayerCacheHash(Key, Info.name, strlen(Info.name));
+		}
+	}
+
+	// What the channels have been told so far, the song might rely on it
+	Key = PlayerCacheHash(Key, SynthState.Channels, sizeof(SynthState.Channels));
+	Key = PlayerCacheHash(Key, SynthState.ResetSysEx, SynthState.ResetSysExLen);
+
+	return Key;
+}
+
+// Adds the cached audio to what the synth rendered. Returns FALSE if the file couldn't be read
+static BOOL MixPlayerCache(void* Buffer, DWORD Length, QWORD* Pos, QWORD End)
+{
+	DWORD Bytes = (DWORD)min((QWORD)Length, End - *Pos);
+	const BYTE* Src = PlayerCacheView + sizeof(PlayerCacheHeader) + *Pos;
+
+	__try
+	{
+		if (PlayerCacheSampleSize == sizeof(float))
+		{
+			float* Out = (float*)Buffer;
+			const float* In = (const float*)Src;
+
+			for (DWORD i = 0; i < Bytes / sizeof(float); i++)
+				Out[i] += In[i];
+		}
+		else
+		{
+			SHORT* Out = (SHORT*)Buffer;
+			const SHORT* In = (const SHORT*)Src;
+
+			for (DWORD i = 0; i < Bytes / sizeof(SHORT); i++)
+			{
+				int Sample = Out[i] + In[i];
+				Out[i] = (SHORT)(Sample > 32767 ? 32767 : (Sample < -32768 ? -32768 : Sample));
+			}
+		}
+	}
+	__except (GetExceptionCode() == EXCEPTION_IN_PAGE_ERROR ? EXCEPTION_EXECUTE_HANDLER : EXCEPTION_CONTINUE_SEARCH)
+	{
+		return FALSE;
+	}
+
+	*Pos += Bytes;
+	return TRUE;
+}
+
+// Has to be called with PlayerCacheLock held
+static void FinishPlayerCacheRecording()
+{
+	DOUBLE Seconds = (DOUBLE)PlayerCacheRecTimed / PlayerCacheRecEntry.Freq;
+
+	PlayerCacheRecEntry.Frames = PlayerCacheRecBytes / (PlayerCacheRecEntry.Chans * PlayerCacheRecEntry.SampleSize);
+	PlayerCacheRecEntry.LiveUs = Seconds ? (FLOAT)(PlayerCacheRecUs / Seconds) : 0.0f;
+	PlayerCacheLiveUs = PlayerCacheRecEntry.LiveUs;
+	PlayerCacheMode = PCACHE_DONE;
+}
+
+// Keeps the recording if the whole song made it in, drops it otherwise. Has to be called with PlayerCacheLock held
+static void CutPlayerCacheRecording()
+{
+	if (PlayerCacheRecBytes >= PlayerCacheRecMin)
+		FinishPlayerCacheRecording();
+	else
+		PlayerCacheMode = PCACHE_IDLE;
+}
+
+static void CALLBACK PlayerCacheProc(HDSP handle, DWORD channel, void* buffer, DWORD length, void* user)
+{
+	LARGE_INTEGER End;
+	DWORD Bytes, Frames;
+	DOUBLE Us;
+
+	if (PlayerCacheMode != PCACHE_RECORDING && PlayerCacheMode != PCACHE_STREAMING && PlayerCacheTail >= PlayerCacheTailEnd)
+		return;
+
+	LockForWriting(&PlayerCacheLock);
+
+	switch (PlayerCacheMode)
+	{
+	case PCACHE_RECORDING:
+		// The app got in the way, whatever it did is in this block already
+		if (PlayerCacheTainted)
+		{
+			PrintMessageToDebugLog("PlayerCache", "Another source sent events to the synth, the recording has been cut.");
+			CutPlayerCacheRecording();
+			break;
+		}
+
+		Bytes = (DWORD)min((QWORD)length, PlayerCacheRecSize - PlayerCacheRecBytes);
+		memcpy(PlayerCacheRec + PlayerCacheRecBytes, buffer, Bytes);
+		PlayerCacheRecBytes += Bytes;
+
+		if (PlayerCacheRecBytes >= PlayerCacheRecSize)
+			FinishPlayerCacheRecording();
+		break;
+
+	case PCACHE_STREAMING:
+		if (!MixPlayerCache(buffer, length, &PlayerCacheRead, PlayerCacheEntry.Frames * PlayerCacheChans * PlayerCacheSampleSize))
+		{
+			PlayerCacheLost = TRUE;
+			PlayerCacheMode = PCACHE_IDLE;
+			PlayerCacheTail = PlayerCacheTailEnd = 0;
+			break;
+		}
+
+		// The view stays around, in case the song gets played again
+		if (PlayerCacheRead >= PlayerCacheEntry.Frames * PlayerCacheChans * PlayerCacheSampleSize)
+			PlayerCacheMode = PCACHE_IDLE;
+		break;
+	}
+
+	if (PlayerCacheTail < PlayerCacheTailEnd && !MixPlayerCache(buffer, length, &PlayerCacheTail, PlayerCacheTailEnd))
+		PlayerCacheTail = PlayerCacheTailEnd = 0;
+
+	// Time spent since the player started the block, which covers the release of its events and the rendering
+	if (PlayerCacheBlockStart.QuadPart && PlayerCacheQPCFreq.QuadPart)
+	{
+		QueryPerformanceCounter(&End);
+		Us = (DOUBLE)(End.QuadPart - PlayerCacheBlockStart.QuadPart) * 1000000.0 / PlayerCacheQPCFreq.QuadPart;
+		Frames = length / (PlayerCacheChans * PlayerCacheSampleSize);
+		PlayerCacheBlockStart.QuadPart = 0;
+
+		if (PlayerCacheMode == PCACHE_RECORDING || PlayerCacheMode == PCACHE_DONE)
+		{
+			PlayerCacheRecUs += Us;
+			PlayerCacheRecTimed += Frames;
+		}
+		else if (Frames)
+		{
+			PlayerCacheHitTotalUs += Us;
+			PlayerCacheHitTimed += Frames;
+			PlayerCacheHitUs = (FLOAT)(PlayerCacheHitTotalUs * PlayerCacheFreq / PlayerCacheHitTimed);
+
+			if (PlayerCacheEntry.LiveUs > PlayerCacheHitUs)
+				PlayerCacheSavedMs += (FLOAT)((PlayerCacheEntry.LiveUs - PlayerCacheHitUs) * Frames / PlayerCacheFreq / 1000.0);
+		}
+	}
+
+	UnlockForWriting(&PlayerCacheLock);
+}
+
+// Puts the DSP on the current stream, and gets its format. The DSPs go away with the stream they were on
+static BOOL AttachPlayerCache()
+{
+	BASS_CHANNELINFO Info;
+
+	if (!OMStream || !BASS_ChannelGetInfo(OMStream, &Info) || (Info.flags & BASS_SAMPLE_8BITS))
+		return FALSE;
+
+	if (PlayerCacheStream != OMStream)
+	{
+		if (!BASS_ChannelSetDSP(OMStream, PlayerCacheProc, NULL, PCACHE_PRIORITY))
+			return FALSE;
+
+		PlayerCacheStream = OMStream;
+	}
+
+	if (!PlayerCacheQPCFreq.QuadPart)
+		QueryPerformanceFrequency(&PlayerCacheQPCFreq);
+
+	PlayerCacheFreq = Info.freq;
+	PlayerCacheChans = Info.chans;
+	PlayerCacheSampleSize = (Info.flags & BASS_SAMPLE_FLOAT) ? sizeof(float) : sizeof(SHORT);
+
+	return TRUE;
+}
+
+static QWORD __inline PlayerCacheOffset(QWORD Time)
+{
+	QWORD Frame = (QWORD)((DOUBLE)Time * PlayerCacheFreq / 1000000.0);
+	return min(Frame, PlayerCacheEntry.Frames) * PlayerCacheChans * PlayerCacheSampleSize;
+}
+
+// Ends the current play, the tail of a streamed one keeps ringing. Called by the player, with PlayerLock held
+void StopPlayerCache()
+{
+	if (PlayerCacheMode == PCACHE_IDLE)
+		return;
+
+	LockForWriting(&PlayerCacheLock);
+
+	switch (PlayerCacheMode)
+	{
+	case PCACHE_ARMED:
+		PlayerCacheMode = PCACHE_IDLE;
+		break;
+	case PCACHE_RECORDING:
+		CutPlayerCacheRecording();
+		break;
+	case PCACHE_QUEUED:
+	case PCACHE_STREAMING:
+		PlayerCacheMode = PCACHE_IDLE;
+		break;
+	}
+
+	UnlockForWriting(&PlayerCacheLock);
+}
+
+// Stops everything, and lets go of the cached file
+void ClosePlayerCache()
+{
+	HANDLE File, Mapping;
+	const BYTE* View;
+
+	StopPlayerCache();
+
+	LockForWriting(&PlayerCacheLock);
+	PlayerCacheTail = PlayerCacheTailEnd = 0;
+	File = PlayerCacheFile;
+	Mapping = PlayerCacheMapping;
+	View = PlayerCacheView;
+	PlayerCacheFile = INVALID_HANDLE_VALUE;
+	PlayerCacheMapping = NULL;
+	PlayerCacheView = NULL;
+	UnlockForWriting(&PlayerCacheLock);
+
+	if (View) UnmapViewOfFile(View);
+	if (Mapping) CloseHandle(Mapping);
+	if (File != INVALID_HANDLE_VALUE) CloseHandle(File);
+}
+
+// Maps the entry, if it's there and it matches what's about to be played
+static BOOL OpenPlayerCache(LPCWSTR Path, QWORD Key, QWORD SongLength)
+{
+	PlayerCacheHeader Header;
+	LARGE_INTEGER Size;
+	FILETIME Now;
+	DWORD Read;
+	HANDLE File = CreateFileW(Path, GENERIC_READ | FILE_WRITE_ATTRIBUTES, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
+	HANDLE Mapping = NULL;
+	const BYTE* View = NULL;
+
+	if (File == INVALID_HANDLE_VALUE)
+		return FALSE;
+
+	if (!ReadFile(File, &Header, sizeof(Header), &Read, NULL) || Read != sizeof(Header) || !GetFileSizeEx(File, &Size) ||
+		Header.Magic != PCACHE_MAGIC || Header.Version != PCACHE_VERSION || Header.Key != Key || Header.SongLength != SongLength ||
+		Header.Freq != PlayerCacheFreq || Header.Chans != PlayerCacheChans || Header.SampleSize != PlayerCacheSampleSize ||
+		(QWORD)Size.QuadPart != sizeof(Header) + Header.Frames * Header.Chans * Header.SampleSize ||
+		(ULONGLONG)Size.QuadPart > SIZE_MAX)
+	{
+		PrintMessageToDebugLog("PlayerCache", "The cached audio doesn't match the song, it'll be rendered live.");
+		CloseHandle(File);
+		return FALSE;
+	}
+
+	Mapping = CreateFileMappingW(File, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (Mapping) View = (const BYTE*)MapViewOfFile(Mapping, FILE_MAP_READ, 0, 0, 0);
+
+	if (!View)
+	{
+		PrintMessageToDebugLog("PlayerCache", "Couldn't map the cached audio, it'll be rendered live.");
+		if (Mapping) CloseHandle(Mapping);
+		CloseHandle(File);
+		return FALSE;
+	}
+
+	// Recently played entries are the last ones to be evicted
+	GetSystemTimeAsFileTime(&Now);
+	SetFileTime(File, NULL, NULL, &Now);
+
+	LockForWriting(&PlayerCacheLock);
+	PlayerCacheFile = File;
+	PlayerCacheMapping = Mapping;
+	PlayerCacheView = View;
+	PlayerCacheEntry = Header;
+	UnlockForWriting(&PlayerCacheLock);
+
+	return TRUE;
+}
+
+// Called by StartPlayer, before the player is playing and without PlayerLock, the file and the buffer would hold the
+// audio thread up otherwise. Returns TRUE if the play is going to be streamed from the cache
+BOOL StartPlayerCache(QWORD Position, QWORD SongLength)
+{
+	wchar_t Dir[MAX_PATH], Path[MAX_PATH];
+	FLOAT Voices = 0.0f;
+	QWORD Key, FrameBytes, Bytes;
+	BYTE* Rec;
+	BOOL Reuse, Ringing = PlayerCacheMode == PCACHE_STREAMING;
+
+	StopPlayerCache();
+
+	if (!PlayerCacheSongKey || !PlayerCacheOn() || !AttachPlayerCache() || !PlayerCacheDir(Dir, MAX_PATH))
+	{
+		ClosePlayerCache();
+		return FALSE;
+	}
+
+	// A play from the start always starts from a reset synth, otherwise every loop would look like a different session
+	if (!Position)
+	{
+		_BMSE(OMStream, 0, MIDI_EVENT_SYSTEM, MIDI_SYSTEM_DEFAULT);
+		for (DWORD Port = 0; Port < ActivePorts; Port++)
+			_BMSE(OMStream, (Port << 4) | 9, MIDI_EVENT_DRUMS, 1);
+
+		ResetSynthState();
+		if (DecimationOn) InvalidateDecimation(-1);
+	}
+
+	Key = PlayerCacheKey(SongLength);
+	FrameBytes = PlayerCacheChans * PlayerCacheSampleSize;
+	swprintf_s(Path, MAX_PATH, L"%s\\%016llX.omcache", Dir, Key);
+
+	// Played again with the same entry, the tail of the last play can keep going while the new one starts
+	Reuse = PlayerCacheView && PlayerCacheEntry.Key == Key && PlayerCacheStream == OMStream;
+
+	if (!Reuse)
+		ClosePlayerCache();
+
+	if (Reuse || OpenPlayerCache(Path, Key, SongLength))
+	{
+		LockForWriting(&PlayerCacheLock);
+
+		// Only if the last play made it to the end, a stopped one has already been silenced
+		if (Reuse && Ringing && PlayerCacheRead >= PlayerCacheOffset(SongLength))
+		{
+			PlayerCacheTail = PlayerCacheRead;
+			PlayerCacheTailEnd = PlayerCacheEntry.Frames * FrameBytes;
+		}
+
+		PlayerCacheRead = PlayerCacheOffset(Position);
+		PlayerCacheLost = FALSE;
+		PlayerCacheHitTotalUs = 0.0;
+		PlayerCacheHitTimed = 0;
+		PlayerCacheLiveUs = PlayerCacheEntry.LiveUs;
+		PlayerCacheMode = PCACHE_QUEUED;
+
+		UnlockForWriting(&PlayerCacheLock);
+
+		PlayerCacheHits++;
+		PrintMessageToDebugLog("PlayerCache", "The song will be streamed from the cache.");
+		return TRUE;
+	}
+
+	PlayerCacheMisses++;
+
+	// Only a whole play can be recorded, and the last recording has to be written down first
+	if (Position || PlayerCacheMode != PCACHE_IDLE || PlayerCacheRec)
+		return FALSE;
+
+	// Whatever is still ringing would end up in the recording
+	BASS_ChannelGetAttribute(OMStream, BASS_ATTRIB_MIDI_VOICES_ACTIVE, &Voices);
+	if (Voices > 0.0f)
+	{
+		PrintMessageToDebugLog("PlayerCache", "The synth is still playing something, this play won't be recorded.");
+		return FALSE;
+	}
+
+	Bytes = ((SongLength / 1000 + PCACHE_TAIL_MS) * PlayerCacheFreq / 1000) * FrameBytes;
+	if (sizeof(PlayerCacheHeader) + Bytes > PlayerCacheLimit() || Bytes > SIZE_MAX)
+	{
+		PrintMessageToDebugLog("PlayerCache", "The song would take more space than the cache has, it won't be recorded.");
+		return FALSE;
+	}
+
+	// The pages only get touched as the recording goes
+	Rec = (BYTE*)VirtualAlloc(NULL, (SIZE_T)Bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+	if (!Rec)
+	{
+		PrintMessageToDebugLog("PlayerCache", "Couldn't allocate the recording buffer.");
+		return FALSE;
+	}
+
+	LockForWriting(&PlayerCacheLock);
+
+	PlayerCacheRecEntry.Magic = PCACHE_MAGIC;
+	PlayerCacheRecEntry.Version = PCACHE_VERSION;
+	PlayerCacheRecEntry.Key = Key;
+	PlayerCacheRecEntry.SongLength = SongLength;
+	PlayerCacheRecEntry.Frames = 0;
+	PlayerCacheRecEntry.Freq = PlayerCacheFreq;
+	PlayerCacheRecEntry.Chans = PlayerCacheChans;
+	PlayerCacheRecEntry.SampleSize = PlayerCacheSampleSize;
+	PlayerCacheRecEntry.LiveUs = 0.0f;
+	StringCchCopyW(PlayerCacheRecPath, MAX_PATH, Path);
+
+	PlayerCacheRec = Rec;
+	PlayerCacheRecSize = Bytes;
+	PlayerCacheRecMin = (SongLength * PlayerCacheFreq / 1000000) * FrameBytes;
+	PlayerCacheRecBytes = 0;
+	PlayerCacheRecUs = 0.0;
+	PlayerCacheRecTimed = 0;
+	PlayerCacheTainted = FALSE;
+	PlayerCacheMode = PCACHE_ARMED;
+
+	UnlockForWriting(&PlayerCacheLock);
+
+	PrintMessageToDebugLog("PlayerCache", "The song isn't in the cache yet, this play will be recorded.");
+	return FALSE;
+}
+
+// Called by SeekPlayer while streaming. Returns FALSE if the synth has to take over
+BOOL SeekPlayerCache(QWORD Time)
+{
+	BOOL Streaming;
+
+	LockForWriting(&PlayerCacheLock);
+
+	Streaming = (PlayerCacheMode == PCACHE_QUEUED || PlayerCacheMode == PCACHE_STREAMING) && !PlayerCacheLost;
+	if (Streaming)
+	{
+		PlayerCacheRead = PlayerCacheOffset(Time);
+		PlayerCacheTail = PlayerCacheTailEnd = 0;
+		PlayerCacheMode = PCACHE_QUEUED;
+	}
+
+	UnlockForWriting(&PlayerCacheLock);
+	return Streaming;
+}
+
+// Called by the player before every block it plays, with PlayerLock held.
+// Returns TRUE if a recording or a streamed play starts with this block, the song has to be lined up with it
+BOOL PlayerCacheBlock()
+{
+	BOOL Starting = FALSE;
+
+	if (PlayerCacheMode == PCACHE_IDLE || PlayerCacheMode == PCACHE_DONE)
+		return FALSE;
+
+	LockForWriting(&PlayerCacheLock);
+
+	switch (PlayerCacheMode)
+	{
+	case PCACHE_ARMED:
+		PlayerCacheMode = PCACHE_RECORDING;
+		Starting = TRUE;
+		break;
+	case PCACHE_QUEUED:
+		PlayerCacheMode = PCACHE_STREAMING;
+		Starting = TRUE;
+		break;
+	}
+
+	if (PlayerCacheMode == PCACHE_RECORDING || PlayerCacheMode == PCACHE_STREAMING)
+		QueryPerformanceCounter(&PlayerCacheBlockStart);
+
+	UnlockForWriting(&PlayerCacheLock);
+	return Starting;
+}
+
+// Called by SendToBASSMIDI, SendLongToBASSMIDI and the scheduler, for everything that isn't the player's
+void PlayerCacheInput()
+{
+	if ((PlayerCacheMode == PCACHE_ARMED || PlayerCacheMode == PCACHE_RECORDING) && GetCurrentThreadId() != PlayerCacheOwner)
+		PlayerCacheTainted = TRUE;
+}
+
+typedef struct PlayerCacheFileInfo
+{
+	FILETIME Used;
+	QWORD Size;
+	std::wstring Path;
+} PlayerCacheFileInfo;
+
+// Evicts the entries that haven't been played for the longest time, until the store fits in its size
+static void TrimPlayerCache(LPCWSTR Dir)
+{
+	std::vector<PlayerCacheFileInfo> Files;
+	WIN32_FIND_DATAW Data;
+	wchar_t Pattern[MAX_PATH];
+	QWORD Total = 0, Limit = PlayerCacheLimit();
+
+	swprintf_s(Pattern, MAX_PATH, L"%s\\*.omcache", Dir);
+
+	HANDLE Find = FindFirstFileW(Pattern, &Data);
+	if (Find == INVALID_HANDLE_VALUE)
+		return;
+
+	do
+	{
+		QWORD Size = ((QWORD)Data.nFileSizeHigh << 32) | Data.nFileSizeLow;
+		Files.push_back({ Data.ftLastWriteTime, Size, std::wstring(Dir) + L"\\" + Data.cFileName });
+		Total += Size;
+	} while (FindNextFileW(Find, &Data));
+
+	FindClose(Find);
+
+	std::sort(Files.begin(), Files.end(), [](const PlayerCacheFileInfo& A, const PlayerCacheFileInfo& B) {
+		return CompareFileTime(&A.Used, &B.Used) < 0;
+	});
+
+	// The one being streamed can't be deleted, it just gets skipped
+	for (auto F = Files.begin(); F != Files.end() && Total > Limit; ++F)
+	{
+		if (DeleteFileW(F->Path.c_str()))
+		{
+			Total -= F->Size;
+			PrintMessageToDebugLog("PlayerCache", "Evicted an entry from the cache.");
+		}
+	}
+}
+
+// Called by the health thread, writes the finished recordings down and gets rid of the dropped ones
+void ProcessPlayerCache()
+{
+	PlayerCacheHeader Header;
+	wchar_t Path[MAX_PATH], Temp[MAX_PATH], Dir[MAX_PATH];
+	BYTE* Rec;
+	DWORD Written;
+	BOOL Success;
+
+	if (!PlayerCacheRec || (PlayerCacheMode != PCACHE_DONE && PlayerCacheMode != PCACHE_IDLE))
+		return;
+
+	LockForWriting(&PlayerCacheLock);
+
+	// Checked again, StartPlayerCache might have armed a new recording in the meantime
+	if (!PlayerCacheRec || (PlayerCacheMode != PCACHE_DONE && PlayerCacheMode != PCACHE_IDLE))
+	{
+		UnlockForWriting(&PlayerCacheLock);
+		return;
+	}
+
+	Success = PlayerCacheMode == PCACHE_DONE;
+	Rec = PlayerCacheRec;
+	Header = PlayerCacheRecEntry;
+	StringCchCopyW(Path, MAX_PATH, PlayerCacheRecPath);
+	PlayerCacheRec = NULL;
+	PlayerCacheMode = PCACHE_IDLE;
+
+	UnlockForWriting(&PlayerCacheLock);
+
+	if (Success)
+	{
+		QWORD Left = Header.Frames * Header.Chans * Header.SampleSize;
+		const BYTE* Data = Rec;
+
+		// Written next to it first, so that a half-written entry never gets picked up
+		swprintf_s(Temp, MAX_PATH, L"%s.tmp", Path);
+		HANDLE File = CreateFileW(Temp, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+
+		Success = File != INVALID_HANDLE_VALUE && WriteFile(File, &Header, sizeof(Header), &Written, NULL) && Written == sizeof(Header);
+
+		while (Success && Left)
+		{
+			DWORD Chunk = (DWORD)min(Left, (QWORD)1 << 26);
+			Success = WriteFile(File, Data, Chunk, &Written, NULL) && Written == Chunk;
+			Data += Chunk;
+			Left -= Chunk;
+		}
+
+		if (File != INVALID_HANDLE_VALUE) CloseHandle(File);
+
+		if (Success && MoveFileExW(Temp, Path, MOVEFILE_REPLACE_EXISTING))
+		{
+			FLOAT MB = (FLOAT)((sizeof(Header) + Header.Frames * Header.Chans * Header.SampleSize) / 1048576.0);
+			FLOAT LiveUs = Header.LiveUs;
+
+			PlayerCacheWritten++;
+			PrintVarToDebugLog("PlayerCache", "Recording written to the cache (MB)", &MB, PRINT_FLOAT);
+			PrintVarToDebugLog("PlayerCache", "Render time per second of audio, live (us)", &LiveUs, PRINT_FLOAT);
+
+			if (PlayerCacheDir(Dir, MAX_PATH))
+				TrimPlayerCache(Dir);
+		}
+		else
+		{
+			PrintMessageToDebugLog("PlayerCache", "Couldn't write the recording to the cache.");
+			DeleteFileW(Temp);
+		}
+	}
+
+	VirtualFree(Rec, 0, MEM_RELEASE);
+}
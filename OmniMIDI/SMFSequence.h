@@ -0,0 +1,566 @@
+/*
+OmniMIDI SMF sequence
+Plays a Standard MIDI File (format 0, 1 or 2) straight out of its data, without decoding it into memory first.
+Black MIDIs can get to gigabytes, so loading only scans the tracks (in parallel) for their tempo changes,
+and keeps a seek point every SMF_SEEK_STEP events. The tracks are never merged into a single list either:
+a Cursor decodes the next event of each track as it gets to it, and merges them on the fly.
+The data has to stay valid for as long as the sequence is loaded.
+Doesn't depend on Win32, the driver takes care of mapping the file.
+*/
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+#define SMF_DEFAULT_TEMPO	500000		// 120 BPM, in microseconds per quarter note
+#define SMF_SEEK_STEP		1024		// Events between two seek points of a track, a seek decodes up to this many per track
+
+class SMFSequence {
+public:
+	typedef struct Event {
+		uint64_t Time;				// Microseconds from the start of the song
+		uint32_t Msg;				// Short message, running status resolved. 0 for long messages
+		const uint8_t* Long;		// Long message, if there's one. Only valid until the cursor moves again
+		uint32_t LongLength;
+	} Event;
+
+	uint64_t Length = 0;			// Microseconds, up to the end of the longest track
+	uint16_t Tracks = 0;
+	uint64_t EventCount = 0;
+	uint64_t MemoryUsed = 0;		// Bytes taken by the seek points and the tempo map, the events stay in the data
+
+private:
+	enum Kind { KIND_END, KIND_SHORT, KIND_LONG, KIND_TEMPO };
+
+	typedef struct Raw {
+		uint32_t Msg;				// Short message, or the tempo
+		const uint8_t* Long;		// Long message, straight from the data. nullptr for short messages
+		uint32_t LongLength;
+		uint8_t LongStatus;			// 0xF0 if the status byte has to be put back in front of the data, 0xF7 for escapes
+	} Raw;
+
+	typedef struct Tempo {
+		uint64_t Tick;
+		uint32_t Value;				// Microseconds per quarter note
+		uint16_t Track;
+	} Tempo;
+
+	// Where to pick a track up from, right after one of its events
+	typedef struct SeekPoint {
+		uint64_t Tick;
+		uint64_t Time;				// Of the event right before the point, every event before it is at this time or earlier
+		size_t Offset;				// From the start of the track
+		uint8_t Status;				// Running status
+	} SeekPoint;
+
+	typedef struct Track {
+		const uint8_t* Data;
+		const uint8_t* End;			// Where the scan stopped, the damaged part of a track is never read again
+		std::vector<SeekPoint> Points;
+		std::vector<Tempo> Tempos;	// Only while loading
+		uint64_t Base;				// Format 2 tracks start where the previous one ended
+		uint64_t LastTick;
+		size_t Count;
+	} Track;
+
+	// Walks through a track, one event at a time
+	typedef struct Reader {
+		const uint8_t* Data;
+		const uint8_t* End;
+		uint64_t Tick;
+		uint64_t Base;
+		uint64_t Time;				// Of Ev
+		size_t Seg;					// Tempo change Tick is in
+		uint8_t Status;
+		Raw Ev;
+	} Reader;
+
+	std::vector<Track> TrackList;
+	std::vector<Tempo> TempoMap;	// In time order, the first one is the default tempo on tick 0
+	std::vector<double> TempoUs;	// Time at which each tempo change starts
+	uint16_t Division = 0;
+	double UsPerTick = 0.0;			// SMPTE divisions don't care about the tempo
+
+	static uint32_t ReadBE(const uint8_t* Data, size_t Bytes) {
+		uint32_t Value = 0;
+
+		for (size_t i = 0; i < Bytes; i++)
+			Value = (Value << 8) | Data[i];
+
+		return Value;
+	}
+
+	static bool ReadVLQ(const uint8_t*& Data, const uint8_t* End, uint32_t& Value) {
+		Value = 0;
+
+		for (int i = 0; i < 4; i++) {
+			if (Data >= End)
+				return false;
+
+			Value = (Value << 7) | (*Data & 0x7F);
+			if (!(*Data++ & 0x80))
+				return true;
+		}
+
+		return false;
+	}
+
+	// Reads the next event of a track, skipping the meta events other than the tempo changes.
+	// Returns KIND_END at the end of the track, or where it's damaged
+	static Kind ReadEvent(const uint8_t*& Data, const uint8_t* End, uint64_t& Tick, uint8_t& Status, Raw& Ev) {
+		while (Data < End) {
+			uint32_t Delta, Length;
+
+			if (!ReadVLQ(Data, End, Delta) || Data >= End)
+				return KIND_END;
+
+			Tick += Delta;
+
+			if (*Data & 0x80)
+				Status = *Data++;
+			else if (!Status)
+				return KIND_END;
+
+			if (Status == 0xFF) {
+				if (Data >= End)
+					return KIND_END;
+
+				uint8_t Type = *Data++;
+
+				if (!ReadVLQ(Data, End, Length) || Length > (size_t)(End - Data))
+					return KIND_END;
+
+				if (Type == 0x2F)	// End of track
+					return KIND_END;
+
+				const uint8_t* Meta = Data;
+
+				// Meta events and SysEx cancel the running status
+				Data += Length;
+				Status = 0;
+
+				if (Type == 0x51 && Length == 3 && ReadBE(Meta, 3)) {
+					Ev.Msg = ReadBE(Meta, 3);
+					return KIND_TEMPO;
+				}
+
+				continue;
+			}
+
+			if (Status == 0xF0 || Status == 0xF7) {
+				if (!ReadVLQ(Data, End, Length) || Length > (size_t)(End - Data))
+					return KIND_END;
+
+				Ev.Msg = 0;
+				Ev.Long = Data;
+				Ev.LongLength = Length;
+				Ev.LongStatus = Status;
+
+				Data += Length;
+				Status = 0;
+
+				// An empty escape has nothing to send
+				if (Length || Ev.LongStatus == 0xF0)
+					return KIND_LONG;
+
+				continue;
+			}
+
+			if (Status >= 0xF0)	// No other system message can be in a file
+				return KIND_END;
+
+			size_t Needed = ((Status & 0xF0) == 0xC0 || (Status & 0xF0) == 0xD0) ? 1 : 2;
+
+			if ((size_t)(End - Data) < Needed)
+				return KIND_END;
+
+			Ev.Msg = Status | (Data[0] << 8) | (Needed == 2 ? (Data[1] << 16) : 0);
+			Ev.Long = nullptr;
+			Ev.LongLength = 0;
+
+			Data += Needed;
+			return KIND_SHORT;
+		}
+
+		return KIND_END;
+	}
+
+	// Counts the events of a track and collects its tempo changes, dropping a seek point every SMF_SEEK_STEP events.
+	// A damaged track keeps the events before the damage
+	static void ScanTrack(Track& T, uint16_t Index) {
+		const uint8_t* Data = T.Data;
+		uint64_t Tick = 0;
+		uint8_t Status = 0;
+		size_t Count = 0;
+		Raw Ev;
+
+		for (;;) {
+			const uint8_t* Start = Data;
+			Kind K = ReadEvent(Data, T.End, Tick, Status, Ev);
+
+			if (K == KIND_END) {
+				T.End = Start;
+				break;
+			}
+
+			if (K == KIND_TEMPO) {
+				Tempo Tmp = { Tick, Ev.Msg, Index };
+				T.Tempos.push_back(Tmp);
+				continue;
+			}
+
+			if (!(++Count % SMF_SEEK_STEP)) {
+				SeekPoint P = { Tick, 0, (size_t)(Data - T.Data), Status };
+				T.Points.push_back(P);
+			}
+		}
+
+		T.Count = Count;
+		T.LastTick = Tick;
+	}
+
+	// Runs Work(Track) on every track, spread across the available cores
+	template <class F> static bool ForEachTrack(size_t Count, unsigned Threads, F Work) {
+		std::atomic<size_t> Next(0);
+		std::atomic<bool> Failed(false);
+		std::vector<std::thread> Pool;
+
+		auto Worker = [&]() {
+			try {
+				for (size_t i = Next++; i < Count && !Failed; i = Next++)
+					Work(i);
+			}
+			catch (...) {
+				Failed = true;
+			}
+		};
+
+		if (!Threads) Threads = std::thread::hardware_concurrency();
+		if (Threads > Count) Threads = (unsigned)Count;
+
+		try {
+			for (unsigned i = 1; i < Threads; i++)
+				Pool.emplace_back(Worker);
+		}
+		catch (...) {
+			// Couldn't get more threads, the ones we got will do
+		}
+
+		Worker();
+
+		for (size_t i = 0; i < Pool.size(); i++)
+			Pool[i].join();
+
+		return !Failed;
+	}
+
+	// Seg only moves forward, so a track walks through the tempo map once
+	uint64_t ToTime(uint64_t Tick, size_t& Seg) const {
+		while (Seg + 1 < TempoMap.size() && TempoMap[Seg + 1].Tick <= Tick)
+			Seg++;
+
+		double Rate = (Division & 0x8000) ? UsPerTick : (double)TempoMap[Seg].Value / Division;
+		return (uint64_t)(TempoUs[Seg] + (double)(Tick - TempoMap[Seg].Tick) * Rate);
+	}
+
+	// Decodes the next message of the track into R, false at its end
+	bool StepReader(Reader& R) const {
+		Kind K;
+
+		do K = ReadEvent(R.Data, R.End, R.Tick, R.Status, R.Ev);
+		while (K == KIND_TEMPO);
+
+		if (K == KIND_END)
+			return false;
+
+		R.Time = ToTime(R.Tick + R.Base, R.Seg);
+		return true;
+	}
+
+	// Decodes the first message of track t at or after Time into R, false if there's none
+	bool StartReader(Reader& R, size_t t, uint64_t Time) const {
+		const Track& T = TrackList[t];
+		auto P = std::lower_bound(T.Points.begin(), T.Points.end(), Time,
+			[](const SeekPoint& p, uint64_t v) { return p.Time < v; });
+
+		R.Data = T.Data;
+		R.End = T.End;
+		R.Tick = 0;
+		R.Status = 0;
+		R.Base = T.Base;
+
+		// The last point before Time, everything before it is too early
+		if (P != T.Points.begin()) {
+			--P;
+			R.Data = T.Data + P->Offset;
+			R.Tick = P->Tick;
+			R.Status = P->Status;
+		}
+
+		R.Seg = std::upper_bound(TempoMap.begin(), TempoMap.end(), R.Tick + R.Base,
+			[](uint64_t v, const Tempo& p) { return v < p.Tick; }) - TempoMap.begin() - 1;
+
+		while (StepReader(R)) {
+			if (R.Time >= Time)
+				return true;
+		}
+
+		return false;
+	}
+
+public:
+	// Merges the tracks on the fly, in time order. Events on the same time keep their track order
+	class Cursor {
+		typedef struct Head {
+			uint64_t Time;				// Time of the next event of the track, kept here to spare a lookup per comparison
+			uint32_t Track;
+		} Head;
+
+		const SMFSequence* Seq = nullptr;
+		std::vector<Reader> Readers;	// Next event of each track, already decoded
+		std::vector<Head> Heap;			// Tracks with events left, soonest on top
+		std::vector<uint8_t> LongBuf;	// SysExes get their F0 back in here
+
+		static bool Before(const Head& a, const Head& b) {
+			return a.Time < b.Time || (a.Time == b.Time && a.Track < b.Track);
+		}
+
+		void SiftDown(size_t i) {
+			size_t Size = Heap.size();
+
+			for (;;) {
+				size_t Min = i, L = i * 2 + 1, R = L + 1;
+
+				if (L < Size && Before(Heap[L], Heap[Min])) Min = L;
+				if (R < Size && Before(Heap[R], Heap[Min])) Min = R;
+				if (Min == i) return;
+
+				std::swap(Heap[i], Heap[Min]);
+				i = Min;
+			}
+		}
+
+	public:
+		void Attach(const SMFSequence& S) {
+			Seq = &S;
+			Readers.resize(S.TrackList.size());
+			Heap.reserve(S.TrackList.size());
+			Seek(0);
+		}
+
+		void Detach() {
+			Seq = nullptr;
+			Readers.clear();
+			Heap.clear();
+		}
+
+		// Moves to the first event at or after Time
+		void Seek(uint64_t Time) {
+			Heap.clear();
+
+			if (!Seq)
+				return;
+
+			for (uint32_t t = 0; t < Readers.size(); t++) {
+				if (Seq->StartReader(Readers[t], t, Time)) {
+					Head H = { Readers[t].Time, t };
+					Heap.push_back(H);
+				}
+			}
+
+			for (size_t i = Heap.size() / 2; i-- > 0; )
+				SiftDown(i);
+		}
+
+		bool AtEnd() const { return Heap.empty(); }
+
+		// Time of the next event, UINT64_MAX past the end
+		uint64_t PeekTime() const {
+			return Heap.empty() ? UINT64_MAX : Heap[0].Time;
+		}
+
+		// Returns the next event and moves past it, only valid if AtEnd() is false
+		Event Next() {
+			Reader& R = Readers[Heap[0].Track];
+			Event Ev = { R.Time, R.Ev.Msg, R.Ev.Long, R.Ev.LongLength };
+
+			if (Ev.Long && R.Ev.LongStatus == 0xF0) {
+				LongBuf.resize(Ev.LongLength + 1);
+				LongBuf[0] = 0xF0;
+				memcpy(LongBuf.data() + 1, Ev.Long, Ev.LongLength);
+				Ev.Long = LongBuf.data();
+				Ev.LongLength++;
+			}
+
+			if (Seq->StepReader(R))
+				Heap[0].Time = R.Time;
+			else {
+				Heap[0] = Heap.back();
+				Heap.pop_back();
+			}
+
+			if (!Heap.empty())
+				SiftDown(0);
+
+			return Ev;
+		}
+	};
+
+	// Calls Fire(Track, Time, Msg) for every short message before Time, track by track
+	template <class F> void ForEachBefore(uint64_t Time, F Fire) const {
+		Reader R;
+
+		for (uint16_t t = 0; t < TrackList.size(); t++) {
+			if (!StartReader(R, t, 0))
+				continue;
+
+			do {
+				if (R.Time >= Time)
+					break;
+
+				if (!R.Ev.Long)
+					Fire(t, R.Time, R.Ev.Msg);
+			} while (StepReader(R));
+		}
+	}
+
+	void Clear() {
+		std::vector<Track>().swap(TrackList);
+		std::vector<Tempo>().swap(TempoMap);
+		std::vector<double>().swap(TempoUs);
+		Length = EventCount = MemoryUsed = 0;
+		Tracks = Division = 0;
+		UsPerTick = 0.0;
+	}
+
+	// Returns false if the data isn't a MIDI file at all, or if its index would take more than MaxMemory bytes (0 = no limit).
+	// Threads is the amount of threads scanning the tracks, 0 to use all the cores
+	bool Load(const uint8_t* Data, size_t Size, uint64_t MaxMemory = 0, unsigned Threads = 0) {
+		const uint8_t* End = Data + Size;
+		uint16_t Format;
+
+		Clear();
+
+		if (Size < 14 || memcmp(Data, "MThd", 4) || ReadBE(Data + 4, 4) < 6 || ReadBE(Data + 4, 4) > Size - 8)
+			return false;
+
+		Format = (uint16_t)ReadBE(Data + 8, 2);
+		Division = (uint16_t)ReadBE(Data + 12, 2);
+		if (Format > 2 || !Division) {
+			Clear();
+			return false;
+		}
+
+		// An SMPTE division with no frames per second or no ticks per frame would end up dividing by zero
+		if ((Division & 0x8000) && (-(int8_t)(Division >> 8) <= 0 || !(Division & 0xFF))) {
+			Clear();
+			return false;
+		}
+
+		Data += 8 + ReadBE(Data + 4, 4);
+
+		// Find the tracks first, skipping the chunks that aren't tracks
+		try {
+			while ((size_t)(End - Data) >= 8 && TrackList.size() < 0xFFFF) {
+				size_t ChunkSize = ReadBE(Data + 4, 4);
+				const uint8_t* ChunkEnd = ((size_t)(End - Data - 8) < ChunkSize) ? End : Data + 8 + ChunkSize;
+
+				if (!memcmp(Data, "MTrk", 4)) {
+					Track T = { Data + 8, ChunkEnd, {}, {}, 0, 0, 0 };
+					TrackList.push_back(T);
+				}
+
+				Data = ChunkEnd;
+			}
+		}
+		catch (...) {
+			Clear();
+			return false;
+		}
+
+		if (TrackList.empty()) {
+			Clear();
+			return false;
+		}
+
+		if (!ForEachTrack(TrackList.size(), Threads, [&](size_t t) {
+			ScanTrack(TrackList[t], (uint16_t)t);
+		})) {
+			Clear();
+			return false;
+		}
+
+		MemoryUsed = TrackList.size() * sizeof(Track);
+
+		for (size_t t = 0; t < TrackList.size(); t++) {
+			MemoryUsed += TrackList[t].Points.size() * sizeof(SeekPoint) + TrackList[t].Tempos.size() * (sizeof(Tempo) + sizeof(double));
+			EventCount += TrackList[t].Count;
+
+			// Format 2 tracks are independent songs, played one after the other
+			TrackList[t].Base = (Format == 2 && t) ? TrackList[t - 1].Base + TrackList[t - 1].LastTick : 0;
+		}
+
+		// MemoryUsed is kept, so that the caller can tell why it failed
+		if (MaxMemory && MemoryUsed > MaxMemory) {
+			uint64_t Needed = MemoryUsed;
+
+			Clear();
+			MemoryUsed = Needed;
+			return false;
+		}
+
+		// Build the tempo map, in time order and track by track for the tempo changes on the same tick
+		try {
+			Tempo First = { 0, SMF_DEFAULT_TEMPO, 0 };
+			TempoMap.push_back(First);
+
+			if (!(Division & 0x8000)) {
+				for (size_t t = 0; t < TrackList.size(); t++) {
+					for (size_t i = 0; i < TrackList[t].Tempos.size(); i++) {
+						Tempo Tmp = TrackList[t].Tempos[i];
+						Tmp.Tick += TrackList[t].Base;
+						TempoMap.push_back(Tmp);
+					}
+				}
+			}
+
+			std::stable_sort(TempoMap.begin() + 1, TempoMap.end(), [](const Tempo& a, const Tempo& b) { return a.Tick < b.Tick; });
+			TempoUs.resize(TempoMap.size());
+		}
+		catch (...) {
+			Clear();
+			return false;
+		}
+
+		for (size_t t = 0; t < TrackList.size(); t++)
+			std::vector<Tempo>().swap(TrackList[t].Tempos);
+
+		if (Division & 0x8000) {
+			int FPS = -(int8_t)(Division >> 8);
+			UsPerTick = 1000000.0 / ((FPS == 29 ? 29.97 : FPS) * (Division & 0xFF));
+		}
+
+		TempoUs[0] = 0.0;
+		for (size_t i = 1; i < TempoMap.size(); i++)
+			TempoUs[i] = TempoUs[i - 1] + (double)(TempoMap[i].Tick - TempoMap[i - 1].Tick) * TempoMap[i - 1].Value / Division;
+
+		// The seek points get their time, and the tracks their end
+		for (size_t t = 0; t < TrackList.size(); t++) {
+			Track& T = TrackList[t];
+			size_t Seg = 0;
+
+			for (size_t i = 0; i < T.Points.size(); i++)
+				T.Points[i].Time = ToTime(T.Points[i].Tick + T.Base, Seg);
+
+			uint64_t TrackEnd = ToTime(T.Base + T.LastTick, Seg);
+			if (TrackEnd > Length) Length = TrackEnd;
+		}
+
+		Tracks = (uint16_t)TrackList.size();
+		return true;
+	}
+};
@@ -242,100 +242,109 @@ static BOOL ParseSoundFontListFromStream(std::wistream &stream, std::vector<Soun
 	}
 }
 
-// Load SoundFonts from a parsed vector of SoundFontList entries
-// This is shared between file-based and IPC-based loading
-static BOOL LoadSoundFontsFromVector(std::vector<SoundFontList> *TempSoundFonts)
+// Initialize the SoundFonts from the parsed list, and push them to the given vectors
+// The presets are reversed, so that they're ready for BASS_MIDI_StreamSetFonts
+// Silent only logs the errors, for callers that can't show a message box (offline renderers)
+static void InitSoundFontsFromVector(std::vector<SoundFontList> *TempSoundFonts, std::vector<HSOUNDFONT> *Handles, std::vector<BASS_MIDI_FONTEX> *Presets,
+									 const Settings &Config = ManagedSettings, BOOL Silent = FALSE)
 {
-	try
+	for (auto CurrentSF = TempSoundFonts->begin(); CurrentSF != TempSoundFonts->end(); ++CurrentSF)
 	{
-		// Free fonts, to prepare the arrays
-		FreeFonts();
+		if (!CurrentSF->EnableState)
+		{
+			PrintSoundFontToDebugLog(CurrentSF->Path, "SoundFont disabled, skipping to next one...");
+			continue;
+		}
 
-		for (auto CurrentSF = TempSoundFonts->begin(); CurrentSF != TempSoundFonts->end(); ++CurrentSF)
+		// Debug: Log path length and last few char codes
+		size_t pathLen = wcslen(CurrentSF->Path);
+		char pathDebug[256];
+		sprintf(pathDebug, "Path length: %zu, Last 5 char codes: [%d][%d][%d][%d][%d]",
+				pathLen,
+				pathLen >= 5 ? (int)CurrentSF->Path[pathLen - 5] : -1,
+				pathLen >= 4 ? (int)CurrentSF->Path[pathLen - 4] : -1,
+				pathLen >= 3 ? (int)CurrentSF->Path[pathLen - 3] : -1,
+				pathLen >= 2 ? (int)CurrentSF->Path[pathLen - 2] : -1,
+				pathLen >= 1 ? (int)CurrentSF->Path[pathLen - 1] : -1);
+		PrintMessageToDebugLog("NewSFLoader", pathDebug);
+		PrintSoundFontToDebugLog(CurrentSF->Path, "Checking if file exists...");
+
+		if (PathFileExists(CurrentSF->Path))
 		{
-			if (!CurrentSF->EnableState)
+			PrintSoundFontToDebugLog(CurrentSF->Path, "Initializing SoundFont...");
+			HSOUNDFONT font = BASS_MIDI_FontInit(CurrentSF->Path,
+												 BASS_UNICODE | BASS_MIDI_FONT_MMAP |
+													 (CurrentSF->XGBankMode ? BASS_MIDI_FONT_XGDRUMS : NULL) |
+													 (Config.AudioRampIn ? BASS_MIDI_FONT_NORAMPIN : NULL) |
+													 (Config.LinAttMod ? BASS_MIDI_FONT_LINATTMOD : NULL) |
+													 (Config.LinDecVol ? BASS_MIDI_FONT_LINDECVOL : NULL) |
+													 (Config.NoSFGenLimits ? BASS_MIDI_FONT_NOLIMITS : NULL));
+
+			if (!font)
 			{
-				PrintSoundFontToDebugLog(CurrentSF->Path, "SoundFont disabled, skipping to next one...");
+				PrintSoundFontToDebugLog(CurrentSF->Path, "An error has occurred while initializing the SoundFont.");
+				if (!Silent) SoundFontError(L"An error has occurred while initializing the SoundFont.", CurrentSF->Path);
 				continue;
 			}
 
-			// Debug: Log path length and last few char codes
-			size_t pathLen = wcslen(CurrentSF->Path);
-			char pathDebug[256];
-			sprintf(pathDebug, "Path length: %zu, Last 5 char codes: [%d][%d][%d][%d][%d]",
-					pathLen,
-					pathLen >= 5 ? (int)CurrentSF->Path[pathLen - 5] : -1,
-					pathLen >= 4 ? (int)CurrentSF->Path[pathLen - 4] : -1,
-					pathLen >= 3 ? (int)CurrentSF->Path[pathLen - 3] : -1,
-					pathLen >= 2 ? (int)CurrentSF->Path[pathLen - 2] : -1,
-					pathLen >= 1 ? (int)CurrentSF->Path[pathLen - 1] : -1);
-			PrintMessageToDebugLog("NewSFLoader", pathDebug);
-			PrintSoundFontToDebugLog(CurrentSF->Path, "Checking if file exists...");
-
-			if (PathFileExists(CurrentSF->Path))
-			{
-				PrintSoundFontToDebugLog(CurrentSF->Path, "Initializing SoundFont...");
-				HSOUNDFONT font = BASS_MIDI_FontInit(CurrentSF->Path,
-													 BASS_UNICODE | BASS_MIDI_FONT_MMAP |
-														 (CurrentSF->XGBankMode ? BASS_MIDI_FONT_XGDRUMS : NULL) |
-														 (ManagedSettings.AudioRampIn ? BASS_MIDI_FONT_NORAMPIN : NULL) |
-														 (ManagedSettings.LinAttMod ? BASS_MIDI_FONT_LINATTMOD : NULL) |
-														 (ManagedSettings.LinDecVol ? BASS_MIDI_FONT_LINDECVOL : NULL) |
-														 (ManagedSettings.NoSFGenLimits ? BASS_MIDI_FONT_NOLIMITS : NULL));
-
-				if (!font)
-				{
-					PrintSoundFontToDebugLog(CurrentSF->Path, "An error has occurred while initializing the SoundFont.");
-					SoundFontError(L"An error has occurred while initializing the SoundFont.", CurrentSF->Path);
-					continue;
-				}
-
-				PrintSoundFontToDebugLog(CurrentSF->Path, "Preparing BASS_MIDI_FONTEX...");
-				BASS_MIDI_FONTEX FEX = {
-					font,
-					CurrentSF->SourcePreset,
-					CurrentSF->SourceBank,
-					CurrentSF->DestinationPreset,
-					CurrentSF->DestinationBank,
-					CurrentSF->DestinationBankLSB};
+			PrintSoundFontToDebugLog(CurrentSF->Path, "Preparing BASS_MIDI_FONTEX...");
+			BASS_MIDI_FONTEX FEX = {
+				font,
+				CurrentSF->SourcePreset,
+				CurrentSF->SourceBank,
+				CurrentSF->DestinationPreset,
+				CurrentSF->DestinationBank,
+				CurrentSF->DestinationBankLSB};
 
-				if (ManagedSettings.PreloadSoundFonts && CurrentSF->Preload)
-				{
-					PrintSoundFontToDebugLog(CurrentSF->Path, "Preloading SoundFont...");
+			if (Config.PreloadSoundFonts && CurrentSF->Preload)
+			{
+				PrintSoundFontToDebugLog(CurrentSF->Path, "Preloading SoundFont...");
 #if defined(_M_IX86)
-					if (FileSize(CurrentSF->Path) <= 1073741824)
-					{
+				if (FileSize(CurrentSF->Path) <= 1073741824)
+				{
 #endif
-						if (!BASS_MIDI_FontLoad(font, CurrentSF->SourcePreset, CurrentSF->SourceBank))
-						{
-							PrintSoundFontToDebugLog(CurrentSF->Path, "An error has occurred while preloading the SoundFont.");
-							SoundFontError(L"An error has occurred while preloading the SoundFont.", CurrentSF->Path);
-							continue;
-						}
-#if defined(_M_IX86)
-					}
-					else
+					if (!BASS_MIDI_FontLoad(font, CurrentSF->SourcePreset, CurrentSF->SourceBank))
 					{
-						MessageBeep(MB_ICONEXCLAMATION);
-						PrintSoundFontToDebugLog(CurrentSF->Path, "The SoundFont is too big, it will not be preloaded.");
+						PrintSoundFontToDebugLog(CurrentSF->Path, "An error has occurred while preloading the SoundFont.");
+						if (!Silent) SoundFontError(L"An error has occurred while preloading the SoundFont.", CurrentSF->Path);
+						continue;
 					}
-#endif
+#if defined(_M_IX86)
 				}
-
-				PrintSoundFontToDebugLog(CurrentSF->Path, "Everything seems to be OK. Pushing it back inside the vector array...");
-				SoundFontHandles.push_back(font);
-				SoundFontPresets.push_back(FEX);
-				PrintSoundFontToDebugLog(CurrentSF->Path, "Done.");
-			}
-			else
-			{
-				PrintSoundFontToDebugLog(CurrentSF->Path, "Unable to load SoundFont! The file does not exist.");
-				SoundFontError(L"Unable to load SoundFont!\nThe file does not exist.", CurrentSF->Path);
+				else
+				{
+					if (!Silent) MessageBeep(MB_ICONEXCLAMATION);
+					PrintSoundFontToDebugLog(CurrentSF->Path, "The SoundFont is too big, it will not be preloaded.");
+				}
+#endif
 			}
+
+			PrintSoundFontToDebugLog(CurrentSF->Path, "Everything seems to be OK. Pushing it back inside the vector array...");
+			Handles->push_back(font);
+			Presets->push_back(FEX);
+			PrintSoundFontToDebugLog(CurrentSF->Path, "Done.");
+		}
+		else
+		{
+			PrintSoundFontToDebugLog(CurrentSF->Path, "Unable to load SoundFont! The file does not exist.");
+			if (!Silent) SoundFontError(L"Unable to load SoundFont!\nThe file does not exist.", CurrentSF->Path);
 		}
+	}
 
-		PrintMessageToDebugLog("NewSFLoader", "Preparing vector array for BASS_MIDI_StreamSetFonts...");
-		std::reverse(SoundFontPresets.begin(), SoundFontPresets.end());
+	PrintMessageToDebugLog("NewSFLoader", "Preparing vector array for BASS_MIDI_StreamSetFonts...");
+	std::reverse(Presets->begin(), Presets->end());
+}
+
+// Load SoundFonts from a parsed vector of SoundFontList entries
+// This is shared between file-based and IPC-based loading
+static BOOL LoadSoundFontsFromVector(std::vector<SoundFontList> *TempSoundFonts)
+{
+	try
+	{
+		// Free fonts, to prepare the arrays
+		FreeFonts();
+
+		InitSoundFontsFromVector(TempSoundFonts, &SoundFontHandles, &SoundFontPresets);
 
 		PrintMessageToDebugLog("NewSFLoader", "Loading SoundFont(s) through BASS_MIDI_StreamSetFonts...");
 		if (SoundFontPresets.size() > 0)
@@ -353,6 +362,23 @@ static BOOL LoadSoundFontsFromVector(std::vector<SoundFontList> *TempSoundFonts)
 	}
 }
 
+// Parse a .omlist/.csflist file from disk
+static BOOL ParseSoundFontListFile(LPCWSTR in_path, std::vector<SoundFontList> *TempSoundFonts)
+{
+	std::wifstream SFList(in_path);
+
+	if (!SFList)
+		return FALSE;
+
+	PrintMessageToDebugLog("NewSFLoader", "SoundFont list is valid. Setting UTF-8 encoding...");
+	SFList.imbue(UTF8Support);
+
+	BOOL result = ParseSoundFontListFromStream(SFList, TempSoundFonts);
+	SFList.close();
+
+	return result;
+}
+
 // Load SoundFonts from a string containing .omlist format data
 // Used by Permafrost IPC to load lists received over named pipe
 static BOOL FontLoaderFromString(const std::wstring &listData)
@@ -458,23 +484,8 @@ static BOOL FontLoader(LPWSTR in_path)
 			// Open file
 			PrintMessageToDebugLog("NewSFLoader", "Opening SoundFont list...");
 			std::vector<SoundFontList> *TempSoundFonts = new std::vector<SoundFontList>;
-			std::wifstream SFList(in_path);
-
-			if (SFList)
-			{
-				PrintMessageToDebugLog("NewSFLoader", "SoundFont list is valid. Setting UTF-8 encoding...");
-				SFList.imbue(UTF8Support);
 
-				if (!ParseSoundFontListFromStream(SFList, TempSoundFonts))
-				{
-					SFList.close();
-					delete TempSoundFonts;
-					return FALSE;
-				}
-
-				SFList.close();
-			}
-			else
+			if (!ParseSoundFontListFile(in_path, TempSoundFonts))
 			{
 				delete TempSoundFonts;
 				return FALSE;
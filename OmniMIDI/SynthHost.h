@@ -0,0 +1,919 @@
+/*
+OmniMIDI synth host
+Lets the driver hand its events over to a single out-of-process (64-bit) synthesizer,
+instead of loading BASS and the SoundFonts inside every app that opens it.
+
+The host is the driver itself, started through rundll32 ("OmniMIDI.dll,RunSynthHost").
+Every client gets a slot in a shared memory region, with its own single-producer/single-consumer
+queue, and is mapped to its own port on the host's stream so that clients never share channels.
+If the host dies, its clients move to in-process synthesis until the app restarts.
+
+Queue records are 8 bytes: the high-order byte of Data is the record type, which is free
+since short messages don't use it (see SendToBASSMIDI), Stamp is the low part of the QPC at
+the time the record got written, so that the host can measure the cross-process latency.
+*/
+#pragma once
+
+#define SYNTHHOST_SHARED_MEM_NAME L"OmniMIDI_SynthHost"
+#define SYNTHHOST_DATA_EVENT_NAME L"OmniMIDI_SynthHostData"
+#define SYNTHHOST_VERSION 1
+
+#define SYNTHHOST_MAX_CLIENTS OM_MAXPORTS				// One port per client
+#define SYNTHHOST_QUEUE_RECORDS 32768					// Must be a power of two
+#define SYNTHHOST_QUEUE_MASK (SYNTHHOST_QUEUE_RECORDS - 1)
+
+#define SYNTHHOST_CONNECT_TIMEOUT_MS 5000				// How long to wait for a freshly launched host
+#define SYNTHHOST_HEARTBEAT_TIMEOUT_MS 500				// How long before we assume the host crashed
+#define SYNTHHOST_IDLE_TIMEOUT_MS 30000					// How long the host stays alive without clients
+#define SYNTHHOST_OWNER_CHECK_MS 1000					// How often the host looks for crashed clients
+#define SYNTHHOST_EVENTS_BATCH 64						// BASS_MIDI_EVENT structs forwarded per write
+
+// Full access for SYSTEM, the admins and the owner, low integrity label so that sandboxed apps can connect too
+#define SYNTHHOST_SDDL L"D:(A;;GA;;;SY)(A;;GA;;;BA)(A;;GA;;;OW)S:(ML;;NW;;;LW)"
+
+// SynthHost_Attach results
+#define SYNTHHOST_ATTACH_FAILED 0
+#define SYNTHHOST_ATTACH_OK 1
+#define SYNTHHOST_ATTACH_RETRY 2	// The host is shutting down, try again once it's gone
+
+// Record types
+#define SYNTHHOST_REC_SHORT 0x00	// Short message in the low 24 bits
+#define SYNTHHOST_REC_LONG 0x01		// Long message, length in the low 24 bits, followed by its bytes
+#define SYNTHHOST_REC_EVENT 0x02	// BASSMIDI event in the low 24 bits, followed by a { chan, param } record
+
+#pragma pack(push, 1)
+
+typedef struct SynthHostRecord
+{
+	DWORD Data;
+	DWORD Stamp;
+} SynthHostRecord;
+
+typedef struct SynthHostQueue
+{
+	volatile LONG OwnerPID;			// 0 = free slot
+	volatile LONG Generation;		// Bumped by every new owner, so that the host can tell them apart
+	volatile LONG StartHead;		// Where the current owner started writing
+	volatile LONG WriteHead;		// Written by the client only
+	volatile LONG ReadHead;			// Written by the host only
+
+	// Stats, the clients update the first three, the host the rest
+	volatile LONG Sent;				// Messages written to the queue
+	volatile LONG Dropped;			// Messages lost because the queue was full (or the host died)
+	volatile LONG Stalls;			// Times the client had to wait for the host (DontMissNotes)
+	volatile LONG Received;			// Messages played by the host
+	volatile DWORD LatencyAvgUs;	// Average queue latency, in microseconds
+	volatile DWORD LatencyMaxUs;	// Worst queue latency, in microseconds
+	DWORD Reserved[5];
+
+	SynthHostRecord Records[SYNTHHOST_QUEUE_RECORDS];
+} SynthHostQueue;
+
+typedef struct SynthHostHeader
+{
+	char Magic[4];					// "OMSH" = OmniMIDI Synth Host
+	DWORD Version;
+	DWORD HostPID;
+	DWORD SampleRate;
+	volatile LONG Heartbeat;		// Incremented on every iteration of the host loop
+	volatile LONG HostSleeping;		// The host is waiting on the data event, clients have to wake it up
+	volatile LONG Shutdown;			// The host is going away, don't connect to it
+	DWORD Reserved[9];
+
+	SynthHostQueue Queues[SYNTHHOST_MAX_CLIENTS];
+} SynthHostHeader;
+
+#pragma pack(pop)
+
+// Shared state
+static HANDLE SynthHostMapping = NULL;
+static HANDLE SynthHostDataEvent = NULL;
+static SynthHostHeader *SynthHostShared = NULL;
+
+// Client state
+static BOOL SynthHostClient = FALSE;
+static BOOL SynthHostDontMissNotes = FALSE;
+static SynthHostQueue *SynthHostQueuePtr = NULL;
+static LockSystem SynthHostLock = { 0, 0 };
+static LONG SynthHostLastBeat = 0;
+static ULONGLONG SynthHostLastBeatTime = 0;
+static BOOL SynthHostDisabled = FALSE;			// The host died on us, stay in-process from now on
+static volatile LONG SynthHostFailing = FALSE;
+static HANDLE SynthHostFailoverThread = NULL;
+
+// Host state
+static BOOL SynthHostServer = FALSE;
+static volatile BOOL SynthHostStop = FALSE;
+static LONG SynthHostGens[SYNTHHOST_MAX_CLIENTS] = { 0 };
+static LONG SynthHostOwners[SYNTHHOST_MAX_CLIENTS] = { 0 };
+static BYTE SynthHostLongBuf[LONGMSG_MAXSIZE];
+
+// Forward declarations, these live in KDMAPI.h and Settings.h
+BOOL DoStartClient();
+BOOL DoStopClient();
+void UnsetBufferPointers();
+void SynthHost_Disconnect();
+
+static DWORD SynthHost_ReadSetting(LPCWSTR Name, DWORD Default)
+{
+	DWORD Value = Default;
+	DWORD Type = REG_DWORD, Size = sizeof(DWORD);
+	HKEY hKey;
+
+	if (RegOpenKeyExW(HKEY_CURRENT_USER, L"Software\\OmniMIDI\\Configuration", 0, KEY_READ, &hKey) == ERROR_SUCCESS)
+	{
+		if (RegQueryValueExW(hKey, Name, NULL, &Type, (LPBYTE)&Value, &Size) != ERROR_SUCCESS)
+			Value = Default;
+
+		RegCloseKey(hKey);
+	}
+
+	return Value;
+}
+
+static BOOL SynthHost_Map(BOOL Create)
+{
+	SECURITY_ATTRIBUTES SA = { sizeof(SECURITY_ATTRIBUTES), NULL, FALSE };
+
+	if (Create)
+	{
+		// The default descriptor would keep out the clients running at low integrity
+		if (!ConvertStringSecurityDescriptorToSecurityDescriptorW(SYNTHHOST_SDDL, SDDL_REVISION_1, &SA.lpSecurityDescriptor, NULL))
+		{
+			PrintMessageToDebugLog("SynthHost", "Unable to build the security descriptor of the shared memory.");
+			return FALSE;
+		}
+
+		SynthHostMapping = CreateFileMappingW(INVALID_HANDLE_VALUE, &SA, PAGE_READWRITE, 0, sizeof(SynthHostHeader), SYNTHHOST_SHARED_MEM_NAME);
+
+		// Another host is already running
+		if (SynthHostMapping && GetLastError() == ERROR_ALREADY_EXISTS)
+		{
+			CloseHandle(SynthHostMapping);
+			SynthHostMapping = NULL;
+		}
+	}
+	else SynthHostMapping = OpenFileMappingW(FILE_MAP_ALL_ACCESS, FALSE, SYNTHHOST_SHARED_MEM_NAME);
+
+	if (!SynthHostMapping)
+	{
+		if (SA.lpSecurityDescriptor) LocalFree(SA.lpSecurityDescriptor);
+		return FALSE;
+	}
+
+	SynthHostShared = (SynthHostHeader*)MapViewOfFile(SynthHostMapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(SynthHostHeader));
+	SynthHostDataEvent = Create ? CreateEventW(&SA, FALSE, FALSE, SYNTHHOST_DATA_EVENT_NAME) : OpenEventW(EVENT_MODIFY_STATE, FALSE, SYNTHHOST_DATA_EVENT_NAME);
+
+	if (SA.lpSecurityDescriptor)
+		LocalFree(SA.lpSecurityDescriptor);
+
+	if (!SynthHostShared || !SynthHostDataEvent)
+	{
+		if (SynthHostShared) UnmapViewOfFile(SynthHostShared);
+		if (SynthHostDataEvent) CloseHandle(SynthHostDataEvent);
+		CloseHandle(SynthHostMapping);
+
+		SynthHostShared = NULL;
+		SynthHostDataEvent = NULL;
+		SynthHostMapping = NULL;
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static void SynthHost_Unmap()
+{
+	if (SynthHostShared) UnmapViewOfFile(SynthHostShared);
+	if (SynthHostDataEvent) CloseHandle(SynthHostDataEvent);
+	if (SynthHostMapping) CloseHandle(SynthHostMapping);
+
+	SynthHostShared = NULL;
+	SynthHostDataEvent = NULL;
+	SynthHostMapping = NULL;
+}
+
+// ----------------------------------------------------------------------
+// Client side
+// ----------------------------------------------------------------------
+
+static BOOL SynthHost_IsHostAlive()
+{
+	ULONGLONG Now = GetTickCount64();
+	LONG Beat = SynthHostShared->Heartbeat;
+
+	if (SynthHostShared->Shutdown)
+		return FALSE;
+
+	if (Beat != SynthHostLastBeat)
+	{
+		SynthHostLastBeat = Beat;
+		SynthHostLastBeatTime = Now;
+		return TRUE;
+	}
+
+	return (Now - SynthHostLastBeatTime) < SYNTHHOST_HEARTBEAT_TIMEOUT_MS;
+}
+
+// Copies raw bytes to/from the ring, which might have to wrap around
+static void SynthHost_CopyToRing(SynthHostQueue *Q, LONG Head, const void *Data, DWORD Bytes)
+{
+	DWORD Start = Head & SYNTHHOST_QUEUE_MASK;
+	DWORD First = (SYNTHHOST_QUEUE_RECORDS - Start) * sizeof(SynthHostRecord);
+
+	if (Bytes <= First)
+		memcpy(&Q->Records[Start], Data, Bytes);
+	else
+	{
+		memcpy(&Q->Records[Start], Data, First);
+		memcpy(&Q->Records[0], (const BYTE*)Data + First, Bytes - First);
+	}
+}
+
+static void SynthHost_CopyFromRing(SynthHostQueue *Q, LONG Head, void *Data, DWORD Bytes)
+{
+	DWORD Start = Head & SYNTHHOST_QUEUE_MASK;
+	DWORD First = (SYNTHHOST_QUEUE_RECORDS - Start) * sizeof(SynthHostRecord);
+
+	if (Bytes <= First)
+		memcpy(Data, &Q->Records[Start], Bytes);
+	else
+	{
+		memcpy(Data, &Q->Records[Start], First);
+		memcpy((BYTE*)Data + First, &Q->Records[0], Bytes - First);
+	}
+}
+
+// The host is gone, move the client to the local engine instead of dropping everything it sends
+static unsigned __stdcall SynthHost_Failover(LPVOID)
+{
+	PrintMessageToDebugLog("SynthHost", "The synth host stopped responding. Falling back to in-process synthesis...");
+	SynthHostDisabled = TRUE;
+
+	SynthHost_Disconnect();
+	bass_initialized = FALSE;
+	DriverInitStatus = FALSE;
+
+	if (!DoStartClient())
+		PrintMessageToDebugLog("SynthHost", "In-process synthesis failed to start.");
+
+	return 0;
+}
+
+static void SynthHost_StartFailover()
+{
+	if (InterlockedCompareExchange(&SynthHostFailing, TRUE, FALSE))
+		return;
+
+	SynthHostFailoverThread = (HANDLE)_beginthreadex(NULL, 0, SynthHost_Failover, NULL, 0, NULL);
+}
+
+// Called before the driver stops, so that it doesn't race a failover that's still starting the local engine
+void SynthHost_WaitFailover()
+{
+	if (!SynthHostFailoverThread)
+		return;
+
+	WaitForSingleObject(SynthHostFailoverThread, INFINITE);
+	CloseHandle(SynthHostFailoverThread);
+	SynthHostFailoverThread = NULL;
+	InterlockedExchange(&SynthHostFailing, FALSE);
+}
+
+static BOOL SynthHost_Write(const SynthHostRecord *Recs, DWORD RecsCount, const void *Payload, DWORD PayloadBytes)
+{
+	DWORD Count = RecsCount + (PayloadBytes + sizeof(SynthHostRecord) - 1) / sizeof(SynthHostRecord);
+	BOOL Stalled = FALSE;
+
+	LockForWriting(&SynthHostLock);
+
+	// Read under the lock, the failover unmaps the queue as soon as it gets it
+	SynthHostQueue *Q = SynthHostQueuePtr;
+	if (!Q)
+	{
+		UnlockForWriting(&SynthHostLock);
+		return FALSE;
+	}
+
+	if (!SynthHost_IsHostAlive())
+	{
+		InterlockedIncrement(&Q->Dropped);
+		UnlockForWriting(&SynthHostLock);
+		SynthHost_StartFailover();
+		return FALSE;
+	}
+
+	LONG Write = Q->WriteHead;
+
+	// Flow control, either wait for the host or drop the message
+	while ((DWORD)(Write - Q->ReadHead) + Count > SYNTHHOST_QUEUE_RECORDS)
+	{
+		if (!SynthHostDontMissNotes || !SynthHost_IsHostAlive())
+		{
+			InterlockedIncrement(&Q->Dropped);
+			UnlockForWriting(&SynthHostLock);
+			return FALSE;
+		}
+
+		if (!Stalled)
+		{
+			InterlockedIncrement(&Q->Stalls);
+			Stalled = TRUE;
+		}
+
+		SetEvent(SynthHostDataEvent);
+		_FWAIT;
+	}
+
+	for (DWORD i = 0; i < RecsCount; i++)
+		Q->Records[(Write + i) & SYNTHHOST_QUEUE_MASK] = Recs[i];
+
+	if (PayloadBytes)
+		SynthHost_CopyToRing(Q, Write + RecsCount, Payload, PayloadBytes);
+
+	// The records have to be visible before the head moves
+	InterlockedExchange(&Q->WriteHead, Write + Count);
+	Q->Sent++;
+
+	if (SynthHostShared->HostSleeping)
+		SetEvent(SynthHostDataEvent);
+
+	UnlockForWriting(&SynthHostLock);
+	return TRUE;
+}
+
+void SynthHost_ParseData(DWORD_PTR dwParam1) noexcept
+{
+	LARGE_INTEGER Now;
+	QueryPerformanceCounter(&Now);
+
+	// The port of the client is its slot, any other port gets folded into it
+	SynthHostRecord Rec = { STRIPPORT((DWORD)dwParam1) | (SYNTHHOST_REC_SHORT << 24), Now.LowPart };
+	SynthHost_Write(&Rec, 1, NULL, 0);
+}
+
+void SynthHost_PrepareData(DWORD dwParam1) noexcept
+{
+	SynthHost_ParseData(dwParam1);
+}
+
+BOOL WINAPI SynthHost_BMSE(HSTREAM, DWORD chan, DWORD event, DWORD param) noexcept
+{
+	LARGE_INTEGER Now;
+	QueryPerformanceCounter(&Now);
+
+	SynthHostRecord Recs[2] = {
+		{ (event & 0xFFFFFF) | (SYNTHHOST_REC_EVENT << 24), Now.LowPart },
+		{ chan, param }
+	};
+
+	return SynthHost_Write(Recs, 2, NULL, 0);
+}
+
+DWORD WINAPI SynthHost_BMSEs(HSTREAM, DWORD mode, const void *events, DWORD length) noexcept
+{
+	LARGE_INTEGER Now;
+
+	// Nothing is ever left pending on the host for this client, so BASS_MIDI_EVENTS_CANCEL has nothing to cancel
+	if (!events || !length)
+		return 0;
+
+	QueryPerformanceCounter(&Now);
+
+	if (mode & BASS_MIDI_EVENTS_RAW)
+	{
+		if (length > LONGMSG_MAXSIZE)
+		{
+			PrintMessageToDebugLog("SynthHost", "Raw MIDI data too long for the synth host, dropped.");
+			return 0;
+		}
+
+		SynthHostRecord Rec = { length | (SYNTHHOST_REC_LONG << 24), Now.LowPart };
+		return SynthHost_Write(&Rec, 1, events, length) ? length : 0;
+	}
+
+	// BASS_MIDI_EVENT structs, sent as events
+	// Their positions belong to a local stream that doesn't exist, so they're played as soon as the host gets them
+	const BASS_MIDI_EVENT *Evs = (const BASS_MIDI_EVENT*)events;
+	SynthHostRecord Recs[SYNTHHOST_EVENTS_BATCH * 2];
+	DWORD Sent = 0;
+
+	while (Sent < length)
+	{
+		DWORD Batch = min(length - Sent, SYNTHHOST_EVENTS_BATCH);
+
+		for (DWORD i = 0; i < Batch; i++)
+		{
+			Recs[i * 2] = { (Evs[Sent + i].event & 0xFFFFFF) | (SYNTHHOST_REC_EVENT << 24), Now.LowPart };
+			Recs[i * 2 + 1] = { Evs[Sent + i].chan, Evs[Sent + i].param };
+		}
+
+		if (!SynthHost_Write(Recs, Batch * 2, NULL, 0))
+			break;
+
+		Sent += Batch;
+	}
+
+	return Sent;
+}
+
+void SynthHost_SetBufferPointers()
+{
+	_PrsData = SynthHost_ParseData;
+	_PforBASSMIDI = SynthHost_PrepareData;
+	_PlayBufData = DummyPlayBufData;
+	_PlayBufDataChk = DummyPlayBufData;
+	_BMSE = SynthHost_BMSE;
+	_BMSEs = SynthHost_BMSEs;
+}
+
+static BOOL SynthHost_LaunchHost()
+{
+	wchar_t WinDir[MAX_PATH] = { 0 };
+	wchar_t RunDll[MAX_PATH] = { 0 };
+	wchar_t HostDll[NTFS_MAX_PATH] = { 0 };
+	wchar_t CmdLine[NTFS_MAX_PATH * 2] = { 0 };
+	BOOL Wow64 = FALSE;
+
+	STARTUPINFOW si = { 0 };
+	PROCESS_INFORMATION pi = { 0 };
+	si.cb = sizeof(si);
+
+	if (!GetWindowsDirectoryW(WinDir, MAX_PATH))
+		return FALSE;
+
+	// 32-bit apps have to reach for the 64-bit driver, the whole point is to get out of their address space
+	IsWow64Process(GetCurrentProcess(), &Wow64);
+	swprintf_s(RunDll, MAX_PATH, L"%s\\%s\\rundll32.exe", WinDir, Wow64 ? L"Sysnative" : L"System32");
+
+	if (Wow64)
+		swprintf_s(HostDll, NTFS_MAX_PATH, L"%s\\Sysnative\\OmniMIDI.dll", WinDir);
+	else if (!GetModuleFileNameW(hinst, HostDll, NTFS_MAX_PATH))
+		return FALSE;
+
+	swprintf_s(CmdLine, NTFS_MAX_PATH * 2, L"\"%s\" \"%s\",RunSynthHost", RunDll, HostDll);
+
+	if (!CreateProcessW(RunDll, CmdLine, NULL, NULL, FALSE, DETACHED_PROCESS, NULL, NULL, &si, &pi))
+	{
+		PrintMessageToDebugLog("SynthHost", "Unable to launch the synth host.");
+		return FALSE;
+	}
+
+	CloseHandle(pi.hThread);
+	CloseHandle(pi.hProcess);
+
+	PrintMessageToDebugLog("SynthHost", "Synth host launched.");
+	return TRUE;
+}
+
+static DWORD SynthHost_Attach(ULONGLONG Deadline)
+{
+	if (!SynthHost_Map(FALSE))
+	{
+		if (!SynthHost_LaunchHost())
+			return SYNTHHOST_ATTACH_FAILED;
+
+		while (!SynthHost_Map(FALSE))
+		{
+			if (GetTickCount64() > Deadline)
+			{
+				PrintMessageToDebugLog("SynthHost", "The synth host didn't show up in time. Falling back to in-process synthesis.");
+				return SYNTHHOST_ATTACH_FAILED;
+			}
+
+			Sleep(10);
+		}
+	}
+
+	// The host creates the mapping before it's ready, wait for it to fill the header
+	while (memcmp(SynthHostShared->Magic, "OMSH", 4) || !SynthHostShared->Heartbeat)
+	{
+		if (SynthHostShared->Shutdown)
+		{
+			SynthHost_Unmap();
+			return SYNTHHOST_ATTACH_RETRY;
+		}
+
+		if (GetTickCount64() > Deadline)
+		{
+			PrintMessageToDebugLog("SynthHost", "The synth host isn't responding. Falling back to in-process synthesis.");
+			SynthHost_Unmap();
+			return SYNTHHOST_ATTACH_FAILED;
+		}
+
+		Sleep(10);
+	}
+
+	if (SynthHostShared->Shutdown)
+	{
+		SynthHost_Unmap();
+		return SYNTHHOST_ATTACH_RETRY;
+	}
+
+	if (SynthHostShared->Version != SYNTHHOST_VERSION)
+	{
+		PrintMessageToDebugLog("SynthHost", "The synth host is using a different protocol version. Falling back to in-process synthesis.");
+		SynthHost_Unmap();
+		return SYNTHHOST_ATTACH_FAILED;
+	}
+
+	// Claim a free slot
+	LONG PID = (LONG)GetCurrentProcessId();
+	for (DWORD Slot = 0; Slot < SYNTHHOST_MAX_CLIENTS; Slot++)
+	{
+		SynthHostQueue *Q = &SynthHostShared->Queues[Slot];
+
+		if (InterlockedCompareExchange(&Q->OwnerPID, PID, 0) != 0)
+			continue;
+
+		// The host raises Shutdown before its last look at the slots, so either it sees our claim or we see the flag
+		if (SynthHostShared->Shutdown)
+		{
+			InterlockedExchange(&Q->OwnerPID, 0);
+			SynthHost_Unmap();
+			return SYNTHHOST_ATTACH_RETRY;
+		}
+
+		Q->StartHead = Q->WriteHead;
+		Q->Sent = Q->Dropped = Q->Stalls = 0;
+		InterlockedIncrement(&Q->Generation);
+
+		SynthHostQueuePtr = Q;
+		SynthHostClient = TRUE;
+		SynthHostDontMissNotes = SynthHost_ReadSetting(L"DontMissNotes", FALSE);
+		SynthHostLastBeat = SynthHostShared->Heartbeat;
+		SynthHostLastBeatTime = GetTickCount64();
+
+		SynthHost_SetBufferPointers();
+
+		PrintMessageToDebugLog("SynthHost", "Connected to the synth host.");
+		return SYNTHHOST_ATTACH_OK;
+	}
+
+	PrintMessageToDebugLog("SynthHost", "The synth host has no free slots. Falling back to in-process synthesis.");
+	SynthHost_Unmap();
+	return SYNTHHOST_ATTACH_FAILED;
+}
+
+BOOL SynthHost_Connect()
+{
+	// The host itself obviously doesn't connect to anything
+	if (SynthHostServer || SynthHostClient || SynthHostDisabled)
+		return FALSE;
+
+	if (!SynthHost_ReadSetting(L"UseSynthHost", FALSE))
+		return FALSE;
+
+	PrintMessageToDebugLog("SynthHost", "Connecting to the synth host...");
+
+	ULONGLONG Deadline = GetTickCount64() + SYNTHHOST_CONNECT_TIMEOUT_MS;
+	for (;;)
+	{
+		DWORD Result = SynthHost_Attach(Deadline);
+
+		if (Result != SYNTHHOST_ATTACH_RETRY)
+			return Result == SYNTHHOST_ATTACH_OK;
+
+		// The old host is on its way out, wait for it to be gone so that a new one can be launched
+		if (GetTickCount64() > Deadline)
+		{
+			PrintMessageToDebugLog("SynthHost", "The synth host is shutting down. Falling back to in-process synthesis.");
+			return FALSE;
+		}
+
+		Sleep(10);
+	}
+}
+
+void SynthHost_Disconnect()
+{
+	if (!SynthHostClient)
+		return;
+
+	UnsetBufferPointers();
+
+	// Give the slot back, the host will silence our port
+	LockForWriting(&SynthHostLock);
+	InterlockedExchange(&SynthHostQueuePtr->OwnerPID, 0);
+	SynthHostQueuePtr = NULL;
+	UnlockForWriting(&SynthHostLock);
+
+	SetEvent(SynthHostDataEvent);
+	SynthHost_Unmap();
+
+	SynthHostClient = FALSE;
+	PrintMessageToDebugLog("SynthHost", "Disconnected from the synth host.");
+}
+
+// ----------------------------------------------------------------------
+// Host side
+// ----------------------------------------------------------------------
+
+static void SynthHost_ResetPort(DWORD Port)
+{
+	for (DWORD ch = Port << 4; ch < (Port << 4) + 16; ch++)
+	{
+		_BMSE(OMStream, ch, MIDI_EVENT_NOTESOFF, NULL);
+		_BMSE(OMStream, ch, MIDI_EVENT_SOUNDOFF, NULL);
+		_BMSE(OMStream, ch, MIDI_EVENT_RESET, NULL);
+		_BMSE(OMStream, ch, MIDI_EVENT_PROGRAM, 0);
+	}
+
+	_BMSE(OMStream, (Port << 4) | 9, MIDI_EVENT_DRUMS, 1);
+}
+
+static void SynthHost_ApplyEvent(DWORD Port, DWORD Event, DWORD Chan, DWORD Param)
+{
+	switch (Event)
+	{
+	case MIDI_EVENT_SYSTEM:
+	case MIDI_EVENT_SYSTEMEX:
+		// A system reset would hit every client, keep it inside the port
+		SynthHost_ResetPort(Port);
+		return;
+	default:
+		_BMSE(OMStream, (Port << 4) | (Chan & 0xF), Event, Param);
+		return;
+	}
+}
+
+// Everything a client sends is applied right away by the host loop, in the order it got written
+static void SynthHost_ApplyShort(DWORD Port, DWORD Msg)
+{
+	if (!CheckIfEventIsToIgnore(STRIPPORT(Msg)))
+		_PforBASSMIDI(SETPORT(Msg, Port));
+}
+
+static void SynthHost_ApplyLong(DWORD Port, const BYTE* Data, DWORD Length)
+{
+	BYTE Status = 0;
+	DWORD i = 0, Len;
+
+	if (!Length)
+		return;
+
+	if (Data[0] == 0xF0)
+	{
+		// A mode reset would hit every client, keep it inside the port
+		if (IsModeResetSysEx(Data, Length))
+			SynthHost_ResetPort(Port);
+		else
+			_BMSEs(OMStream, BASS_MIDI_EVENTS_RAW, Data, Length);
+
+		return;
+	}
+
+	// Raw channel messages, split up so that they end up on the client's port
+	while (i < Length)
+	{
+		if (Data[i] & 0x80)
+			Status = Data[i++];
+
+		// System messages can't be moved to a port, and they have no business in here anyway
+		if (!Status || Status >= 0xF0)
+			return;
+
+		Len = ((Status & 0xE0) == MIDI_PROGCHAN) ? 1 : 2;
+		if (i + Len > Length)
+			return;
+
+		SynthHost_ApplyShort(Port, Status | (Data[i] << 8) | ((Len == 2) ? (Data[i + 1] << 16) : 0));
+		i += Len;
+	}
+}
+
+static DWORD SynthHost_DrainQueue(DWORD Port)
+{
+	SynthHostQueue *Q = &SynthHostShared->Queues[Port];
+	LARGE_INTEGER Now;
+	DWORD Messages = 0;
+
+	LONG Write = Q->WriteHead;
+	MemoryBarrier();
+	LONG Read = Q->ReadHead;
+
+	if (Read == Write)
+		return 0;
+
+	QueryPerformanceCounter(&Now);
+
+	while (Read != Write)
+	{
+		SynthHostRecord Rec = Q->Records[Read & SYNTHHOST_QUEUE_MASK];
+		DWORD Payload = 0;
+
+		switch (Rec.Data >> 24)
+		{
+		case SYNTHHOST_REC_SHORT:
+			SynthHost_ApplyShort(Port, Rec.Data);
+			break;
+		case SYNTHHOST_REC_LONG:
+		{
+			DWORD Length = Rec.Data & 0xFFFFFF;
+			Payload = (Length + sizeof(SynthHostRecord) - 1) / sizeof(SynthHostRecord);
+
+			if (Length > LONGMSG_MAXSIZE || (DWORD)(Write - Read) < 1 + Payload)
+			{
+				// Something went really wrong, skip everything that's left
+				Read = Write;
+				continue;
+			}
+
+			SynthHost_CopyFromRing(Q, Read + 1, SynthHostLongBuf, Length);
+			SynthHost_ApplyLong(Port, SynthHostLongBuf, Length);
+			break;
+		}
+		case SYNTHHOST_REC_EVENT:
+		{
+			SynthHostRecord Args = Q->Records[(Read + 1) & SYNTHHOST_QUEUE_MASK];
+			Payload = 1;
+
+			SynthHost_ApplyEvent(Port, Rec.Data & 0xFFFFFF, Args.Data, Args.Stamp);
+			break;
+		}
+		default:
+			Read = Write;
+			continue;
+		}
+
+		// Queue latency, QPC is the same for every process on the system
+		DWORD LatencyUs = (DWORD)((ULONGLONG)(Now.LowPart - Rec.Stamp) * 1000000ULL / SchedulerQPCFreq.QuadPart);
+		LONG Delta = (LONG)LatencyUs - (LONG)Q->LatencyAvgUs;
+		Q->LatencyAvgUs = (DWORD)((LONG)Q->LatencyAvgUs + Delta / 16);
+		if (LatencyUs > Q->LatencyMaxUs) Q->LatencyMaxUs = LatencyUs;
+
+		Read += 1 + Payload;
+		Messages++;
+	}
+
+	Q->Received += Messages;
+	InterlockedExchange(&Q->ReadHead, Read);
+
+	return Messages;
+}
+
+static BOOL SynthHost_IsProcessAlive(DWORD PID)
+{
+	HANDLE Process = OpenProcess(SYNCHRONIZE, FALSE, PID);
+
+	if (!Process)
+		return FALSE;
+
+	BOOL Alive = (WaitForSingleObject(Process, 0) == WAIT_TIMEOUT);
+	CloseHandle(Process);
+
+	return Alive;
+}
+
+static BOOL SynthHost_UpdateSlot(DWORD Slot, BOOL CheckOwner)
+{
+	SynthHostQueue *Q = &SynthHostShared->Queues[Slot];
+	LONG Owner = Q->OwnerPID;
+
+	// The client left, silence its port
+	if (!Owner)
+	{
+		if (SynthHostOwners[Slot])
+		{
+			SynthHost_ResetPort(Slot);
+			Q->ReadHead = Q->WriteHead;
+			SynthHostOwners[Slot] = 0;
+			PrintMessageToDebugLog("SynthHost", "A client disconnected.");
+		}
+
+		return FALSE;
+	}
+
+	// The client crashed without giving its slot back
+	if (CheckOwner && !SynthHost_IsProcessAlive(Owner))
+	{
+		InterlockedCompareExchange(&Q->OwnerPID, 0, Owner);
+		return FALSE;
+	}
+
+	// New client, start from where it started writing
+	if (Q->Generation != SynthHostGens[Slot])
+	{
+		SynthHostGens[Slot] = Q->Generation;
+		SynthHostOwners[Slot] = Owner;
+
+		Q->ReadHead = Q->StartHead;
+		Q->Received = 0;
+		Q->LatencyAvgUs = Q->LatencyMaxUs = 0;
+
+		EnableMIDIPort(Slot);
+		SynthHost_ResetPort(Slot);
+		PrintMessageToDebugLog("SynthHost", "A client connected.");
+	}
+
+	return TRUE;
+}
+
+// Raised before the last look at the slots, so a client claiming one right now either shows up here or backs off
+static BOOL SynthHost_BeginShutdown()
+{
+	InterlockedExchange(&SynthHostShared->Shutdown, TRUE);
+
+	for (DWORD Slot = 0; Slot < SYNTHHOST_MAX_CLIENTS; Slot++)
+	{
+		if (SynthHostShared->Queues[Slot].OwnerPID)
+		{
+			InterlockedExchange(&SynthHostShared->Shutdown, FALSE);
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+static BOOL SynthHost_QueuesPending()
+{
+	for (DWORD Slot = 0; Slot < SYNTHHOST_MAX_CLIENTS; Slot++)
+	{
+		if (SynthHostShared->Queues[Slot].WriteHead != SynthHostShared->Queues[Slot].ReadHead)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+// rundll32 entry point, same signature as DriverRegistration
+extern "C" void __stdcall RunSynthHost(HWND hWnd, HINSTANCE hInstanceDLL, LPSTR CommandLine, DWORD CmdShow)
+{
+	SynthHostServer = TRUE;
+
+	if (!SynthHost_Map(TRUE))
+	{
+		PrintMessageToDebugLog("SynthHost", "Another synth host is already running, or the shared memory couldn't be created.");
+		return;
+	}
+
+	if (!DoStartClient())
+	{
+		PrintMessageToDebugLog("SynthHost", "The synth host was unable to start the driver.");
+		SynthHost_Unmap();
+		return;
+	}
+
+	// All the clients share the same stream, the same fonts and the same output
+	AlreadyInitializedViaKDMAPI = TRUE;
+
+	if (!SchedulerQPCFreq.QuadPart)
+		QueryPerformanceFrequency(&SchedulerQPCFreq);
+
+	SynthHostShared->Version = SYNTHHOST_VERSION;
+	SynthHostShared->HostPID = GetCurrentProcessId();
+	SynthHostShared->SampleRate = ManagedSettings.AudioFrequency;
+	memcpy(SynthHostShared->Magic, "OMSH", 4);
+	InterlockedIncrement(&SynthHostShared->Heartbeat);
+
+	PrintMessageToDebugLog("SynthHost", "Synth host is ready.");
+
+	ULONGLONG LastClient = GetTickCount64();
+	ULONGLONG LastOwnerCheck = LastClient;
+
+	while (!SynthHostStop)
+	{
+		ULONGLONG Now = GetTickCount64();
+		BOOL CheckOwners = (Now - LastOwnerCheck) >= SYNTHHOST_OWNER_CHECK_MS;
+		BOOL AnyClient = FALSE;
+		DWORD Drained = 0;
+
+		InterlockedIncrement(&SynthHostShared->Heartbeat);
+
+		for (DWORD Slot = 0; Slot < SYNTHHOST_MAX_CLIENTS; Slot++)
+		{
+			if (!SynthHost_UpdateSlot(Slot, CheckOwners))
+				continue;
+
+			AnyClient = TRUE;
+			Drained += SynthHost_DrainQueue(Slot);
+		}
+
+		if (CheckOwners)
+			LastOwnerCheck = Now;
+
+		if (AnyClient)
+			LastClient = Now;
+		else if (Now - LastClient > SYNTHHOST_IDLE_TIMEOUT_MS && SynthHost_BeginShutdown())
+			break;
+
+		if (!Drained)
+		{
+			// Tell the clients to wake us up, then look again in case they missed it
+			InterlockedExchange(&SynthHostShared->HostSleeping, TRUE);
+
+			if (!SynthHost_QueuesPending())
+				WaitForSingleObject(SynthHostDataEvent, 1);
+
+			InterlockedExchange(&SynthHostShared->HostSleeping, FALSE);
+		}
+	}
+
+	PrintMessageToDebugLog("SynthHost", "No clients left, shutting down the synth host...");
+	InterlockedExchange(&SynthHostShared->Shutdown, TRUE);
+
+	AlreadyInitializedViaKDMAPI = FALSE;
+	DoStopClient();
+	SynthHost_Unmap();
+}
@@ -0,0 +1,304 @@
+/*
+OmniMIDI synth state mirror
+Keeps a copy of what every channel has been told (program, bank, controllers, pitch bend and its range...),
+updated by SendToBASSMIDI as the events go through.
+When the stream has to be recreated (engine switch, stream restart...), the mirror gets checkpointed first,
+and replayed into the new stream as a single batch, so that the app doesn't have to resend everything.
+Notes aren't part of it, they'd only come back as stuck notes.
+Both the thread draining the events and the audio thread (scheduled events, note-off timers, player) update it,
+so it's guarded by SynthStateLock.
+*/
+#pragma once
+
+#define SS_UNTOUCHED		0xFF
+#define SS_RPN_NULL			0x3FFF
+#define SS_RPNS				3			// Pitch bend range, fine tune, coarse tune
+#define SS_RESET_MAX		16			// Longest reset SysEx that gets remembered
+
+// SynthHost.h
+static DWORD SynthHost_ReadSetting(LPCWSTR Name, DWORD Default);
+
+typedef struct ChannelState
+{
+	BYTE CC[128];				// SS_UNTOUCHED = the synth is still at the default value
+	BYTE Program;
+	BYTE Pressure;
+	WORD Pitch;					// 0xFFFF = untouched
+	WORD RPNSelect;				// (MSB << 7) | LSB, SS_RPN_NULL while nothing (or an NRPN) is selected
+	BYTE RPN[SS_RPNS][2];		// Data entry MSB/LSB of the RPNs that get restored
+	BOOL Touched;				// Anything at all to restore
+} ChannelState;
+
+typedef struct SynthStateMirror
+{
+	ChannelState Channels[VB_CHANNELS];
+	BYTE ResetSysEx[SS_RESET_MAX];	// Last GM/GS/XG reset, the new stream has to be switched to the same mode first
+	DWORD ResetSysExLen;
+} SynthStateMirror;
+
+static LockSystem SynthStateLock = { 0, 0 };
+static SynthStateMirror SynthState;
+static SynthStateMirror SynthCheckpoint;
+static BOOL SynthCheckpointReady = FALSE;
+
+// Stats, printed to the debug pipe
+static FLOAT SynthRestoreMs = 0.0f;
+static DWORD SynthRestoreEvents = 0;
+static DWORD SynthRestoreMismatches = 0;
+
+static void ResetChannelState(ChannelState* Ch)
+{
+	memset(Ch, SS_UNTOUCHED, sizeof(ChannelState));
+	Ch->RPNSelect = SS_RPN_NULL;
+	Ch->Touched = FALSE;
+}
+
+// Has to be called with SynthStateLock held
+static void ClearSynthState()
+{
+	for (DWORD i = 0; i < VB_CHANNELS; i++)
+		ResetChannelState(&SynthState.Channels[i]);
+
+	SynthState.ResetSysExLen = 0;
+}
+
+void ResetSynthState()
+{
+	LockForWriting(&SynthStateLock);
+	ClearSynthState();
+	UnlockForWriting(&SynthStateLock);
+}
+
+// Has to be called with SynthStateLock held
+static void __inline MirrorChannelEvent(ChannelState* Ch, BYTE Cmd, BYTE Param1, BYTE Param2)
+{
+	switch (Cmd)
+	{
+	case MIDI_CMC:
+		Param1 &= 0x7F;
+
+		switch (Param1)
+		{
+		case 6:		// Data entry
+		case 38:
+			if (Ch->RPNSelect < SS_RPNS)
+				Ch->RPN[Ch->RPNSelect][Param1 == 38] = Param2;
+			break;
+		case 98:	// NRPN, data entries aren't for the RPNs anymore
+		case 99:
+			Ch->RPNSelect = SS_RPN_NULL;
+			break;
+		case 100:
+			Ch->RPNSelect = (Ch->RPNSelect & 0x3F80) | (Param2 & 0x7F);
+			break;
+		case 101:
+			Ch->RPNSelect = (Ch->RPNSelect & 0x7F) | ((Param2 & 0x7F) << 7);
+			break;
+		case 121:	// Reset all controllers, everything it touches goes back to its default
+			Ch->CC[1] = Ch->CC[11] = SS_UNTOUCHED;
+			memset(&Ch->CC[64], SS_UNTOUCHED, 6);
+			Ch->Pitch = 0xFFFF;
+			Ch->Pressure = SS_UNTOUCHED;
+			Ch->RPNSelect = SS_RPN_NULL;
+			break;
+		default:
+			// Channel mode messages and data increments don't leave anything behind to restore
+			if (Param1 >= 120 || Param1 == 96 || Param1 == 97)
+				return;
+
+			Ch->CC[Param1] = Param2;
+			break;
+		}
+		break;
+	case MIDI_PROGCHAN:
+		Ch->Program = Param1;
+		break;
+	case MIDI_CHANAFTER:
+		Ch->Pressure = Param1;
+		break;
+	case MIDI_PITCHWHEEL:
+		Ch->Pitch = (Param2 << 7) | Param1;
+		break;
+	default:
+		return;
+	}
+
+	Ch->Touched = TRUE;
+}
+
+// Called by SendToBASSMIDI for every short event that reaches the synth
+void __inline MirrorSynthEvent(BYTE Chan, BYTE Cmd, BYTE Param1, BYTE Param2)
+{
+	// Notes don't leave anything behind, no need to wait for the lock over them
+	if (Cmd < MIDI_CMC)
+		return;
+
+	LockForWriting(&SynthStateLock);
+	MirrorChannelEvent(&SynthState.Channels[Chan], Cmd, Param1, Param2);
+	UnlockForWriting(&SynthStateLock);
+}
+
+// GM, GS or XG reset
+BOOL IsModeResetSysEx(const BYTE* Data, DWORD Length)
+{
+	static const BYTE GMReset[] = { 0xF0, 0x7E, 0x7F, 0x09 };
+	static const BYTE GSReset[] = { 0xF0, 0x41, 0x10, 0x42, 0x12, 0x40, 0x00, 0x7F };
+	static const BYTE XGReset[] = { 0xF0, 0x43, 0x10, 0x4C, 0x00, 0x00, 0x7E };
+
+	return (Length >= sizeof(GMReset) && !memcmp(Data, GMReset, sizeof(GMReset))) ||
+		(Length >= sizeof(GSReset) && !memcmp(Data, GSReset, sizeof(GSReset))) ||
+		(Length >= sizeof(XGReset) && !memcmp(Data, XGReset, sizeof(XGReset)));
+}
+
+// Called by SendLongToBASSMIDI, only the mode resets matter here
+void MirrorSynthSysEx(const BYTE* Data, DWORD Length)
+{
+	if (Length > SS_RESET_MAX || !IsModeResetSysEx(Data, Length))
+		return;
+
+	LockForWriting(&SynthStateLock);
+	ClearSynthState();
+	memcpy(SynthState.ResetSysEx, Data, Length);
+	SynthState.ResetSysExLen = Length;
+	UnlockForWriting(&SynthStateLock);
+}
+
+// Called right before the stream gets freed
+void CheckpointSynthState()
+{
+	LockForWriting(&SynthStateLock);
+	memcpy(&SynthCheckpoint, &SynthState, sizeof(SynthStateMirror));
+	UnlockForWriting(&SynthStateLock);
+	SynthCheckpointReady = TRUE;
+}
+
+static void __inline PushRawEvent(std::vector<BYTE>& Batch, BYTE Status, BYTE Param1, BYTE Param2)
+{
+	Batch.push_back(Status);
+	Batch.push_back(Param1);
+	if ((Status & 0xF0) != MIDI_PROGCHAN && (Status & 0xF0) != MIDI_CHANAFTER)
+		Batch.push_back(Param2);
+
+	SynthRestoreEvents++;
+}
+
+static void BuildChannelRestore(std::vector<BYTE>& Batch, const ChannelState* Ch, BYTE Chan)
+{
+	BYTE CMC = MIDI_CMC | Chan;
+	BOOL RPNsTouched = FALSE;
+
+	// Banks first, so that the program change picks them up
+	if (Ch->CC[0] != SS_UNTOUCHED) PushRawEvent(Batch, CMC, 0, Ch->CC[0]);
+	if (Ch->CC[32] != SS_UNTOUCHED) PushRawEvent(Batch, CMC, 32, Ch->CC[32]);
+	if (Ch->Program != SS_UNTOUCHED) PushRawEvent(Batch, MIDI_PROGCHAN | Chan, Ch->Program, 0);
+
+	for (BYTE CC = 1; CC < 120; CC++)
+	{
+		if (CC == 6 || CC == 32 || CC == 38 || (CC >= 96 && CC <= 101) || Ch->CC[CC] == SS_UNTOUCHED)
+			continue;
+
+		PushRawEvent(Batch, CMC, CC, Ch->CC[CC]);
+	}
+
+	for (BYTE RPN = 0; RPN < SS_RPNS; RPN++)
+	{
+		if (Ch->RPN[RPN][0] == SS_UNTOUCHED && Ch->RPN[RPN][1] == SS_UNTOUCHED)
+			continue;
+
+		PushRawEvent(Batch, CMC, 101, 0);
+		PushRawEvent(Batch, CMC, 100, RPN);
+		if (Ch->RPN[RPN][0] != SS_UNTOUCHED) PushRawEvent(Batch, CMC, 6, Ch->RPN[RPN][0]);
+		if (Ch->RPN[RPN][1] != SS_UNTOUCHED) PushRawEvent(Batch, CMC, 38, Ch->RPN[RPN][1]);
+		RPNsTouched = TRUE;
+	}
+
+	// Leave the RPN selection where the app left it, or closed if it was busy with an NRPN
+	if (RPNsTouched || Ch->RPNSelect != SS_RPN_NULL)
+	{
+		PushRawEvent(Batch, CMC, 101, (BYTE)(Ch->RPNSelect >> 7));
+		PushRawEvent(Batch, CMC, 100, (BYTE)(Ch->RPNSelect & 0x7F));
+	}
+
+	if (Ch->Pitch != 0xFFFF) PushRawEvent(Batch, MIDI_PITCHWHEEL | Chan, Ch->Pitch & 0x7F, Ch->Pitch >> 7);
+	if (Ch->Pressure != SS_UNTOUCHED) PushRawEvent(Batch, MIDI_CHANAFTER | Chan, Ch->Pressure, 0);
+}
+
+// Asks the new stream what it ended up with, and counts what doesn't match the checkpoint
+static DWORD CheckRestoredChannel(const ChannelState* Ch, DWORD Chan)
+{
+	static const struct { DWORD Event; BYTE CC; } Checks[] = {
+		{ MIDI_EVENT_MODULATION, 1 }, { MIDI_EVENT_VOLUME, 7 }, { MIDI_EVENT_PAN, 10 },
+		{ MIDI_EVENT_EXPRESSION, 11 }, { MIDI_EVENT_SUSTAIN, 64 },
+	};
+	DWORD Mismatches = 0;
+
+	for (DWORD i = 0; i < _countof(Checks); i++)
+	{
+		if (Ch->CC[Checks[i].CC] != SS_UNTOUCHED && BASS_MIDI_StreamGetEvent(OMStream, Chan, Checks[i].Event) != Ch->CC[Checks[i].CC])
+			Mismatches++;
+	}
+
+	if (Ch->Program != SS_UNTOUCHED && BASS_MIDI_StreamGetEvent(OMStream, Chan, MIDI_EVENT_PROGRAM) != Ch->Program)
+		Mismatches++;
+
+	if (Ch->Pitch != 0xFFFF && BASS_MIDI_StreamGetEvent(OMStream, Chan, MIDI_EVENT_PITCH) != Ch->Pitch)
+		Mismatches++;
+
+	if (Ch->RPN[0][0] != SS_UNTOUCHED && LOWORD(BASS_MIDI_StreamGetEvent(OMStream, Chan, MIDI_EVENT_PITCHRANGE)) != Ch->RPN[0][0])
+		Mismatches++;
+
+	return Mismatches;
+}
+
+// Called once the new stream is ready and its SoundFonts are loaded, before the threads start feeding it
+void RestoreSynthState()
+{
+	LARGE_INTEGER Start, End, Freq;
+	std::vector<BYTE> Batch;
+
+	if (!SynthCheckpointReady)
+		return;
+
+	SynthCheckpointReady = FALSE;
+
+	if (!SynthHost_ReadSetting(L"RestoreSynthState", TRUE))
+		return;
+
+	QueryPerformanceCounter(&Start);
+	SynthRestoreEvents = SynthRestoreMismatches = 0;
+
+	if (SynthCheckpoint.ResetSysExLen)
+		_BMSEs(OMStream, BASS_MIDI_EVENTS_RAW, SynthCheckpoint.ResetSysEx, SynthCheckpoint.ResetSysExLen);
+
+	// One batch per channel, the raw data can only be sent to a channel past the first 16 by overriding its own
+	for (DWORD i = 0; i < VB_CHANNELS; i++)
+	{
+		if (!SynthCheckpoint.Channels[i].Touched)
+			continue;
+
+		Batch.clear();
+		BuildChannelRestore(Batch, &SynthCheckpoint.Channels[i], (BYTE)(i & 0xF));
+
+		if (!Batch.empty())
+			_BMSEs(OMStream, RAWCHANNEL(i), &Batch[0], (DWORD)Batch.size());
+	}
+
+	QueryPerformanceCounter(&End);
+	QueryPerformanceFrequency(&Freq);
+	SynthRestoreMs = (FLOAT)((DOUBLE)(End.QuadPart - Start.QuadPart) * 1000.0 / Freq.QuadPart);
+
+	// The new stream starts from the checkpoint, and so does the mirror
+	LockForWriting(&SynthStateLock);
+	memcpy(&SynthState, &SynthCheckpoint, sizeof(SynthStateMirror));
+	UnlockForWriting(&SynthStateLock);
+
+	for (DWORD i = 0; i < VB_CHANNELS; i++)
+	{
+		if (SynthCheckpoint.Channels[i].Touched)
+			SynthRestoreMismatches += CheckRestoredChannel(&SynthCheckpoint.Channels[i], i);
+	}
+
+	PrintVarToDebugLog("RestoreSynthState", "Events replayed", &SynthRestoreEvents, PRINT_UINT32);
+	PrintVarToDebugLog("RestoreSynthState", "Restore time (ms)", &SynthRestoreMs, PRINT_FLOAT);
+	PrintVarToDebugLog("RestoreSynthState", "Values the new stream doesn't agree with", &SynthRestoreMismatches, PRINT_UINT32);
+}
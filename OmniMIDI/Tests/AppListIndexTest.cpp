@@ -0,0 +1,163 @@
+// AppListIndex: lookups, the order of the lists, and the round trip through the file with its source stamps
+
+#include "Check.h"
+#include "../AppListIndex.h"
+#include <random>
+#include <string>
+#include <vector>
+
+static std::wstring AppPath(uint32_t i) {
+	return L"C:\\Program Files\\Vendor " + std::to_wstring(i % 97) + L"\\App" + std::to_wstring(i) + L".exe";
+}
+
+static void Stamps(AppListIndex::Stamp* Out, uint64_t Seed) {
+	for (int i = 0; i < APPIDX_SOURCES; i++) {
+		Out[i].Time = Seed * 1000 + i;
+		Out[i].Size = Seed + i * 10;
+	}
+}
+
+static void TestLookups() {
+	AppListIndex Index;
+	AppListIndex::Stamp Src[APPIDX_SOURCES];
+
+	Stamps(Src, 1);
+	Index.Reset(Src);
+
+	for (uint32_t i = 0; i < 5000; i++)
+		CHECK(Index.Add(AppPath(i).c_str(), i % APPIDX_SOURCES));
+
+	CHECK(Index.Size() == 5000);
+
+	for (uint32_t i = 0; i < 5000; i++)
+		CHECK(Index.Find(AppPath(i).c_str()) == (int)(i % APPIDX_SOURCES));
+
+	CHECK(Index.Find(L"C:\\Windows\\notepad.exe") == -1);
+	CHECK(Index.Find(L"") == -1);
+
+	// The first list naming an app keeps it
+	CHECK(Index.Add(L"player.exe", 3));
+	CHECK(!Index.Add(L"player.exe", 1));
+	CHECK(Index.Find(L"player.exe") == 3);
+
+	// Same matching as _wcsicmp on the normalized path, lines from CRLF files lose their \r
+	CHECK(Index.Add(L"D:/Games/Some Game/Game.EXE\r", 5));
+	CHECK(Index.Find(L"d:\\games\\some game\\game.exe") == 5);
+	CHECK(Index.Find(L"D:\\Games\\Some Game\\Game.exe2") == -1);
+
+	// Blank lines don't count
+	CHECK(!Index.Add(L"", 0));
+	CHECK(!Index.Add(L"\r", 0));
+	CHECK(Index.Size() == 5002);
+	CHECK(AppListIndex::Hash(L"") != 0);
+}
+
+static void TestRoundTrip() {
+	AppListIndex Index, Loaded;
+	AppListIndex::Stamp Src[APPIDX_SOURCES], Changed[APPIDX_SOURCES];
+	std::vector<uint8_t> Data;
+
+	Stamps(Src, 2);
+	Index.Reset(Src);
+	for (uint32_t i = 0; i < 1000; i++)
+		Index.Add(AppPath(i).c_str(), (i * 3) % APPIDX_SOURCES);
+
+	CHECK(Index.IsCurrent(Src));
+	Index.Serialize(Data);
+
+	CHECK(Loaded.Deserialize(Data.data(), Data.size(), Src));
+	CHECK(Loaded.IsCurrent(Src));
+	CHECK(Loaded.Size() == Index.Size());
+
+	for (uint32_t i = 0; i < 1200; i++)
+		CHECK(Loaded.Find(AppPath(i).c_str()) == Index.Find(AppPath(i).c_str()));
+
+	// Any of the applists changing, even only in size, means it has to be rebuilt
+	for (int i = 0; i < APPIDX_SOURCES; i++) {
+		memcpy(Changed, Src, sizeof(Src));
+		if (i & 1) Changed[i].Size++;
+		else Changed[i].Time++;
+
+		CHECK(!Index.IsCurrent(Changed));
+		CHECK(!Loaded.Deserialize(Data.data(), Data.size(), Changed));
+	}
+
+	// Damaged files are refused, and leave what was loaded alone
+	std::vector<uint8_t> Bad = Data;
+	Bad[0] ^= 1;
+	CHECK(!Loaded.Deserialize(Bad.data(), Bad.size(), Src));
+	CHECK(!Loaded.Deserialize(Data.data(), Data.size() - 1, Src));
+	CHECK(!Loaded.Deserialize(Data.data(), 8, Src));
+
+	// A table that doesn't match its count could leave Find() probing forever
+	const size_t Table = 8 + sizeof(AppListIndex::Stamp) * APPIDX_SOURCES + 8;	// Magic, version, stamps, capacity and count
+	uint32_t Count;
+
+	memcpy(&Count, &Data[Table - 4], sizeof(Count));
+	CHECK(Count == Index.Size());
+
+	Bad = Data;
+	Count++;
+	memcpy(&Bad[Table - 4], &Count, sizeof(Count));
+	CHECK(!Loaded.Deserialize(Bad.data(), Bad.size(), Src));
+
+	Bad = Data;
+	for (size_t i = Table; i < Bad.size(); i += 16) {
+		if (Bad[i]) {
+			memset(&Bad[i], 0, 8);
+			break;
+		}
+	}
+	CHECK(!Loaded.Deserialize(Bad.data(), Bad.size(), Src));
+
+	CHECK(Loaded.Size() == Index.Size());
+	CHECK(Loaded.Find(AppPath(7).c_str()) == Index.Find(AppPath(7).c_str()));
+}
+
+// Lookup cost on indexes of thousands of apps, what the driver pays on every open
+static void Bench() {
+	for (uint32_t Apps = 1000; Apps <= 100000; Apps *= 10) {
+		AppListIndex Index, Loaded;
+		AppListIndex::Stamp Src[APPIDX_SOURCES];
+		std::vector<std::wstring> Names(Apps);
+		std::vector<uint8_t> Data;
+		std::mt19937 Rng(Apps);
+		int Found = 0;
+
+		for (uint32_t i = 0; i < Apps; i++)
+			Names[i] = AppPath(i);
+
+		Stamps(Src, 3);
+
+		CheckClock Start = CheckNow();
+		Index.Reset(Src);
+		for (uint32_t i = 0; i < Apps; i++)
+			Index.Add(Names[i].c_str(), i % APPIDX_SOURCES);
+		double BuildTime = SecondsSince(Start);
+
+		Index.Serialize(Data);
+
+		Start = CheckNow();
+		Loaded.Deserialize(Data.data(), Data.size(), Src);
+		double LoadTime = SecondsSince(Start);
+
+		const int Lookups = 1000000;
+		Start = CheckNow();
+		for (int i = 0; i < Lookups; i++)
+			Found += Loaded.Find(Names[Rng() % Apps].c_str()) >= 0;
+		double FindTime = SecondsSince(Start);
+
+		printf("AppListIndex: %6u apps, build %.2f ms, load %.3f ms (%zu bytes), lookup %.1f ns (%d)\n",
+			Apps, BuildTime * 1e3, LoadTime * 1e3, Data.size(), FindTime * 1e9 / Lookups, Found == Lookups);
+	}
+}
+
+int main(int argc, char** argv) {
+	TestLookups();
+	TestRoundTrip();
+
+	if (WantsBench(argc, argv))
+		Bench();
+
+	return CheckResult("AppListIndex");
+}
@@ -0,0 +1,37 @@
+/*
+OmniMIDI portable tests
+The headers that don't depend on Win32 get tested on their own, each test is a single file:
+g++ -std=c++11 -O2 -Wall -Wextra -pthread TimerWheelTest.cpp -o TimerWheelTest && ./TimerWheelTest
+Run a test with "bench" as its argument to get its benchmarks too.
+*/
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+static int CheckFailures = 0;
+
+#define CHECK(x) do { if (!(x)) { printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #x); CheckFailures++; } } while (0)
+
+typedef std::chrono::steady_clock::time_point CheckClock;
+
+static CheckClock CheckNow() {
+	return std::chrono::steady_clock::now();
+}
+
+static double SecondsSince(CheckClock Start) {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - Start).count();
+}
+
+static bool WantsBench(int argc, char** argv) {
+	return argc > 1 && !strcmp(argv[1], "bench");
+}
+
+// What main returns
+static int CheckResult(const char* Name) {
+	if (CheckFailures) printf("%s: %d checks failed\n", Name, CheckFailures);
+	else printf("%s: passed\n", Name);
+
+	return CheckFailures != 0;
+}
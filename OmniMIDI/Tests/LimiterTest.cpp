@@ -0,0 +1,253 @@
+// Built-in limiter: the gain reduction keeps every frame under the ceiling without relying on the final clamp,
+// leaves quiet audio alone, and lets go once the peak is gone.
+// "bench" prints the CPU time per render block and the latency the lookahead adds
+
+#include "Check.h"
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+// Just enough of Win32 and BASS for Limiter.h to build, the kernel itself doesn't touch them
+typedef int BOOL;
+typedef uint32_t DWORD;
+typedef uint64_t QWORD;
+typedef float FLOAT;
+typedef double DOUBLE;
+typedef int16_t SHORT;
+typedef uint32_t HDSP;
+typedef uint32_t HSTREAM;
+typedef void* HKEY;
+typedef uint8_t* LPBYTE;
+typedef struct { int64_t QuadPart; } LARGE_INTEGER;
+typedef struct { DWORD freq, chans, flags; } BASS_CHANNELINFO;
+typedef void (*DSPPROC)(HDSP, DWORD, void*, DWORD, void*);
+
+#define TRUE 1
+#define FALSE 0
+#define CALLBACK
+#define ERROR_SUCCESS 0
+#define HKEY_CURRENT_USER nullptr
+#define KEY_READ 0
+#define REG_DWORD 4
+#define BASS_SAMPLE_8BITS 1
+#define BASS_SAMPLE_FLOAT 256
+#define ERRORCODE 0
+#define max(a, b) (((a) > (b)) ? (a) : (b))
+#define min(a, b) (((a) < (b)) ? (a) : (b))
+
+// The SSE2 paths are what the driver runs on x86, test them when the compiler has them
+#if defined(__SSE2__) && !defined(_M_AMD64)
+#define _M_AMD64
+#endif
+
+static HSTREAM OMStream = 0;
+static long RegOpenKeyExW(HKEY, const wchar_t*, DWORD, DWORD, HKEY*) { return 1; }
+static long RegQueryValueExW(HKEY, const wchar_t*, DWORD*, DWORD*, LPBYTE, DWORD*) { return 1; }
+static long RegCloseKey(HKEY) { return 0; }
+static int QueryPerformanceFrequency(LARGE_INTEGER* Freq) { Freq->QuadPart = 1000000000; return 1; }
+static int QueryPerformanceCounter(LARGE_INTEGER* Count) {
+	Count->QuadPart = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	return 1;
+}
+static int BASS_ChannelGetInfo(HSTREAM, BASS_CHANNELINFO*) { return 0; }
+static HDSP BASS_ChannelSetDSP(HSTREAM, DSPPROC, void*, int) { return 0; }
+static int BASS_ChannelRemoveDSP(HSTREAM, HDSP) { return 1; }
+static int BASS_VST_ChannelRemoveDSP(HSTREAM, DWORD) { return 1; }
+static void PrintMessageToDebugLog(const char*, const char*) { }
+static bool CheckUp(bool, int, const char*, bool) { return false; }
+
+// The DSP callback has the whole BASS signature, most of which it doesn't need
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+#include "../Limiter.h"
+#pragma GCC diagnostic pop
+
+static const DWORD Freq = 48000;
+static const DWORD Quiet = Freq / 4;	// Frames before the first loud part
+
+static float LinkedPeak(const float* Frame, DWORD Chans) {
+	float Peak = 0.0f;
+
+	for (DWORD c = 0; c < Chans; c++)
+		Peak = max(Peak, fabsf(Frame[c]));
+
+	return Peak;
+}
+
+// Runs Input through the kernel chunk by chunk, checking every gain against the frame it gets applied to.
+// Returns the output, which lags Look frames behind
+static std::vector<float> Run(LimiterState* L, const std::vector<float>& Input) {
+	std::vector<float> Output(Input);
+	DWORD Frames = (DWORD)(Input.size() / L->Chans);
+	int Overshoots = 0;
+
+	for (DWORD Done = 0; Done < Frames; ) {
+		DWORD Chunk = min(Frames - Done, (DWORD)LIMITER_CHUNK);
+
+		LimiterProcessChunk(L, &Output[Done * L->Chans], Chunk);
+
+		// The gain alone has to be enough, the clamp in LimiterApply is only there for rounding
+		for (DWORD i = 0; i < Chunk; i++) {
+			uint64_t Frame = Done + i;
+
+			if (Frame >= L->Look && L->Gain[i] * LinkedPeak(&Input[(Frame - L->Look) * L->Chans], L->Chans) > L->Ceiling * 1.0001f)
+				Overshoots++;
+		}
+
+		Done += Chunk;
+	}
+
+	CHECK(!Overshoots);
+	return Output;
+}
+
+static void TestGainReduction(DWORD Chans) {
+	std::mt19937 Rng(81 + Chans);
+	std::uniform_real_distribution<float> Noise(-1.0f, 1.0f);
+	const DWORD Frames = Freq * 2;
+	std::vector<float> Input(Frames * Chans);
+
+	LimiterCeiling = 300;		// -3 dB
+	LimiterRelease = 50;
+	LimiterLookahead = 5;
+
+	LimiterState* L = Limiter = AllocateLimiter(Freq, Chans, sizeof(float));
+	CHECK(L && L->Look == Freq * 5 / 1000);
+	if (!L)
+		return;
+
+	// Quiet for a while, then loud bursts with isolated spikes, then quiet again
+	for (DWORD i = 0; i < Frames; i++) {
+		bool Loud = i >= Quiet && i < Freq * 3 / 2;
+		float Level = !Loud ? 0.2f : ((i / 2400) % 2 ? 3.0f : 0.5f);
+
+		for (DWORD c = 0; c < Chans; c++)
+			Input[i * Chans + c] = Noise(Rng) * Level;
+
+		if (Loud && !(i % 7919))
+			Input[i * Chans] = 8.0f;
+	}
+
+	std::vector<float> Output = Run(L, Input);
+	float MaxOut = 0.0f;
+
+	for (size_t i = 0; i < Output.size(); i++)
+		MaxOut = max(MaxOut, fabsf(Output[i]));
+
+	CHECK(MaxOut <= L->Ceiling);
+
+	// Untouched, only delayed, until the loud part gets into the lookahead window
+	for (DWORD i = L->Look; i < Quiet; i++) {
+		for (DWORD c = 0; c < Chans; c++) {
+			if (Output[i * Chans + c] != Input[(i - L->Look) * Chans + c]) {
+				CHECK(!"Quiet audio got changed");
+				i = Quiet;
+				break;
+			}
+		}
+	}
+
+	// Back to unity once the release is over, 50 ms is plenty to get within 1%
+	float Tail = L->Gain[LIMITER_CHUNK - 1];
+	CHECK(Tail > 0.99f && Tail <= 1.0f);
+
+	FreeLimiter();
+}
+
+// A steady sine at twice the ceiling gets brought down to the ceiling, and the reduction is reported through the DSP
+static void TestSteadyTone() {
+	const DWORD Chans = 2, Frames = Freq;
+	std::vector<SHORT> Pcm(Frames * Chans);
+	float Ceiling;
+
+	LimiterCeiling = 600;		// -6 dB
+	LimiterRelease = 100;
+	LimiterLookahead = 2;
+
+	Limiter = AllocateLimiter(Freq, Chans, sizeof(SHORT));
+	CHECK(Limiter != NULL);
+	if (!Limiter)
+		return;
+
+	Ceiling = Limiter->Ceiling;
+	QueryPerformanceFrequency(&LimiterQPCFreq);
+
+	// The 16-bit path, with a tone that would clip at full scale if it could go past it
+	for (DWORD i = 0; i < Frames; i++) {
+		float S = (float)sin(2.0 * 3.14159265358979 * 440.0 * i / Freq) * 32767.0f;
+		Pcm[i * 2] = Pcm[i * 2 + 1] = (SHORT)S;
+	}
+
+	LimiterDSPProc(0, 0, &Pcm[0], (DWORD)(Pcm.size() * sizeof(SHORT)), NULL);
+
+	SHORT MaxOut = 0;
+	for (DWORD i = Freq / 2; i < Frames; i++)
+		MaxOut = max(MaxOut, (SHORT)abs(Pcm[i * 2]));
+
+	// Within a dB of where it should be, and never above it
+	CHECK(MaxOut <= (SHORT)(Ceiling * 32768.0f) + 1);
+	CHECK(MaxOut >= (SHORT)(Ceiling * 32768.0f * 0.89f));
+	CHECK(fabsf(LimiterReduction - 20.0f * log10f(Ceiling)) < 1.0f);
+
+	FreeLimiter();
+}
+
+// Out of range settings get clamped, and there's nothing to limit without a stream
+static void TestSettings() {
+	LimiterMode = 7;
+	LimiterCeiling = 10000;
+	LimiterRelease = 0;
+	LimiterLookahead = 1000;
+	LoadLimiterSettings();
+
+	CHECK(LimiterMode == LIMITER_BUILTIN);
+	CHECK(LimiterCeiling == 2400);
+	CHECK(LimiterRelease == 1);
+	CHECK(LimiterLookahead == LIMITER_MAX_LOOKAHEAD);
+
+	CHECK(!InitializeBuiltInLimiter());
+	CHECK(!Limiter && !GetLimiterLatency());
+}
+
+static void Bench() {
+	const DWORD Chans = 2, Block = 1024, Blocks = 20000;
+	std::vector<float> Buffer(Block * Chans);
+	std::mt19937 Rng(1);
+	std::uniform_real_distribution<float> Noise(-2.0f, 2.0f);
+
+	LimiterCeiling = 100;
+	LimiterRelease = 100;
+	LimiterLookahead = 5;
+	Limiter = AllocateLimiter(Freq, Chans, sizeof(float));
+	QueryPerformanceFrequency(&LimiterQPCFreq);
+
+	for (size_t i = 0; i < Buffer.size(); i++)
+		Buffer[i] = Noise(Rng);
+
+	CheckClock Start = CheckNow();
+	for (DWORD i = 0; i < Blocks; i++)
+		LimiterDSPProc(0, 0, &Buffer[0], Block * Chans * sizeof(float), NULL);
+	double Time = SecondsSince(Start);
+
+	printf("Limiter: %u-frame stereo blocks, %.2f us per block (%.1f%% of a core at %u Hz), max %u us\n",
+		Block, Time * 1e6 / Blocks, Time * 100.0 * Freq / ((double)Block * Blocks), Freq, LimiterBlockMaxUs);
+
+	LimiterDSP = 1;
+	printf("Limiter: %.0f ms lookahead, %u frames of latency at %u Hz\n", GetLimiterLatency(), Limiter->Look, Freq);
+
+	DetachLimiter();
+}
+
+int main(int argc, char** argv) {
+	TestGainReduction(2);
+	TestGainReduction(1);
+	TestSteadyTone();
+	TestSettings();
+
+	if (WantsBench(argc, argv))
+		Bench();
+
+	return CheckResult("Limiter");
+}
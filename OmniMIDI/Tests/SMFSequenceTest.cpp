@@ -0,0 +1,345 @@
+// SMFSequence: decoding, merge order, seeking and the memory limit.
+// "bench [MB]" generates a black MIDI of that size (1024 MB by default) in the temp folder and plays it through
+
+#include "Check.h"
+#include "../SMFSequence.h"
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+typedef std::vector<uint8_t> Bytes;
+
+static void PutVLQ(Bytes& Out, uint32_t Value) {
+	uint8_t Tmp[5];
+	int Count = 0;
+
+	do Tmp[Count++] = Value & 0x7F;
+	while (Value >>= 7);
+
+	while (Count--)
+		Out.push_back(Tmp[Count] | (Count ? 0x80 : 0));
+}
+
+static void PutBE(Bytes& Out, uint32_t Value, int Size) {
+	while (Size--)
+		Out.push_back((uint8_t)(Value >> (Size * 8)));
+}
+
+static Bytes Header(uint16_t Format, uint16_t Tracks, uint16_t Division) {
+	Bytes Out = { 'M', 'T', 'h', 'd' };
+
+	PutBE(Out, 6, 4);
+	PutBE(Out, Format, 2);
+	PutBE(Out, Tracks, 2);
+	PutBE(Out, Division, 2);
+	return Out;
+}
+
+static void PutTrack(Bytes& Out, const Bytes& Track) {
+	Out.insert(Out.end(), { 'M', 'T', 'r', 'k' });
+	PutBE(Out, (uint32_t)Track.size(), 4);
+	Out.insert(Out.end(), Track.begin(), Track.end());
+}
+
+static const Bytes EndOfTrack = { 0x00, 0xFF, 0x2F, 0x00 };
+
+typedef struct Expected {
+	uint64_t Time;
+	uint32_t Msg;
+	uint32_t Track;
+} Expected;
+
+static std::vector<SMFSequence::Event> PlayAll(SMFSequence::Cursor& C) {
+	std::vector<SMFSequence::Event> Out;
+
+	while (!C.AtEnd()) {
+		uint64_t Time = C.PeekTime();
+		SMFSequence::Event Ev = C.Next();
+
+		CHECK(Ev.Time == Time);
+		Out.push_back(Ev);
+	}
+
+	CHECK(C.PeekTime() == UINT64_MAX);
+	return Out;
+}
+
+// Tempo changes, running status, long messages and meta events in a small format 1 file
+static void TestDecoding() {
+	Bytes File = Header(1, 3, 96);
+	Bytes T0 = {
+		0x00, 0xFF, 0x03, 0x04, 'T', 'e', 's', 't',		// Name, skipped
+		0x00, 0xF0, 0x03, 0x7E, 0x7F, 0xF7,				// SysEx, gets its F0 back
+		0x60, 0xFF, 0x51, 0x03, 0x03, 0xD0, 0x90,		// 250000 us per quarter note on tick 96
+		0x60, 0xF7, 0x02, 0xF8, 0xFA,					// Escape, sent as it is
+	};
+	Bytes T1 = {
+		0x00, 0x91, 0x3C, 0x40,
+		0x60, 0x3E, 0x40,								// Running status
+		0x60, 0xC1, 0x05,								// One data byte
+		0x00, 0x81, 0x3C, 0x00,
+	};
+	Bytes T2 = {
+		0x00, 0x92, 0x40, 0x50,
+		0x81, 0x40, 0x82, 0x40, 0x00,					// Tick 192, two byte delta
+	};
+
+	T0.insert(T0.end(), EndOfTrack.begin(), EndOfTrack.end());
+	T1.insert(T1.end(), EndOfTrack.begin(), EndOfTrack.end());
+	T2.insert(T2.end(), EndOfTrack.begin(), EndOfTrack.end());
+	PutTrack(File, T0);
+	PutTrack(File, T1);
+	PutTrack(File, T2);
+
+	SMFSequence Seq;
+	SMFSequence::Cursor C;
+
+	CHECK(Seq.Load(File.data(), File.size()));
+	CHECK(Seq.Tracks == 3);
+	CHECK(Seq.EventCount == 8);
+	CHECK(Seq.Length == 750000);
+
+	C.Attach(Seq);
+	std::vector<SMFSequence::Event> Evs = PlayAll(C);
+	const uint8_t SysEx[] = { 0xF0, 0x7E, 0x7F, 0xF7 }, Escape[] = { 0xF8, 0xFA };
+
+	CHECK(Evs.size() == 8);
+	if (Evs.size() != 8)
+		return;
+
+	// Same time, track order
+	CHECK(Evs[0].Time == 0 && Evs[0].Long && Evs[0].LongLength == 4 && !memcmp(Evs[0].Long, SysEx, 4));
+	CHECK(Evs[1].Time == 0 && Evs[1].Msg == 0x403C91);
+	CHECK(Evs[2].Time == 0 && Evs[2].Msg == 0x504092);
+	CHECK(Evs[3].Time == 500000 && Evs[3].Msg == 0x403E91);
+
+	// Twice as fast after the tempo change
+	CHECK(Evs[4].Time == 750000 && Evs[4].Long && Evs[4].LongLength == 2 && !memcmp(Evs[4].Long, Escape, 2));
+	CHECK(Evs[5].Time == 750000 && Evs[5].Msg == 0x05C1);
+	CHECK(Evs[6].Time == 750000 && Evs[6].Msg == 0x003C81);
+	CHECK(Evs[7].Time == 750000 && Evs[7].Msg == 0x004082);
+
+	// Seeking right on an event keeps it, the chase only sees the short messages before
+	C.Seek(500000);
+	CHECK(!C.AtEnd() && C.PeekTime() == 500000 && C.Next().Msg == 0x403E91);
+
+	std::vector<uint32_t> Chased;
+	Seq.ForEachBefore(750000, [&](uint16_t, uint64_t, uint32_t Msg) { Chased.push_back(Msg); });
+	CHECK((Chased == std::vector<uint32_t>{ 0x403C91, 0x403E91, 0x504092 }));
+
+	C.Detach();
+	CHECK(C.AtEnd());
+}
+
+// Random tracks, checked against a reference merge
+static void TestMerge() {
+	const uint16_t Tracks = 12, Division = 480;
+	std::mt19937 Rng(98);
+	std::vector<Expected> Reference;
+	Bytes File = Header(1, Tracks, Division);
+
+	for (uint16_t t = 0; t < Tracks; t++) {
+		Bytes T;
+		uint64_t Tick = 0;
+		uint8_t Last = 0;
+
+		// Long enough to get a few seek points
+		for (int i = (t == 5) ? 0 : (int)(Rng() % (SMF_SEEK_STEP * 4)); i > 0; i--) {
+			uint32_t Delta = (Rng() % 3) ? 0 : Rng() % 2000;
+			uint8_t Status = 0x90 | (t & 15);
+			Expected E;
+
+			Tick += Delta;
+			PutVLQ(T, Delta);
+			if (Status != Last || Rng() % 2) T.push_back(Status);
+			T.push_back(Rng() % 128);
+			T.push_back(Rng() % 128);
+			Last = Status;
+
+			E.Time = (uint64_t)((double)Tick * ((double)SMF_DEFAULT_TEMPO / Division));
+			E.Msg = Status | (T[T.size() - 2] << 8) | (T[T.size() - 1] << 16);
+			E.Track = t;
+			Reference.push_back(E);
+		}
+
+		T.insert(T.end(), EndOfTrack.begin(), EndOfTrack.end());
+		PutTrack(File, T);
+	}
+
+	std::stable_sort(Reference.begin(), Reference.end(), [](const Expected& a, const Expected& b) {
+		return a.Time < b.Time || (a.Time == b.Time && a.Track < b.Track);
+	});
+
+	SMFSequence Seq;
+	SMFSequence::Cursor C;
+
+	CHECK(Seq.Load(File.data(), File.size(), 0, 4));
+	CHECK(Seq.EventCount == Reference.size());
+
+	C.Attach(Seq);
+
+	for (int Round = 0; Round < 8; Round++) {
+		uint64_t Time = Round ? Rng() % (Seq.Length + 2) : 0;
+		size_t First = std::lower_bound(Reference.begin(), Reference.end(), Time,
+			[](const Expected& e, uint64_t v) { return e.Time < v; }) - Reference.begin();
+
+		C.Seek(Time);
+		std::vector<SMFSequence::Event> Evs = PlayAll(C);
+
+		CHECK(Evs.size() == Reference.size() - First);
+
+		for (size_t i = 0; i < Evs.size() && First + i < Reference.size(); i++) {
+			if (Evs[i].Time != Reference[First + i].Time || Evs[i].Msg != Reference[First + i].Msg) {
+				CHECK(!"Event out of order");
+				break;
+			}
+		}
+
+		size_t Chased = 0;
+		Seq.ForEachBefore(Time, [&](uint16_t Track, uint64_t EvTime, uint32_t Msg) {
+			CHECK(EvTime < Time && (Msg & 0xF) == Track);
+			Chased++;
+		});
+		CHECK(Chased == First);
+	}
+}
+
+// The memory limit refuses a file, and reports what it would have needed
+static void TestLimits() {
+	Bytes File = Header(0, 1, 96), T;
+
+	for (int i = 0; i < SMF_SEEK_STEP * 64; i++) {
+		T.insert(T.end(), { 0x00, 0x90, 0x3C, 0x40 });
+		T.insert(T.end(), { 0x01, 0x80, 0x3C, 0x00 });
+	}
+
+	T.insert(T.end(), EndOfTrack.begin(), EndOfTrack.end());
+	PutTrack(File, T);
+
+	SMFSequence Seq;
+
+	CHECK(Seq.Load(File.data(), File.size()));
+	CHECK(Seq.EventCount == SMF_SEEK_STEP * 128);
+
+	// Only the index stays in memory, way less than the file itself
+	uint64_t Needed = Seq.MemoryUsed;
+	CHECK(Needed && Needed < File.size() / 64);
+
+	CHECK(!Seq.Load(File.data(), File.size(), Needed - 1));
+	CHECK(Seq.MemoryUsed == Needed && !Seq.Tracks && !Seq.EventCount);
+	CHECK(Seq.Load(File.data(), File.size(), Needed));
+
+	// A damaged track keeps what came before the damage
+	Bytes Damaged = Header(2, 2, 96), D0 = { 0x00, 0x90, 0x3C, 0x40, 0x60, 0x3E }, D1 = { 0x00, 0x90, 0x40, 0x40 };
+	D1.insert(D1.end(), EndOfTrack.begin(), EndOfTrack.end());
+	PutTrack(Damaged, D0);
+	PutTrack(Damaged, D1);
+
+	SMFSequence::Cursor C;
+
+	CHECK(Seq.Load(Damaged.data(), Damaged.size()));
+	CHECK(Seq.EventCount == 2);
+	C.Attach(Seq);
+	std::vector<SMFSequence::Event> Evs = PlayAll(C);
+
+	// Format 2, the second track starts where the first one ended
+	CHECK(Evs.size() == 2 && Evs[0].Time == 0 && Evs[1].Time == 500000 && Evs[1].Msg == 0x404090);
+
+	// Not MIDI files, or ones that would divide by zero
+	Bytes NoTracks = Header(1, 0, 96), Smpte = Header(0, 1, 0xE700);	// 25 fps, no ticks per frame
+	PutTrack(Smpte, EndOfTrack);
+
+	CHECK(!Seq.Load(NoTracks.data(), NoTracks.size()));
+	CHECK(!Seq.Load(Smpte.data(), Smpte.size()));
+	CHECK(!Seq.Load(File.data(), 10));
+	CHECK(!Seq.Tracks && !Seq.Length);
+}
+
+static double PeakRSSMB() {
+	struct rusage Usage;
+
+	getrusage(RUSAGE_SELF, &Usage);
+	return Usage.ru_maxrss / 1024.0;
+}
+
+// A black MIDI: 256 tracks of chords, written to a file and mapped like the driver does
+static void Bench(size_t MB) {
+	const uint16_t Tracks = 256;
+	std::string Path = std::string(getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp") + "/SMFSequenceBench.mid";
+	FILE* Out = fopen(Path.c_str(), "wb");
+	Bytes Chunk = Header(1, Tracks, 960);
+	size_t TrackBytes = MB * 1048576 / Tracks;
+
+	if (!Out) {
+		printf("SMFSequence: couldn't create %s\n", Path.c_str());
+		return;
+	}
+
+	fwrite(Chunk.data(), 1, Chunk.size(), Out);
+
+	for (uint16_t t = 0; t < Tracks; t++) {
+		Bytes T;
+		uint8_t Key = 0;
+
+		T.reserve(TrackBytes + 16);
+
+		while (T.size() < TrackBytes) {
+			T.insert(T.end(), { 0x00, (uint8_t)(0x90 | (t & 15)), Key, 0x40, 0x00, Key, 0x00 });
+			T.insert(T.end(), { 0x0A, (uint8_t)(0x80 | (t & 15)), Key, 0x00 });
+			Key = (Key + 7) & 0x7F;
+		}
+
+		T.insert(T.end(), EndOfTrack.begin(), EndOfTrack.end());
+		Chunk.clear();
+		PutTrack(Chunk, T);
+		fwrite(Chunk.data(), 1, Chunk.size(), Out);
+	}
+
+	fclose(Out);
+
+	int Fd = open(Path.c_str(), O_RDONLY);
+	size_t Size = (size_t)lseek(Fd, 0, SEEK_END);
+	const uint8_t* Data = (const uint8_t*)mmap(nullptr, Size, PROT_READ, MAP_PRIVATE, Fd, 0);
+	SMFSequence Seq;
+	SMFSequence::Cursor C;
+	uint64_t Played = 0, Sum = 0;
+
+	CheckClock Start = CheckNow();
+	CHECK(Seq.Load(Data, Size));
+	double LoadTime = SecondsSince(Start);
+
+	Start = CheckNow();
+	for (C.Attach(Seq); !C.AtEnd(); Played++)
+		Sum += C.Next().Msg;
+	double PlayTime = SecondsSince(Start);
+
+	CHECK(Played == Seq.EventCount);
+
+	printf("SMFSequence: %.0f MB, %llu events, %u tracks\n", Size / 1048576.0, (unsigned long long)Seq.EventCount, Seq.Tracks);
+	printf("  load %.2f s (%.1f M events/s), merge %.2f s (%.1f M events/s)\n",
+		LoadTime, Seq.EventCount / LoadTime / 1e6, PlayTime, Played / PlayTime / 1e6);
+	printf("  index %.2f MB, peak RSS %.1f MB (mapped pages included) (%llu)\n",
+		Seq.MemoryUsed / 1048576.0, PeakRSSMB(), (unsigned long long)(Sum & 0xFF));
+
+	C.Detach();
+	Seq.Clear();
+	munmap((void*)Data, Size);
+	close(Fd);
+	unlink(Path.c_str());
+}
+
+int main(int argc, char** argv) {
+	TestDecoding();
+	TestMerge();
+	TestLimits();
+
+	if (WantsBench(argc, argv))
+		Bench(argc > 2 ? (size_t)atoi(argv[2]) : 1024);
+
+	return CheckResult("SMFSequence");
+}
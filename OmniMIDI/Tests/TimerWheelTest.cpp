@@ -0,0 +1,199 @@
+// TimerWheel: every event fires once, in order and on time, from whichever level it was parked on
+
+#include "Check.h"
+#include "../TimerWheel.h"
+#include <map>
+#include <random>
+#include <vector>
+
+typedef struct Pending {
+	uint64_t Frame;
+	uint32_t Handle;
+	uint16_t Group;
+} Pending;
+
+// Expires up to Horizon, and checks what fired against what should have
+static void ExpireAndCheck(TimerWheel& Wheel, std::map<uint32_t, Pending>& Expected, uint64_t& Clock, uint64_t Horizon) {
+	uint64_t Last = 0;
+	size_t Due = 0, Fired = 0;
+
+	for (auto& E : Expected)
+		Due += E.second.Frame < Horizon;
+
+	Wheel.Expire(Horizon, [&](uint64_t Frame, uint32_t Data) {
+		auto E = Expected.find(Data);
+
+		CHECK(E != Expected.end());
+		if (E == Expected.end())
+			return;
+
+		CHECK(E->second.Frame == Frame);
+		CHECK(Frame < Horizon);
+		CHECK(Frame >= Last);
+
+		// Events that were already late when they got added fire on the first frame
+		Last = (Frame > Clock) ? Frame : Clock;
+		Expected.erase(E);
+		Fired++;
+	});
+
+	CHECK(Fired == Due);
+	CHECK(Wheel.Pending() == Expected.size());
+	Clock = Horizon;
+}
+
+// One event on each side of every level boundary
+static void TestLevels() {
+	TimerWheel Wheel;
+	std::map<uint32_t, Pending> Expected;
+	uint64_t Clock = 1000;
+	uint32_t Data = 0;
+	const uint64_t Deltas[] = { 0, 1, 255, 256, 257, 65535, 65536, 65537, 100000, (1 << 24) - 1, 1 << 24, (1 << 24) + 12345, 50000000 };
+
+	CHECK(Wheel.Init(64, 16));
+	Wheel.Reset(Clock);
+
+	for (uint64_t Delta : Deltas) {
+		Pending P = { Clock + Delta, 0, (uint16_t)(Data & 15) };
+
+		P.Handle = Wheel.Add(P.Frame, Data, P.Group);
+		CHECK(P.Handle != TW_NIL);
+		Expected[Data++] = P;
+	}
+
+	// Small steps around the boundaries, big ones in between
+	while (!Expected.empty() && Clock < 60000000)
+		ExpireAndCheck(Wheel, Expected, Clock, Clock + ((Clock & 0xFFFF) < 300 ? 7 : 9973));
+
+	CHECK(Expected.empty());
+}
+
+// Random adds, cancels and expiries against a plain map
+static void TestRandom() {
+	TimerWheel Wheel;
+	std::map<uint32_t, Pending> Expected;
+	std::mt19937 Rng(94);
+	uint64_t Clock = 0;
+	uint32_t Data = 0;
+
+	CHECK(Wheel.Init(256, 16));
+
+	for (int Round = 0; Round < 400; Round++) {
+		for (int i = Rng() % 64; i > 0; i--) {
+			static const uint32_t Spreads[] = { 1 << 8, 1 << 16, 1 << 22, 1 << 25 };
+			Pending P = { Clock + Rng() % Spreads[Rng() % 4], 0, (uint16_t)(Rng() % 16) };
+
+			// Runs out of nodes sometimes, it has to grow without losing the handles it gave out
+			P.Handle = Wheel.Add(P.Frame, Data, P.Group);
+			if (P.Handle == TW_NIL) {
+				CHECK(Wheel.Grow(Wheel.Size() * 2));
+				P.Handle = Wheel.Add(P.Frame, Data, P.Group);
+			}
+
+			CHECK(P.Handle != TW_NIL);
+			Expected[Data++] = P;
+		}
+
+		// Cancel a few by handle, one of them twice
+		for (int i = Rng() % 8; i > 0 && !Expected.empty(); i--) {
+			auto E = Expected.lower_bound(Rng() % Data);
+			if (E == Expected.end()) E = Expected.begin();
+
+			CHECK(Wheel.Cancel(E->second.Handle, E->first));
+			CHECK(!Wheel.Cancel(E->second.Handle, E->first));
+			Expected.erase(E);
+		}
+
+		if (!(Round % 50)) {
+			uint16_t Group = Rng() % 16;
+			uint32_t Cancelled = 0;
+
+			for (auto E = Expected.begin(); E != Expected.end(); ) {
+				if (E->second.Group == Group) {
+					E = Expected.erase(E);
+					Cancelled++;
+				}
+				else E++;
+			}
+
+			CHECK(Wheel.CancelGroup(Group) == Cancelled);
+		}
+
+		ExpireAndCheck(Wheel, Expected, Clock, Clock + Rng() % (1 << 17));
+	}
+
+	while (!Expected.empty())
+		ExpireAndCheck(Wheel, Expected, Clock, Clock + (1 << 20));
+}
+
+// Events added behind the clock fire right away, and Reset drops everything
+static void TestLateAndReset() {
+	TimerWheel Wheel;
+	uint32_t Fired = 0;
+
+	CHECK(Wheel.Init(8, 1));
+	Wheel.Reset(5000);
+
+	CHECK(Wheel.Add(10, 1, 0) != TW_NIL);
+	CHECK(Wheel.Add(20000, 2, 0) != TW_NIL);
+	CHECK(Wheel.Add(1, 3, 1) == TW_NIL);	// No such group
+
+	Wheel.Expire(5001, [&](uint64_t Frame, uint32_t Data) {
+		CHECK(Frame == 10 && Data == 1);
+		Fired++;
+	});
+
+	CHECK(Fired == 1);
+	CHECK(Wheel.Pending() == 1);
+
+	Wheel.Reset(0);
+	CHECK(Wheel.Pending() == 0);
+	Wheel.Expire(100000, [&](uint64_t, uint32_t) { Fired++; });
+	CHECK(Fired == 1);
+
+	// An empty wheel lets the clock jump, a new event is measured from there
+	CHECK(Wheel.Add(100100, 4, 0) != TW_NIL);
+	Wheel.Expire(100101, [&](uint64_t Frame, uint32_t Data) {
+		CHECK(Frame == 100100 && Data == 4);
+		Fired++;
+	});
+	CHECK(Fired == 2);
+}
+
+// Millions of pending note-offs, spread over a minute of audio at 48 kHz
+static void Bench() {
+	const uint32_t Events = 4000000;
+	TimerWheel Wheel;
+	std::mt19937 Rng(1);
+	std::vector<uint64_t> Frames(Events);
+	uint64_t Sum = 0;
+
+	for (uint32_t i = 0; i < Events; i++)
+		Frames[i] = Rng() % (48000 * 60);
+
+	Wheel.Init(Events, 16);
+
+	CheckClock Start = CheckNow();
+	for (uint32_t i = 0; i < Events; i++)
+		Wheel.Add(Frames[i], i, (uint16_t)(i & 15));
+	double AddTime = SecondsSince(Start);
+
+	Start = CheckNow();
+	for (uint64_t Block = 0; Wheel.Pending(); Block += 512)
+		Wheel.Expire(Block + 512, [&](uint64_t Frame, uint32_t) { Sum += Frame; });
+	double ExpireTime = SecondsSince(Start);
+
+	printf("TimerWheel: %u events, add %.1f ns/event, expire %.1f ns/event (%llu)\n",
+		Events, AddTime * 1e9 / Events, ExpireTime * 1e9 / Events, (unsigned long long)(Sum & 0xFF));
+}
+
+int main(int argc, char** argv) {
+	TestLevels();
+	TestRandom();
+	TestLateAndReset();
+
+	if (WantsBench(argc, argv))
+		Bench();
+
+	return CheckResult("TimerWheel");
+}
@@ -0,0 +1,252 @@
+/*
+OmniMIDI timer wheel
+Hierarchical timing wheel, holding small events until the render clock reaches the sample frame they're due at.
+Insertion and cancellation are O(1), expiring costs one slot check per frame plus the events that expire,
+and every event gets moved down at most once per level.
+Events are grouped (one group per MIDI channel), so that all the events of a group can be cancelled at once.
+Doesn't depend on Win32.
+*/
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#define TW_LEVELS	4
+#define TW_BITS		8
+#define TW_SLOTS	(1 << TW_BITS)
+#define TW_MASK		(TW_SLOTS - 1)
+#define TW_NIL		0xFFFFFFFF
+
+class TimerWheel {
+	typedef struct Node {
+		uint64_t Frame;
+		uint32_t Next, Prev;		// Slot list
+		uint32_t GNext, GPrev;		// Group list
+		uint32_t Data;
+		uint16_t Bucket;			// Level * TW_SLOTS + slot, TW_NIL & 0xFFFF when free
+		uint16_t Group;
+	} Node;
+
+	Node* Nodes = nullptr;
+	uint32_t* GroupHeads = nullptr;
+	uint32_t Heads[TW_LEVELS * TW_SLOTS];
+	uint32_t Capacity = 0, Groups = 0;
+	uint32_t FreeHead = TW_NIL;
+	uint32_t Fresh = 0;				// Nodes past this one have never been used since the last reset
+	uint32_t Count = 0;
+	uint64_t Current = 0;			// Next frame to expire
+
+	void Link(uint32_t Index) {
+		Node* N = &Nodes[Index];
+		uint64_t Frame = (N->Frame < Current) ? Current : N->Frame;
+		uint64_t Delta = Frame - Current;
+		uint32_t Level = 0;
+
+		while (Level < TW_LEVELS - 1 && Delta >= ((uint64_t)1 << (TW_BITS * (Level + 1))))
+			Level++;
+
+		// Farther than the last level can reach, park it in its last slot for now
+		if (Delta >= ((uint64_t)1 << (TW_BITS * TW_LEVELS)))
+			Frame = Current + ((uint64_t)1 << (TW_BITS * TW_LEVELS)) - 1;
+
+		N->Bucket = (uint16_t)(Level * TW_SLOTS + ((Frame >> (TW_BITS * Level)) & TW_MASK));
+		N->Prev = TW_NIL;
+		N->Next = Heads[N->Bucket];
+		if (N->Next != TW_NIL) Nodes[N->Next].Prev = Index;
+		Heads[N->Bucket] = Index;
+	}
+
+	void Unlink(uint32_t Index) {
+		Node* N = &Nodes[Index];
+
+		if (N->Prev != TW_NIL) Nodes[N->Prev].Next = N->Next;
+		else Heads[N->Bucket] = N->Next;
+		if (N->Next != TW_NIL) Nodes[N->Next].Prev = N->Prev;
+	}
+
+	void Release(uint32_t Index) {
+		Node* N = &Nodes[Index];
+
+		if (N->GPrev != TW_NIL) Nodes[N->GPrev].GNext = N->GNext;
+		else GroupHeads[N->Group] = N->GNext;
+		if (N->GNext != TW_NIL) Nodes[N->GNext].GPrev = N->GPrev;
+
+		N->Bucket = (uint16_t)TW_NIL;
+		N->Next = FreeHead;
+		FreeHead = Index;
+		Count--;
+	}
+
+	// Moves the events of the current slot of a level down to the levels below
+	void Cascade(uint32_t Level) {
+		uint32_t Slot = (uint32_t)(Current >> (TW_BITS * Level)) & TW_MASK;
+
+		if (!Slot && Level + 1 < TW_LEVELS)
+			Cascade(Level + 1);
+
+		uint32_t Index = Heads[Level * TW_SLOTS + Slot];
+		Heads[Level * TW_SLOTS + Slot] = TW_NIL;
+
+		while (Index != TW_NIL) {
+			uint32_t Next = Nodes[Index].Next;
+			Link(Index);
+			Index = Next;
+		}
+	}
+
+public:
+	~TimerWheel() { Free(); }
+
+	bool Init(uint32_t MaxEvents, uint32_t MaxGroups) {
+		Free();
+
+		Nodes = (Node*)malloc((size_t)MaxEvents * sizeof(Node));
+		GroupHeads = (uint32_t*)malloc((size_t)MaxGroups * sizeof(uint32_t));
+		if (!Nodes || !GroupHeads) {
+			Free();
+			return false;
+		}
+
+		Capacity = MaxEvents;
+		Groups = MaxGroups;
+		Reset(0);
+		return true;
+	}
+
+	// Makes room for more events, the handles that have been handed out stay valid
+	bool Grow(uint32_t MaxEvents) {
+		if (MaxEvents <= Capacity)
+			return true;
+
+		Node* Larger = (Node*)realloc(Nodes, (size_t)MaxEvents * sizeof(Node));
+		if (!Larger)
+			return false;
+
+		Nodes = Larger;
+		Capacity = MaxEvents;
+		return true;
+	}
+
+	void Free() {
+		free(Nodes);
+		free(GroupHeads);
+		Nodes = nullptr;
+		GroupHeads = nullptr;
+		Capacity = Groups = Count = 0;
+	}
+
+	bool IsReady() const { return Nodes != nullptr; }
+	uint32_t Pending() const { return Count; }
+	uint32_t Size() const { return Capacity; }
+
+	// Drops everything, and restarts the clock from Frame
+	void Reset(uint64_t Frame) {
+		memset(Heads, 0xFF, sizeof(Heads));
+		memset(GroupHeads, 0xFF, Groups * sizeof(uint32_t));
+
+		// Cheap even with millions of nodes, they're only handed out again from the start
+		FreeHead = TW_NIL;
+		Fresh = 0;
+		Count = 0;
+		Current = Frame;
+	}
+
+	// Returns a handle for Cancel, or TW_NIL if the wheel is full
+	uint32_t Add(uint64_t Frame, uint32_t Data, uint16_t Group) {
+		uint32_t Index;
+
+		if (Group >= Groups)
+			return TW_NIL;
+
+		if (FreeHead != TW_NIL) {
+			Index = FreeHead;
+			FreeHead = Nodes[Index].Next;
+		}
+		else if (Fresh < Capacity)
+			Index = Fresh++;
+		else
+			return TW_NIL;
+
+		Node* N = &Nodes[Index];
+
+		N->Frame = Frame;
+		N->Data = Data;
+		N->Group = Group;
+		N->GPrev = TW_NIL;
+		N->GNext = GroupHeads[Group];
+		if (N->GNext != TW_NIL) Nodes[N->GNext].GPrev = Index;
+		GroupHeads[Group] = Index;
+
+		Link(Index);
+		Count++;
+		return Index;
+	}
+
+	void Cancel(uint32_t Handle) {
+		if (Handle >= Fresh || Nodes[Handle].Bucket == (uint16_t)TW_NIL)
+			return;
+
+		Unlink(Handle);
+		Release(Handle);
+	}
+
+	// Handles get reused once their event fired, so this only cancels it if it's still pending with the same Data
+	bool Cancel(uint32_t Handle, uint32_t Data) {
+		if (Handle >= Fresh || Nodes[Handle].Bucket == (uint16_t)TW_NIL || Nodes[Handle].Data != Data)
+			return false;
+
+		Unlink(Handle);
+		Release(Handle);
+		return true;
+	}
+
+	uint32_t CancelGroup(uint16_t Group) {
+		uint32_t Cancelled = 0;
+
+		while (Group < Groups && GroupHeads[Group] != TW_NIL) {
+			Cancel(GroupHeads[Group]);
+			Cancelled++;
+		}
+
+		return Cancelled;
+	}
+
+	// Fires every event due before Horizon, in order, as Fire(Frame, Data)
+	template <class F> void Expire(uint64_t Horizon, F Fire) {
+		// Nothing to wait for, the clock can just jump ahead
+		if (!Count) {
+			if (Horizon > Current)
+				Current = Horizon;
+			return;
+		}
+
+		while (Current < Horizon) {
+			uint32_t Slot = (uint32_t)Current & TW_MASK;
+
+			if (!Slot)
+				Cascade(1);
+
+			uint32_t Index = Heads[Slot];
+			Heads[Slot] = TW_NIL;
+
+			while (Index != TW_NIL) {
+				uint32_t Next = Nodes[Index].Next;
+				uint64_t Frame = Nodes[Index].Frame;
+				uint32_t Data = Nodes[Index].Data;
+
+				Release(Index);
+				Fire(Frame, Data);
+				Index = Next;
+			}
+
+			Current++;
+
+			if (!Count) {
+				if (Horizon > Current)
+					Current = Horizon;
+				return;
+			}
+		}
+	}
+};
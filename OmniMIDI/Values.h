@@ -19,6 +19,12 @@ UINT CPUThreadsAvailable = 0;
 #define GETCHANNEL(f) (f & 0xF)
 #define GETFP(f) ((f >> 8) & 0xFF)
 #define GETSP(f) ((f >> 16) & 0xFF)
+#define GETPORT(f) ((f >> 24) & 0xF)
+#define GETPORTCHANNEL(f) (((f >> 20) & 0xF0) | (f & 0xF))
+#define STRIPPORT(f) (f & 0xFFFFFF)
+#define SETPORT(f, np) ((STRIPPORT(f)) | ((DWORD(np) & 0xF) << 24))
+// Raw channel messages sent to BASSMIDI channel ch (port * 16 + channel), whatever channel their status byte says
+#define RAWCHANNEL(ch) (BASS_MIDI_EVENTS_RAW + DWORD(ch) + 1)
 
 #define SETVELOCITY(f, nf) f = (f & 0xFF00FFFF) | ((DWORD(nf) & 0xFF) << 16)
 #define SETNOTE(f, nf) f = (f & 0xFFFF00FF) | ((DWORD(nf) & 0xFF) << 8)
@@ -66,8 +72,9 @@ typedef struct EventsBuffer
 
 // The buffer's structure
 EventsBuffer EVBuffer;				 // The buffer
-unsigned char LastRunningStatus = 0; // Last running status
+unsigned char LastRunningStatus[OM_MAXPORTS] = { 0 }; // Last running status, one per port
 ULONGLONG EvBufferSize = 4096;
+volatile ULONGLONG EvBufferDropped = 0; // Events lost because the buffer was full
 ULONG EvBufferMultRatio = 1;
 ULONG GetEvBuffSizeFromRAM = 0;
 
@@ -197,6 +204,33 @@ HANDLE hPipe = INVALID_HANDLE_VALUE; // debug info
 // Main values
 DWORD RestartValue = 0;		// For AudToWAV
 BOOL UnlimitedChannels = 0; // For KDMAPI
+volatile DWORD ActivePorts = 1; // Ports addressed through SendDirectDataPort, 16 channels each
+
+// Live changes, see LiveConfig.h
+#define LIVE_SCOPE_NONE		0			// Picked up by the real-time settings loop on its own
+#define LIVE_SCOPE_STREAM	(1 << 0)	// Plain values, picked up as they are
+#define LIVE_SCOPE_EFFECT	(1 << 1)	// DSPs on the stream (limiter, effects)
+#define LIVE_SCOPE_BUFFER	(1 << 2)	// Events buffer
+#define LIVE_SCOPE_FONTS	(1 << 3)	// SoundFonts loaded into the stream
+#define LIVE_SCOPE_ENGINE	(1 << 4)	// Output and stream, full restart
+#define LIVE_SCOPES 5
+FLOAT LiveDropoutLast[LIVE_SCOPES] = { 0 };	// ms, how long the last change of each scope took to apply
+FLOAT LiveDropoutMax[LIVE_SCOPES] = { 0 };
+
+// Output recovery, see OutputRecovery.h
+DWORD OutputRecoveries = 0;			// How many times the output got reopened without touching the stream
+FLOAT OutputRecoveryLast = 0.0f;	// ms
+FLOAT OutputRecoveryMax = 0.0f;
+
+// Non-blocking open, see EarlyQueue.h
+FLOAT OpenLatencyMs = 0.0f;			// How long the app waited for midiOutOpen/InitializeKDMAPIStream
+FLOAT FirstSoundMs = 0.0f;			// From the open call to the moment the synth could play the first note
+DWORD EarlyQueued = 0;				// Events queued while the driver was initializing
+DWORD EarlyDropped = 0;				// Events that didn't fit in the queue (controller state excluded)
+DWORD EarlyStale = 0;				// Note-ons that got too old to be played back
+
+// Instance linger, see InstanceLinger.h
+DWORD WarmReopens = 0;				// Opens that reused a parked engine
 
 // Delay options
 DWORD FNoteLengthValue = 0.0;
@@ -0,0 +1,232 @@
+/*
+OmniMIDI voice budgets
+BASS_ATTRIB_MIDI_VOICES only caps the voices of the whole stream, so a single channel holding down
+hundreds of notes can take them away from all the others.
+The drain side (and the audio thread, for the events it places in the block) keeps track of the notes
+playing on each channel, under VBLock since both of them do it, and once a channel goes over its budget, its oldest (or quietest) key gets released
+before the new note is let through.
+Notes kept alive by the sustain pedal can't be released one by one, so while the pedal is down
+new notes go through as they are, and the stream's own voice limit takes care of them.
+*/
+#pragma once
+
+#define VB_CHANNELS (OM_MAXPORTS * 16)
+
+// VoiceStealMode
+#define VB_STEAL_OLDEST		0
+#define VB_STEAL_QUIETEST	1
+
+typedef struct VoiceBudgetChannel
+{
+	DWORD Held;				// Notes being held down
+	DWORD Sustained;		// Notes released while the pedal was down
+	BOOL Pedal;
+	BYTE Count[128];		// Notes held down on each key
+	BYTE SusCount[128];		// Notes kept alive by the pedal on each key
+	BYTE Velocity[128];		// Velocity of the last note-on of each key
+	DWORD Stamp[128];		// When the last note-on of each key came in
+} VoiceBudgetChannel;
+
+static LockSystem VBLock = { 0, 0 };
+static VoiceBudgetChannel VBChannels[VB_CHANNELS];
+static DWORD VBBudget[16] = { 0 };		// Per MIDI channel, shared by all the ports. 0 = no limit
+static DWORD VBClock = 0;
+static BOOL VoiceBudgetOn = FALSE;
+static DWORD VoiceStealMode = VB_STEAL_OLDEST;
+
+static volatile LONG VBResetPending = FALSE;
+
+// Stats, read by the health thread
+static volatile DWORD VBStolen[VB_CHANNELS] = { 0 };
+
+// Can be called from any thread, the counters get cleared before the next event gets tracked
+void ResetVoiceBudgets()
+{
+	InterlockedExchange(&VBResetPending, TRUE);
+}
+
+// Has to be called with VBLock held
+static void __inline ApplyVoiceBudgetReset()
+{
+	if (VBResetPending && InterlockedExchange(&VBResetPending, FALSE))
+	{
+		memset(VBChannels, 0, sizeof(VBChannels));
+		VBClock = 0;
+	}
+}
+
+// ChannelVoiceBudget applies to every channel, ChannelVoiceBudgets (16 DWORDs) overrides it for single channels
+void LoadVoiceBudgets()
+{
+	DWORD Budget = 0, Overrides[16] = { 0 };
+	BOOL On = FALSE;
+	HKEY hKey;
+
+	VoiceStealMode = VB_STEAL_OLDEST;
+
+	if (RegOpenKeyExW(HKEY_CURRENT_USER, L"Software\\OmniMIDI\\Configuration", 0, KEY_READ, &hKey) == ERROR_SUCCESS)
+	{
+		DWORD dwType = REG_DWORD, dwSize = sizeof(DWORD);
+		RegQueryValueExW(hKey, L"ChannelVoiceBudget", NULL, &dwType, (LPBYTE)&Budget, &dwSize);
+
+		dwType = REG_DWORD, dwSize = sizeof(DWORD);
+		RegQueryValueExW(hKey, L"VoiceStealMode", NULL, &dwType, (LPBYTE)&VoiceStealMode, &dwSize);
+
+		dwType = REG_BINARY, dwSize = sizeof(Overrides);
+		if (RegQueryValueExW(hKey, L"ChannelVoiceBudgets", NULL, &dwType, (LPBYTE)Overrides, &dwSize) != ERROR_SUCCESS)
+			memset(Overrides, 0, sizeof(Overrides));
+
+		RegCloseKey(hKey);
+	}
+
+	if (VoiceStealMode > VB_STEAL_QUIETEST)
+		VoiceStealMode = VB_STEAL_OLDEST;
+
+	for (int i = 0; i < 16; i++)
+	{
+		VBBudget[i] = Overrides[i] ? Overrides[i] : Budget;
+		On |= VBBudget[i] != 0;
+	}
+
+	// Start tracking from a clean slate, the notes that are already playing will be forgotten anyway
+	if (On && !VoiceBudgetOn)
+		ResetVoiceBudgets();
+
+	VoiceBudgetOn = On;
+}
+
+// Picks the key to release, -1 if there's nothing being held down
+static int __inline FindVoiceVictim(VoiceBudgetChannel* Ch)
+{
+	int Victim = -1;
+
+	for (int Key = 0; Key < 128; Key++)
+	{
+		if (!Ch->Count[Key])
+			continue;
+
+		if (Victim == -1 ||
+			(VoiceStealMode == VB_STEAL_QUIETEST && Ch->Velocity[Key] < Ch->Velocity[Victim]) ||
+			((VoiceStealMode == VB_STEAL_OLDEST || Ch->Velocity[Key] == Ch->Velocity[Victim]) && Ch->Stamp[Key] < Ch->Stamp[Victim]))
+			Victim = Key;
+	}
+
+	return Victim;
+}
+
+// Velocity 0 is a note-off. Has to be called with VBLock held
+static void __inline TrackVoiceNote(BYTE Chan, BYTE Key, BYTE Velocity)
+{
+	VoiceBudgetChannel* Ch = &VBChannels[Chan];
+	DWORD Budget = VBBudget[Chan & 0xF];
+
+	ApplyVoiceBudgetReset();
+	Key &= 0x7F;
+
+	if (!Velocity)
+	{
+		// Already stolen, or never seen
+		if (!Ch->Count[Key])
+			return;
+
+		Ch->Count[Key]--;
+		if (Ch->Held) Ch->Held--;
+
+		if (Ch->Pedal && Ch->SusCount[Key] < 0xFF)
+		{
+			Ch->SusCount[Key]++;
+			Ch->Sustained++;
+		}
+
+		return;
+	}
+
+	// While the pedal is down, releasing a key would only move its notes to the sustained ones
+	int Victim = (Budget && !Ch->Pedal && Ch->Held + Ch->Sustained >= Budget) ? FindVoiceVictim(Ch) : -1;
+
+	if (Victim != -1)
+	{
+		// Release every note of the key, the app's own note-offs will be ignored later
+		for (BYTE i = 0; i < Ch->Count[Victim]; i++)
+			_BMSE(OMStream, Chan, MIDI_EVENT_NOTE, Victim);
+
+		VBStolen[Chan] += Ch->Count[Victim];
+		Ch->Held -= Ch->Count[Victim];
+		Ch->Count[Victim] = 0;
+	}
+
+	// Past 255 notes on the same key, the key itself is the problem, let the note through untracked
+	if (Ch->Count[Key] < 0xFF)
+	{
+		Ch->Count[Key]++;
+		Ch->Held++;
+	}
+
+	Ch->Velocity[Key] = Velocity;
+	Ch->Stamp[Key] = ++VBClock;
+}
+
+// Has to be called with VBLock held
+static void __inline TrackVoiceControl(BYTE Chan, BYTE Controller, BYTE Value)
+{
+	VoiceBudgetChannel* Ch = &VBChannels[Chan];
+
+	ApplyVoiceBudgetReset();
+
+	switch (Controller)
+	{
+	case 121:	// Reset all controllers, the pedal goes up
+		Value = 0;
+	case 64:	// Sustain
+		Ch->Pedal = Value >= 64;
+		if (!Ch->Pedal && Ch->Sustained)
+		{
+			memset(Ch->SusCount, 0, sizeof(Ch->SusCount));
+			Ch->Sustained = 0;
+		}
+		break;
+
+	case 123:	// All notes off, the pedal still keeps them alive
+		if (Ch->Pedal)
+		{
+			for (int Key = 0; Key < 128; Key++)
+				Ch->SusCount[Key] = (BYTE)min(Ch->SusCount[Key] + Ch->Count[Key], 0xFF);
+
+			Ch->Sustained += Ch->Held;
+		}
+
+		memset(Ch->Count, 0, sizeof(Ch->Count));
+		Ch->Held = 0;
+		break;
+
+	case 120:	// All sound off
+		memset(Ch, 0, sizeof(VoiceBudgetChannel));
+		break;
+	}
+}
+
+void __inline VoiceBudgetNote(BYTE Chan, BYTE Key, BYTE Velocity)
+{
+	LockForWriting(&VBLock);
+	TrackVoiceNote(Chan, Key, Velocity);
+	UnlockForWriting(&VBLock);
+}
+
+// Called for every short event that reaches the synth, no matter which path it took
+void __inline VoiceBudgetEvent(BYTE Chan, BYTE Cmd, BYTE Param1, BYTE Param2)
+{
+	switch (Cmd)
+	{
+	case MIDI_NOTEON:
+		VoiceBudgetNote(Chan, Param1, Param2);
+		break;
+	case MIDI_NOTEOFF:
+		VoiceBudgetNote(Chan, Param1, 0);
+		break;
+	case MIDI_CMC:
+		LockForWriting(&VBLock);
+		TrackVoiceControl(Chan, Param1, Param2);
+		UnlockForWriting(&VBLock);
+		break;
+	}
+}
@@ -246,7 +246,7 @@ void CookedPlayerSystem(CookedPlayer *Player)
 			switch (evid)
 			{
 			case MEVT_SHORTMSG:
-				_PrsData(evt->dwEvent);
+				_PrsData(STRIPPORT(evt->dwEvent));
 				break;
 			case MEVT_LONGMSG:
 				_BMSEs(OMStream, BASS_MIDI_EVENTS_RAW, evt->dwParms, evt->dwEvent & 0xFFFFFF);
@@ -293,7 +293,13 @@ BOOL PrepareDriver()
 	// Done, now initialize the threads
 	CreateThreads();
 
-	SetEvent(OMReady);
+	// The stream exists now, the client can be told that we're ready
+	DriverInitStatus = TRUE;
+	bass_initialized = TRUE;
+
+	// If the client didn't wait for us, OMReady is only used to signal that the health thread is gone
+	if (!EarlyOpen)
+		SetEvent(OMReady);
 
 	return TRUE;
 }
@@ -302,21 +308,55 @@ BOOL PrepareDriver()
 BOOL StreamHealthCheck()
 {
 	BOOL LiveChangesB = FALSE;
+	BOOL OutputLostB = FALSE;
 
 	// If BASS is forbidden from initializing itself, then abort immediately
 	if (block_bassinit || stop_svthread)
 		return FALSE;
 
+	// The engine is being parked, the threads and the output are meant to go down
+	if (LingerState != LINGER_NONE)
+		return FALSE;
+
 	if (WaitForSingleObject(LiveChanges, 50) == WAIT_OBJECT_0)
 	{
-		PrintMessageToDebugLog("StreamWatchdog", "Received LiveChanges event!");
-		LiveChangesB = TRUE;
+		DWORD Scope = GetLiveChangesScope();
+
+		// Anything below the engine level can be applied to the running stream
+		if (Scope & LIVE_SCOPE_ENGINE)
+		{
+			PrintMessageToDebugLog("StreamWatchdog", "Received LiveChanges event, the engine has to be restarted!");
+			LiveChangesB = TRUE;
+		}
+		else if (Scope)
+		{
+			PrintMessageToDebugLog("StreamWatchdog", "Received LiveChanges event, applying it to the running stream...");
+			ApplyLiveChanges(Scope);
+		}
+	}
+
+	// Checked again, it might have started parking while we were waiting
+	if (LingerState != LINGER_NONE)
+		return FALSE;
+
+	// If only the device went away, reopen it around the running stream
+	if (!LiveChangesB)
+	{
+		switch (CheckOutput())
+		{
+		case OUTPUT_DOWN:
+			return FALSE;
+		case OUTPUT_LOST:
+			OutputLostB = TRUE;
+			break;
+		}
 	}
 
 	// Check if the call failed
-	if ((BASS_ChannelIsActive(OMStream) == BASS_ACTIVE_STOPPED || LiveChangesB))
+	if ((BASS_ChannelIsActive(OMStream) == BASS_ACTIVE_STOPPED || LiveChangesB || OutputLostB))
 	{
 		PrintMessageToDebugLog("StreamWatchdog", "Stream is down! Restarting audio stream...");
+		LONGLONG RestartStart = LiveTimerStart();
 
 		// Restart feedback mode just in case
 		DisableMIDIFeedbackMode();
@@ -324,6 +364,7 @@ BOOL StreamHealthCheck()
 
 		// It did, reload the settings and reallocate the memory for the buffer
 		CloseThreads();
+		CheckpointSynthState();
 
 		LoadSettings(TRUE, FALSE);
 
@@ -332,9 +373,15 @@ BOOL StreamHealthCheck()
 		{
 			SetUpStream();
 			LoadSoundFontsToStream();
+			RestoreSynthState();
 
 			// Done, now initialize the threads
 			CreateThreads();
+
+			if (LiveChangesB)
+				RecordLiveDropout(LIVE_SCOPE_ENGINE, RestartStart);
+
+			TakeLiveSnapshot();
 		}
 		else
 			PrintMessageToDebugLog("StreamWatchdog", "Failed to initialize stream! Retrying...");
@@ -342,7 +389,7 @@ BOOL StreamHealthCheck()
 		return FALSE;
 	}
 
-	if (stop_thread || !ATThread.ThreadHandle)
+	if ((stop_thread || !ATThread.ThreadHandle) && LingerState == LINGER_NONE)
 	{
 		if (ManagedSettings.CurrentEngine == WASAPI_ENGINE ||
 			(ManagedSettings.CurrentEngine == ASIO_ENGINE && !ManagedSettings.ASIODirectFeed))
@@ -383,20 +430,35 @@ void Supervisor(LPVOID lpV)
 			TightenTimings();
 
 			// Ok, everything's ready, do not open more debug pipes from now on
-			DriverInitStatus = TRUE;
+			// (DriverInitStatus and bass_initialized get set by PrepareDriver, once the stream exists)
 			AlreadyStartedOnce = TRUE;
-			bass_initialized = TRUE;
 
 			EnableMIDIFeedbackMode();
 
 			if (!PrepareDriver())
 				_THROWCRASH;
 
+			// Remember what got applied, so that live changes can be diffed against it
+			TakeLiveSnapshot();
+
+			// Play back what the app sent while we were getting ready
+			FlushEarlyQueue(stop_svthread);
+
 			// Check system
 			PrintMessageToDebugLog("StreamWatchdog", "Checking for settings changes or hotkeys...");
 
 			while (!stop_svthread)
 			{
+				// The app closed the driver, keep the engine parked until it comes back or the time runs out
+				if (LingerState != LINGER_NONE)
+				{
+					if (LingerExpired())
+						break;
+
+					Sleep(50);
+					continue;
+				}
+
 				// Check if the threads and streams are still alive
 				if (StreamHealthCheck())
 					;
@@ -407,9 +469,13 @@ void Supervisor(LPVOID lpV)
 					LoadCustomInstruments();			// Load custom instrument values from the registry
 					KeyShortcuts();						// Check for keystrokes (ALT+1, INS, etc..)
 					SFDynamicLoaderCheck();				// Check current active voices, rendering time, etc..
+					ProcessPatchCache();				// Load the patches the app asked us to cache
+					ProcessPlayerCache();				// Write down the songs the player recorded
+					ProcessPlayerChase();				// Catch the synth up with the player, after a fall back from the cache
 					MixerCheck();						// Send dB values to the mixer
 					SetNoteValuesFromSettings();		// Check if custom preset/bank or finetune are applied
-					InitializeEventsProcesserThreads(); // Check if the user wants to parse the notes through a separate thread
+					if (LingerState == LINGER_NONE)
+						InitializeEventsProcesserThreads(); // Check if the user wants to parse the notes through a separate thread
 
 					// Check the current output volume
 					CheckVolume(FALSE);
@@ -418,6 +484,9 @@ void Supervisor(LPVOID lpV)
 					// This needs to run in the main health loop, not just when debug pipe is connected
 					PollPermafrostMixerCommands();
 
+					// Publish a fresh stats snapshot for GetDriverStats
+					PublishDriverStats();
+
 					if (ManagedSettings.CurrentEngine == ASIO_ENGINE || ManagedSettings.CurrentEngine == WASAPI_ENGINE)
 						_ProcData = ManagedSettings.NotesCatcherWithAudio ? ProcDataSameThread : ProcData;
 				}
@@ -478,6 +547,8 @@ void Supervisor(LPVOID lpV)
 		_THROWCRASH;
 	}
 
+	FlushEarlyQueue(TRUE);
+	InterlockedExchange(&LingerState, LINGER_NONE);
 	SetEvent(OMReady);
 
 	// Close the thread
@@ -487,12 +558,46 @@ void Supervisor(LPVOID lpV)
 
 BOOL DoStartClient()
 {
-	if (!DriverInitStatus && !block_bassinit)
+	// While the early queue is active, the client is open even though the stream isn't ready yet
+	if (!DriverInitStatus && !EarlyQueueActive && !block_bassinit)
 	{
+		QueryPerformanceCounter(&EarlyOpenStart);
+
+		// The engine from the last client is still around, reuse it
+		if (ResumeLinger())
+		{
+			bass_initialized = TRUE;
+			DriverInitStatus = TRUE;
+
+			OpenLatencyMs = FirstSoundMs = EarlyElapsedMs();
+			PrintVarToDebugLog("StartDriver", "Open latency (ms)", &OpenLatencyMs, PRINT_FLOAT);
+			PrintMessageToDebugLog("StartDriver", "Driver initialized, using the parked engine.");
+			return TRUE;
+		}
+
+		// It's being freed right now, wait for the health thread to be done with it
+		if (LingerState == LINGER_EXPIRING && OMReady)
+			WaitForSingleObject(OMReady, INFINITE);
+
+		// If the user wants it, let the shared synth host do the heavy lifting
+		if (SynthHost_Connect())
+		{
+			bass_initialized = TRUE;
+			DriverInitStatus = TRUE;
+			PrintMessageToDebugLog("StartDriver", "Driver initialized, using the synth host.");
+			return TRUE;
+		}
+
 		// Create an event, to wait for the driver to be ready
 		PrintMessageToDebugLog("StartDriver", "Creating handles...");
 		if (!OMReady)
 			OMReady = CreateEvent(NULL, TRUE, FALSE, L"OMReady");
+		ResetEvent(OMReady);
+
+		// Queue the events until the stream is ready, instead of making the app wait for it
+		EarlyOpen = SynthHost_ReadSetting(L"FastOpen", TRUE);
+		if (EarlyOpen)
+			StartEarlyQueue();
 
 		// Create the main thread
 		PrintMessageToDebugLog("StartDriver", "Starting main watchdog thread...");
@@ -501,6 +606,14 @@ BOOL DoStartClient()
 		SetThreadPriority(HealthThread.ThreadHandle, THREAD_PRIORITY_NORMAL);
 		PrintMessageToDebugLog("StartDriver", "Done!");
 
+		if (EarlyOpen)
+		{
+			OpenLatencyMs = EarlyElapsedMs();
+			PrintVarToDebugLog("StartDriver", "Open latency (ms)", &OpenLatencyMs, PRINT_FLOAT);
+			PrintMessageToDebugLog("StartDriver", "Driver initializing in the background, events will be queued until it's ready.");
+			return TRUE;
+		}
+
 		// Wait for the SoundFonts to load, then close the event's handle
 		PrintMessageToDebugLog("StartDriver", "Waiting for the driver to signal if it's ready...");
 
@@ -513,6 +626,8 @@ BOOL DoStartClient()
 			return FALSE;
 		}
 
+		OpenLatencyMs = FirstSoundMs = EarlyElapsedMs();
+		PrintVarToDebugLog("StartDriver", "Open latency (ms)", &OpenLatencyMs, PRINT_FLOAT);
 		PrintMessageToDebugLog("StartDriver", "Driver initialized.");
 		return TRUE;
 	}
@@ -522,11 +637,38 @@ BOOL DoStartClient()
 
 BOOL DoStopClient()
 {
-	if (DriverInitStatus)
+	// The synth host might have died, wait for the client to be done moving to the local engine
+	SynthHost_WaitFailover();
+
+	if (DriverInitStatus || EarlyQueueActive)
 	{
 		PrintMessageToDebugLog("StopDriver", "Terminating driver...");
 
+		// No local stream to stop, just leave the synth host
+		if (SynthHostClient)
+		{
+			SynthHost_Disconnect();
+			bass_initialized = FALSE;
+			DriverInitStatus = FALSE;
+			ResetMIDIPorts();
+			ResetDriverStats();
+			PrintMessageToDebugLog("StopDriver", "Driver terminated.");
+			return TRUE;
+		}
+
 		bass_initialized = FALSE;
+
+		// Keep the engine around for a bit, the app might open the driver again right away
+		if (StartLinger())
+		{
+			ResetMIDIPorts();
+			ResetDriverStats();
+
+			DriverInitStatus = FALSE;
+			PrintMessageToDebugLog("StopDriver", "Driver parked.");
+			return TRUE;
+		}
+
 		stop_svthread = TRUE;
 
 		PrintMessageToDebugLog("StartDriver", "Waiting for the threads to go offline..");
@@ -542,7 +684,12 @@ BOOL DoStopClient()
 			OMReady = NULL;
 		}
 
-		// Boopers
+		// The next client starts from a single port again, with fresh stats
+		ResetMIDIPorts();
+		ResetDriverStats();
+
+		// Boopers, the health thread might have set them while we were waiting for it
+		bass_initialized = FALSE;
 		DriverInitStatus = FALSE;
 		PrintMessageToDebugLog("StopDriver", "Driver terminated.");
 	}
@@ -589,7 +736,7 @@ extern "C" BOOL KDMAPI IsKDMAPIAvailable()
 
 extern "C" BOOL KDMAPI InitializeKDMAPIStream()
 {
-	if (!AlreadyInitializedViaKDMAPI && !bass_initialized)
+	if (!AlreadyInitializedViaKDMAPI && !bass_initialized && !EarlyQueueActive)
 	{
 		// Enable the debug log
 		OpenRegistryKey(Configuration, L"Software\\OmniMIDI\\Configuration", FALSE);
@@ -624,7 +771,7 @@ extern "C" BOOL KDMAPI TerminateKDMAPIStream()
 	BOOL ret = FALSE;
 
 	// If the driver is already initialized, close it
-	if (AlreadyInitializedViaKDMAPI && bass_initialized)
+	if (AlreadyInitializedViaKDMAPI && (bass_initialized || EarlyQueueActive))
 	{
 		// Prevent BASS from reinitializing itself
 		block_bassinit = TRUE;
@@ -735,6 +882,10 @@ extern "C" VOID KDMAPI NoFeedbackMode()
 
 extern "C" VOID KDMAPI ResetKDMAPIStream()
 {
+	// Still initializing, there's nothing to reset but the queue
+	if (ClearEarlyQueue())
+		return;
+
 	// Redundant
 	if (bass_initialized)
 		ResetSynth(FALSE, TRUE);
@@ -747,14 +898,85 @@ extern "C" BOOL KDMAPI SendCustomEvent(DWORD eventtype, DWORD chan, DWORD param)
 
 extern "C" VOID KDMAPI SendDirectData(DWORD dwMsg) noexcept
 {
+	// Still initializing, queue it until the stream is ready
+	if (EarlyQueueActive && QueueEarlyShort(STRIPPORT(dwMsg)))
+		return;
+
 	// Send it to the pointed ParseData function (Either ParseData or ParseDataHyper)
-	_PrsData(dwMsg);
+	_PrsData(STRIPPORT(dwMsg));
 }
 
 extern "C" VOID KDMAPI SendDirectDataNoBuf(DWORD dwMsg) noexcept
 {
+	if (EarlyQueueActive && QueueEarlyShort(STRIPPORT(dwMsg)))
+		return;
+
 	// Send the data directly to BASSMIDI, bypassing the buffer altogether
-	_PforBASSMIDI(dwMsg);
+	_PforBASSMIDI(STRIPPORT(dwMsg));
+}
+
+extern "C" BOOL KDMAPI SendDirectDataPort(DWORD dwMsg, DWORD Port) noexcept
+{
+	// Make sure the stream has enough channels for the port before queueing anything
+	if (!EnableMIDIPort(Port))
+		return FALSE;
+
+	if (EarlyQueueActive && QueueEarlyShort(SETPORT(dwMsg, Port)))
+		return TRUE;
+
+	// The port travels through the buffer in the high-order byte, which is unused by short messages
+	_PrsData(SETPORT(dwMsg, Port));
+	return TRUE;
+}
+
+extern "C" BOOL KDMAPI SendDirectDataScheduled(DWORD dwMsg, DWORD64 Timestamp, DWORD TimeFormat) noexcept
+{
+	if (!bass_initialized)
+		return FALSE;
+
+	switch (TimeFormat) {
+	case OM_SCHED_SAMPLES:
+		return ScheduleEvent(dwMsg, Timestamp);
+	case OM_SCHED_QPC:
+		return ScheduleEvent(dwMsg, QPCToRenderFrame((LONGLONG)Timestamp));
+	default:
+		return FALSE;
+	}
+}
+
+extern "C" UINT KDMAPI SendDirectDataScheduledBatch(const ScheduledEvent *Events, UINT Count, DWORD TimeFormat) noexcept
+{
+	UINT Queued = 0;
+
+	if (!bass_initialized || !Events || (TimeFormat != OM_SCHED_SAMPLES && TimeFormat != OM_SCHED_QPC))
+		return 0;
+
+	// Stop at the first failure, so that the app knows where to resume from
+	for (; Queued < Count; Queued++) {
+		QWORD Frame = (TimeFormat == OM_SCHED_QPC) ? QPCToRenderFrame((LONGLONG)Events[Queued].Timestamp) : Events[Queued].Timestamp;
+
+		if (!ScheduleEvent(Events[Queued].Event, Frame))
+			break;
+	}
+
+	return Queued;
+}
+
+extern "C" BOOL KDMAPI GetRenderClock(DWORD64 *SamplePosition, DWORD64 *QPCTime, LPDWORD SampleRate) noexcept
+{
+	LARGE_INTEGER Now;
+
+	if (!bass_initialized || !SchedulerFreq)
+		return FALSE;
+
+	// Both values are sampled together, so the app can map its own clock onto ours
+	QueryPerformanceCounter(&Now);
+
+	if (SamplePosition) *SamplePosition = GetRenderPosition();
+	if (QPCTime) *QPCTime = Now.QuadPart;
+	if (SampleRate) *SampleRate = SchedulerFreq;
+
+	return TRUE;
 }
 
 extern "C" MMRESULT KDMAPI PrepareLongData(MIDIHDR *IIMidiHdr, UINT IIMidiHdrSize)
@@ -856,7 +1078,7 @@ extern "C" MMRESULT KDMAPI UnprepareLongData(MIDIHDR *IIMidiHdr, UINT IIMidiHdrS
 extern "C" MMRESULT KDMAPI SendDirectLongData(MIDIHDR *IIMidiHdr, UINT IIMidiHdrSize)
 {
 	// Check if the MIDIHDR buffer is valid and if the stream is alive
-	while (!bass_initialized) // The driver isn't ready
+	while (!bass_initialized && !EarlyQueueActive) // The driver isn't ready, and it's not queueing either
 		/* return */ DebugResult("SendDirectLongData", MIDIERR_NOTREADY, "BASS hasn't been initialized yet.");
 	// Since some apps don't listen to the MIDIERR_NOTREADY return value,
 	// I'm forced to make OmniMIDI spinlock until BASS is ready. (Thank you VanBasco.)
@@ -885,8 +1107,9 @@ extern "C" MMRESULT KDMAPI SendDirectLongData(MIDIHDR *IIMidiHdr, UINT IIMidiHdr
 	IIMidiHdr->dwFlags &= ~MHDR_DONE;
 	IIMidiHdr->dwFlags |= MHDR_INQUEUE;
 
-	// Do the stuff with it
-	SendLongToBASSMIDI(IIMidiHdr);
+	// Do the stuff with it, or copy it to the early queue if the stream isn't ready yet
+	if (!EarlyQueueActive || !QueueEarlyLong(IIMidiHdr))
+		SendLongToBASSMIDI(IIMidiHdr);
 
 	// Mark the buffer as done
 	IIMidiHdr->dwFlags &= ~MHDR_INQUEUE;
@@ -1008,6 +1231,15 @@ extern "C" DebugInfo *KDMAPI GetDriverDebugInfo()
 	return &ManagedDebugInfo;
 }
 
+extern "C" BOOL KDMAPI GetDriverStats(DriverStats *Stats)
+{
+	// Lock-free, the app can call it as often as it wants
+	if (!Stats)
+		return FALSE;
+
+	return CopyDriverStats(Stats);
+}
+
 extern "C" BOOL KDMAPI LoadCustomSoundFontsList(LPWSTR Directory)
 {
 	// Load the SoundFont from the specified path (It can be a sf2/sfz or a sflist)
@@ -1020,6 +1252,100 @@ extern "C" BOOL KDMAPI LoadCustomSoundFontsList(LPWSTR Directory)
 	return FontLoader(Directory);
 }
 
+extern "C" HANDLE KDMAPI InitializeOfflineRender(DWORD SampleRate, LPCWSTR SoundFontList)
+{
+	// Device-less instance, it doesn't touch the driver's own stream
+	PrintMessageToDebugLog("KDMAPI_IOR", "The app requested an offline renderer.");
+	return (HANDLE)CreateOfflineRenderer(SampleRate, SoundFontList);
+}
+
+extern "C" BOOL KDMAPI SendOfflineRenderData(HANDLE Renderer, DWORD SampleOffset, DWORD dwMsg)
+{
+	if (!Renderer)
+		return FALSE;
+
+	return OfflineRendererEvent((OfflineRenderer *)Renderer, SampleOffset, dwMsg);
+}
+
+extern "C" BOOL KDMAPI SendOfflineRenderLongData(HANDLE Renderer, LPSTR MidiHdrData, DWORD MidiHdrDataLen)
+{
+	if (!Renderer || !MidiHdrData || !MidiHdrDataLen)
+		return FALSE;
+
+	// SysExes get applied at the current render position
+	return BASS_MIDI_StreamEvents(((OfflineRenderer *)Renderer)->Stream, BASS_MIDI_EVENTS_RAW, MidiHdrData, MidiHdrDataLen) > 0;
+}
+
+extern "C" DWORD KDMAPI RenderOfflineFrames(HANDLE Renderer, FLOAT *Buffer, DWORD Frames)
+{
+	if (!Renderer || !Buffer || !Frames)
+		return 0;
+
+	return OfflineRendererRender((OfflineRenderer *)Renderer, Buffer, Frames);
+}
+
+extern "C" BOOL KDMAPI TerminateOfflineRender(HANDLE Renderer)
+{
+	if (!Renderer)
+		return FALSE;
+
+	PrintMessageToDebugLog("KDMAPI_TOR", "The app requested the termination of an offline renderer.");
+	DestroyOfflineRenderer((OfflineRenderer *)Renderer);
+	return TRUE;
+}
+
+extern "C" BOOL KDMAPI LoadMIDIFile(LPCWSTR Path)
+{
+	if (!Path)
+		return FALSE;
+
+	PrintMessageToDebugLog("KDMAPI_LMF", "The app requested the driver to load a MIDI file.");
+	return LoadPlayerFile(Path);
+}
+
+extern "C" BOOL KDMAPI LoadMIDIFileFromMemory(const BYTE* Data, DWORD Length)
+{
+	if (!Data || !Length)
+		return FALSE;
+
+	PrintMessageToDebugLog("KDMAPI_LMFFM", "The app requested the driver to load a MIDI file from memory.");
+	return LoadPlayerSong(Data, Length);
+}
+
+extern "C" VOID KDMAPI UnloadMIDIFile()
+{
+	UnloadPlayerSong();
+}
+
+extern "C" BOOL KDMAPI PlayMIDIFile()
+{
+	// The events get released by the audio thread, so the stream has to be there
+	if (!bass_initialized)
+		return FALSE;
+
+	return StartPlayer();
+}
+
+extern "C" BOOL KDMAPI StopMIDIFile()
+{
+	return StopPlayer();
+}
+
+extern "C" BOOL KDMAPI SeekMIDIFile(DWORD64 Microseconds)
+{
+	return SeekPlayer(Microseconds);
+}
+
+extern "C" BOOL KDMAPI SetMIDIFileSpeed(FLOAT Speed)
+{
+	return SetPlayerSpeed(Speed);
+}
+
+extern "C" BOOL KDMAPI GetMIDIFilePosition(DWORD64* Position, DWORD64* Length)
+{
+	return GetPlayerPosition(Position, Length);
+}
+
 extern "C" DWORD64 KDMAPI timeGetTime64()
 {
 	ULONGLONG CurrentTime;
@@ -7,6 +7,13 @@ OmniMIDI settings loading system
 
 void SetBufferPointers()
 {
+	// Everything goes to the synth host, there's no local stream to feed
+	if (SynthHostClient)
+	{
+		SynthHost_SetBufferPointers();
+		return;
+	}
+
 	_PrsData = HyperMode ? ParseDataHyper : ParseData;
 	_PforBASSMIDI = HyperMode ? PrepareForBASSMIDIHyper : PrepareForBASSMIDI;
 	_PlayBufData = HyperMode ? PlayBufferedDataHyper : PlayBufferedData;
@@ -45,6 +52,23 @@ void InitializeOrUpdateEffects()
 		PrintMessageToDebugLog("InitializeOrUpdateEffects", "Applied volume settings.");
 	}
 
+	// The built-in chain takes care of reverb, chorus and echo, get rid of the DX8 FX if they're still there
+	if (NativeFx)
+	{
+		HFX *DX8FX[] = { &ChReverb, &ChChorus, &ChEcho };
+		for (int i = 0; i < _countof(DX8FX); i++)
+		{
+			if (*DX8FX[i])
+			{
+				BASS_ChannelRemoveFX(OMStream, *DX8FX[i]);
+				*DX8FX[i] = NULL;
+			}
+		}
+
+		UpdateNativeEffects();
+		return;
+	}
+
 	if (ManagedSettings.ReverbOverride)
 	{
 		if (!ChReverb)
@@ -164,7 +188,12 @@ void InitializeOrUpdateEffects()
 
 void ResetSynth(BOOL SwitchingBufferMode, BOOL ModeReset)
 {
-	if (SwitchingBufferMode)
+	// Drop whatever was still scheduled, it belongs to the old timeline
+	FlushEventScheduler();
+	ResetVoiceBudgets();
+	ResetDecimation();
+
+	if (SwitchingBufferMode && EVBuffer.Buffer)
 	{
 		EVBuffer.ReadHead = 0;
 		EVBuffer.WriteHead = 0;
@@ -177,12 +206,13 @@ void ResetSynth(BOOL SwitchingBufferMode, BOOL ModeReset)
 		// Wait for the heads to align, to avoid crashes
 		UnsetBufferPointers();
 		_BMSE(OMStream, 0, MIDI_EVENT_SYSTEMEX, MIDI_SYSTEM_XG);
+		ResetSynthState();
 		PrintMessageToDebugLog("ResetSynth", "Sent SysEx to BASSMIDI.");
 		SetBufferPointers();
 	}
 	else
 	{
-		for (int ch = 0; ch < 16; ch++)
+		for (DWORD ch = 0; ch < ActivePorts * 16; ch++)
 		{
 			_BMSE(OMStream, ch, MIDI_EVENT_NOTESOFF, NULL);
 			_BMSE(OMStream, ch, MIDI_EVENT_SOUNDOFF, NULL);
@@ -317,6 +347,114 @@ BOOL LoadSoundfont(int whichsf)
 	return RET;
 }
 
+static void GetAppListStamp(LPCWSTR Path, AppListIndex::Stamp* Stamp)
+{
+	WIN32_FILE_ATTRIBUTE_DATA fad;
+
+	if (!GetFileAttributesExW(Path, GetFileExInfoStandard, &fad))
+	{
+		Stamp->Time = Stamp->Size = 0;
+		return;
+	}
+
+	Stamp->Time = ((ULONGLONG)fad.ftLastWriteTime.dwHighDateTime << 32) | fad.ftLastWriteTime.dwLowDateTime;
+	Stamp->Size = ((ULONGLONG)fad.nFileSizeHigh << 32) | fad.nFileSizeLow;
+}
+
+static BOOL LoadAppListIndex(LPCWSTR Path, AppListIndex* Index, const AppListIndex::Stamp* Stamps)
+{
+	std::vector<uint8_t> Data;
+	LARGE_INTEGER Size;
+	DWORD Read = 0;
+	BOOL Valid = FALSE;
+
+	HANDLE File = CreateFileW(Path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (File == INVALID_HANDLE_VALUE)
+		return FALSE;
+
+	if (GetFileSizeEx(File, &Size) && Size.QuadPart > 0 && Size.QuadPart < 0x4000000)
+	{
+		Data.resize((size_t)Size.QuadPart);
+		if (ReadFile(File, &Data[0], (DWORD)Data.size(), &Read, NULL) && Read == Data.size())
+			Valid = Index->Deserialize(&Data[0], Data.size(), Stamps);
+	}
+
+	CloseHandle(File);
+	return Valid;
+}
+
+static void SaveAppListIndex(LPCWSTR Path, const AppListIndex* Index)
+{
+	std::vector<uint8_t> Data;
+	std::wstring TempPath = std::wstring(Path) + L"." + std::to_wstring(GetCurrentProcessId());
+	DWORD Written = 0;
+
+	Index->Serialize(Data);
+
+	// Write it somewhere else first, so that other processes never see half of it
+	HANDLE File = CreateFileW(TempPath.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (File == INVALID_HANDLE_VALUE)
+		return;
+
+	BOOL Done = WriteFile(File, &Data[0], (DWORD)Data.size(), &Written, NULL) && Written == Data.size();
+	CloseHandle(File);
+
+	if (!Done || !MoveFileExW(TempPath.c_str(), Path, MOVEFILE_REPLACE_EXISTING))
+		DeleteFileW(TempPath.c_str());
+}
+
+// Returns the list (0 = A) the applists assign to this app, or -1
+static int FindAppList()
+{
+	AppListIndex Index;
+	AppListIndex::Stamp Stamps[APPIDX_SOURCES] = { 0 };
+	wchar_t AppLists[APPIDX_SOURCES][NTFS_MAX_PATH] = { 0 };
+	wchar_t IndexPath[NTFS_MAX_PATH] = { 0 };
+	wchar_t CurrentString[NTFS_MAX_PATH] = { 0 };
+
+	if (!GetFolderPath(FOLDERID_Profile, CSIDL_PROFILE, IndexPath, sizeof(IndexPath)))
+		return -1;
+
+	for (int i = 0; i < APPIDX_SOURCES; ++i)
+	{
+		wcscpy_s(AppLists[i], NTFS_MAX_PATH, IndexPath);
+		swprintf_s(AppLists[i] + wcslen(AppLists[i]), NTFS_MAX_PATH - wcslen(AppLists[i]), OMFileTemplate, L"applists", OMLetters[i], L"applist");
+		GetAppListStamp(AppLists[i], &Stamps[i]);
+	}
+
+	swprintf_s(IndexPath + wcslen(IndexPath), NTFS_MAX_PATH - wcslen(IndexPath), L"\\OmniMIDI\\applists\\OmniMIDI.appidx");
+
+	// Only go through the applists again if one of them changed since the index has been built
+	if (!LoadAppListIndex(IndexPath, &Index, Stamps))
+	{
+		PrintMessageToDebugLog("FindAppList", "Applists changed, rebuilding the index...");
+		Index.Reset(Stamps);
+
+		for (int i = 0; i < APPIDX_SOURCES; ++i)
+		{
+			if (!Stamps[i].Time)
+				continue;
+
+			std::wifstream AppList(AppLists[i]);
+			if (AppList)
+			{
+				AppList.imbue(UTF8Support);
+				while (AppList.getline(CurrentString, sizeof(CurrentString) / sizeof(*CurrentString)))
+					Index.Add(CurrentString, i);
+			}
+		}
+
+		SaveAppListIndex(IndexPath, &Index);
+	}
+
+	DWORD Apps = Index.Size();
+	PrintVarToDebugLog("FindAppList", "Apps in index", &Apps, PRINT_UINT32);
+
+	// Same as going through the lists in order, the first one naming either the app or its path wins
+	int ByName = Index.Find(AppNameW), ByPath = Index.Find(AppPathW);
+	return (ByName < 0 || (ByPath >= 0 && ByPath < ByName)) ? ByPath : ByName;
+}
+
 bool LoadSoundfontStartup()
 {
 	// First, try Permafrost service for SoundFont list
@@ -341,38 +479,22 @@ bool LoadSoundfontStartup()
 		PrintMessageToDebugLog("LoadSoundfontStartup", "Permafrost not available, using file-based lookup...");
 	}
 
-	// Fallback: Check .applist files for app-specific SoundFont lists
-	wchar_t CurrentAppList[NTFS_MAX_PATH] = {0};
-	wchar_t CurrentString[NTFS_MAX_PATH] = {0};
-
-	for (int i = 0; i < 7; ++i)
-	{
-		memset(CurrentAppList, 0, sizeof(CurrentAppList));
-		if (GetFolderPath(FOLDERID_Profile, CSIDL_PROFILE, CurrentAppList, sizeof(CurrentAppList)))
-		{
-			swprintf_s(CurrentAppList + wcslen(CurrentAppList), NTFS_MAX_PATH, OMFileTemplate, L"applists", OMLetters[i], L"applist");
+	// Fallback: Check the applists index for app-specific SoundFont lists
+	LARGE_INTEGER Freq, Start, End;
+	QueryPerformanceFrequency(&Freq);
+	QueryPerformanceCounter(&Start);
 
-			PrintMessageWToDebugLog(L"LoadSoundfontStartup", CurrentAppList);
+	int List = FindAppList();
 
-			std::wifstream AppList(CurrentAppList);
-			if (AppList)
-			{
-				AppList.imbue(UTF8Support);
-				while (AppList.getline(CurrentString, sizeof(CurrentString) / sizeof(*CurrentString)))
-				{
-					PrintMessageWToDebugLog(L"LoadSoundfontStartup", CurrentString);
+	QueryPerformanceCounter(&End);
+	FLOAT Elapsed = (FLOAT)((DOUBLE)(End.QuadPart - Start.QuadPart) * 1000.0 / Freq.QuadPart);
+	PrintVarToDebugLog("LoadSoundfontStartup", "Applist lookup (ms)", &Elapsed, PRINT_FLOAT);
 
-					if (!_wcsicmp(AppNameW, CurrentString) || !_wcsicmp(AppPathW, CurrentString))
-					{
-						PrintMessageToDebugLog("LoadSoundfontStartup", "Found list. Loading...");
-						LoadSoundfont(i + 1);
-						return TRUE;
-					}
-				}
-			}
-		}
-		else
-			break;
+	if (List >= 0)
+	{
+		PrintMessageToDebugLog("LoadSoundfontStartup", "Found list. Loading...");
+		LoadSoundfont(List + 1);
+		return TRUE;
 	}
 
 	PrintMessageToDebugLog("LoadSoundfontStartup", "No default startup list found. Continuing...");
@@ -537,9 +659,12 @@ BOOL LoadBASSFunctions()
 			LoadFuncM(BASS, BASS_ChannelFlags);
 			LoadFuncM(BASS, BASS_ChannelGetAttribute);
 			LoadFuncM(BASS, BASS_ChannelGetData);
+			LoadFuncM(BASS, BASS_ChannelGetInfo);
 			LoadFuncM(BASS, BASS_ChannelGetLevelEx);
+			LoadFuncM(BASS, BASS_ChannelGetPosition);
 			LoadFuncM(BASS, BASS_ChannelIsActive);
 			LoadFuncM(BASS, BASS_ChannelPlay);
+			LoadFuncM(BASS, BASS_ChannelPause);
 			LoadFuncM(BASS, BASS_ChannelRemoveFX);
 			LoadFuncM(BASS, BASS_ChannelSetDSP);
 			LoadFuncM(BASS, BASS_ChannelRemoveDSP);
@@ -554,14 +679,17 @@ BOOL LoadBASSFunctions()
 			LoadFuncM(BASS, BASS_Free);
 			LoadFuncM(BASS, BASS_GetDevice);
 			LoadFuncM(BASS, BASS_GetDeviceInfo);
+			LoadFuncM(BASS, BASS_GetConfig);
 			LoadFuncM(BASS, BASS_GetInfo);
 			LoadFuncM(BASS, BASS_Init);
 			LoadFuncM(BASS, BASS_PluginFree);
 			LoadFuncM(BASS, BASS_PluginLoad);
 			LoadFuncM(BASS, BASS_SetConfig);
+			LoadFuncM(BASS, BASS_SetDevice);
 			LoadFuncM(BASS, BASS_Stop);
 			LoadFuncM(BASS, BASS_StreamFree);
 			LoadFuncM(BASSMIDI, BASS_MIDI_FontFree);
+			LoadFuncM(BASSMIDI, BASS_MIDI_FontGetInfo);
 			LoadFuncM(BASSMIDI, BASS_MIDI_FontInit);
 			LoadFuncM(BASSMIDI, BASS_MIDI_FontLoad);
 			LoadFuncM(BASSMIDI, BASS_MIDI_StreamCreate);
@@ -605,6 +733,7 @@ BOOL LoadBASSFunctions()
 			LoadFuncM(BASSWASAPI, BASS_WASAPI_GetDevice);
 			LoadFuncM(BASSWASAPI, BASS_WASAPI_GetLevelEx);
 			LoadFuncM(BASSWASAPI, BASS_WASAPI_PutData);
+			LoadFuncM(BASSWASAPI, BASS_WASAPI_SetNotify);
 
 			// Load plugins
 			LoadPluginModule(&bassflac, L"BASSFLAC");
@@ -662,6 +791,7 @@ VOID UnloadBASSFunctions()
 			UnloadLib(&BASSMIDI);
 			UnloadLib(&BASSENC);
 			UnloadLib(&BASSASIO);
+			DeviceCacheRelease();
 			UnloadLib(&BASSWASAPI);
 			UnloadLib(&BASS_VST);
 
@@ -1189,7 +1319,7 @@ void LoadSettings(BOOL Restart, BOOL RT)
 		}
 
 		if (RT)
-			BASS_ChannelSetAttribute(OMStream, BASS_ATTRIB_MIDI_CHANS, UnlimitedChannels ? 128.0f : 16.0f);
+			BASS_ChannelSetAttribute(OMStream, BASS_ATTRIB_MIDI_CHANS, RequiredMIDIChannels());
 
 		if (!RT)
 			PrintMessageToDebugLog("LoadSettingsFuncs", "Settings loaded.");
@@ -1423,6 +1553,16 @@ void FillContentDebug()
 	for (int i = 0; i <= 15; ++i)
 		PipeContent.append(L"|CV" + std::to_wstring(i) + L" = " + std::to_wstring(ManagedDebugInfo.ActiveVoices[i]));
 
+	for (int i = 0; VoiceBudgetOn && i <= 15; ++i)
+	{
+		PipeContent.append(L"|CN" + std::to_wstring(i) + L" = " + std::to_wstring(ManagedDebugInfo.ActiveNotes[i]));
+		PipeContent.append(L"|CS" + std::to_wstring(i) + L" = " + std::to_wstring(ManagedDebugInfo.StolenNotes[i]));
+	}
+
+	PipeContent.append(L"|ActivePorts = " + std::to_wstring(ManagedDebugInfo.ActivePorts));
+	for (DWORD i = 0; i < ManagedDebugInfo.ActivePorts; ++i)
+		PipeContent.append(L"|PV" + std::to_wstring(i) + L" = " + std::to_wstring(ManagedDebugInfo.ActivePortVoices[i]));
+
 	PipeContent.append(L"|CurCPU = " + std::to_wstring(ManagedDebugInfo.RenderingTime));
 	PipeContent.append(L"|Handles = " + std::to_wstring(handleCount));
 	PipeContent.append(L"|RAMUsage = " + std::to_wstring(static_cast<QWORD>(RU)));
@@ -1443,6 +1583,78 @@ void FillContentDebug()
 	PipeContent.append(L"|AsioInputLatency = " + std::to_wstring(ManagedDebugInfo.AsioInputLatency));
 	PipeContent.append(L"|ActualSampleRate = " + std::to_wstring(ManagedDebugInfo.ActualSampleRate));
 
+	// Event scheduler
+	PipeContent.append(L"|SchedPending = " + std::to_wstring(SchedulerCount));
+	PipeContent.append(L"|SchedReleased = " + std::to_wstring(SchedulerReleased));
+	PipeContent.append(L"|SchedLate = " + std::to_wstring(SchedulerLate));
+	PipeContent.append(L"|SchedMaxLate = " + std::to_wstring(SchedulerMaxLate));
+	PipeContent.append(L"|SchedDropped = " + std::to_wstring(SchedulerDropped));
+	PipeContent.append(L"|NoteTimersPending = " + std::to_wstring(NoteTimers.Pending()));
+	PipeContent.append(L"|NoteTimersPeak = " + std::to_wstring(NoteTimersPeak));
+	PipeContent.append(L"|NoteTimersReleased = " + std::to_wstring(NoteTimersReleased));
+	PipeContent.append(L"|NoteTimersOverflow = " + std::to_wstring(NoteTimersOverflow));
+
+	// Controller decimation
+	PipeContent.append(L"|DecCollapsed = " + std::to_wstring(DecCollapsed));
+	PipeContent.append(L"|DecDispatched = " + std::to_wstring(DecDispatched));
+	PipeContent.append(L"|DecDispatchNs = " + std::to_wstring(DecDispatchNs));
+	PipeContent.append(L"|DecSavedMs = " + std::to_wstring(DecSavedMs));
+
+	// Synth state restore
+	PipeContent.append(L"|StateRestoreMs = " + std::to_wstring(SynthRestoreMs));
+	PipeContent.append(L"|StateRestoreEvents = " + std::to_wstring(SynthRestoreEvents));
+	PipeContent.append(L"|StateRestoreMismatches = " + std::to_wstring(SynthRestoreMismatches));
+
+	// MIDI file player
+	PipeContent.append(L"|PlayerReleased = " + std::to_wstring(PlayerReleased));
+	PipeContent.append(L"|PlayerLate = " + std::to_wstring(PlayerLate));
+	PipeContent.append(L"|PlayerMaxLate = " + std::to_wstring(PlayerMaxLate));
+
+	// Rendered audio cache
+	PipeContent.append(L"|PlayerCacheHits = " + std::to_wstring(PlayerCacheHits));
+	PipeContent.append(L"|PlayerCacheMisses = " + std::to_wstring(PlayerCacheMisses));
+	PipeContent.append(L"|PlayerCacheFallbacks = " + std::to_wstring(PlayerCacheFallbacks));
+	PipeContent.append(L"|PlayerCacheWritten = " + std::to_wstring(PlayerCacheWritten));
+	PipeContent.append(L"|PlayerCacheLiveUs = " + std::to_wstring(PlayerCacheLiveUs));
+	PipeContent.append(L"|PlayerCacheHitUs = " + std::to_wstring(PlayerCacheHitUs));
+	PipeContent.append(L"|PlayerCacheSavedMs = " + std::to_wstring(PlayerCacheSavedMs));
+
+	// Built-in limiter
+	PipeContent.append(L"|LimiterMode = " + std::to_wstring(LimiterMode));
+	PipeContent.append(L"|LimiterGR = " + std::to_wstring(LimiterReduction));
+	PipeContent.append(L"|LimiterBlockUs = " + std::to_wstring(LimiterBlockUs));
+	PipeContent.append(L"|LimiterBlockMaxUs = " + std::to_wstring(LimiterBlockMaxUs));
+	PipeContent.append(L"|LimiterLatency = " + std::to_wstring(GetLimiterLatency()));
+
+	// Built-in effects
+	PipeContent.append(L"|NativeFX = " + std::to_wstring(NativeFx != NULL));
+	PipeContent.append(L"|FXReverbUs = " + std::to_wstring(FxReverbUs));
+	PipeContent.append(L"|FXChorusUs = " + std::to_wstring(FxChorusUs));
+	PipeContent.append(L"|FXEchoUs = " + std::to_wstring(FxEchoUs));
+
+	// Patch caching
+	PipeContent.append(L"|PatchCacheRequested = " + std::to_wstring(PatchRequested));
+	PipeContent.append(L"|PatchCacheLoaded = " + std::to_wstring(PatchLoaded));
+	PipeContent.append(L"|PatchCachePending = " + std::to_wstring(PatchRequested - PatchLoaded - PatchDropped));
+
+	// Live changes, dropout per scope
+	for (int i = 0; i < LIVE_SCOPES; ++i)
+	{
+		PipeContent.append(L"|LiveDropout" + std::to_wstring(i) + L" = " + std::to_wstring(LiveDropoutLast[i]));
+		PipeContent.append(L"|LiveDropoutMax" + std::to_wstring(i) + L" = " + std::to_wstring(LiveDropoutMax[i]));
+	}
+
+	// Output recovery
+	PipeContent.append(L"|OutputRecoveries = " + std::to_wstring(OutputRecoveries));
+	PipeContent.append(L"|OutputRecoveryMs = " + std::to_wstring(OutputRecoveryLast));
+	PipeContent.append(L"|OutputRecoveryMaxMs = " + std::to_wstring(OutputRecoveryMax));
+	PipeContent.append(L"|OpenLatencyMs = " + std::to_wstring(OpenLatencyMs));
+	PipeContent.append(L"|FirstSoundMs = " + std::to_wstring(FirstSoundMs));
+	PipeContent.append(L"|EarlyQueued = " + std::to_wstring(EarlyQueued));
+	PipeContent.append(L"|EarlyDropped = " + std::to_wstring(EarlyDropped));
+	PipeContent.append(L"|EarlyStale = " + std::to_wstring(EarlyStale));
+	PipeContent.append(L"|WarmReopens = " + std::to_wstring(WarmReopens));
+
 	// Append recent MIDI events (format: ME=channel,type,data1,data2)
 	// Type: 0=NoteOff, 1=NoteOn, 2=CC, 3=PC, 4=PitchBend
 	while (DebugMidiEventReadHead < DebugMidiEventWriteHead)
@@ -1481,6 +1693,37 @@ void ParseDebugData()
 				ManagedDebugInfo.ActiveVoices[i] = temp;
 		}
 
+		// Voices for the extra ports, port 0 is just the sum of the channels above
+		ManagedDebugInfo.ActivePorts = ActivePorts;
+		for (DWORD p = 0; p < OM_MAXPORTS; ++p)
+		{
+			DWORD PortVoices = 0;
+
+			for (DWORD i = 0; p < ActivePorts && i <= 15; ++i)
+			{
+				int temp = p ? BASS_MIDI_StreamGetEvent(OMStream, (p << 4) | i, MIDI_EVENT_VOICES) : ManagedDebugInfo.ActiveVoices[i];
+				if (temp != -1)
+					PortVoices += temp;
+			}
+
+			ManagedDebugInfo.ActivePortVoices[p] = PortVoices;
+		}
+
+		// Voice budgets, the notes the drain side is tracking on each channel
+		for (DWORD i = 0; i <= 15; ++i)
+		{
+			DWORD Notes = 0, Stolen = 0;
+
+			for (DWORD p = 0; VoiceBudgetOn && p < ActivePorts; ++p)
+			{
+				Notes += VBChannels[(p << 4) | i].Held + VBChannels[(p << 4) | i].Sustained;
+				Stolen += VBStolen[(p << 4) | i];
+			}
+
+			ManagedDebugInfo.ActiveNotes[i] = Notes;
+			ManagedDebugInfo.StolenNotes[i] = Stolen;
+		}
+
 		// Send voice counts to AudioBus - Permafrost can show per-channel activity
 		if (AudioBus_IsConnected())
 		{
@@ -1562,6 +1805,10 @@ void ParseDebugData()
 		ManagedDebugInfo.AsioInputLatency = 0.0;
 		for (int i = 0; i <= 15; ++i)
 			ManagedDebugInfo.ActiveVoices[i] = 0;
+		for (int i = 0; i < OM_MAXPORTS; ++i)
+			ManagedDebugInfo.ActivePortVoices[i] = 0;
+		for (int i = 0; i <= 15; ++i)
+			ManagedDebugInfo.ActiveNotes[i] = 0;
 	}
 
 	// Check for Permafrost mixer commands (panic, etc)
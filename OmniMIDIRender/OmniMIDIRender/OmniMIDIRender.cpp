@@ -0,0 +1,498 @@
+// OmniMIDIRender: renders MIDI files to audio through OmniMIDI's offline renderer, several of them at once
+
+#include <Windows.h>
+#include <Shlwapi.h>
+#include <stdio.h>
+#include <vector>
+#include <string>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include "SMFSequence.h"
+#include "SongRender.h"
+
+#define RENDER_BLOCK		4096		// Frames rendered per call
+#define RENDER_CHANNELS		2			// The offline renderer always gives interleaved stereo float
+
+enum OutputFormat {
+	FORMAT_WAVFLOAT,
+	FORMAT_WAV16,
+	FORMAT_FLAC
+};
+
+typedef struct RenderJob {
+	std::wstring Input;
+	std::wstring Output;
+	DOUBLE AudioSeconds = 0.0;
+	DOUBLE RenderSeconds = 0.0;
+	BOOL Done = FALSE;
+	const char* Error = NULL;
+} RenderJob;
+
+// KDMAPI, loaded at runtime like any other KDMAPI app would
+typedef HANDLE(WINAPI* KInitOfflineFunc)(DWORD SampleRate, LPCWSTR SoundFontList);
+typedef BOOL(WINAPI* KOfflineDataFunc)(HANDLE Renderer, DWORD SampleOffset, DWORD dwMsg);
+typedef BOOL(WINAPI* KOfflineLongDataFunc)(HANDLE Renderer, LPSTR MidiHdrData, DWORD MidiHdrDataLen);
+typedef DWORD(WINAPI* KOfflineRenderFunc)(HANDLE Renderer, FLOAT* Buffer, DWORD Frames);
+typedef BOOL(WINAPI* KTermOfflineFunc)(HANDLE Renderer);
+
+static KInitOfflineFunc KInitOffline = NULL;
+static KOfflineDataFunc KOfflineData = NULL;
+static KOfflineLongDataFunc KOfflineLongData = NULL;
+static KOfflineRenderFunc KOfflineRender = NULL;
+static KTermOfflineFunc KTermOffline = NULL;
+
+// Options
+static DWORD SampleRate = 0;
+static DWORD Instances = 0;
+static DWORD TailSeconds = 2;
+static OutputFormat Format = FORMAT_WAVFLOAT;
+static std::wstring SoundFontList;
+static std::wstring OutputFolder;
+static std::wstring SummaryPath;
+static std::wstring FLACEncoder = L"flac.exe";
+static std::wstring DriverPath = L"OmniMIDI.dll";
+
+static std::vector<RenderJob> Jobs;
+static std::atomic<size_t> NextJob(0);
+static std::atomic<size_t> FinishedJobs(0);
+static std::mutex ConsoleMutex;
+
+// Writes the rendered audio to a WAV file, or to the FLAC encoder through a pipe
+class AudioSink {
+	HANDLE Output = INVALID_HANDLE_VALUE;
+	HANDLE Encoder = NULL;
+	DWORD64 DataBytes = 0;
+	std::vector<BYTE> Converted;
+
+	BOOL Put(const void* Data, DWORD Bytes) {
+		DWORD Written = 0;
+		return WriteFile(Output, Data, Bytes, &Written, NULL) && Written == Bytes;
+	}
+
+	// RIFF can't go past 4GB, the sizes just stay at their maximum after that
+	BOOL PutWAVHeader() {
+		BOOL Float = (Format == FORMAT_WAVFLOAT);
+		WORD Bits = Float ? 32 : 16, Align = RENDER_CHANNELS * Bits / 8, Tag = Float ? 3 : 1, Channels = RENDER_CHANNELS;
+		DWORD Bytes = (DataBytes > 0xFFFFFFFF - 36) ? 0xFFFFFFFF - 36 : (DWORD)DataBytes;
+		DWORD RIFFSize = Bytes + 36, FmtSize = 16, ByteRate = SampleRate * Align;
+		BYTE Header[44];
+
+		memcpy(Header, "RIFF", 4);
+		memcpy(Header + 4, &RIFFSize, 4);
+		memcpy(Header + 8, "WAVEfmt ", 8);
+		memcpy(Header + 16, &FmtSize, 4);
+		memcpy(Header + 20, &Tag, 2);
+		memcpy(Header + 22, &Channels, 2);
+		memcpy(Header + 24, &SampleRate, 4);
+		memcpy(Header + 28, &ByteRate, 4);
+		memcpy(Header + 32, &Align, 2);
+		memcpy(Header + 34, &Bits, 2);
+		memcpy(Header + 36, "data", 4);
+		memcpy(Header + 40, &Bytes, 4);
+
+		return Put(Header, sizeof(Header));
+	}
+
+	BOOL StartEncoder(const std::wstring& Path) {
+		SECURITY_ATTRIBUTES SA = { sizeof(SECURITY_ATTRIBUTES), NULL, TRUE };
+		STARTUPINFOW SI = { 0 };
+		PROCESS_INFORMATION PI = { 0 };
+		HANDLE ReadEnd = NULL;
+		wchar_t Rate[16];
+
+		if (!CreatePipe(&ReadEnd, &Output, &SA, 1 << 20))
+			return FALSE;
+
+		// Only the encoder gets to inherit its end of the pipe
+		SetHandleInformation(Output, HANDLE_FLAG_INHERIT, 0);
+
+		swprintf_s(Rate, 16, L"%u", SampleRate);
+		std::wstring Command = L"\"" + FLACEncoder + L"\" --silent --force --force-raw-format --endian=little --sign=signed --channels=2 --bps=24 --sample-rate=" +
+			std::wstring(Rate) + L" -o \"" + Path + L"\" -";
+
+		SI.cb = sizeof(STARTUPINFOW);
+		SI.dwFlags = STARTF_USESTDHANDLES;
+		SI.hStdInput = ReadEnd;
+		SI.hStdOutput = GetStdHandle(STD_OUTPUT_HANDLE);
+		SI.hStdError = GetStdHandle(STD_ERROR_HANDLE);
+
+		BOOL Started = CreateProcessW(NULL, &Command[0], NULL, NULL, TRUE, CREATE_NO_WINDOW, NULL, NULL, &SI, &PI);
+		CloseHandle(ReadEnd);
+
+		if (!Started) {
+			CloseHandle(Output);
+			Output = INVALID_HANDLE_VALUE;
+			return FALSE;
+		}
+
+		CloseHandle(PI.hThread);
+		Encoder = PI.hProcess;
+		return TRUE;
+	}
+
+public:
+	~AudioSink() { Close(); }
+
+	BOOL Open(const std::wstring& Path) {
+		if (Format == FORMAT_FLAC)
+			return StartEncoder(Path);
+
+		Output = CreateFileW(Path.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+		return Output != INVALID_HANDLE_VALUE && PutWAVHeader();
+	}
+
+	BOOL Write(const FLOAT* Buffer, DWORD Frames) {
+		DWORD Samples = Frames * RENDER_CHANNELS;
+
+		switch (Format) {
+		case FORMAT_WAVFLOAT:
+			DataBytes += Samples * sizeof(FLOAT);
+			return Put(Buffer, Samples * sizeof(FLOAT));
+
+		case FORMAT_WAV16:
+			Converted.resize(Samples * 2);
+
+			for (DWORD i = 0; i < Samples; i++) {
+				FLOAT S = Buffer[i] < -1.0f ? -1.0f : (Buffer[i] > 1.0f ? 1.0f : Buffer[i]);
+				SHORT V = (SHORT)(S * 32767.0f);
+				memcpy(&Converted[i * 2], &V, 2);
+			}
+
+			DataBytes += Samples * 2;
+			return Put(&Converted[0], Samples * 2);
+
+		default:
+			Converted.resize(Samples * 3);
+
+			for (DWORD i = 0; i < Samples; i++) {
+				FLOAT S = Buffer[i] < -1.0f ? -1.0f : (Buffer[i] > 1.0f ? 1.0f : Buffer[i]);
+				LONG V = (LONG)(S * 8388607.0f);
+
+				Converted[i * 3] = (BYTE)V;
+				Converted[i * 3 + 1] = (BYTE)(V >> 8);
+				Converted[i * 3 + 2] = (BYTE)(V >> 16);
+			}
+
+			DataBytes += Samples * 3;
+			return Put(&Converted[0], Samples * 3);
+		}
+	}
+
+	BOOL Close() {
+		BOOL Success = TRUE;
+
+		if (Output == INVALID_HANDLE_VALUE)
+			return TRUE;
+
+		if (Encoder) {
+			DWORD ExitCode = 1;
+
+			// Closing the pipe tells the encoder it's done
+			CloseHandle(Output);
+			WaitForSingleObject(Encoder, INFINITE);
+			GetExitCodeProcess(Encoder, &ExitCode);
+			CloseHandle(Encoder);
+
+			Encoder = NULL;
+			Success = !ExitCode;
+		}
+		else {
+			// Now that the sizes are known, go back and fix the header
+			SetFilePointer(Output, 0, NULL, FILE_BEGIN);
+			Success = PutWAVHeader();
+			CloseHandle(Output);
+		}
+
+		Output = INVALID_HANDLE_VALUE;
+		return Success;
+	}
+};
+
+// The driver's offline renderer, as RenderSong sees it
+typedef struct OfflineSynth {
+	HANDLE Renderer;
+
+	void Data(DWORD Offset, DWORD Msg) { KOfflineData(Renderer, Offset, Msg); }
+	void LongData(const uint8_t* Data, DWORD Length) { KOfflineLongData(Renderer, (LPSTR)Data, Length); }
+	DWORD Render(FLOAT* Buffer, DWORD Frames) { return KOfflineRender(Renderer, Buffer, Frames); }
+} OfflineSynth;
+
+// Returns the mapped file, which has to stay mapped for as long as the song gets played
+static LPVOID LoadMIDI(const std::wstring& Path, SMFSequence& Song) {
+	HANDLE File = CreateFileW(Path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	HANDLE Mapping = NULL;
+	LPVOID View = NULL;
+	LARGE_INTEGER Size;
+
+	if (File == INVALID_HANDLE_VALUE)
+		return NULL;
+
+	if (GetFileSizeEx(File, &Size) && Size.QuadPart && (ULONGLONG)Size.QuadPart <= SIZE_MAX) {
+		Mapping = CreateFileMappingW(File, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (Mapping) View = MapViewOfFile(Mapping, FILE_MAP_READ, 0, 0, 0);
+
+		// The files are already spread across the cores, one thread per file is enough
+		if (View && !Song.Load((const uint8_t*)View, (size_t)Size.QuadPart, 0, 1)) {
+			UnmapViewOfFile(View);
+			View = NULL;
+		}
+
+		if (Mapping) CloseHandle(Mapping);
+	}
+
+	CloseHandle(File);
+	return View;
+}
+
+static BOOL Render(RenderJob& Job) {
+	SMFSequence Song;
+	AudioSink Sink;
+	std::vector<FLOAT> Buffer(RENDER_BLOCK * RENDER_CHANNELS);
+	LARGE_INTEGER Start, End, Freq;
+	DWORD64 Position = 0;
+	BOOL Success;
+	HANDLE Renderer;
+	LPVOID View;
+
+	QueryPerformanceCounter(&Start);
+
+	View = LoadMIDI(Job.Input, Song);
+	if (!View) {
+		Job.Error = "Not a valid MIDI file";
+		return FALSE;
+	}
+
+	Renderer = KInitOffline(SampleRate, SoundFontList.empty() ? NULL : SoundFontList.c_str());
+	if (!Renderer) {
+		UnmapViewOfFile(View);
+		Job.Error = "Couldn't create the offline renderer";
+		return FALSE;
+	}
+
+	if (!Sink.Open(Job.Output)) {
+		UnmapViewOfFile(View);
+		KTermOffline(Renderer);
+		Job.Error = (Format == FORMAT_FLAC) ? "Couldn't start the FLAC encoder" : "Couldn't create the output file";
+		return FALSE;
+	}
+
+	OfflineSynth Synth = { Renderer };
+	Success = RenderSong(Song, SampleRate, (DWORD64)TailSeconds * SampleRate, &Buffer[0], RENDER_BLOCK, Synth,
+		[&](const FLOAT* Data, DWORD Frames) { return Sink.Write(Data, Frames) != FALSE; }, &Position);
+
+	KTermOffline(Renderer);
+	UnmapViewOfFile(View);
+
+	if (!Sink.Close() || !Success) {
+		if (!Success) Job.Error = "Rendering failed";
+		else Job.Error = (Format == FORMAT_FLAC) ? "The FLAC encoder failed" : "Couldn't write the output file";
+		return FALSE;
+	}
+
+	QueryPerformanceCounter(&End);
+	QueryPerformanceFrequency(&Freq);
+
+	Job.AudioSeconds = (DOUBLE)Position / SampleRate;
+	Job.RenderSeconds = (DOUBLE)(End.QuadPart - Start.QuadPart) / Freq.QuadPart;
+	return TRUE;
+}
+
+static void RenderWorker() {
+	for (size_t i = NextJob++; i < Jobs.size(); i = NextJob++) {
+		RenderJob& Job = Jobs[i];
+
+		Job.Done = Render(Job);
+
+		std::lock_guard<std::mutex> Lock(ConsoleMutex);
+		size_t Finished = ++FinishedJobs;
+
+		if (Job.Done)
+			wprintf(L"[%zu/%zu] %s: %.1fs of audio in %.1fs (%.2fx)\n", Finished, Jobs.size(), PathFindFileNameW(Job.Input.c_str()),
+				Job.AudioSeconds, Job.RenderSeconds, Job.RenderSeconds > 0.0 ? Job.AudioSeconds / Job.RenderSeconds : 0.0);
+		else
+			wprintf(L"[%zu/%zu] %s: FAILED, %S\n", Finished, Jobs.size(), PathFindFileNameW(Job.Input.c_str()), Job.Error);
+	}
+}
+
+static BOOL IsMIDIFile(LPCWSTR Path) {
+	LPCWSTR Extension = PathFindExtensionW(Path);
+	return !_wcsicmp(Extension, L".mid") || !_wcsicmp(Extension, L".midi") || !_wcsicmp(Extension, L".kar") || !_wcsicmp(Extension, L".smf");
+}
+
+static void AddJob(const std::wstring& Input) {
+	RenderJob Job;
+	std::wstring Name = PathFindFileNameW(Input.c_str());
+	std::wstring Folder = OutputFolder.empty() ? Input.substr(0, Input.size() - Name.size()) : OutputFolder + L"\\";
+
+	Name = Name.substr(0, Name.size() - wcslen(PathFindExtensionW(Name.c_str())));
+	Job.Input = Input;
+	Job.Output = Folder + Name + (Format == FORMAT_FLAC ? L".flac" : L".wav");
+	Jobs.push_back(Job);
+}
+
+// Folders get all of their MIDI files added, not recursively
+static void AddInput(const std::wstring& Input) {
+	WIN32_FIND_DATAW FD;
+	HANDLE Find;
+
+	if (!PathIsDirectoryW(Input.c_str())) {
+		AddJob(Input);
+		return;
+	}
+
+	Find = FindFirstFileW((Input + L"\\*").c_str(), &FD);
+	if (Find == INVALID_HANDLE_VALUE)
+		return;
+
+	do {
+		if (!(FD.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) && IsMIDIFile(FD.cFileName))
+			AddJob(Input + L"\\" + FD.cFileName);
+	} while (FindNextFileW(Find, &FD));
+
+	FindClose(Find);
+}
+
+// Falls back to the frequency set in the configurator, like the offline renderer itself does
+static DWORD ConfiguredSampleRate() {
+	DWORD Rate = 0, Type = REG_DWORD, Size = sizeof(DWORD);
+	HKEY Key;
+
+	if (RegOpenKeyExW(HKEY_CURRENT_USER, L"Software\\OmniMIDI\\Configuration", 0, KEY_READ, &Key) == ERROR_SUCCESS) {
+		RegQueryValueExW(Key, L"AudioFrequency", NULL, &Type, (LPBYTE)&Rate, &Size);
+		RegCloseKey(Key);
+	}
+
+	return Rate ? Rate : 48000;
+}
+
+static void WriteSummary(DOUBLE WallSeconds) {
+	DOUBLE Audio = 0.0, Render = 0.0;
+	size_t Done = 0;
+	FILE* CSV = NULL;
+
+	if (!SummaryPath.empty() && _wfopen_s(&CSV, SummaryPath.c_str(), L"w"))
+		wprintf(L"Couldn't create the summary file.\n");
+
+	if (CSV)
+		fwprintf(CSV, L"File,AudioSeconds,RenderSeconds,SpeedRatio,Status\n");
+
+	for (size_t i = 0; i < Jobs.size(); i++) {
+		if (Jobs[i].Done) {
+			Audio += Jobs[i].AudioSeconds;
+			Render += Jobs[i].RenderSeconds;
+			Done++;
+		}
+
+		if (CSV)
+			fwprintf(CSV, L"\"%s\",%.3f,%.3f,%.3f,%S\n", Jobs[i].Input.c_str(), Jobs[i].AudioSeconds, Jobs[i].RenderSeconds,
+				Jobs[i].RenderSeconds > 0.0 ? Jobs[i].AudioSeconds / Jobs[i].RenderSeconds : 0.0, Jobs[i].Done ? "OK" : Jobs[i].Error);
+	}
+
+	if (CSV)
+		fclose(CSV);
+
+	wprintf(L"\n%zu of %zu files rendered with %u instances.\n", Done, Jobs.size(), Instances);
+	wprintf(L"Audio: %.1fs, wall time: %.1fs\n", Audio, WallSeconds);
+	wprintf(L"Speed ratio per instance: %.2fx\n", Render > 0.0 ? Audio / Render : 0.0);
+	wprintf(L"Speed ratio overall: %.2fx\n", WallSeconds > 0.0 ? Audio / WallSeconds : 0.0);
+}
+
+static void Usage() {
+	wprintf(L"Usage: OmniMIDIRender [options] <MIDI files or folders...>\n\n"
+		L"  -j <n>          Render instances working at once (Default: number of cores)\n"
+		L"  -r <rate>       Sample rate (Default: the one set in the configurator)\n"
+		L"  -f <format>     wav (32-bit float), wav16 or flac (Default: wav)\n"
+		L"  -o <folder>     Output folder (Default: next to each MIDI file)\n"
+		L"  -s <list>       SoundFont list or SoundFont (Default: the driver's list)\n"
+		L"  -t <seconds>    Time left to the release tails after the last event (Default: 2)\n"
+		L"  -summary <csv>  Write the speed ratio of every file to a CSV file\n"
+		L"  -flac <path>    FLAC encoder to use (Default: flac.exe)\n"
+		L"  -dll <path>     OmniMIDI library to use (Default: OmniMIDI.dll)\n");
+}
+
+int wmain(int argc, wchar_t** argv) {
+	std::vector<std::thread> Workers;
+	LARGE_INTEGER Start, End, Freq;
+	HANDLE FontHolder;
+	HMODULE OM;
+
+	for (int i = 1; i < argc; i++) {
+		std::wstring Arg = argv[i];
+		BOOL HasValue = (i + 1 < argc);
+
+		if (Arg == L"-j" && HasValue) Instances = _wtoi(argv[++i]);
+		else if (Arg == L"-r" && HasValue) SampleRate = _wtoi(argv[++i]);
+		else if (Arg == L"-o" && HasValue) OutputFolder = argv[++i];
+		else if (Arg == L"-s" && HasValue) SoundFontList = argv[++i];
+		else if (Arg == L"-t" && HasValue) TailSeconds = _wtoi(argv[++i]);
+		else if (Arg == L"-summary" && HasValue) SummaryPath = argv[++i];
+		else if (Arg == L"-flac" && HasValue) FLACEncoder = argv[++i];
+		else if (Arg == L"-dll" && HasValue) DriverPath = argv[++i];
+		else if (Arg == L"-f" && HasValue) {
+			std::wstring Value = argv[++i];
+
+			if (Value == L"wav") Format = FORMAT_WAVFLOAT;
+			else if (Value == L"wav16") Format = FORMAT_WAV16;
+			else if (Value == L"flac") Format = FORMAT_FLAC;
+			else {
+				Usage();
+				return 1;
+			}
+		}
+		else if (Arg[0] == L'-') {
+			Usage();
+			return 1;
+		}
+		else AddInput(Arg);
+	}
+
+	if (Jobs.empty()) {
+		Usage();
+		return 1;
+	}
+
+	OM = LoadLibraryW(DriverPath.c_str());
+	if (OM) {
+		KInitOffline = (KInitOfflineFunc)GetProcAddress(OM, "InitializeOfflineRender");
+		KOfflineData = (KOfflineDataFunc)GetProcAddress(OM, "SendOfflineRenderData");
+		KOfflineLongData = (KOfflineLongDataFunc)GetProcAddress(OM, "SendOfflineRenderLongData");
+		KOfflineRender = (KOfflineRenderFunc)GetProcAddress(OM, "RenderOfflineFrames");
+		KTermOffline = (KTermOfflineFunc)GetProcAddress(OM, "TerminateOfflineRender");
+	}
+
+	if (!KInitOffline || !KOfflineData || !KOfflineLongData || !KOfflineRender || !KTermOffline) {
+		wprintf(L"Couldn't load the offline renderer from %s, is OmniMIDI up to date?\n", DriverPath.c_str());
+		return 1;
+	}
+
+	if (!SampleRate) SampleRate = ConfiguredSampleRate();
+	if (!Instances) Instances = std::thread::hardware_concurrency();
+	if (!Instances) Instances = 1;
+	if (Instances > Jobs.size()) Instances = (DWORD)Jobs.size();
+
+	// The instances share the SoundFonts of the same list for as long as one of them is open,
+	// so keep one open for the whole batch, and the SoundFonts only get loaded once
+	FontHolder = KInitOffline(SampleRate, SoundFontList.empty() ? NULL : SoundFontList.c_str());
+	if (!FontHolder) {
+		wprintf(L"Couldn't create the offline renderer, check the SoundFonts.\n");
+		return 1;
+	}
+
+	wprintf(L"Rendering %zu files at %uHz, %u at a time...\n", Jobs.size(), SampleRate, Instances);
+	QueryPerformanceCounter(&Start);
+
+	for (DWORD i = 0; i < Instances; i++)
+		Workers.emplace_back(RenderWorker);
+
+	for (size_t i = 0; i < Workers.size(); i++)
+		Workers[i].join();
+
+	QueryPerformanceCounter(&End);
+	QueryPerformanceFrequency(&Freq);
+	WriteSummary((DOUBLE)(End.QuadPart - Start.QuadPart) / Freq.QuadPart);
+
+	KTermOffline(FontHolder);
+	FreeLibrary(OM);
+	return FinishedJobs == Jobs.size() && std::all_of(Jobs.begin(), Jobs.end(), [](const RenderJob& J) { return J.Done; }) ? 0 : 2;
+}
@@ -0,0 +1,63 @@
+/*
+OmniMIDIRender song renderer
+Feeds a song to an offline renderer block by block, every event on the exact sample frame it falls on,
+so that the output doesn't depend on the block size.
+Doesn't depend on Win32, the renderer and the output are callbacks.
+*/
+#pragma once
+
+#include "SMFSequence.h"
+
+// Synth needs Data(Offset, Msg) and LongData(Data, Length), with Offset counted from what it rendered so far,
+// and Render(Buffer, Frames), which returns how many frames it rendered (0 if it failed).
+// Write(Buffer, Frames) gets the audio, returns false if it couldn't write it.
+// Rendered gets the amount of frames that made it to the output, even if it fails
+template <class Synth, class Writer>
+static bool RenderSong(const SMFSequence& Song, uint32_t SampleRate, uint64_t TailFrames, float* Buffer, uint32_t BlockFrames,
+	Synth& S, Writer Write, uint64_t* Rendered) {
+	SMFSequence::Cursor Cursor;
+	uint64_t Position = 0, Length = (uint64_t)((double)Song.Length * SampleRate / 1000000.0) + TailFrames;
+	bool Success = true;
+
+	// Renders up to the requested frame
+	auto RenderTo = [&](uint64_t Frame) -> bool {
+		while (Position < Frame) {
+			uint32_t Frames = (Frame - Position > BlockFrames) ? BlockFrames : (uint32_t)(Frame - Position);
+			uint32_t Done = S.Render(Buffer, Frames);
+
+			if (!Done || !Write(Buffer, Done))
+				return false;
+
+			Position += Done;
+		}
+
+		return true;
+	};
+
+	Cursor.Attach(Song);
+
+	while (Success && Position < Length) {
+		uint64_t BlockEnd = (Length - Position > BlockFrames) ? Position + BlockFrames : Length;
+
+		while (Success && !Cursor.AtEnd()) {
+			uint64_t Frame = (uint64_t)((double)Cursor.PeekTime() * SampleRate / 1000000.0);
+
+			if (Frame >= BlockEnd)
+				break;
+
+			SMFSequence::Event Ev = Cursor.Next();
+
+			if (Ev.Long) {
+				// Long messages are applied at the current render position, so get there first
+				Success = RenderTo(Frame);
+				if (Success) S.LongData(Ev.Long, Ev.LongLength);
+			}
+			else S.Data((uint32_t)(Frame > Position ? Frame - Position : 0), Ev.Msg);
+		}
+
+		Success = Success && RenderTo(BlockEnd);
+	}
+
+	*Rendered = Position;
+	return Success;
+}
@@ -0,0 +1,272 @@
+// OmniMIDIRender song loop, with a stub synth: every event lands on its frame, and the output doesn't depend on the block size.
+// Standalone, like the driver's portable tests:
+// g++ -std=c++11 -O2 -Wall -Wextra -pthread -I../../../OmniMIDI SongRenderTest.cpp -o SongRenderTest && ./SongRenderTest
+// Run it with "bench" as its argument to get the render speed too.
+
+#include "../SongRender.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+static int Failures = 0;
+
+#define CHECK(x) do { if (!(x)) { printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #x); Failures++; } } while (0)
+
+typedef std::vector<uint8_t> Bytes;
+
+static const uint32_t Rate = 48000;
+
+typedef struct Applied {
+	uint64_t Frame;
+	uint32_t Msg;		// Long messages log their length with the top bit set
+
+	bool operator==(const Applied& Other) const { return Frame == Other.Frame && Msg == Other.Msg; }
+} Applied;
+
+// Takes events the way KOfflineData does, offset from what it rendered so far,
+// and plays them on their exact frame. The audio is a running hash of what it got
+typedef struct StubSynth {
+	std::vector<Applied> Pending, Log;
+	uint64_t Rendered = 0;
+	uint32_t State = 1;
+	uint32_t FailAt = UINT32_MAX;
+
+	void Data(uint32_t Offset, uint32_t Msg) {
+		Applied Ev = { Rendered + Offset, Msg };
+
+		// Same frame events keep the order they came in
+		CHECK(Pending.empty() || Pending.back().Frame <= Ev.Frame);
+		Pending.push_back(Ev);
+	}
+
+	void LongData(const uint8_t* Data, uint32_t Length) {
+		// Applied right away, everything before it has to be in already
+		CHECK(Pending.empty() || Pending.back().Frame <= Rendered);
+		Flush(Rendered + 1);
+
+		for (uint32_t i = 0; i < Length; i++)
+			State = State * 31 + Data[i];
+
+		Log.push_back({ Rendered, 0x80000000 | Length });
+	}
+
+	void Flush(uint64_t Frame) {
+		size_t Done = 0;
+
+		for (; Done < Pending.size() && Pending[Done].Frame < Frame; Done++) {
+			State = State * 31 + Pending[Done].Msg;
+			Log.push_back(Pending[Done]);
+		}
+
+		Pending.erase(Pending.begin(), Pending.begin() + Done);
+	}
+
+	uint32_t Render(float* Buffer, uint32_t Frames) {
+		if (Rendered + Frames > FailAt)
+			return 0;
+
+		for (uint32_t i = 0; i < Frames; i++) {
+			Flush(Rendered + 1);
+			Buffer[i * 2] = (float)(State & 0xFFFF) / 65536.0f;
+			Buffer[i * 2 + 1] = (float)(Rendered & 0xFF) / 256.0f;
+			Rendered++;
+		}
+
+		return Frames;
+	}
+} StubSynth;
+
+static void PutVLQ(Bytes& Out, uint32_t Value) {
+	uint8_t Tmp[5];
+	int Count = 0;
+
+	do Tmp[Count++] = Value & 0x7F;
+	while (Value >>= 7);
+
+	while (Count--)
+		Out.push_back(Tmp[Count] | (Count ? 0x80 : 0));
+}
+
+static void PutBE(Bytes& Out, uint32_t Value, int Size) {
+	while (Size--)
+		Out.push_back((uint8_t)(Value >> (Size * 8)));
+}
+
+// A format 1 song with tempo changes on the first track, notes and some SysEx on the others
+static Bytes MakeSong(uint16_t Tracks, uint32_t Events, uint32_t Seed) {
+	std::mt19937 Rng(Seed);
+	Bytes File = { 'M', 'T', 'h', 'd' };
+
+	PutBE(File, 6, 4);
+	PutBE(File, 1, 2);
+	PutBE(File, Tracks, 2);
+	PutBE(File, 480, 2);
+
+	for (uint16_t t = 0; t < Tracks; t++) {
+		Bytes Track;
+
+		for (uint32_t i = 0; i < Events; i++) {
+			PutVLQ(Track, Rng() % 40);
+
+			if (!t) {
+				uint32_t Tempo = 200000 + Rng() % 600000;
+				Track.insert(Track.end(), { 0xFF, 0x51, 0x03 });
+				PutBE(Track, Tempo, 3);
+			}
+			else if (!(Rng() % 97)) {
+				Track.insert(Track.end(), { 0xF0, 0x04, 0x41, (uint8_t)(Rng() & 0x7F), 0x12, 0xF7 });
+			}
+			else {
+				Track.push_back((uint8_t)(0x90 | (Rng() & 0xF)));
+				Track.push_back((uint8_t)(Rng() & 0x7F));
+				Track.push_back((uint8_t)(Rng() & 0x7F));
+			}
+		}
+
+		Track.insert(Track.end(), { 0x00, 0xFF, 0x2F, 0x00 });
+		File.insert(File.end(), { 'M', 'T', 'r', 'k' });
+		PutBE(File, (uint32_t)Track.size(), 4);
+		File.insert(File.end(), Track.begin(), Track.end());
+	}
+
+	return File;
+}
+
+// What the stub should log, straight from the song
+static std::vector<Applied> Reference(const SMFSequence& Song) {
+	std::vector<Applied> Out;
+	SMFSequence::Cursor C;
+
+	C.Attach(Song);
+	while (!C.AtEnd()) {
+		SMFSequence::Event Ev = C.Next();
+		uint64_t Frame = (uint64_t)((double)Ev.Time * Rate / 1000000.0);
+
+		if (Ev.Long) Out.push_back({ Frame, 0x80000000 | Ev.LongLength });
+		else Out.push_back({ Frame, Ev.Msg });
+	}
+
+	return Out;
+}
+
+static std::vector<float> Render(const SMFSequence& Song, uint32_t Block, std::vector<Applied>* Log) {
+	std::vector<float> Buffer(Block * 2), Out;
+	StubSynth Synth;
+	uint64_t Rendered = 0;
+	uint32_t Calls = 0;
+	bool Done = RenderSong(Song, Rate, Rate / 2, &Buffer[0], Block, Synth,
+		[&](const float* Data, uint32_t Frames) {
+			CHECK(Frames && Frames <= Block);
+			Out.insert(Out.end(), Data, Data + Frames * 2);
+			Calls++;
+			return true;
+		}, &Rendered);
+
+	CHECK(Done);
+	CHECK(Rendered == Out.size() / 2 && Rendered == Synth.Rendered);
+	CHECK(Synth.Pending.empty());
+	CHECK(Calls >= Rendered / Block);
+
+	if (Log) *Log = Synth.Log;
+	return Out;
+}
+
+static void TestDeterminism() {
+	Bytes File = MakeSong(8, 600, 77);
+	SMFSequence Song;
+
+	CHECK(Song.Load(File.data(), File.size()));
+
+	std::vector<Applied> Expect = Reference(Song), Log;
+	std::vector<float> Ref = Render(Song, 4096, &Log);
+	uint64_t Length = (uint64_t)((double)Song.Length * Rate / 1000000.0) + Rate / 2;
+
+	CHECK(Ref.size() == Length * 2);
+	CHECK(Log == Expect);
+
+	// Same events on the same frames, and the same audio, whatever the block size
+	const uint32_t Blocks[] = { 333, 64, 1 };
+	for (uint32_t b = 0; b < sizeof(Blocks) / sizeof(Blocks[0]); b++) {
+		CHECK(Render(Song, Blocks[b], &Log) == Ref);
+		CHECK(Log == Expect);
+	}
+}
+
+// A synth or an output that fails stops the render, with what got written counted
+static void TestFailures() {
+	Bytes File = MakeSong(2, 100, 5);
+	SMFSequence Song;
+	std::vector<float> Buffer(256 * 2);
+	uint64_t Rendered = 0, Written = 0;
+
+	CHECK(Song.Load(File.data(), File.size()));
+
+	StubSynth Broken;
+	Broken.FailAt = 1000;
+	CHECK(!RenderSong(Song, Rate, 0, &Buffer[0], 256, Broken, [&](const float*, uint32_t Frames) { Written += Frames; return true; }, &Rendered));
+	CHECK(Rendered == Written && Rendered <= 1000);
+
+	StubSynth Synth;
+	CHECK(!RenderSong(Song, Rate, 0, &Buffer[0], 256, Synth, [](const float*, uint32_t) { return false; }, &Rendered));
+	CHECK(Rendered == 0);
+
+	// An empty song is just the tail
+	Bytes Empty = MakeSong(1, 0, 1);
+	SMFSequence Silence;
+	StubSynth Idle;
+
+	CHECK(Silence.Load(Empty.data(), Empty.size()));
+	CHECK(RenderSong(Silence, Rate, 1000, &Buffer[0], 256, Idle, [](const float*, uint32_t) { return true; }, &Rendered));
+	CHECK(Rendered == 1000 && Idle.Log.empty());
+}
+
+// The loop's own cost, with a synth that doesn't do anything
+typedef struct NullSynth {
+	uint64_t Events = 0;
+
+	void Data(uint32_t, uint32_t) { Events++; }
+	void LongData(const uint8_t*, uint32_t) { Events++; }
+	uint32_t Render(float*, uint32_t Frames) { return Frames; }
+} NullSynth;
+
+static void Bench() {
+	Bytes File = MakeSong(64, 100000, 1);
+	SMFSequence Song;
+	std::vector<float> Buffer(4096 * 2);
+	uint64_t Rendered = 0;
+
+	Song.Load(File.data(), File.size());
+
+	for (uint32_t Block = 64; Block <= 4096; Block *= 8) {
+		NullSynth Null;
+		auto Start = std::chrono::steady_clock::now();
+		RenderSong(Song, Rate, 0, &Buffer[0], Block, Null, [](const float*, uint32_t) { return true; }, &Rendered);
+		double Time = std::chrono::duration<double>(std::chrono::steady_clock::now() - Start).count();
+
+		printf("SongRender: %u-frame blocks, %llu events in %.1f s of audio, %.1f M events/s, %.0fx realtime\n",
+			Block, (unsigned long long)Null.Events, (double)Rendered / Rate, Null.Events / Time / 1e6, (double)Rendered / Rate / Time);
+	}
+
+	// With the stub synth doing some work for every frame
+	StubSynth Stub;
+	auto Start = std::chrono::steady_clock::now();
+	RenderSong(Song, Rate, 0, &Buffer[0], 4096, Stub, [](const float*, uint32_t) { return true; }, &Rendered);
+	double Time = std::chrono::duration<double>(std::chrono::steady_clock::now() - Start).count();
+
+	printf("SongRender: stub synth, %.1f M frames/s, %.0fx realtime\n", Rendered / Time / 1e6, (double)Rendered / Rate / Time);
+}
+
+int main(int argc, char** argv) {
+	TestDeterminism();
+	TestFailures();
+
+	if (argc > 1 && !strcmp(argv[1], "bench"))
+		Bench();
+
+	if (Failures) printf("SongRender: %d checks failed\n", Failures);
+	else printf("SongRender: passed\n");
+
+	return Failures != 0;
+}
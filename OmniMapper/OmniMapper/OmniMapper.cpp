@@ -30,11 +30,25 @@ static BOOL KDMAPIMode = FALSE;
 
 static DWORD_PTR OMUser;// Dummy pointer, used for KDMAPI Output
 
+// Forwarders, picked once at MODM_OPEN so that MODM_DATA and MODM_LONGDATA don't have to check the mode every time
+typedef MMRESULT(*ShortForwarder)(DWORD_PTR);
+typedef MMRESULT(*LongForwarder)(DWORD_PTR, DWORD_PTR);
+static ShortForwarder ForwardShort = NULL;
+static LongForwarder ForwardLong = NULL;
+
 static const GUID OMCLSID = { 0x62F3192B, 0xA961, 0x456D, { 0xAB, 0xCA, 0xA5, 0xC9, 0x5A, 0x14, 0xB9, 0xAA } };
 
 // Blacklist system from OM
 #include "BlackListSystem.h"
 
+// Routing to multiple targets
+#include "Router.h"
+
+static Router MapperRouter;
+static HMIDIOUT LayerOut[ROUTER_MAXTARGETS] = { 0 };
+static WORD LayerChannels[ROUTER_MAXTARGETS] = { 0 };
+static DWORD LayerCount = 0;
+
 void ShowFatalError(LPCSTR Error) {
 	MessageBox(NULL, Error, "OmniMapper - FATAL ERROR", MB_ICONHAND | MB_SYSTEMMODAL);
 	exit(-1);
@@ -211,6 +225,150 @@ DWORD GiveMapperCaps(MIDIOUTCAPS* capsPtr, DWORD capsSize) {
 	return MMSYSERR_NOERROR;
 }
 
+static MMRESULT KDMAPIShort(DWORD_PTR dwParam1) {
+	SendDirectData((DWORD)dwParam1);
+	return MMSYSERR_NOERROR;
+}
+
+static MMRESULT KDMAPILong(DWORD_PTR dwParam1, DWORD_PTR dwParam2) {
+	MMRESULT ReturnVal = SendDirectLongData((LPMIDIHDR)dwParam1, (UINT)dwParam2);
+	RunCallbackFunction(MM_MOM_DONE, dwParam1, dwParam2);
+	return ReturnVal;
+}
+
+static MMRESULT WinMMShort(DWORD_PTR dwParam1) {
+	return midiOutShortMsg((HMIDIOUT)Target, (DWORD)dwParam1);
+}
+
+static MMRESULT WinMMLong(DWORD_PTR dwParam1, DWORD_PTR dwParam2) {
+	return midiOutLongMsg((HMIDIOUT)Target, (LPMIDIHDR)dwParam1, (UINT)dwParam2);
+}
+
+static BOOL FindOutputDevice(LPCWSTR Name, DWORD* DeviceID) {
+	MIDIOUTCAPSW Caps;
+
+	for (DWORD i = 0; i < midiOutGetNumDevs(); i++) {
+		if (midiOutGetDevCapsW(i, &Caps, sizeof(MIDIOUTCAPSW)) || lstrcmpW(Caps.szPname, Name))
+			continue;
+
+		*DeviceID = i;
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+// Finds the target synth once, instead of relying on the last MODM_GETDEVCAPS call
+MMRESULT ResolveTarget() {
+	WCHAR TrgtSynthW[MAXPNAMELEN] = L"KDMAPI Output\0";
+	DWORD Type = REG_SZ, Size = sizeof(TrgtSynthW);
+	HKEY MapperKey;
+
+	if (!RegOpenKeyExA(HKEY_CURRENT_USER, "Software\\OmniMIDI\\Mapper", 0, KEY_READ, &MapperKey)) {
+		RegQueryValueExW(MapperKey, L"TrgtSynth", NULL, &Type, (LPBYTE)&TrgtSynthW, &Size);
+		RegCloseKey(MapperKey);
+	}
+
+	KDMAPIMode = !wcsicmp(TrgtSynthW, L"KDMAPI Output\0");
+
+	if (!KDMAPIMode) {
+		if (!FindOutputDevice(TrgtSynthW, &SelectedDevice))
+			return MMSYSERR_BADDEVICEID;
+	}
+	else SelectedDevice = 0;
+
+	ForwardShort = KDMAPIMode ? KDMAPIShort : WinMMShort;
+	ForwardLong = KDMAPIMode ? KDMAPILong : WinMMLong;
+
+	return MMSYSERR_NOERROR;
+}
+
+static bool KDMAPIRouteSend(uint32_t Msg, void* User) {
+	SendDirectData(Msg);
+	return true;
+}
+
+static bool WinMMRouteSend(uint32_t Msg, void* User) {
+	return midiOutShortMsg((HMIDIOUT)User, Msg) == MMSYSERR_NOERROR;
+}
+
+static MMRESULT RouterShort(DWORD_PTR dwParam1) {
+	MapperRouter.Route((uint32_t)dwParam1);
+	return MMSYSERR_NOERROR;
+}
+
+// Sets up the routing table, if the user configured one:
+// TrgtChannels is the channel mask of the main target, LayerTargetN/LayerChannelsN (N = 1 to 7) add more devices
+// Long messages, streams and the other messages still only go to the main target
+void OpenRoutes() {
+	WCHAR ValueName[32], LayerName[MAXPNAMELEN];
+	DWORD Type, Size, Mask = ROUTER_ALLCHANNELS, LayerMask, DeviceID;
+	HKEY MapperKey;
+
+	if (RegOpenKeyExA(HKEY_CURRENT_USER, "Software\\OmniMIDI\\Mapper", 0, KEY_READ, &MapperKey))
+		return;
+
+	Type = REG_DWORD; Size = sizeof(DWORD);
+	RegQueryValueExW(MapperKey, L"TrgtChannels", NULL, &Type, (LPBYTE)&Mask, &Size);
+
+	for (DWORD i = 1; i < ROUTER_MAXTARGETS; i++) {
+		swprintf(ValueName, 32, L"LayerTarget%u", i);
+		Type = REG_SZ; Size = sizeof(LayerName);
+		if (RegQueryValueExW(MapperKey, ValueName, NULL, &Type, (LPBYTE)&LayerName, &Size) || !LayerName[0])
+			continue;
+
+		swprintf(ValueName, 32, L"LayerChannels%u", i);
+		LayerMask = ROUTER_ALLCHANNELS;
+		Type = REG_DWORD; Size = sizeof(DWORD);
+		RegQueryValueExW(MapperKey, ValueName, NULL, &Type, (LPBYTE)&LayerMask, &Size);
+
+		if (!FindOutputDevice(LayerName, &DeviceID) || midiOutOpen(&LayerOut[LayerCount], DeviceID, 0, 0, CALLBACK_NULL))
+			continue;
+
+		LayerChannels[LayerCount++] = (WORD)LayerMask;
+	}
+
+	RegCloseKey(MapperKey);
+
+	// Nothing to route, keep the direct path
+	if (!LayerCount && (WORD)Mask == ROUTER_ALLCHANNELS)
+		return;
+
+	// KDMAPI never blocks, so it can be fed straight from the app's thread
+	if (KDMAPIMode) MapperRouter.AddTarget(KDMAPIRouteSend, NULL, (uint16_t)Mask, false);
+	else MapperRouter.AddTarget(WinMMRouteSend, Target, (uint16_t)Mask, true);
+
+	for (DWORD i = 0; i < LayerCount; i++)
+		MapperRouter.AddTarget(WinMMRouteSend, LayerOut[i], LayerChannels[i], true);
+
+	ForwardShort = RouterShort;
+}
+
+// Flushes the queues, logs what happened to each target, and closes the layers
+void CloseRoutes() {
+	RouterStats Stats;
+	CHAR Msg[256];
+
+	for (int i = 0; i < ROUTER_MAXTARGETS; i++) {
+		if (!MapperRouter.GetStats(i, &Stats))
+			continue;
+
+		sprintf_s(Msg, "OmniMapper: Target %d - Sent %llu, dropped %llu, failed %llu, max lag %uus\n",
+			i, Stats.Sent, Stats.Dropped, Stats.Failed, Stats.LagMaxUs);
+		OutputDebugStringA(Msg);
+	}
+
+	MapperRouter.Clear();
+
+	for (DWORD i = 0; i < LayerCount; i++) {
+		midiOutReset(LayerOut[i]);
+		midiOutClose(LayerOut[i]);
+		LayerOut[i] = NULL;
+	}
+
+	LayerCount = 0;
+}
+
 MMRESULT mM(UINT uDeviceID, UINT uMsg, DWORD_PTR dwUser, DWORD_PTR dwParam1, DWORD_PTR dwParam2) {
 	MMRESULT ReturnVal = MMSYSERR_NOERROR;
 
@@ -222,16 +380,9 @@ MMRESULT mM(UINT uDeviceID, UINT uMsg, DWORD_PTR dwUser, DWORD_PTR dwParam1, DWO
 		// Stub, pretend it's supported
 		return MMSYSERR_NOERROR;
 	case MODM_DATA:
-		KDMAPIMode ? SendDirectData(dwParam1) : ReturnVal = midiOutShortMsg((HMIDIOUT)Target, dwParam1);
-		return ReturnVal;
+		return ForwardShort ? ForwardShort(dwParam1) : MMSYSERR_NOTENABLED;
 	case MODM_LONGDATA:
-		if (KDMAPIMode) {
-			ReturnVal = SendDirectLongData((LPMIDIHDR)dwParam1, dwParam2);
-			RunCallbackFunction(MM_MOM_DONE, dwParam1, dwParam2);
-			return ReturnVal;
-		}
-		
-		return midiOutLongMsg((HMIDIOUT)Target, (LPMIDIHDR)dwParam1, dwParam2);
+		return ForwardLong ? ForwardLong(dwParam1, dwParam2) : MMSYSERR_NOTENABLED;
 	case MODM_STRMDATA:
 		return KDMAPIMode ? modMessage(0, MODM_STRMDATA, OMUser, dwParam1, dwParam2) : midiStreamOut((HMIDISTRM)Target, (LPMIDIHDR)dwParam1, dwParam2);
 	case MODM_PREPARE:
@@ -239,13 +390,21 @@ MMRESULT mM(UINT uDeviceID, UINT uMsg, DWORD_PTR dwUser, DWORD_PTR dwParam1, DWO
 	case MODM_UNPREPARE:
 		return KDMAPIMode ? UnprepareLongData((LPMIDIHDR)dwParam1, dwParam2) : midiOutUnprepareHeader((HMIDIOUT)Target, (LPMIDIHDR)dwParam1, dwParam2);
 	case MODM_OPEN:
+		if ((ReturnVal = ResolveTarget()) != MMSYSERR_NOERROR)
+			return ReturnVal;
+
 		if (!KDMAPIMode) {
 			StreamMode = (DWORD)dwParam2 & 0x00000002L;
 
 			if (StreamMode)
-				return midiStreamOpen((LPHMIDISTRM)&Target, (LPUINT)SelectedDevice, 1, ((MIDIOPENDESC*)dwParam1)->dwCallback, ((MIDIOPENDESC*)dwParam1)->dwInstance, dwParam2);
+				ReturnVal = midiStreamOpen((LPHMIDISTRM)&Target, (LPUINT)SelectedDevice, 1, ((MIDIOPENDESC*)dwParam1)->dwCallback, ((MIDIOPENDESC*)dwParam1)->dwInstance, dwParam2);
 			else
-				return midiOutOpen((LPHMIDIOUT)&Target, SelectedDevice, ((MIDIOPENDESC*)dwParam1)->dwCallback, ((MIDIOPENDESC*)dwParam1)->dwInstance, dwParam2);
+				ReturnVal = midiOutOpen((LPHMIDIOUT)&Target, SelectedDevice, ((MIDIOPENDESC*)dwParam1)->dwCallback, ((MIDIOPENDESC*)dwParam1)->dwInstance, dwParam2);
+
+			if (!ReturnVal)
+				OpenRoutes();
+
+			return ReturnVal;
 		}
 		else {
 			if (!OMAlreadyInit) {
@@ -266,6 +425,7 @@ MMRESULT mM(UINT uDeviceID, UINT uMsg, DWORD_PTR dwUser, DWORD_PTR dwParam1, DWO
 				DriverSettings(0xFFFFF, NULL, NULL, NULL);
 
 				RunCallbackFunction(MM_MOM_OPEN, 0, 0);
+				OpenRoutes();
 
 				return MMSYSERR_NOERROR;
 			}
@@ -275,6 +435,10 @@ MMRESULT mM(UINT uDeviceID, UINT uMsg, DWORD_PTR dwUser, DWORD_PTR dwParam1, DWO
 			}
 		}
 	case MODM_CLOSE:
+		ForwardShort = NULL;
+		ForwardLong = NULL;
+		CloseRoutes();
+
 		if (!KDMAPIMode) {
 			if (StreamMode) return midiStreamClose((HMIDISTRM)Target);
 			else return midiOutClose((HMIDIOUT)Target);
@@ -298,6 +462,10 @@ MMRESULT mM(UINT uDeviceID, UINT uMsg, DWORD_PTR dwUser, DWORD_PTR dwParam1, DWO
 	case MODM_GETPOS:
 		return KDMAPIMode ? modMessage(0, uMsg, OMUser, dwParam1, dwParam2) : midiStreamPosition((HMIDISTRM)Target, (LPMMTIME)&dwParam1, (UINT)dwParam2);
 	case MODM_RESET:
+		// Drop the queued events first, or the workers would replay them after the reset
+		MapperRouter.Discard();
+		for (DWORD i = 0; i < LayerCount; i++)
+			midiOutReset(LayerOut[i]);
 		KDMAPIMode ? ResetKDMAPIStream() : ReturnVal = midiOutReset((HMIDIOUT)Target);
 		return ReturnVal;
 	case MODM_RESTART:
@@ -0,0 +1,283 @@
+/*
+OmniMapper routing core
+Fans short messages out to several targets, picked by channel.
+Targets that could block (hardware ports) get their own queue and worker thread, so that they can't hold up
+the app or the other targets. When a queue is full the event is dropped and counted, instead of waiting.
+Doesn't depend on WinMM, the targets are plain callbacks.
+*/
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+#define ROUTER_MAXTARGETS	8
+#define ROUTER_QUEUESIZE	4096	// Per target, has to be a power of two
+#define ROUTER_ALLCHANNELS	0xFFFF
+
+// Sends one short message to the target, returns false if it failed
+typedef bool(*RouterSendProc)(uint32_t Msg, void* User);
+
+typedef struct RouterStats
+{
+	uint64_t Sent;			// Events handed to the target
+	uint64_t Dropped;		// Events lost because the queue was full
+	uint64_t Failed;		// Events the target refused
+	uint32_t LagMaxUs;		// Longest time an event waited in the queue
+} RouterStats;
+
+class RouterTarget {
+	typedef struct Slot {
+		std::atomic<size_t> Seq;
+		uint32_t Msg;
+		int64_t Stamp;
+	} Slot;
+
+	// Route() reads it from the app's threads while Close() clears it, nullptr means closed
+	std::atomic<RouterSendProc> Send{ nullptr };
+	void* User = nullptr;
+	bool Queued = false;
+
+	// Bounded MPMC queue (Vyukov), the app can call us from more than one thread
+	Slot Slots[ROUTER_QUEUESIZE];
+	std::atomic<size_t> Head{ 0 }, Tail{ 0 };
+
+	std::thread Worker;
+	std::atomic<bool> Stop{ false };
+	std::atomic<bool> Sleeping{ false };
+	std::mutex WakeLock;
+	std::condition_variable Wake;
+
+	std::atomic<uint64_t> Sent{ 0 }, Dropped{ 0 }, Failed{ 0 };
+	std::atomic<uint32_t> LagMaxUs{ 0 };
+
+	static int64_t Now() {
+		return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	bool Pop(uint32_t* Msg, int64_t* Stamp) {
+		size_t Pos = Head.load(std::memory_order_relaxed);
+
+		for (;;) {
+			Slot* S = &Slots[Pos & (ROUTER_QUEUESIZE - 1)];
+			intptr_t Diff = (intptr_t)S->Seq.load(std::memory_order_acquire) - (intptr_t)(Pos + 1);
+
+			if (Diff == 0) {
+				if (Head.compare_exchange_weak(Pos, Pos + 1, std::memory_order_relaxed)) {
+					*Msg = S->Msg;
+					*Stamp = S->Stamp;
+					S->Seq.store(Pos + ROUTER_QUEUESIZE, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (Diff < 0) return false;
+			else Pos = Head.load(std::memory_order_relaxed);
+		}
+	}
+
+	void Deliver(RouterSendProc Proc, uint32_t Msg) {
+		if (Proc(Msg, User)) Sent.fetch_add(1, std::memory_order_relaxed);
+		else Failed.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	// Gets its own copy of the proc, Close() clears Send before joining us and the final flush still needs it
+	void Run(RouterSendProc Proc) {
+		uint32_t Msg;
+		int64_t Stamp;
+
+		while (!Stop.load(std::memory_order_acquire)) {
+			if (Pop(&Msg, &Stamp)) {
+				uint32_t Lag = (uint32_t)(Now() - Stamp);
+				if (Lag > LagMaxUs.load(std::memory_order_relaxed))
+					LagMaxUs.store(Lag, std::memory_order_relaxed);
+
+				Deliver(Proc, Msg);
+				continue;
+			}
+
+			// Nothing to do, sleep until Push wakes us up
+			std::unique_lock<std::mutex> Lock(WakeLock);
+			Sleeping.store(true, std::memory_order_seq_cst);
+			if (Head.load(std::memory_order_seq_cst) == Tail.load(std::memory_order_seq_cst) && !Stop.load())
+				Wake.wait_for(Lock, std::chrono::milliseconds(100));
+			Sleeping.store(false, std::memory_order_relaxed);
+		}
+
+		// Flush what's left, so that no note-off gets lost on close
+		while (Pop(&Msg, &Stamp))
+			Deliver(Proc, Msg);
+	}
+
+	// Back to an empty queue and zeroed stats, so that a reopened target doesn't report the last session
+	void ResetState() {
+		for (size_t i = 0; i < ROUTER_QUEUESIZE; i++)
+			Slots[i].Seq.store(i, std::memory_order_relaxed);
+
+		Head.store(0, std::memory_order_relaxed);
+		Tail.store(0, std::memory_order_relaxed);
+		Sent.store(0, std::memory_order_relaxed);
+		Dropped.store(0, std::memory_order_relaxed);
+		Failed.store(0, std::memory_order_relaxed);
+		LagMaxUs.store(0, std::memory_order_relaxed);
+	}
+
+public:
+	uint16_t Channels = ROUTER_ALLCHANNELS;
+
+	RouterTarget() { ResetState(); }
+
+	~RouterTarget() { Close(); }
+
+	// Queued targets get a worker, the others are called from the app's thread (Use it for KDMAPI, it never blocks)
+	// Send is published last, Route() won't touch the target before everything else is set up
+	void Open(RouterSendProc Proc, void* ProcUser, uint16_t ChannelMask, bool UseQueue) {
+		ResetState();
+		User = ProcUser;
+		Channels = ChannelMask;
+		Queued = UseQueue;
+		Stop.store(false);
+		Send.store(Proc, std::memory_order_release);
+
+		if (Queued)
+			Worker = std::thread(&RouterTarget::Run, this, Proc);
+	}
+
+	// Clears Send first, so that Route() stops pushing, then lets the worker flush and exit
+	void Close() {
+		Send.store(nullptr, std::memory_order_seq_cst);
+
+		if (Worker.joinable()) {
+			{
+				std::lock_guard<std::mutex> Lock(WakeLock);
+				Stop.store(true, std::memory_order_release);
+			}
+			Wake.notify_one();
+			Worker.join();
+		}
+	}
+
+	bool IsOpen() const { return Send.load(std::memory_order_acquire) != nullptr; }
+
+	// Throws away what's still queued, used on reset so that stale notes don't reach the port after midiOutReset
+	void Discard() {
+		uint32_t Msg;
+		int64_t Stamp;
+
+		if (Queued)
+			while (Pop(&Msg, &Stamp));
+	}
+
+	void Push(uint32_t Msg) {
+		if (!Queued) {
+			RouterSendProc Proc = Send.load(std::memory_order_acquire);
+			if (Proc) Deliver(Proc, Msg);
+			return;
+		}
+
+		size_t Pos = Tail.load(std::memory_order_relaxed);
+
+		for (;;) {
+			Slot* S = &Slots[Pos & (ROUTER_QUEUESIZE - 1)];
+			intptr_t Diff = (intptr_t)S->Seq.load(std::memory_order_acquire) - (intptr_t)Pos;
+
+			if (Diff == 0) {
+				if (Tail.compare_exchange_weak(Pos, Pos + 1, std::memory_order_relaxed)) {
+					S->Msg = Msg;
+					S->Stamp = Now();
+					S->Seq.store(Pos + 1, std::memory_order_release);
+					break;
+				}
+			}
+			// Full, the target is lagging behind
+			else if (Diff < 0) {
+				Dropped.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+			else Pos = Tail.load(std::memory_order_relaxed);
+		}
+
+		if (Sleeping.load(std::memory_order_seq_cst)) {
+			std::lock_guard<std::mutex> Lock(WakeLock);
+			Wake.notify_one();
+		}
+	}
+
+	void GetStats(RouterStats* Stats) const {
+		Stats->Sent = Sent.load(std::memory_order_relaxed);
+		Stats->Dropped = Dropped.load(std::memory_order_relaxed);
+		Stats->Failed = Failed.load(std::memory_order_relaxed);
+		Stats->LagMaxUs = LagMaxUs.load(std::memory_order_relaxed);
+	}
+};
+
+class Router {
+	RouterTarget Targets[ROUTER_MAXTARGETS];
+
+	// Data-only messages rely on it, each target would otherwise apply them to whatever status it saw last
+	std::atomic<uint8_t> RunningStatus{ 0 };
+
+public:
+	// Returns the index of the new target, or -1 if the table is full
+	int AddTarget(RouterSendProc Proc, void* User, uint16_t ChannelMask, bool UseQueue) {
+		for (int i = 0; i < ROUTER_MAXTARGETS; i++) {
+			if (Targets[i].IsOpen())
+				continue;
+
+			Targets[i].Open(Proc, User, ChannelMask, UseQueue);
+			return i;
+		}
+
+		return -1;
+	}
+
+	void Clear() {
+		for (int i = 0; i < ROUTER_MAXTARGETS; i++)
+			Targets[i].Close();
+	}
+
+	void Discard() {
+		RunningStatus.store(0, std::memory_order_relaxed);
+
+		for (int i = 0; i < ROUTER_MAXTARGETS; i++)
+			if (Targets[i].IsOpen()) Targets[i].Discard();
+	}
+
+	// System messages (0xF0 and up) have no channel, they go everywhere
+	void Route(uint32_t Msg) {
+		uint8_t Status = (uint8_t)Msg;
+
+		// Running status gets expanded here, the channel is in the status byte.
+		// SysEx and system common messages cancel it, real-time messages leave it alone
+		if (Status & 0x80) {
+			if (Status < 0xF0) RunningStatus.store(Status, std::memory_order_relaxed);
+			else if (Status < 0xF8) RunningStatus.store(0, std::memory_order_relaxed);
+		}
+		else {
+			uint8_t Last = RunningStatus.load(std::memory_order_relaxed);
+
+			// Nothing to apply the data to
+			if (!Last)
+				return;
+
+			Msg = ((Msg << 8) | Last) & 0xFFFFFF;
+		}
+
+		uint16_t Bit = ((Msg & 0xF0) == 0xF0) ? ROUTER_ALLCHANNELS : (uint16_t)(1 << (Msg & 0xF));
+
+		for (int i = 0; i < ROUTER_MAXTARGETS; i++) {
+			if (Targets[i].IsOpen() && (Targets[i].Channels & Bit))
+				Targets[i].Push(Msg);
+		}
+	}
+
+	bool GetStats(int Index, RouterStats* Stats) const {
+		if (Index < 0 || Index >= ROUTER_MAXTARGETS || !Targets[Index].IsOpen())
+			return false;
+
+		Targets[Index].GetStats(Stats);
+		return true;
+	}
+};
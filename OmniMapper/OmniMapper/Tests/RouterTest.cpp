@@ -0,0 +1,209 @@
+// OmniMapper routing core, with fake targets: routing by channel, running status, and the queued targets' counters.
+// Standalone, like the driver's portable tests:
+// g++ -std=c++11 -O2 -Wall -Wextra -pthread RouterTest.cpp -o RouterTest && ./RouterTest
+// Run it with "bench" as its argument to get the throughput too.
+
+#include "../Router.h"
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+static int Failures = 0;
+
+#define CHECK(x) do { if (!(x)) { printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #x); Failures++; } } while (0)
+
+typedef struct FakeTarget {
+	std::mutex Lock;
+	std::vector<uint32_t> Got;
+	std::atomic<bool> Hold{ false };	// Keeps the worker busy, so that the queue fills up
+	bool Refuse = false;
+} FakeTarget;
+
+static bool FakeSend(uint32_t Msg, void* User) {
+	FakeTarget* T = (FakeTarget*)User;
+
+	while (T->Hold.load())
+		std::this_thread::yield();
+
+	std::lock_guard<std::mutex> Lock(T->Lock);
+	T->Got.push_back(Msg);
+	return !T->Refuse;
+}
+
+static std::vector<uint32_t> Take(FakeTarget& T) {
+	std::lock_guard<std::mutex> Lock(T.Lock);
+	std::vector<uint32_t> Out;
+
+	Out.swap(T.Got);
+	return Out;
+}
+
+static void TestChannels() {
+	Router R;
+	FakeTarget Low, High, All;
+
+	CHECK(R.AddTarget(FakeSend, &Low, 0x00FF, false) == 0);
+	CHECK(R.AddTarget(FakeSend, &High, 0xFF00, false) == 1);
+	CHECK(R.AddTarget(FakeSend, &All, ROUTER_ALLCHANNELS, false) == 2);
+
+	R.Route(0x403C90);		// Channel 1
+	R.Route(0x403C9F);		// Channel 16
+	R.Route(0xF8);			// No channel, goes everywhere
+
+	CHECK((Take(Low) == std::vector<uint32_t>{ 0x403C90, 0xF8 }));
+	CHECK((Take(High) == std::vector<uint32_t>{ 0x403C9F, 0xF8 }));
+	CHECK((Take(All) == std::vector<uint32_t>{ 0x403C90, 0x403C9F, 0xF8 }));
+
+	RouterStats Stats;
+	CHECK(R.GetStats(2, &Stats) && Stats.Sent == 3 && !Stats.Dropped && !Stats.Failed);
+	CHECK(!R.GetStats(3, &Stats));
+}
+
+// Data-only messages get the channel of the last status, wherever they're going
+static void TestRunningStatus() {
+	Router R;
+	FakeTarget Ch1, Ch2;
+
+	R.AddTarget(FakeSend, &Ch1, 1 << 0, false);
+	R.AddTarget(FakeSend, &Ch2, 1 << 1, false);
+
+	R.Route(0x3C40);		// Nothing to apply it to yet
+	R.Route(0x403C91);
+	R.Route(0x403E);		// Running status, channel 2
+	R.Route(0xFE);			// Real-time, doesn't cancel it
+	R.Route(0x0040);
+	R.Route(0x403C80);
+	R.Route(0x0041);		// Now channel 1
+	R.Route(0xF6);			// System common, cancels it
+	R.Route(0x0042);
+
+	CHECK((Take(Ch1) == std::vector<uint32_t>{ 0xFE, 0x403C80, 0x4180, 0xF6 }));
+	CHECK((Take(Ch2) == std::vector<uint32_t>{ 0x403C91, 0x403E91, 0xFE, 0x4091, 0xF6 }));
+
+	// A reset forgets it too
+	R.Route(0x007B91);
+	R.Discard();
+	R.Route(0x0000);
+
+	CHECK((Take(Ch2) == std::vector<uint32_t>{ 0x7B91 }));
+	CHECK(Take(Ch1).empty());
+}
+
+// A stuck target drops what doesn't fit in its queue, without holding up the others
+static void TestQueues() {
+	Router R;
+	FakeTarget Slow, Fast;
+	RouterStats Stats;
+	const uint32_t Events = ROUTER_QUEUESIZE * 2;
+
+	Slow.Hold = true;
+	R.AddTarget(FakeSend, &Slow, ROUTER_ALLCHANNELS, true);
+	R.AddTarget(FakeSend, &Fast, ROUTER_ALLCHANNELS, false);
+
+	for (uint32_t i = 0; i < Events; i++)
+		R.Route(0x90 | ((i & 0x7F) << 8) | (((i >> 7) & 0x7F) << 16));
+
+	CHECK(Take(Fast).size() == Events);
+
+	R.GetStats(0, &Stats);
+	CHECK(Stats.Dropped >= Events - ROUTER_QUEUESIZE - 1);
+
+	// What got queued arrives in order, closing flushes it
+	Slow.Hold = false;
+	R.Clear();
+
+	std::vector<uint32_t> Got = Take(Slow);
+	CHECK(Got.size() + Stats.Dropped == Events);
+	CHECK(!Got.empty() && Got[0] == 0x90);
+
+	for (size_t i = 1; i < Got.size(); i++) {
+		uint32_t Prev = ((Got[i - 1] >> 8) & 0x7F) | (((Got[i - 1] >> 16) & 0x7F) << 7);
+		uint32_t Cur = ((Got[i] >> 8) & 0x7F) | (((Got[i] >> 16) & 0x7F) << 7);
+
+		if (Cur <= Prev) {
+			CHECK(!"Queued events out of order");
+			break;
+		}
+	}
+
+	// Reopened targets start from zero
+	CHECK(R.AddTarget(FakeSend, &Fast, ROUTER_ALLCHANNELS, true) == 0);
+	CHECK(R.GetStats(0, &Stats) && !Stats.Sent && !Stats.Dropped && !Stats.Failed);
+	R.Clear();
+}
+
+static void TestFailures() {
+	Router R;
+	FakeTarget Broken;
+	RouterStats Stats;
+
+	Broken.Refuse = true;
+	R.AddTarget(FakeSend, &Broken, ROUTER_ALLCHANNELS, true);
+
+	for (int i = 0; i < 100; i++)
+		R.Route(0x403C90);
+
+	// The stats go away with the target, so wait for the worker instead of closing it
+	for (int Wait = 0; Wait < 2000 && R.GetStats(0, &Stats) && Stats.Failed < 100; Wait++)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+	CHECK(R.GetStats(0, &Stats) && Stats.Failed == 100 && !Stats.Sent && !Stats.Dropped);
+	CHECK(Take(Broken).size() == 100);
+	R.Clear();
+}
+
+// Four queued targets fed from two app threads
+static void Bench() {
+	const uint32_t Events = 4000000;
+	Router R;
+	FakeTarget Targets[4];
+	std::thread Feeders[2];
+
+	for (int i = 0; i < 4; i++)
+		R.AddTarget([](uint32_t, void*) { return true; }, &Targets[i], (uint16_t)(0xF << (i * 4)), true);
+
+	auto Start = std::chrono::steady_clock::now();
+
+	for (int f = 0; f < 2; f++) {
+		Feeders[f] = std::thread([&R, f]() {
+			for (uint32_t i = 0; i < Events / 2; i++) {
+				R.Route(0x403C90 | (i & 0xF));
+				if (!(i & 0xFF)) R.Route(0x40 | (f << 8));	// Some running status too
+			}
+		});
+	}
+
+	for (int f = 0; f < 2; f++)
+		Feeders[f].join();
+
+	double RouteTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - Start).count();
+
+	for (int i = 0; i < 4; i++) {
+		RouterStats Stats = { 0, 0, 0, 0 };
+
+		// Let the workers catch up before reading their counters
+		while (R.GetStats(i, &Stats) && Stats.Sent + Stats.Dropped < Events / 4)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+		printf("Router: target %d, %llu sent, %llu dropped, max lag %u us\n",
+			i, (unsigned long long)Stats.Sent, (unsigned long long)Stats.Dropped, Stats.LagMaxUs);
+	}
+
+	printf("Router: %u events from 2 threads, %.1f ns/event\n", Events, RouteTime * 1e9 / Events);
+	R.Clear();
+}
+
+int main(int argc, char** argv) {
+	TestChannels();
+	TestRunningStatus();
+	TestQueues();
+	TestFailures();
+
+	if (argc > 1 && !strcmp(argv[1], "bench"))
+		Bench();
+
+	if (Failures) printf("Router: %d checks failed\n", Failures);
+	else printf("Router: passed\n");
+
+	return Failures != 0;
+}